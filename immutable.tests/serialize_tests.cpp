@@ -0,0 +1,220 @@
+#include "serialize_tests.h"
+#include "test_assert.h"
+#include <immutable/vector.h>
+#include <immutable/serialize.h>
+#include <stdexcept>
+#include <vector>
+
+namespace
+  {
+
+  template <bool atomic_ref_counting, int N>
+  immutable::vector<int, atomic_ref_counting, N> make_vector(uint32_t sz)
+    {
+    immutable::vector<int, atomic_ref_counting, N> v;
+    auto tr = v.transient();
+    for (uint32_t i = 0; i < sz; ++i)
+      tr.push_back(rand());
+    return tr.persistent();
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_serialize_empty_vector()
+    {
+    std::vector<immutable::vector<int, atomic_ref_counting, N>> vectors(1);
+    std::string data = immutable::serialize(vectors);
+    auto loaded = immutable::deserialize<int, atomic_ref_counting, N>(data.data(), data.size());
+    TEST_EQ(1, loaded.size());
+    TEST_ASSERT(loaded[0].empty());
+    loaded[0] = loaded[0].push_back(3);
+    TEST_EQ(3, loaded[0][0]);
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_serialize_round_trip(uint32_t sz = 10000)
+    {
+    std::vector<immutable::vector<int, atomic_ref_counting, N>> vectors;
+    for (uint32_t s : { 1u, 31u, 32u, 33u, 1025u, sz })
+      vectors.push_back(make_vector<atomic_ref_counting, N>(s));
+    vectors.push_back(vectors.back().erase(sz / 3, sz / 2)); // relaxed nodes with size tables
+    vectors.push_back(vectors.back().insert(sz / 4, vectors[4]));
+    std::string data = immutable::serialize(vectors);
+    auto loaded = immutable::deserialize<int, atomic_ref_counting, N>(data.data(), data.size());
+    TEST_EQ(vectors.size(), loaded.size());
+    for (size_t i = 0; i < vectors.size(); ++i)
+      TEST_ASSERT(vectors[i] == loaded[i]);
+    // the loaded vectors are ordinary vectors
+    auto changed = loaded.back().set(7, -1).push_back(5).erase(0, 100);
+    TEST_EQ(loaded.back().size(), changed.size() + 99);
+    TEST_EQ(-1, loaded.back().set(7, -1)[7]);
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_serialize_writes_shared_nodes_once(uint32_t sz = 100000, uint32_t versions = 1000)
+    {
+    std::vector<immutable::vector<int, atomic_ref_counting, N>> vectors;
+    vectors.push_back(make_vector<atomic_ref_counting, N>(sz));
+    for (uint32_t i = 1; i < versions; ++i)
+      vectors.push_back(vectors.back().set((i * 7919) % sz, (int)i));
+    std::string data = immutable::serialize(vectors);
+    // each version only adds the nodes on the path to the changed element
+    TEST_ASSERT(data.size() < 2 * sz * sizeof(int) + versions * 1024);
+
+    auto loaded = immutable::deserialize<int, atomic_ref_counting, N>(data.data(), data.size());
+    TEST_EQ(versions, loaded.size());
+    for (uint32_t i = 0; i < versions; i += 97)
+      TEST_ASSERT(vectors[i] == loaded[i]);
+
+    // the loaded versions share their unchanged leaves again
+    for (uint32_t i = 1; i < versions; i += 97)
+      {
+      const uint32_t changed = (i * 7919) % sz;
+      const uint32_t unchanged = changed < sz / 2 ? sz - 1 : 0;
+      auto previous = immutable::rrb_region_for(loaded[i - 1].raw(), unchanged);
+      auto current = immutable::rrb_region_for(loaded[i].raw(), unchanged);
+      TEST_ASSERT(std::get<0>(previous) == std::get<0>(current));
+      TEST_ASSERT(immutable::rrb_region_for(loaded[i - 1].raw(), changed) != immutable::rrb_region_for(loaded[i].raw(), changed));
+      }
+
+    // writing the loaded versions again gives the same data
+    TEST_ASSERT(data == immutable::serialize(loaded));
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_deserialize_invalid_data()
+    {
+    std::vector<immutable::vector<int, atomic_ref_counting, N>> vectors;
+    vectors.push_back(make_vector<atomic_ref_counting, N>(1000));
+    std::string data = immutable::serialize(vectors);
+    for (size_t len : { (size_t)0, (size_t)3, data.size() / 2, data.size() - 1 })
+      {
+      bool thrown = false;
+      try
+        {
+        immutable::deserialize<int, atomic_ref_counting, N>(data.data(), len);
+        }
+      catch (std::runtime_error&)
+        {
+        thrown = true;
+        }
+      TEST_ASSERT(thrown);
+      }
+    std::string invalid_tag(data);
+    invalid_tag[4] = 7;
+    bool thrown = false;
+    try
+      {
+      immutable::deserialize<int, atomic_ref_counting, N>(invalid_tag.data(), invalid_tag.size());
+      }
+    catch (std::runtime_error&)
+      {
+      thrown = true;
+      }
+    TEST_ASSERT(thrown);
+    }
+
+  void write_leaf(std::string& out, uint32_t len)
+    {
+    using namespace immutable::serialize_details;
+    write_u8(out, NODE_TAG_LEAF);
+    write_u32(out, len);
+    for (uint32_t i = 0; i < len; ++i)
+      immutable::trivial_codec<int>::write(out, (int)i);
+    }
+
+  void write_internal(std::string& out, const std::vector<uint32_t>& children, const std::vector<uint32_t>& sizes)
+    {
+    using namespace immutable::serialize_details;
+    write_u8(out, NODE_TAG_INTERNAL);
+    write_u32(out, (uint32_t)children.size());
+    write_u8(out, sizes.empty() ? 0 : 1);
+    for (auto sz : sizes)
+      write_u32(out, sz);
+    for (auto child : children)
+      write_u32(out, child);
+    }
+
+  void write_header(std::string& out, uint32_t cnt, uint32_t shift, uint32_t tail_len, uint32_t tail, uint32_t root)
+    {
+    using namespace immutable::serialize_details;
+    write_u8(out, NODE_TAG_END);
+    for (uint32_t v : { cnt, shift, tail_len, tail, root })
+      write_u32(out, v);
+    }
+
+  template <bool atomic_ref_counting, int N>
+  bool is_rejected(const std::string& data)
+    {
+    try
+      {
+      immutable::deserialize<int, atomic_ref_counting, N>(data.data(), data.size());
+      }
+    catch (std::runtime_error&)
+      {
+      return true;
+      }
+    return false;
+    }
+
+  /*
+  Builds one vector by hand: node 0 is a full leaf, node 1 a leaf with one element, node 2 the tail, and node 3 the
+  root, an internal node with the given children and size table. Only the tree with a full first child is valid.
+  */
+  template <bool atomic_ref_counting, int N>
+  std::string tree_with_root(const std::vector<uint32_t>& children, const std::vector<uint32_t>& sizes, uint32_t cnt)
+    {
+    const uint32_t full = 1 << N;
+    std::string data;
+    immutable::serialize_details::write_u32(data, 1);
+    write_leaf(data, full);
+    write_leaf(data, 1);
+    write_leaf(data, 2);
+    write_internal(data, children, sizes);
+    write_header(data, cnt, N, 2, 2, 3);
+    return data;
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_deserialize_invalid_tree()
+    {
+    const uint32_t full = 1 << N;
+    const std::string dense = tree_with_root<atomic_ref_counting, N>({ 0, 1 }, {}, full + 3);
+    auto valid = immutable::deserialize<int, atomic_ref_counting, N>(dense.data(), dense.size());
+    TEST_EQ(full + 3, valid[0].size());
+    TEST_EQ(0, valid[0][full]);
+    const std::string relaxed = tree_with_root<atomic_ref_counting, N>({ 1, 0 }, { 1, full + 1 }, full + 3);
+    valid = immutable::deserialize<int, atomic_ref_counting, N>(relaxed.data(), relaxed.size());
+    TEST_EQ(full + 3, valid[0].size());
+    TEST_EQ(1, valid[0][2]);
+    TEST_ASSERT((is_rejected<atomic_ref_counting, N>(tree_with_root<atomic_ref_counting, N>({ 1, 0 }, {}, full + 3)))); // a child before the last one is not full
+    TEST_ASSERT((is_rejected<atomic_ref_counting, N>(tree_with_root<atomic_ref_counting, N>({ 1, 0 }, { 1, full + 2 }, full + 3)))); // wrong size table
+    TEST_ASSERT((is_rejected<atomic_ref_counting, N>(tree_with_root<atomic_ref_counting, N>({ 0, 1 }, {}, full + 4)))); // wrong count
+    TEST_ASSERT((is_rejected<atomic_ref_counting, N>(tree_with_root<atomic_ref_counting, N>({}, {}, 2)))); // internal node without children
+
+    std::string mixed_heights;
+    immutable::serialize_details::write_u32(mixed_heights, 1);
+    write_leaf(mixed_heights, full);
+    write_internal(mixed_heights, { 0 }, {});
+    write_internal(mixed_heights, { 0, 1 }, { full, 2 * full });
+    write_header(mixed_heights, 2 * full, 2 * N, 0, 0, 2);
+    TEST_ASSERT((is_rejected<atomic_ref_counting, N>(mixed_heights)));
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void run_tests()
+    {
+    test_serialize_empty_vector<atomic_ref_counting, N>();
+    test_serialize_round_trip<atomic_ref_counting, N>();
+    test_serialize_writes_shared_nodes_once<atomic_ref_counting, N>();
+    test_deserialize_invalid_data<atomic_ref_counting, N>();
+    test_deserialize_invalid_tree<atomic_ref_counting, N>();
+    }
+
+  }
+
+void run_all_serialize_tests()
+  {
+  run_tests<true, 5>();
+  run_tests<false, 5>();
+  run_tests<false, 6>();
+  }
@@ -0,0 +1,3 @@
+#pragma once
+
+void run_all_serialize_tests();
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "test_assert.h"
 
 #include "rrb_tests.h"
+#include "serialize_tests.h"
 #include "vector_tests.h"
 
 #include <ctime>
@@ -12,6 +13,7 @@ int main(int /*argc*/, const char* /*argv*/[])
   auto tic = std::clock();
   run_all_rrb_tests();
   run_all_vector_tests();
+  run_all_serialize_tests();
   auto toc = std::clock();
 
   if (!testing_fails) 
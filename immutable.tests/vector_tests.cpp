@@ -2,7 +2,11 @@
 #include "test_assert.h"
 #include <iostream>
 #include <immutable/vector.h>
+#include <immutable/memory.h>
 #include <immutable/rrb_debug.h>
+#include <atomic>
+#include <memory>
+#include <thread>
 #include <vector>
 
 namespace
@@ -1037,6 +1041,193 @@ namespace
 
     }
     
+  template <bool atomic_ref_counting, int N>
+  void test_first_difference(uint32_t sz = 10000)
+    {
+    immutable::vector<int, atomic_ref_counting, N> vec;
+    for (uint32_t i = 0; i < sz; ++i)
+      vec = vec.push_back(rand());
+
+    TEST_EQ(sz, immutable::first_difference(vec, vec));
+
+    auto updated = vec.set(sz / 3, vec[sz / 3] + 1);
+    TEST_EQ(sz / 3, immutable::first_difference(vec, updated));
+    TEST_EQ(sz / 3, immutable::first_difference(updated, vec));
+
+    immutable::vector<int, atomic_ref_counting, N> inserted_text;
+    inserted_text = inserted_text.push_back(vec[sz / 2] + 1);
+    auto inserted = vec.insert(sz / 2, inserted_text);
+    TEST_EQ(sz / 2, immutable::first_difference(vec, inserted));
+
+    auto erased = vec.erase(sz - 10, sz);
+    TEST_EQ(sz - 10, immutable::first_difference(vec, erased));
+
+    auto appended = vec.push_back(3);
+    TEST_EQ(sz, immutable::first_difference(vec, appended));
+
+    immutable::vector<int, atomic_ref_counting, N> copy;
+    for (auto v : vec)
+      copy = copy.push_back(v);
+    TEST_EQ(sz, immutable::first_difference(vec, copy));
+
+    immutable::vector<int, atomic_ref_counting, N> empty;
+    TEST_EQ(0, immutable::first_difference(vec, empty));
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_common_suffix_length(uint32_t sz = 10000)
+    {
+    immutable::vector<int, atomic_ref_counting, N> vec;
+    for (uint32_t i = 0; i < sz; ++i)
+      vec = vec.push_back(i);
+
+    TEST_EQ(sz, immutable::common_suffix_length(vec, vec));
+
+    auto updated = vec.set(sz / 3, -1);
+    TEST_EQ(sz - sz / 3 - 1, immutable::common_suffix_length(vec, updated));
+    TEST_EQ(sz - sz / 3 - 1, immutable::common_suffix_length(updated, vec));
+
+    immutable::vector<int, atomic_ref_counting, N> inserted_text;
+    inserted_text = inserted_text.push_back(-1);
+    auto inserted = vec.insert(sz / 2, inserted_text);
+    TEST_EQ(sz - sz / 2, immutable::common_suffix_length(vec, inserted));
+
+    auto erased = vec.erase(0, 10);
+    TEST_EQ(sz - 10, immutable::common_suffix_length(vec, erased));
+
+    auto appended = vec.push_back(-1);
+    TEST_EQ(0, immutable::common_suffix_length(vec, appended));
+
+    immutable::vector<int, atomic_ref_counting, N> copy;
+    for (auto v : vec)
+      copy = copy.push_back(v);
+    TEST_EQ(sz, immutable::common_suffix_length(vec, copy));
+
+    immutable::vector<int, atomic_ref_counting, N> empty;
+    TEST_EQ(0, immutable::common_suffix_length(vec, empty));
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_memory_counter(uint32_t sz = 10000)
+    {
+    immutable::vector<int, atomic_ref_counting, N> vec;
+    for (uint32_t i = 0; i < sz; ++i)
+      vec = vec.push_back(rand());
+
+    immutable::memory_counter<int, atomic_ref_counting, N> counter;
+    const uint64_t bytes = counter.add(vec);
+    TEST_ASSERT(bytes >= sz * sizeof(int));
+    TEST_ASSERT(bytes < 2 * sz * sizeof(int) + 1024);
+    TEST_EQ(0, counter.add(vec));
+
+    // a changed version only adds the nodes on the path to the change
+    auto updated = vec.set(sz / 2, 3);
+    const uint64_t added = counter.add(updated);
+    TEST_ASSERT(added > 0);
+    TEST_ASSERT(added < bytes / 10);
+    TEST_EQ(bytes + added, counter.bytes());
+    }
+
+  // element i of the source is 3 * i, the pages that are asked for are counted
+  struct test_lazy_source : public immutable::lazy_source<int>
+    {
+    test_lazy_source(uint32_t sz, uint32_t page_size) : size(sz), page_size(page_size), reads(0) {}
+
+    virtual void read_page(uint64_t page, std::vector<int>& out) const
+      {
+      ++reads;
+      out.clear();
+      for (uint64_t i = page * page_size; i < size && i < (page + 1) * page_size; ++i)
+        out.push_back((int)(3 * i));
+      }
+
+    uint32_t size, page_size;
+    mutable std::atomic<uint32_t> reads;
+    };
+
+  template <bool atomic_ref_counting, int N>
+  void test_lazy_vector(uint32_t sz)
+    {
+    typedef immutable::vector<int, atomic_ref_counting, N> vector_type;
+    auto source = std::make_shared<test_lazy_source>(sz, vector_type::lazy_page_size);
+    vector_type vec = vector_type::lazy(source, sz);
+    TEST_EQ(sz, vec.size());
+    TEST_ASSERT(source->reads <= 1); // the tail
+    const uint32_t body = sz > 0 ? sz - ((sz - 1) % immutable::rrb_details::bits<N>::rrb_branching + 1) : 0; // the elements before the tail
+    uint32_t unread_pages = 0;
+    vec.for_each_unread_page([&](const immutable::lazy_source<int>& s, uint64_t) { unread_pages += &s == source.get() ? 1 : 1000; });
+    TEST_EQ((body + vector_type::lazy_page_size - 1) / vector_type::lazy_page_size, unread_pages);
+
+    immutable::memory_counter<int, atomic_ref_counting, N> unread;
+    const uint64_t unread_bytes = unread.add(vec);
+    TEST_ASSERT(unread_bytes < sz * sizeof(int) / 4 + 1024);
+
+    // scanning reads every page, but does not keep them
+    uint32_t index = 0;
+    bool equal = true;
+    vec.for_each_run(0, sz, [&](const int* first, const int* last)
+      {
+      for (; first != last; ++first, ++index)
+        equal &= *first == (int)(3 * index);
+      });
+    TEST_EQ(sz, index);
+    TEST_ASSERT(equal);
+    immutable::memory_counter<int, atomic_ref_counting, N> scanned;
+    TEST_EQ(unread_bytes, scanned.add(vec));
+
+    // an element reads its page only
+    if (sz > 0)
+      {
+      TEST_EQ((int)(3 * (sz / 2)), vec[sz / 2]);
+      immutable::memory_counter<int, atomic_ref_counting, N> one_page;
+      TEST_ASSERT(one_page.add(vec) <= unread_bytes + (vector_type::lazy_page_size + 64) * sizeof(int) * 2);
+      uint32_t pages_left = 0;
+      bool read_page_left = false;
+      vec.for_each_unread_page([&](const immutable::lazy_source<int>&, uint64_t page) { ++pages_left; read_page_left |= page == (sz / 2) / vector_type::lazy_page_size; });
+      TEST_ASSERT(!read_page_left);
+      TEST_EQ(unread_pages - (sz / 2 < body ? 1 : 0), pages_left);
+      }
+
+    // edits only read the pages around them: the pages that a concatenation rebalances
+    std::vector<int> expected;
+    for (uint32_t i = 0; i < sz; ++i)
+      expected.push_back((int)(3 * i));
+    const uint32_t reads_before_edits = source->reads;
+    vector_type edited = vec.insert(sz / 3, -1).erase(sz / 4, sz / 4 + 7 < sz ? sz / 4 + 7 : sz / 4).push_back(-2);
+    TEST_ASSERT(source->reads - reads_before_edits <= 6 * immutable::rrb_details::bits<N>::rrb_branching);
+    expected.insert(expected.begin() + sz / 3, -1);
+    expected.erase(expected.begin() + sz / 4, expected.begin() + (sz / 4 + 7 < sz ? sz / 4 + 7 : sz / 4));
+    expected.push_back(-2);
+    TEST_EQ((uint32_t)expected.size(), edited.size());
+    auto it = edited.begin();
+    for (size_t i = 0; i < expected.size(); ++i, ++it)
+      TEST_EQ(expected[i], *it);
+    TEST_ASSERT(immutable::validate_rrb(edited.raw()));
+    TEST_ASSERT(immutable::validate_rrb(vec.raw()));
+    }
+
+  template <bool atomic_ref_counting, int N>
+  void test_lazy_vector()
+    {
+    const uint32_t page_size = immutable::vector<int, atomic_ref_counting, N>::lazy_page_size;
+    const uint32_t sizes[] = { 0, 1, 31, 32, 33, page_size, page_size + 1, page_size + 32, 3 * page_size + 5, 40 * page_size, 200 * page_size + 17 };
+    for (uint32_t sz : sizes)
+      test_lazy_vector<atomic_ref_counting, N>(sz);
+
+    // threads that read the same page at the same time all see the same leaves
+    auto source = std::make_shared<test_lazy_source>(10 * page_size, page_size);
+    auto vec = immutable::vector<int, atomic_ref_counting, N>::lazy(source, 10 * page_size);
+    std::vector<const int*> seen(4);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < seen.size(); ++t)
+      threads.emplace_back([&, t]() { seen[t] = &vec[page_size * 3 + 5]; });
+    for (auto& t : threads)
+      t.join();
+    for (auto p : seen)
+      TEST_ASSERT(p == seen[0]);
+    TEST_EQ((int)(3 * (page_size * 3 + 5)), *seen[0]);
+    }
+
   template <bool atomic_ref_counting, int N>
   void run_tests()
     {           
@@ -1076,6 +1267,10 @@ namespace
     test_vector_of_vector<atomic_ref_counting, N>();
     test_vector_bug_1<atomic_ref_counting, N>();    
     test_bug_concat<atomic_ref_counting, N>();
+    test_first_difference<atomic_ref_counting, N>();
+    test_common_suffix_length<atomic_ref_counting, N>();
+    test_memory_counter<atomic_ref_counting, N>();
+    test_lazy_vector<atomic_ref_counting, N>();
     }
 
   }
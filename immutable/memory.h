@@ -0,0 +1,66 @@
+#pragma once
+
+#include "vector.h"
+
+#include <unordered_set>
+
+namespace immutable
+  {
+
+  /*
+  Counts the memory taken by the nodes of a set of vectors. Vectors share nodes, so a node is only counted
+  the first time it is met, and the nodes below a node that was counted before are not visited again.
+  Hence adding a version of a vector that was derived from a vector that was added before costs time and
+  bytes in proportion to the changes only.
+  The vectors that were added must stay alive as long as the counter is used, as nodes are recognized by their address.
+  */
+  template <typename T, bool atomic_ref_counting = true, int N = 5>
+  class memory_counter
+    {
+    public:
+      typedef rrb_details::tree_node<T, atomic_ref_counting> tree_node_type;
+      typedef rrb_details::leaf_node<T, atomic_ref_counting> leaf_node_type;
+      typedef rrb_details::internal_node<T, atomic_ref_counting> internal_node_type;
+
+      memory_counter() : _bytes(0) {}
+
+      // counts the nodes of v that were not counted yet, and returns their size in bytes
+      uint64_t add(const vector<T, atomic_ref_counting, N>& v)
+        {
+        const auto impl = v.raw();
+        uint64_t added = _add_node(impl->root.ptr);
+        added += _add_node((const tree_node_type*)impl->tail.ptr);
+        _bytes += added;
+        return added;
+        }
+
+      // total size in bytes of all the nodes that were counted
+      uint64_t bytes() const
+        {
+        return _bytes;
+        }
+
+    private:
+      uint64_t _add_node(const tree_node_type* node)
+        {
+        if (!node || !_nodes.insert(node).second)
+          return 0;
+        if (node->type == rrb_details::LEAF_NODE)
+          return sizeof(leaf_node_type) + (uint64_t)node->len * sizeof(T);
+        const internal_node_type* internal = (const internal_node_type*)node;
+        if (!internal->child.known()) // a page of a lazy vector that was not read yet
+          return sizeof(internal_node_type) + sizeof(rrb_details::lazy_page<T>);
+        uint64_t added = sizeof(internal_node_type) + (uint64_t)internal->len * sizeof(ref<internal_node_type>);
+        if (internal->size_table.ptr && _nodes.insert(internal->size_table.ptr).second)
+          added += sizeof(rrb_details::rrb_size_table<atomic_ref_counting>) + (uint64_t)internal->len * sizeof(uint32_t);
+        for (uint32_t i = 0; i < internal->len; ++i)
+          added += _add_node((const tree_node_type*)internal->child[i].ptr);
+        return added;
+        }
+
+    private:
+      std::unordered_set<const void*> _nodes;
+      uint64_t _bytes;
+    };
+
+  }
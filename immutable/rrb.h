@@ -34,6 +34,7 @@
 #include <vector>
 #include <algorithm>
 #include <atomic>
+#include <memory>
 #include <tuple>
 
 #ifndef _WIN32
@@ -84,9 +85,27 @@ namespace immutable
     T* ptr;
     };
 
+  /*
+  The elements of a vector whose nodes are read the first time they are used, see rrb_create_lazy. The elements are
+  read in pages of rrb_branching * rrb_branching elements, i.e. the elements below one node above the leaves, so that
+  a vector that is only used in part only holds the pages that were used in memory.
+  read_page can be called from several threads at the same time.
+  */
+  template <typename T>
+  struct lazy_source
+    {
+    virtual ~lazy_source() {}
+
+    // sets out to the elements of page page, all pages are complete except the last one
+    virtual void read_page(uint64_t page, std::vector<T>& out) const = 0;
+    };
+
   template <typename T, bool atomic_ref_counting, int N>
   ref<rrb<T, atomic_ref_counting, N>> rrb_create();
 
+  template <typename T, bool atomic_ref_counting, int N>
+  ref<rrb<T, atomic_ref_counting, N>> rrb_create_lazy(const std::shared_ptr<const lazy_source<T>>& source, uint32_t size);
+
   template <typename T, bool atomic_ref_counting, int N>
   ref<rrb<T, atomic_ref_counting, N>> rrb_push(const ref<rrb<T, atomic_ref_counting, N>>& in, T element);
 
@@ -102,6 +121,15 @@ namespace immutable
   template <typename T, bool atomic_ref_counting, int N>
   std::tuple<const T*, uint32_t, uint32_t> rrb_region_for(const ref<rrb<T, atomic_ref_counting, N>>& rrb, uint32_t index);
 
+  template <typename T, bool atomic_ref_counting, int N>
+  std::tuple<const T*, uint32_t, uint32_t> rrb_peek_region_for(const ref<rrb<T, atomic_ref_counting, N>>& rrb, uint32_t index, std::vector<T>& page);
+
+  template <typename T, bool atomic_ref_counting, int N, class F>
+  void rrb_for_each_unread_page(const ref<rrb<T, atomic_ref_counting, N>>& rrb, F f);
+
+  template <typename T, bool atomic_ref_counting, int N>
+  bool rrb_shared_node_for(const ref<rrb<T, atomic_ref_counting, N>>& left, uint32_t left_index, const ref<rrb<T, atomic_ref_counting, N>>& right, uint32_t right_index, uint32_t& left_begin, uint32_t& left_end);
+
   template <typename T, bool atomic_ref_counting, int N>
   uint32_t rrb_count(const ref<rrb<T, atomic_ref_counting, N>>& rrb);
 
@@ -136,6 +164,54 @@ namespace immutable
 
     typedef enum { LEAF_NODE, INTERNAL_NODE } node_type;
 
+    // where the leaves of a node of a lazy vector come from
+    template <typename T>
+    struct lazy_page
+      {
+      std::shared_ptr<const lazy_source<T>> source;
+      uint64_t page;
+      uint32_t size; // number of elements of the page below the node, the last page can end in the tail of the vector
+      uint32_t leaf_size;
+      };
+
+    template <typename T, bool atomic_ref_counting>
+    struct internal_node;
+
+    /*
+    The children of an internal node, which is used as a pointer to an array of children. The children of a node
+    of a lazy vector (lazy != nullptr) are leaves that are read from lazy->source the first time they are asked for.
+    Several threads can ask for them at the same time: the first array that is filled in is kept.
+    */
+    template <typename T, bool atomic_ref_counting>
+    struct internal_children
+      {
+      typedef ref<internal_node<T, atomic_ref_counting>> child_type;
+
+      operator child_type* () const
+        {
+        child_type* p = ptr.load(std::memory_order_acquire);
+        return p ? p : read_lazy_page();
+        }
+
+      internal_children& operator = (child_type* p)
+        {
+        ptr.store(p, std::memory_order_relaxed);
+        lazy = nullptr;
+        return *this;
+        }
+
+      // the children if they are known already, without reading them from lazy
+      child_type* known() const
+        {
+        return ptr.load(std::memory_order_acquire);
+        }
+
+      child_type* read_lazy_page() const;
+
+      mutable std::atomic<child_type*> ptr;
+      lazy_page<T>* lazy;
+      };
+
     template <bool atomic_ref_counting>
     struct rrb_size_table;
 
@@ -240,7 +316,7 @@ namespace immutable
       mutable std::atomic<uint32_t> _ref_count;
       guid_type guid;
       ref<rrb_size_table<atomic_ref_counting>> size_table;
-      ref<internal_node<T, atomic_ref_counting>>* child;
+      internal_children<T, atomic_ref_counting> child;
       };
 
     template <typename T>
@@ -251,7 +327,7 @@ namespace immutable
       mutable uint32_t _ref_count;
       guid_type guid;
       ref<rrb_size_table<false>> size_table;
-      ref<internal_node<T, false>>* child;
+      internal_children<T, false> child;
       };
 
     template <typename T, bool atomic_ref_counting>
@@ -350,14 +426,20 @@ namespace immutable
         if (1 == p_node->_ref_count.fetch_sub(1, std::memory_order_acq_rel))
           {
           p_node->size_table.dec();
-          for (uint32_t i = 0; i < p_node->len; ++i)
+          ref<internal_node<T, true>>* children = p_node->child.known(); // nullptr for a lazy page that was never read
+          for (uint32_t i = 0; children && i < p_node->len; ++i)
             {
-            if (p_node->child[i].ptr && p_node->child[i]->type == LEAF_NODE)
+            if (children[i].ptr && children[i]->type == LEAF_NODE)
               {
-              release((leaf_node<T, true>*)p_node->child[i].ptr);
+              release((leaf_node<T, true>*)children[i].ptr);
               }
             else
-              release(p_node->child[i].ptr);
+              release(children[i].ptr);
+            }
+          if (p_node->child.lazy)
+            {
+            free((void*)children);
+            delete p_node->child.lazy;
             }
           free((void*)p_node);
           }
@@ -372,14 +454,20 @@ namespace immutable
         if (1 == p_node->_ref_count--)
           {
           p_node->size_table.dec();
-          for (uint32_t i = 0; i < p_node->len; ++i)
+          ref<internal_node<T, false>>* children = p_node->child.known(); // nullptr for a lazy page that was never read
+          for (uint32_t i = 0; children && i < p_node->len; ++i)
             {
-            if (p_node->child[i].ptr && p_node->child[i]->type == LEAF_NODE)
+            if (children[i].ptr && children[i]->type == LEAF_NODE)
               {
-              release((leaf_node<T, false>*)p_node->child[i].ptr);
+              release((leaf_node<T, false>*)children[i].ptr);
               }
             else
-              release(p_node->child[i].ptr);
+              release(children[i].ptr);
+            }
+          if (p_node->child.lazy)
+            {
+            free((void*)children);
+            delete p_node->child.lazy;
             }
           free((void*)p_node);
           }
@@ -647,6 +735,48 @@ namespace immutable
       return node;
       }
 
+    // a node above the leaves of a lazy vector, its leaves are read when they are needed, see internal_children
+    template <typename T, bool atomic_ref_counting>
+    inline internal_node<T, atomic_ref_counting>* lazy_internal_node_create(const std::shared_ptr<const lazy_source<T>>& source, uint64_t page, uint32_t size, uint32_t leaf_size)
+      {
+      internal_node<T, atomic_ref_counting>* node = (internal_node<T, atomic_ref_counting>*)malloc(sizeof(internal_node<T, atomic_ref_counting>));
+      node->len = (size + leaf_size - 1) / leaf_size;
+      node->type = INTERNAL_NODE;
+      node->size_table.ptr = nullptr;
+      node->guid = 0;
+      node->child = nullptr;
+      node->child.lazy = new lazy_page<T>{ source, page, size, leaf_size };
+      return node;
+      }
+
+    template <typename T, bool atomic_ref_counting>
+    ref<internal_node<T, atomic_ref_counting>>* internal_children<T, atomic_ref_counting>::read_lazy_page() const
+      {
+      std::vector<T> elements;
+      lazy->source->read_page(lazy->page, elements);
+      if (elements.size() < lazy->size)
+        elements.resize(lazy->size); // a source that comes up short gives default elements
+      const uint32_t nr_of_leaves = (lazy->size + lazy->leaf_size - 1) / lazy->leaf_size;
+      child_type* children = (child_type*)malloc(nr_of_leaves * sizeof(child_type));
+      memset(children, 0, nr_of_leaves * sizeof(child_type)); // init pointers to zero
+      for (uint32_t i = 0; i < nr_of_leaves; ++i)
+        {
+        const uint32_t first = i * lazy->leaf_size;
+        const uint32_t len = std::min<uint32_t>(lazy->leaf_size, lazy->size - first);
+        ref<leaf_node<T, atomic_ref_counting>> leaf = leaf_node_create<T, atomic_ref_counting>(len);
+        for (uint32_t j = 0; j < len; ++j)
+          leaf->child[j] = elements[first + j];
+        children[i] = leaf;
+        }
+      child_type* expected = nullptr;
+      if (ptr.compare_exchange_strong(expected, children, std::memory_order_acq_rel, std::memory_order_acquire))
+        return children;
+      for (uint32_t i = 0; i < nr_of_leaves; ++i) // another thread read the page first
+        release((leaf_node<T, atomic_ref_counting>*)children[i].ptr);
+      free((void*)children);
+      return expected;
+      }
+
     template <typename T, bool atomic_ref_counting>
     inline internal_node<T, atomic_ref_counting>* internal_node_clone(const internal_node<T, atomic_ref_counting>* original)
       {
@@ -1898,6 +2028,56 @@ namespace immutable
     return ref<rrb<T, atomic_ref_counting, N>>(empty);
     }
 
+  /*
+  Creates a vector with the size elements of source. Only the tail is read right away: the nodes above the leaves
+  read their page of source the first time that their leaves are used. The tree is dense, as if the elements
+  were pushed one by one, so that edits leave the pages that they do not touch unread.
+  */
+  template <typename T, bool atomic_ref_counting, int N>
+  inline ref<rrb<T, atomic_ref_counting, N>> rrb_create_lazy(const std::shared_ptr<const lazy_source<T>>& source, uint32_t size)
+    {
+    using namespace rrb_details;
+    ref<rrb<T, atomic_ref_counting, N>> out = rrb_create<T, atomic_ref_counting, N>();
+    if (size == 0)
+      return out;
+    const uint32_t page_size = bits<N>::rrb_branching * bits<N>::rrb_branching;
+    const uint32_t tail_len = (size - 1) % bits<N>::rrb_branching + 1;
+    const uint32_t body = size - tail_len;
+    std::vector<T> elements;
+    source->read_page(body / page_size, elements);
+    if (elements.size() < body % page_size + tail_len)
+      elements.resize(body % page_size + tail_len);
+    ref<leaf_node<T, atomic_ref_counting>> tail = leaf_node_create<T, atomic_ref_counting>(tail_len);
+    for (uint32_t i = 0; i < tail_len; ++i)
+      tail->child[i] = elements[body % page_size + i];
+    out->cnt = size;
+    out->tail_len = tail_len;
+    out->tail = tail;
+    if (body == 0)
+      return out;
+    std::vector<ref<internal_node<T, atomic_ref_counting>>> level;
+    for (uint32_t first = 0; first < body; first += page_size)
+      level.emplace_back(lazy_internal_node_create<T, atomic_ref_counting>(source, first / page_size, std::min<uint32_t>(page_size, body - first), bits<N>::rrb_branching));
+    uint32_t shift = bits<N>::rrb_bits;
+    while (level.size() > 1)
+      {
+      std::vector<ref<internal_node<T, atomic_ref_counting>>> above;
+      for (size_t i = 0; i < level.size(); i += bits<N>::rrb_branching)
+        {
+        const uint32_t len = (uint32_t)std::min<size_t>(bits<N>::rrb_branching, level.size() - i);
+        ref<internal_node<T, atomic_ref_counting>> node = internal_node_create<T, atomic_ref_counting>(len);
+        for (uint32_t j = 0; j < len; ++j)
+          node->child[j] = level[i + j];
+        above.push_back(node);
+        }
+      level.swap(above);
+      shift += bits<N>::rrb_bits;
+      }
+    out->root = level[0];
+    out->shift = shift;
+    return out;
+    }
+
   template <typename T, bool atomic_ref_counting, int N>
   inline ref<rrb<T, atomic_ref_counting, N>> rrb_push(const ref<rrb<T, atomic_ref_counting, N>>& in, T element)
     {
@@ -2040,6 +2220,168 @@ namespace immutable
       }
     }
 
+  /*
+  As rrb_region_for, but a page of a lazy vector that was not read yet is read into page and returned from there,
+  without keeping it in the vector. Scanning all the elements of a lazy vector in this way does not fill it in.
+  */
+  template <typename T, bool atomic_ref_counting, int N>
+  inline std::tuple<const T*, uint32_t, uint32_t> rrb_peek_region_for(const ref<rrb<T, atomic_ref_counting, N>>& rrb, uint32_t index, std::vector<T>& page)
+    {
+    using namespace rrb_details;
+    assert(index < rrb->cnt);
+    const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+    if (tail_offset <= index)
+      return std::make_tuple((const T*)rrb->tail->child, tail_offset, rrb->cnt);
+    const internal_node<T, atomic_ref_counting>* current = (const internal_node<T, atomic_ref_counting>*)rrb->root.ptr;
+    uint32_t begin = 0;
+    for (uint32_t shift = rrb->shift; shift > 0; shift -= bits<N>::rrb_bits)
+      {
+      const ref<internal_node<T, atomic_ref_counting>>* children = current->child.known();
+      if (!children)
+        {
+        const lazy_page<T>* lazy = current->child.lazy;
+        lazy->source->read_page(lazy->page, page);
+        if (page.size() < lazy->size)
+          page.resize(lazy->size);
+        return std::make_tuple((const T*)page.data(), begin, begin + lazy->size);
+        }
+      const uint32_t local = index - begin;
+      uint32_t subidx;
+      if (current->size_table.ptr == nullptr)
+        {
+        subidx = (local >> shift) & bits<N>::rrb_mask;
+        begin += subidx << shift;
+        }
+      else
+        {
+        const uint32_t* size = current->size_table->size;
+        subidx = local >> shift;
+        while (size[subidx] <= local)
+          ++subidx;
+        begin += subidx ? size[subidx - 1] : 0;
+        }
+      current = children[subidx].ptr;
+      }
+    const leaf_node<T, atomic_ref_counting>* leaf = (const leaf_node<T, atomic_ref_counting>*)current;
+    return std::make_tuple((const T*)leaf->child, begin, begin + leaf->len);
+    }
+
+  namespace rrb_details
+    {
+    template <typename T, bool atomic_ref_counting, class F>
+    inline void for_each_unread_page(const internal_node<T, atomic_ref_counting>* node, F& f)
+      {
+      const ref<internal_node<T, atomic_ref_counting>>* children = node->child.known();
+      if (!children)
+        {
+        f(*node->child.lazy->source, node->child.lazy->page);
+        return;
+        }
+      for (uint32_t i = 0; i < node->len; ++i)
+        {
+        if (children[i].ptr && children[i]->type != LEAF_NODE)
+          for_each_unread_page(children[i].ptr, f);
+        }
+      }
+    }
+
+  /*
+  Calls f(source, page) for each page of a lazy vector that was not read yet, with the lazy_source it would be read
+  from. The pages that were read already, and the tail, are left out.
+  */
+  template <typename T, bool atomic_ref_counting, int N, class F>
+  inline void rrb_for_each_unread_page(const ref<rrb<T, atomic_ref_counting, N>>& rrb, F f)
+    {
+    using namespace rrb_details;
+    const internal_node<T, atomic_ref_counting>* root = (const internal_node<T, atomic_ref_counting>*)rrb->root.ptr;
+    if (root && root->type != LEAF_NODE)
+      for_each_unread_page(root, f);
+    }
+
+  namespace rrb_details
+    {
+    // fills nodes, begins and ends with the nodes from the root to the leaf (or the tail) that contain index, and the ranges they hold
+    template <typename T, bool atomic_ref_counting, int N>
+    inline uint32_t node_path_for(const ref<rrb<T, atomic_ref_counting, N>>& rrb, uint32_t index, const void** nodes, uint32_t* begins, uint32_t* ends)
+      {
+      const uint32_t tail_offset = rrb->cnt - rrb->tail_len;
+      if (tail_offset <= index)
+        {
+        nodes[0] = rrb->tail.ptr;
+        begins[0] = tail_offset;
+        ends[0] = rrb->cnt;
+        return 1;
+        }
+      const internal_node<T, atomic_ref_counting>* current = (const internal_node<T, atomic_ref_counting>*)rrb->root.ptr;
+      uint32_t begin = 0;
+      uint32_t end = tail_offset;
+      uint32_t length = 0;
+      nodes[length] = current;
+      begins[length] = begin;
+      ends[length] = end;
+      ++length;
+      for (uint32_t shift = rrb->shift; shift > 0; shift -= bits<N>::rrb_bits)
+        {
+        const uint32_t local = index - begin;
+        uint32_t child_begin, child_end;
+        if (current->size_table.ptr == nullptr)
+          {
+          const uint32_t subidx = (local >> shift) & bits<N>::rrb_mask;
+          child_begin = begin + (subidx << shift);
+          child_end = end - child_begin < (1u << shift) ? end : child_begin + (1u << shift);
+          current = current->child[subidx].ptr;
+          }
+        else
+          {
+          const uint32_t* size = current->size_table->size;
+          uint32_t subidx = local >> shift;
+          while (size[subidx] <= local)
+            ++subidx;
+          child_begin = begin + (subidx ? size[subidx - 1] : 0);
+          child_end = begin + size[subidx];
+          current = current->child[subidx].ptr;
+          }
+        begin = child_begin;
+        end = child_end;
+        nodes[length] = current;
+        begins[length] = begin;
+        ends[length] = end;
+        ++length;
+        }
+      return length;
+      }
+    }
+
+  /*
+  Looks for the largest node that holds element left_index of left and element right_index of right, and that is
+  shared by both vectors at the same offset from these elements. Returns false if there is none, otherwise
+  left_begin and left_end are set to the range of the node in left.
+  */
+  template <typename T, bool atomic_ref_counting, int N>
+  inline bool rrb_shared_node_for(const ref<rrb<T, atomic_ref_counting, N>>& left, uint32_t left_index, const ref<rrb<T, atomic_ref_counting, N>>& right, uint32_t right_index, uint32_t& left_begin, uint32_t& left_end)
+    {
+    using namespace rrb_details;
+    const void* left_nodes[bits<N>::rrb_max_height + 2];
+    uint32_t left_begins[bits<N>::rrb_max_height + 2], left_ends[bits<N>::rrb_max_height + 2];
+    const void* right_nodes[bits<N>::rrb_max_height + 2];
+    uint32_t right_begins[bits<N>::rrb_max_height + 2], right_ends[bits<N>::rrb_max_height + 2];
+    const uint32_t left_length = node_path_for(left, left_index, left_nodes, left_begins, left_ends);
+    const uint32_t right_length = node_path_for(right, right_index, right_nodes, right_begins, right_ends);
+    for (uint32_t i = 0; i < left_length; ++i)
+      {
+      for (uint32_t j = 0; j < right_length; ++j)
+        {
+        if (left_nodes[i] == right_nodes[j] && left_index - left_begins[i] == right_index - right_begins[j])
+          {
+          left_begin = left_begins[i];
+          left_end = left_ends[i];
+          return true;
+          }
+        }
+      }
+    return false;
+    }
+
   template <typename T, bool atomic_ref_counting, int N>
   inline uint32_t rrb_count(const ref<rrb<T, atomic_ref_counting, N>>& rrb)
     {
@@ -0,0 +1,346 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+/*
+Serialization of immutable vectors that keeps their structural sharing.
+
+A vector is written as the rrb nodes it consists of, followed by its header. Every node is written only
+once per vector_writer, the first time it is met: a node that is shared with a vector that was written
+before is referred to by its index. Hence writing 1000 versions of a big vector costs about as much as
+the big vector plus the changes between the versions. A vector_reader rebuilds the same graph of nodes,
+so that the vectors share the same nodes again after loading.
+
+The readers work on a block of memory (e.g. a memory mapped file) and throw std::runtime_error when the
+data is invalid. Besides the bounds of the data, the reader checks the shape of the tree that it builds:
+the children of a node have the same height, size tables hold the sizes of the subtrees, nodes without a
+size table only have full children before their last one, and the header agrees with its root and tail.
+Integers are written in little endian, elements are written by an element codec.
+
+  node    := LEAF len element* | INTERNAL len has_size_table size* child_id*
+  vector  := node* END cnt shift tail_len tail_id root_id
+*/
+
+namespace immutable
+  {
+
+  // element codec for trivially copyable types: the elements are written as their bytes in memory
+  template <typename T>
+  struct trivial_codec
+    {
+    static_assert(std::is_trivially_copyable<T>::value, "use a custom element codec for this type");
+
+    enum { element_size = sizeof(T) };
+
+    static void write(std::string& out, const T& value)
+      {
+      out.append((const char*)&value, sizeof(T));
+      }
+
+    static T read(const char* data)
+      {
+      T value;
+      std::memcpy(&value, data, sizeof(T));
+      return value;
+      }
+    };
+
+  namespace serialize_details
+    {
+    enum node_tag
+      {
+      NODE_TAG_END = 0,
+      NODE_TAG_LEAF = 1,
+      NODE_TAG_INTERNAL = 2
+      };
+
+    const uint32_t no_node = 0xffffffff;
+
+    inline void write_u8(std::string& out, uint8_t v)
+      {
+      out.push_back((char)v);
+      }
+
+    inline void write_u32(std::string& out, uint32_t v)
+      {
+      for (int i = 0; i < 4; ++i)
+        out.push_back((char)((v >> (8 * i)) & 0xff));
+      }
+
+    inline void check(size_t bytes, size_t size, size_t pos)
+      {
+      if (pos > size || bytes > size - pos)
+        throw std::runtime_error("serialized vector is truncated");
+      }
+
+    inline uint8_t read_u8(const char* data, size_t size, size_t& pos)
+      {
+      check(1, size, pos);
+      return (uint8_t)data[pos++];
+      }
+
+    inline uint32_t read_u32(const char* data, size_t size, size_t& pos)
+      {
+      check(4, size, pos);
+      uint32_t v = 0;
+      for (int i = 0; i < 4; ++i)
+        v |= ((uint32_t)(uint8_t)data[pos++]) << (8 * i);
+      return v;
+      }
+    }
+
+  /*
+  Writes vectors node by node to a string. The vectors that were written must stay alive as long as the writer
+  is used, as the nodes that were written already are recognized by their address.
+  */
+  template <typename T, bool atomic_ref_counting = true, int N = 5, typename Codec = trivial_codec<T>>
+  class vector_writer
+    {
+    public:
+      typedef rrb_details::tree_node<T, atomic_ref_counting> tree_node_type;
+      typedef rrb_details::leaf_node<T, atomic_ref_counting> leaf_node_type;
+      typedef rrb_details::internal_node<T, atomic_ref_counting> internal_node_type;
+
+      // appends the nodes of v that were not written yet, followed by v itself, to out
+      void write(std::string& out, const vector<T, atomic_ref_counting, N>& v)
+        {
+        using namespace serialize_details;
+        const auto impl = v.raw();
+        const uint32_t root = _write_node(out, impl->root.ptr);
+        const uint32_t tail = _write_node(out, (const tree_node_type*)impl->tail.ptr);
+        write_u8(out, NODE_TAG_END);
+        write_u32(out, impl->cnt);
+        write_u32(out, impl->shift);
+        write_u32(out, impl->tail_len);
+        write_u32(out, tail);
+        write_u32(out, root);
+        }
+
+      // number of distinct nodes written so far
+      uint32_t nr_of_nodes() const
+        {
+        return (uint32_t)_node_ids.size();
+        }
+
+    private:
+      uint32_t _write_node(std::string& out, const tree_node_type* node)
+        {
+        using namespace serialize_details;
+        if (!node)
+          return no_node;
+        auto it = _node_ids.find(node);
+        if (it != _node_ids.end())
+          return it->second;
+        if (node->type == rrb_details::LEAF_NODE)
+          {
+          const leaf_node_type* leaf = (const leaf_node_type*)node;
+          write_u8(out, NODE_TAG_LEAF);
+          write_u32(out, leaf->len);
+          for (uint32_t i = 0; i < leaf->len; ++i)
+            Codec::write(out, leaf->child[i]);
+          }
+        else
+          {
+          const internal_node_type* internal = (const internal_node_type*)node;
+          std::vector<uint32_t> children(internal->len);
+          for (uint32_t i = 0; i < internal->len; ++i)
+            children[i] = _write_node(out, (const tree_node_type*)internal->child[i].ptr);
+          write_u8(out, NODE_TAG_INTERNAL);
+          write_u32(out, internal->len);
+          write_u8(out, internal->size_table.ptr ? 1 : 0);
+          if (internal->size_table.ptr)
+            {
+            for (uint32_t i = 0; i < internal->len; ++i)
+              write_u32(out, internal->size_table.ptr->size[i]);
+            }
+          for (auto child : children)
+            write_u32(out, child);
+          }
+        const uint32_t id = (uint32_t)_node_ids.size();
+        _node_ids[node] = id;
+        return id;
+        }
+
+    private:
+      std::unordered_map<const tree_node_type*, uint32_t> _node_ids;
+    };
+
+  /*
+  Reads the vectors written by a vector_writer, in the same order. The nodes that were read are kept,
+  so that later vectors can share them.
+  */
+  template <typename T, bool atomic_ref_counting = true, int N = 5, typename Codec = trivial_codec<T>>
+  class vector_reader
+    {
+    public:
+      typedef rrb_details::tree_node<T, atomic_ref_counting> tree_node_type;
+      typedef rrb_details::leaf_node<T, atomic_ref_counting> leaf_node_type;
+      typedef rrb_details::internal_node<T, atomic_ref_counting> internal_node_type;
+      typedef rrb_details::rrb_size_table<atomic_ref_counting> size_table_type;
+      typedef rrb<T, atomic_ref_counting, N> rrb_type;
+
+      // reads the vector that starts at data[pos], and moves pos to the end of that vector
+      vector<T, atomic_ref_counting, N> read(const char* data, size_t size, size_t& pos)
+        {
+        using namespace serialize_details;
+        for (uint8_t tag = read_u8(data, size, pos); tag != NODE_TAG_END; tag = read_u8(data, size, pos))
+          {
+          if (tag == NODE_TAG_LEAF)
+            _read_leaf(data, size, pos);
+          else if (tag == NODE_TAG_INTERNAL)
+            _read_internal(data, size, pos);
+          else
+            throw std::runtime_error("serialized vector contains an invalid node");
+          }
+        const uint32_t cnt = read_u32(data, size, pos);
+        const uint32_t shift = read_u32(data, size, pos);
+        const uint32_t tail_len = read_u32(data, size, pos);
+        const uint32_t tail = read_u32(data, size, pos);
+        const uint32_t root = read_u32(data, size, pos);
+        if (tail == no_node || _shape(tail).shift != leaf_shift || _shape(tail).size != tail_len || tail_len > cnt)
+          throw std::runtime_error("serialized vector has an invalid tail");
+        if (root == no_node ? cnt != tail_len || shift > max_shift : _shape(root).shift != shift || (uint64_t)_shape(root).size + tail_len != cnt)
+          throw std::runtime_error("serialized vector does not match its root");
+        rrb_type* r = (rrb_type*)malloc(sizeof(rrb_type));
+        r->cnt = cnt;
+        r->shift = shift;
+        r->tail_len = tail_len;
+        r->tail.ptr = nullptr;
+        r->root.ptr = nullptr;
+        ref<rrb_type> impl(r);
+        impl->tail = _node(tail);
+        if (root != no_node)
+          impl->root = _node(root);
+        return vector<T, atomic_ref_counting, N>(impl);
+        }
+
+      uint32_t nr_of_nodes() const
+        {
+        return (uint32_t)_nodes.size();
+        }
+
+    private:
+      struct node_shape
+        {
+        uint32_t shift; // 0 for a leaf, the shift of the children plus rrb_bits for an internal node
+        uint32_t size; // the number of elements in the subtree
+        };
+
+      enum
+        {
+        leaf_shift = 0,
+        max_shift = rrb_details::bits<N>::rrb_bits * rrb_details::bits<N>::rrb_max_height
+        };
+
+      const ref<tree_node_type>& _node(uint32_t id) const
+        {
+        if (id >= _nodes.size())
+          throw std::runtime_error("serialized vector refers to an unknown node");
+        return _nodes[id];
+        }
+
+      const node_shape& _shape(uint32_t id) const
+        {
+        if (id >= _shapes.size())
+          throw std::runtime_error("serialized vector refers to an unknown node");
+        return _shapes[id];
+        }
+
+      void _read_leaf(const char* data, size_t size, size_t& pos)
+        {
+        using namespace serialize_details;
+        const uint32_t len = read_u32(data, size, pos);
+        if (len > rrb_details::bits<N>::rrb_branching)
+          throw std::runtime_error("serialized vector contains an invalid leaf");
+        check((size_t)len * Codec::element_size, size, pos);
+        leaf_node_type* leaf = rrb_details::leaf_node_create<T, atomic_ref_counting>(len);
+        ref<leaf_node_type> node(leaf);
+        for (uint32_t i = 0; i < len; ++i)
+          {
+          leaf->child[i] = Codec::read(data + pos);
+          pos += Codec::element_size;
+          }
+        _nodes.push_back(node);
+        _shapes.push_back(node_shape{ leaf_shift, len });
+        }
+
+      void _read_internal(const char* data, size_t size, size_t& pos)
+        {
+        using namespace serialize_details;
+        const uint32_t len = read_u32(data, size, pos);
+        if (len == 0 || len > rrb_details::bits<N>::rrb_branching)
+          throw std::runtime_error("serialized vector contains an invalid internal node");
+        internal_node_type* internal = rrb_details::internal_node_create<T, atomic_ref_counting>(len);
+        ref<internal_node_type> node(internal);
+        size_table_type* table = nullptr;
+        if (read_u8(data, size, pos))
+          {
+          table = rrb_details::size_table_create<atomic_ref_counting>(len);
+          internal->size_table = ref<size_table_type>(table);
+          for (uint32_t i = 0; i < len; ++i)
+            table->size[i] = read_u32(data, size, pos);
+          }
+        uint32_t child_shift = 0;
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < len; ++i)
+          {
+          const uint32_t id = read_u32(data, size, pos);
+          internal->child[i] = _node(id);
+          const node_shape child = _shape(id);
+          if (i == 0)
+            child_shift = child.shift;
+          if (child.shift != child_shift || child.size == 0)
+            throw std::runtime_error("serialized vector contains an invalid internal node");
+          total += child.size;
+          if (table && table->size[i] != total)
+            throw std::runtime_error("serialized vector contains an invalid size table");
+          const uint64_t full = (uint64_t)1 << (child_shift + rrb_details::bits<N>::rrb_bits);
+          if (!table && (i + 1 < len ? child.size != full : child.size > full)) // without a size table, elements are found by their index
+            throw std::runtime_error("serialized vector contains a relaxed node without size table");
+          }
+        const uint32_t shift = child_shift + rrb_details::bits<N>::rrb_bits;
+        if (shift > max_shift || total > 0xffffffff)
+          throw std::runtime_error("serialized vector has an invalid height");
+        _nodes.push_back(node);
+        _shapes.push_back(node_shape{ shift, (uint32_t)total });
+        }
+
+    private:
+      std::vector<ref<tree_node_type>> _nodes;
+      std::vector<node_shape> _shapes; // the shape of each node in _nodes, to check the nodes that refer to it
+    };
+
+  // writes a set of vectors, e.g. all versions of a text, sharing their common nodes
+  template <typename T, bool atomic_ref_counting, int N, typename Codec = trivial_codec<T>>
+  std::string serialize(const std::vector<vector<T, atomic_ref_counting, N>>& vectors)
+    {
+    std::string out;
+    vector_writer<T, atomic_ref_counting, N, Codec> writer;
+    serialize_details::write_u32(out, (uint32_t)vectors.size());
+    for (const auto& v : vectors)
+      writer.write(out, v);
+    return out;
+    }
+
+  template <typename T, bool atomic_ref_counting, int N, typename Codec = trivial_codec<T>>
+  std::vector<vector<T, atomic_ref_counting, N>> deserialize(const char* data, size_t size)
+    {
+    size_t pos = 0;
+    vector_reader<T, atomic_ref_counting, N, Codec> reader;
+    const uint32_t nr_of_vectors = serialize_details::read_u32(data, size, pos);
+    serialize_details::check(nr_of_vectors, size, pos); // each vector takes at least one byte
+    std::vector<vector<T, atomic_ref_counting, N>> vectors;
+    vectors.reserve(nr_of_vectors);
+    for (uint32_t i = 0; i < nr_of_vectors; ++i)
+      vectors.push_back(reader.read(data, size, pos));
+    return vectors;
+    }
+
+  }
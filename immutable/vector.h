@@ -292,16 +292,48 @@ namespace immutable
         return transient_type(_impl);
         }
 
+      // the number of elements that a lazy_source reads at once
+      static constexpr size_type lazy_page_size = rrb_details::bits<N>::rrb_branching * rrb_details::bits<N>::rrb_branching;
+
+      // a vector with the size elements of source, whose pages are read the first time they are used, see rrb_create_lazy
+      static vector lazy(const std::shared_ptr<const lazy_source<T>>& source, size_type size)
+        {
+        return vector(rrb_create_lazy<T, atomic_ref_counting, N>(source, size));
+        }
+
+      // calls f(first, last) with the consecutive runs of the elements [from, to). The pages of a lazy vector that were
+      // not used yet are read into a buffer that is reused, so that scanning a lazy vector does not fill it in.
+      template <class F>
+      void for_each_run(size_type from, size_type to, F f) const
+        {
+        std::vector<T> page;
+        while (from < to)
+          {
+          const auto region = rrb_peek_region_for(_impl, from, page);
+          const size_type end = std::get<2>(region) < to ? std::get<2>(region) : to;
+          f(std::get<0>(region) + (from - std::get<1>(region)), std::get<0>(region) + (end - std::get<1>(region)));
+          from = end;
+          }
+        }
+
+      // calls f(source, page) for each page of a lazy vector that was not used yet, with the lazy_source it will be read from
+      template <class F>
+      void for_each_unread_page(F f) const
+        {
+        rrb_for_each_unread_page(_impl, f);
+        }
+
       ref<rrb<T, atomic_ref_counting, N>> raw() const
         {
         return _impl;
         }
 
-    private:
+      // the inverse of raw(), e.g. for rebuilding a vector whose nodes were read back from disk
       vector(const ref<rrb<T, atomic_ref_counting, N>>& impl) : _impl(impl)
         {
         }
 
+    private:
       vector(const ref<transient_rrb<T, atomic_ref_counting, N>>& impl) 
         {
         _impl = transient_to_rrb(impl);
@@ -323,6 +355,81 @@ namespace immutable
     return rrb_concat(left._impl, right._impl);
     }
 
+  // returns the first index where left and right differ, or the size of the smallest vector if it is a prefix of the other one.
+  // Nodes that are shared by both vectors are skipped without comparing their elements, so comparing two versions of the
+  // same vector only costs time proportional to the part that was changed, plus a logarithmic number of node lookups.
+  template <typename T, bool atomic_ref_counting, int N>
+  uint32_t first_difference(const vector<T, atomic_ref_counting, N>& left, const vector<T, atomic_ref_counting, N>& right)
+    {
+    const uint32_t sz = left.size() < right.size() ? left.size() : right.size();
+    const auto left_impl = left.raw();
+    const auto right_impl = right.raw();
+    if (left_impl.ptr == right_impl.ptr)
+      return sz;
+    uint32_t index = 0;
+    while (index < sz)
+      {
+      uint32_t shared_begin, shared_end;
+      if (rrb_shared_node_for(left_impl, index, right_impl, index, shared_begin, shared_end))
+        {
+        index = shared_end < sz ? shared_end : sz;
+        continue;
+        }
+      const auto left_region = rrb_region_for(left_impl, index);
+      const auto right_region = rrb_region_for(right_impl, index);
+      uint32_t end = std::get<2>(left_region) < std::get<2>(right_region) ? std::get<2>(left_region) : std::get<2>(right_region);
+      if (end > sz)
+        end = sz;
+      const T* l = std::get<0>(left_region) + (index - std::get<1>(left_region));
+      const T* r = std::get<0>(right_region) + (index - std::get<1>(right_region));
+      for (; index < end; ++index, ++l, ++r)
+        {
+        if (!(*l == *r))
+          return index;
+        }
+      }
+    return sz;
+    }
+
+  // returns the number of elements at the end of left and right that are equal, which is at most the size of the smallest vector.
+  // As in first_difference, nodes that are shared by both vectors at the same distance from their end are skipped.
+  template <typename T, bool atomic_ref_counting, int N>
+  uint32_t common_suffix_length(const vector<T, atomic_ref_counting, N>& left, const vector<T, atomic_ref_counting, N>& right)
+    {
+    const uint32_t sz = left.size() < right.size() ? left.size() : right.size();
+    const auto left_impl = left.raw();
+    const auto right_impl = right.raw();
+    if (left_impl.ptr == right_impl.ptr)
+      return sz;
+    uint32_t length = 0;
+    while (length < sz)
+      {
+      const uint32_t left_index = left.size() - 1 - length;
+      const uint32_t right_index = right.size() - 1 - length;
+      uint32_t shared_begin, shared_end;
+      if (rrb_shared_node_for(left_impl, left_index, right_impl, right_index, shared_begin, shared_end))
+        {
+        const uint32_t step = left_index - shared_begin + 1;
+        length = step < sz - length ? length + step : sz;
+        continue;
+        }
+      const auto left_region = rrb_region_for(left_impl, left_index);
+      const auto right_region = rrb_region_for(right_impl, right_index);
+      uint32_t step = left_index - std::get<1>(left_region) < right_index - std::get<1>(right_region) ? left_index - std::get<1>(left_region) + 1 : right_index - std::get<1>(right_region) + 1;
+      if (step > sz - length)
+        step = sz - length;
+      const T* l = std::get<0>(left_region) + (left_index - std::get<1>(left_region));
+      const T* r = std::get<0>(right_region) + (right_index - std::get<1>(right_region));
+      for (uint32_t i = 0; i < step; ++i, --l, --r)
+        {
+        if (!(*l == *r))
+          return length;
+        ++length;
+        }
+      }
+    return sz;
+    }
+
 
   template <typename T, bool atomic_ref_counting = true, int N = 5>
   class transient_vector
@@ -1,52 +1,162 @@
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
 #include <string>
-#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <jamlib/jam.h>
+#include <jam_file_utils.h>
 
 enum async_message_type
   {
-  ASYNC_MESSAGE_LOAD
+  ASYNC_MESSAGE_LOAD,
+  ASYNC_MESSAGE_PIPE_OUTPUT,
+  ASYNC_MESSAGE_SEARCH_RESULTS,
+  ASYNC_MESSAGE_HIGHLIGHT_RESULTS,
+  ASYNC_MESSAGE_RESTORE_FILE,
+  ASYNC_MESSAGE_RESTORE_FOLDER,
+  ASYNC_MESSAGE_FILE_CONTENT,
+  ASYNC_MESSAGE_SAVE_RESULT,
+  ASYNC_MESSAGE_FILE_CHANGED,
+  ASYNC_MESSAGE_RELOAD_RESULT,
+  ASYNC_MESSAGE_FILE_INDEX,
+  ASYNC_MESSAGE_OPEN_RESULTS
   };
 
 struct async_message
   {
-  async_message_type m;
-  std::string str;
+  async_message_type m = ASYNC_MESSAGE_LOAD;
+  int64_t file_id = -1; // target file for pipe output, search, highlight and open results
+  std::string str; // file changes: the path that changed on disk
+  std::shared_ptr<jamlib::buffer> content; // the sender keeps no other reference, as buffers are not reference counted atomically
+  jamlib::encoding enc = jamlib::ENC_UTF8;
+  jamlib::range dot = { 0, 0 }; // reload results: the range of the old content that content replaces
+  int64_t file_pos = 0; // reload results of a followed file: the number of bytes of the file that the content holds after the reload
+  JAM::file_version version; // reload results: the version of the file on disk that was compared, or the default version if it cannot be trusted to change with the file
+  uint64_t job_id = 0; // restore, file content, save, highlight, reload, file index and open results: the background job that finished, str holds the error if a read, save or reload failed
   };
 
+/*
+Bounded lock-free multi-producer single-consumer queue.
+Any thread can push, only the main thread (engine::run) pops.
+Each cell carries a sequence number that tells producers whether the cell is free
+and the consumer whether the cell holds a published message, so neither side ever blocks.
+
+Producers post with push_until, which waits while the queue is full. A message is only lost if the producer
+gives up, as tasks do when the pool stops, and every lost message is counted in dropped().
+*/
 class async_messages
   {
   public:
 
-    void push(const async_message& m)
+    enum { capacity = 1024 }; // must be a power of two
+
+    async_messages() : cells(new cell[capacity]), enqueue_pos(0), dequeue_pos(0), dropped_messages(0)
       {
-      mut.lock();
-      message_queue.push(m);
-      mut.unlock();
+      for (size_t i = 0; i < capacity; ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
       }
 
-    async_message pop()
+    async_messages(const async_messages&) = delete;
+    async_messages& operator = (const async_messages&) = delete;
+
+    // Returns false if the queue is full, in which case m is left untouched. Never blocks.
+    bool push(async_message&& m)
       {
-      mut.lock();
-      async_message res = message_queue.front();
-      message_queue.pop();
-      mut.unlock();
-      return res;
+      cell* c;
+      size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+      for (;;)
+        {
+        c = &cells[pos & (capacity - 1)];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+          {
+          if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+          }
+        else if (diff < 0)
+          return false;
+        else
+          pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+      c->message = std::move(m);
+      c->sequence.store(pos + 1, std::memory_order_release);
+      return true;
       }
 
-    bool empty()
+    // Pushes m, and waits while the queue is full until stop() returns true. Returns false, and counts m as dropped, if m was not pushed.
+    template <class TStop>
+    bool push_until(async_message&& m, TStop stop)
       {
-      bool res = true;
-      if (mut.try_lock())
+      while (!push(std::move(m)))
         {
-         res = message_queue.empty();
-         mut.unlock();
+        if (stop())
+          {
+          dropped_messages.fetch_add(1, std::memory_order_relaxed);
+          return false;
+          }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
         }
-      return res;
+      return true;
+      }
+
+    // The number of messages that producers gave up on, see push_until.
+    uint64_t dropped() const
+      {
+      return dropped_messages.load(std::memory_order_relaxed);
+      }
+
+    // Single consumer only.
+    bool pop(async_message& m)
+      {
+      size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+      cell* c = &cells[pos & (capacity - 1)];
+      size_t seq = c->sequence.load(std::memory_order_acquire);
+      if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+        return false;
+      m = std::move(c->message);
+      c->message.str.clear();
+      dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+      c->sequence.store(pos + capacity, std::memory_order_release);
+      return true;
+      }
+
+    // Moves up to max_messages pending messages into out, returns the number of messages drained.
+    size_t pop_all(std::vector<async_message>& out, size_t max_messages = capacity)
+      {
+      size_t nr = 0;
+      async_message m;
+      while (nr < max_messages && pop(m))
+        {
+        out.push_back(std::move(m));
+        ++nr;
+        }
+      return nr;
+      }
+
+    // Single consumer only: exact when called from the consumer thread.
+    bool empty() const
+      {
+      size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+      const cell* c = &cells[pos & (capacity - 1)];
+      size_t seq = c->sequence.load(std::memory_order_acquire);
+      return (intptr_t)seq - (intptr_t)(pos + 1) < 0;
       }
 
   private:
-    std::queue<async_message> message_queue;
-    std::mutex mut;
-  };
\ No newline at end of file
+    struct cell
+      {
+      std::atomic<size_t> sequence;
+      async_message message;
+      };
+
+    std::unique_ptr<cell[]> cells;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+    std::atomic<uint64_t> dropped_messages;
+  };
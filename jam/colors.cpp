@@ -171,6 +171,9 @@ void init_colors(const settings& sett)
   rgb right_color(sett.right_red, sett.right_green, sett.right_blue);
   rgb selection_color(sett.selection_red, sett.selection_green, sett.selection_blue);
   rgb selection_tag_color(sett.selection_tag_red, sett.selection_tag_green, sett.selection_tag_blue);
+  rgb keyword_color(sett.keyword_red, sett.keyword_green, sett.keyword_blue);
+  rgb string_color(sett.string_red, sett.string_green, sett.string_blue);
+  rgb number_color(sett.number_red, sett.number_green, sett.number_blue);
 
   init_color(1, text_color);
   init_color(2, body_color);
@@ -183,6 +186,9 @@ void init_colors(const settings& sett)
   init_color(9, selection_color);
   init_color(10, tag_text_color);
   init_color(11, selection_tag_color);  
+  init_color(12, keyword_color);
+  init_color(13, string_color);
+  init_color(14, number_color);
 
   init_color(20, get_text_color(text_color, body_color));
   init_color(30, get_text_color(text_color, tag_color));
@@ -220,6 +226,9 @@ void init_colors(const settings& sett)
 
   init_pair(highlight, 7, 2);
   init_pair(comment, 8, 2);
+  init_pair(keyword, 12, 2);
+  init_pair(string_literal, 13, 2);
+  init_pair(number_literal, 14, 2);
 
   init_pair(active_window, 4, 3);
   }
\ No newline at end of file
@@ -25,7 +25,10 @@ enum color
   selection_command = 13,
   highlight = 14,
   comment = 15,
-  active_window = 16
+  active_window = 16,
+  keyword = 17,
+  string_literal = 18,
+  number_literal = 19
   };
 
 
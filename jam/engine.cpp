@@ -1,11 +1,17 @@
 #include "engine.h"
 #include "clipboard.h"
 #include "colors.h"
+#include "file_finder.h"
+#include "folder_list.h"
+#include "grep.h"
 #include "pdcex.h"
 #include "mouse.h"
 #include "keyboard.h"
+#include "line_index.h"
 #include "utils.h"
 #include "serialize.h"
+#include "token_cache.h"
+#include <jamlib/undo.h>
 #include <jam_active_folder.h>
 #include <jam_file_utils.h>
 #include <jam_exepath.h>
@@ -17,10 +23,15 @@
 #include <sstream>
 
 #include <thread>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <cassert>
 
 #include <map>
+#include <set>
 #include <functional>
+#include <utility>
 
 #include <jam_pipe.h>
 #include <jam_encoding.h>
@@ -35,6 +46,83 @@ namespace
   {
   int font_width, font_height;
   settings* gp_settings = nullptr;
+  async_messages* gp_messages = nullptr;
+  JAM::thread_pool* gp_pool = nullptr;
+
+  // shared by a save of Putall and the main thread, so that jam can wait for this save alone when it closes
+  struct save_job
+    {
+    std::mutex mt;
+    std::condition_variable cv;
+    bool started = false; // whoever sets this writes the file, the worker or the main thread when jam closes first
+    bool done = false;
+    std::string error;
+    JAM::file_version version; // of the file that was written
+    };
+
+  struct background_save
+    {
+    std::string filename;
+    jamlib::buffer content; // owned by the main thread, the worker that writes it only reads it through a pointer
+    jamlib::encoding enc;
+    std::shared_ptr<save_job> job;
+    };
+
+  std::map<uint64_t, background_save> g_background_saves; // by job id, main thread only
+  std::multiset<std::string> g_files_being_read; // filenames of windows whose content is read in the background, main thread only
+  uint64_t g_last_save_job_id = 0;
+
+  struct background_read
+    {
+    int64_t file_id;
+    std::string filename;
+    jamlib::range dot; // applied once the content is known, and written to the session if jam closes before that
+    int64_t file_pos;
+    };
+
+  std::map<uint64_t, background_read> g_background_reads; // by job id, main thread only
+  uint64_t g_last_read_job_id = 0;
+
+  struct background_reload
+    {
+    int64_t file_id;
+    std::string filename;
+    jamlib::buffer content; // the content that the file on disk is compared with, kept alive as for background_save
+    bool again; // the file changed on disk again while it was being compared
+    bool follow; // only the bytes after offset are read, see read_followed_file
+    int64_t offset;
+    JAM::file_version followed_version;
+    };
+
+  struct followed_file
+    {
+    std::string filename;
+    jamlib::buffer content; // the content after the last reload, the bytes on disk up to offset are in it
+    int64_t offset; // -1 if the content still has to be compared with the complete file
+    JAM::file_version version; // of the file on disk at the last reload, its inode changes when the file is replaced, as when a log is rotated
+    };
+
+  struct compared_file
+    {
+    jamlib::buffer content;
+    JAM::file_version version; // the version of the file on disk that was found to hold content
+    };
+
+  std::map<uint64_t, background_reload> g_background_reloads; // by job id, main thread only
+  std::map<std::string, compared_file> g_compared_files; // by path, the result of the last reload or save of each watched file, main thread only
+  std::map<std::string, bool> g_watched_files; // paths of the files and folders in the windows, true for the files that are watched, main thread only
+  std::set<std::string> g_reload_conflicts; // files that changed on disk while they had unsaved edits, so that this is reported once
+  uint64_t g_last_reload_job_id = 0;
+  std::map<int64_t, followed_file> g_followed_files; // by file id, main thread only
+
+  struct file_finder_window
+    {
+    std::string root;
+    std::string query; // the query of the last search
+    uint64_t job_id; // the last search, the results of older searches are dropped
+    };
+
+  std::map<int64_t, file_finder_window> g_file_finders; // +Open windows by file id, main thread only
   //SDL_Cursor* gp_cursor;
   }
 
@@ -228,16 +316,8 @@ app_state jump_to_pos(int64_t pos, uint32_t file_id, app_state state)
 
   auto& w = state.windows[state.file_id_to_window_id[file_id]];
 
-  int64_t begin_of_line_pos = pos;
-  auto it = f.content.rbegin() + (f.content.size() - pos);
-  auto it_end = f.content.rend();
-  for (; it != it_end; ++it, --begin_of_line_pos)
-    {
-    if (*it == '\n')
-      break;
-    }
-  w.file_pos = begin_of_line_pos;
-  w.wordwrap_row = (pos - begin_of_line_pos) / (w.cols - 1);
+  w.file_pos = line_begin(f.content, pos);
+  w.wordwrap_row = wrapped_row_in_line(f.content, pos, w.cols, gp_settings->tab_space);
   return state;
   }
 
@@ -286,6 +366,7 @@ app_state resize_font(app_state state, int font_size)
   {
   pdc_font_size = font_size;
   gp_settings->font_size = font_size;
+  PDC_clear_glyph_cache();
   TTF_CloseFont(pdc_ttffont);
   //pdc_ttffont = TTF_OpenFont("C:/Windows/Fonts/consola.ttf", pdc_font_size);
   //pdc_ttffont = TTF_OpenFont("D:/_Development/GameDev/Build/games/jamterm/Consolas-Braille-Mono.ttf", pdc_font_size);
@@ -320,19 +401,22 @@ app_state resize_font(app_state state, int font_size)
   resize_term(state.h / font_height, state.w / font_width);
   resize_term_ex(state.h / font_height, state.w / font_width);
 
-  return resize(state);
+  return resize(std::move(state));
   }
 
-jamlib::buffer get_folder_list(const std::string& foldername);
 std::optional<app_state> new_column_command(app_state state, int64_t id, const std::string&);
 std::optional<app_state> load_file(std::string filename, app_state state, int64_t id);
 std::optional<app_state> load_folder(std::string folder, app_state state, int64_t id);
 app_state make_window_piped(app_state state, int64_t file_id, std::string win_command);
 bool has_valid_file_pos(const window& w, const app_state& state);
+int64_t get_line_begin(jamlib::file f, int64_t pos);
+int64_t get_top_wrapped_row(const window& w, const jamlib::file& f);
+void set_top_wrapped_row(window& w, const jamlib::file& f, int64_t row);
 app_state update_command_text(app_state state, uint32_t command_id);
 std::optional<app_state> optimize_column(app_state state, int64_t id);
 std::pair<int64_t, int64_t> get_word_from_position(const app_state& state, int64_t file_id, int64_t pos);
 void get_window_first_last_pos(int64_t& p1, int64_t& p2, const app_state& state, int64_t file_id);
+app_state add_error_text(app_state state, const std::string& errortext);
 
 app_state set_fileids(app_state state)
   {
@@ -402,13 +486,701 @@ app_state check_tags_at_startup(app_state state)
   return state;
   }
 
-engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
+// true if file_id is still shown in a window and still has filename, i.e. its window was not closed
+bool has_window(const app_state& state, int64_t file_id, const std::string& filename)
+  {
+  if (file_id < 0 || file_id >= (int64_t)state.file_id_to_window_id.size() || file_id >= (int64_t)state.file_state.files.size())
+    return false;
+  const uint32_t window_id = state.file_id_to_window_id[file_id];
+  return window_id < state.windows.size() && state.windows[window_id].file_id == file_id && state.file_state.files[file_id].filename == filename;
+  }
+
+// true for files that are read in the background, and whose text is decoded page by page as it is used, see settings::large_file_mb
+bool is_large_file(const std::string& path)
+  {
+  return gp_settings->large_file_mb > 0 && JAM::file_size(path) > (int64_t)gp_settings->large_file_mb * 1024 * 1024;
+  }
+
+/*
+Runs on a thread of the pool: reads the file or lists the folder of a window. The returned message of type m owns the
+only reference to the new content, or holds the error in str if filename could not be read. A file is decoded on the
+threads of pool, or only scanned if lazily is set, see jamlib::read_buffer_from_file_lazily.
+*/
+async_message read_window_content(async_message_type type, const std::string& filename, jamlib::encoding enc, uint64_t job_id, JAM::thread_pool* pool, bool lazily)
+  {
+  async_message m;
+  m.m = type;
+  m.enc = enc;
+  m.job_id = job_id;
+  try
+    {
+    const std::string path = remove_quotes_from_path(filename);
+    if (JAM::file_exists(path))
+      m.content = std::make_shared<jamlib::buffer>(lazily ? jamlib::read_buffer_from_file_lazily(path, m.enc, pool) : jamlib::read_buffer_from_file(path, m.enc, pool));
+    else if (type == ASYNC_MESSAGE_RESTORE_FILE && JAM::is_directory(path))
+      {
+      m.m = ASYNC_MESSAGE_RESTORE_FOLDER;
+      m.content = std::make_shared<jamlib::buffer>(read_folder_list(path));
+      }
+    }
+  catch (std::exception& e)
+    {
+    m.content.reset();
+    m.str = filename + ": " + e.what();
+    }
+  return m;
+  }
+
+// Registers the background read of the content of file_id, see read_window_content, and returns its job id.
+uint64_t start_background_read(int64_t file_id, const std::string& filename, jamlib::range dot, int64_t file_pos)
+  {
+  const uint64_t job_id = ++g_last_read_job_id;
+  g_background_reads[job_id] = background_read{ file_id, filename, dot, file_pos };
+  g_files_being_read.insert(filename);
+  return job_id;
+  }
+
+app_state restore_session_content(app_state state, const async_message& m)
+  {
+  auto it = g_background_reads.find(m.job_id);
+  if (it == g_background_reads.end())
+    return state;
+  const background_read br = std::move(it->second);
+  g_background_reads.erase(it);
+  auto being_read = g_files_being_read.find(br.filename);
+  if (being_read != g_files_being_read.end())
+    g_files_being_read.erase(being_read);
+  if (!m.str.empty())
+    {
+    const std::string error = "Could not read " + m.str;
+    return add_error_text(std::move(state), error);
+    }
+  if (!has_window(state, br.file_id, br.filename))
+    return state; // the window was closed before its content was read
+  if (!m.content)
+    return state; // the file or folder does not exist anymore
+  auto& f = state.file_state.files[br.file_id];
+  if (m.m != ASYNC_MESSAGE_RESTORE_FOLDER)
+    {
+    if (f.modification_mask & 1)
+      {
+      const std::string error = br.filename + " was edited before its content was read: Get reloads it, Put overwrites it";
+      return add_error_text(std::move(state), error);
+      }
+    f.enc = m.enc;
+    f.modification_mask = 0;
+    f.history = immutable::vector<jamlib::snapshot, false>();
+    f.undo_redo_index = 0;
+    }
+  f.content = *m.content;
+  const int64_t size = (int64_t)f.content.size();
+  f.dot.r.p1 = std::min<int64_t>(br.dot.p1, size);
+  f.dot.r.p2 = std::min<int64_t>(br.dot.p2, size);
+  auto& w = state.windows[state.file_id_to_window_id[br.file_id]];
+  w.file_pos = br.file_pos > size ? 0 : br.file_pos;
+  if (!has_valid_file_pos(w, state))
+    w.file_pos = 0;
+  return state;
+  }
+
+// Puts the dot and first visible position of the windows whose content is still being read back, so that the session keeps them.
+app_state keep_positions_of_background_reads(app_state state)
+  {
+  for (const auto& read : g_background_reads)
+    {
+    const background_read& br = read.second;
+    if (!has_window(state, br.file_id, br.filename) || (state.file_state.files[br.file_id].modification_mask & 1))
+      continue;
+    state.file_state.files[br.file_id].dot.r = br.dot;
+    state.windows[state.file_id_to_window_id[br.file_id]].file_pos = br.file_pos;
+    }
+  g_background_reads.clear();
+  g_files_being_read.clear();
+  return state;
+  }
+
+// makes the recovered content the content of file_id, with the content on disk as the step that undo goes back to
+app_state restore_unsaved_edits(app_state state, uint32_t file_id, const recovered_file& rf)
+  {
+  auto& f = state.file_state.files[file_id];
+  jamlib::snapshot ss;
+  ss.content = rf.saved_content;
+  ss.dot = f.dot;
+  ss.dot.r.p1 = ss.dot.r.p2 = 0;
+  ss.modification_mask = 0;
+  ss.enc = rf.enc;
+  f.history = immutable::vector<jamlib::snapshot, false>();
+  jamlib::append_snapshot(f, ss);
+  f.undo_redo_index = f.history.size();
+  f.content = rf.content;
+  f.enc = rf.enc;
+  f.modification_mask |= 1;
+  f.dot.r.p1 = std::min<int64_t>(f.dot.r.p1, (int64_t)f.content.size());
+  f.dot.r.p2 = std::min<int64_t>(f.dot.r.p2, (int64_t)f.content.size());
+  return state;
+  }
+
+std::string recovery_name(const std::string& filename)
+  {
+  return flip_backslash_to_slash_in_filename(cleanup(remove_quotes_from_path(filename)));
+  }
+
+/*
+Replays the journals of the unsaved edits of a jam that crashed. The recovered files of the previous session get
+their recovered content right away, so that restore_session does not read them again. The other recovered files
+are returned in unopened.
+*/
+app_state recover_unsaved_edits(app_state state, std::vector<recovered_file>& unopened, std::vector<std::string>& messages)
+  {
+  auto recovered = recover_journals(messages);
+  for (const auto& rf : recovered)
+    {
+    bool opened = false;
+    for (const auto& w : state.windows)
+      {
+      if (w.is_command_window || w.piped || w.file_id >= state.file_state.files.size())
+        continue;
+      if (recovery_name(state.file_state.files[w.file_id].filename) == recovery_name(rf.filename))
+        {
+        state = restore_unsaved_edits(std::move(state), w.file_id, rf);
+        opened = true;
+        break;
+        }
+      }
+    if (!opened)
+      unopened.push_back(rf);
+    messages.push_back("Recovered unsaved edits of " + rf.filename);
+    }
+  return state;
+  }
+
+/*
+Reads the files and folders of the windows of the previous session on the thread pool.
+The visible windows are queued first and waited for, so that the first frame shows their content.
+The other windows are filled in later via ASYNC_MESSAGE_RESTORE_FILE/FOLDER messages, until then
+they are empty and scrolled to the top, and their dot and first visible position wait in g_background_reads.
+A file that cannot be read is reported in the +Errors window. Returns the state with the visible windows filled in.
+*/
+app_state restore_session(app_state state, async_messages& messages, JAM::thread_pool& pool, size_t& pending_restores)
+  {
+  std::vector<bool> visible(state.windows.size(), false);
+  for (const auto& wp : state.window_pairs)
+    {
+    if (wp.rows > 0 && wp.window_id < visible.size())
+      visible[wp.window_id] = true;
+    }
+
+  std::vector<std::future<async_message>> visible_content;
+  for (int pass = 0; pass < 2; ++pass)
+    {
+    for (uint32_t j = 0; j < (uint32_t)state.windows.size(); ++j)
+      {
+      auto& w = state.windows[j];
+      if (w.is_command_window || w.piped || visible[j] != (pass == 0))
+        continue;
+      if (!state.file_state.files[w.file_id].history.empty())
+        continue; // the content and undo history were restored from the session file
+      auto& f = state.file_state.files[w.file_id];
+      f.filename = flip_backslash_to_slash_in_filename(cleanup(remove_quotes_from_path(f.filename)));
+      const std::string filename = f.filename;
+      const jamlib::encoding enc = f.enc;
+      const bool lazily = is_large_file(filename);
+      JAM::thread_pool* p_pool = &pool;
+      const uint64_t job_id = start_background_read(w.file_id, filename, f.dot.r, w.file_pos);
+      f.dot.r.p1 = f.dot.r.p2 = 0;
+      w.file_pos = 0;
+
+      if (pass == 0)
+        visible_content.push_back(pool.push([filename, enc, job_id, p_pool, lazily]() { return read_window_content(ASYNC_MESSAGE_RESTORE_FILE, filename, enc, job_id, p_pool, lazily); }));
+      else
+        {
+        ++pending_restores;
+        pool.push([filename, enc, job_id, lazily, &messages, &pool]()
+          {
+          auto result = read_window_content(ASYNC_MESSAGE_RESTORE_FILE, filename, enc, job_id, &pool, lazily);
+          messages.push_until(std::move(result), [&]() { return pool.stopped(); });
+          });
+        }
+      }
+    }
+
+  for (auto& content : visible_content)
+    state = restore_session_content(std::move(state), content.get());
+  return state;
+  }
+
+// true if rhs is lhs or a worker copy of lhs
+bool shares_all_nodes(const jamlib::buffer& lhs, const jamlib::buffer& rhs)
+  {
+  const auto l = lhs.raw();
+  const auto r = rhs.raw();
+  return l->root.ptr == r->root.ptr && l->tail.ptr == r->tail.ptr && l->cnt == r->cnt;
+  }
+
+// clears the time of v if the file may be written again within the resolution of its modification time, so that v matches no later version
+void distrust_recent_time(JAM::file_version& v)
+  {
+  const int64_t now = (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  if (now - v.time < 2000000000)
+    v.time = -1;
+  }
+
+/*
+The version of a file that jam has just written, kept with the content it wrote in g_compared_files, so that the changes
+that the watcher reports for the save itself do not read the file again. Unlike in read_reload_result a recent time is
+kept: the save renamed a new file into place, so no write of another program can be going on in it, and a later write
+is only missed if it falls in the same tick of the file system clock and keeps the size. On a file system that only
+keeps whole seconds, that is too likely, and the time is distrusted as for a reload.
+*/
+JAM::file_version get_saved_version(const std::string& filename)
+  {
+  JAM::file_version v = JAM::get_file_version(filename);
+  if (v.time % 1000000000 == 0)
+    distrust_recent_time(v);
+  return v;
+  }
+
+/*
+Handles the result of a save by Putall. The file is only marked as saved if it was not edited while it was being
+written, otherwise it stays modified, and the version that was written is kept for the next reload.
+*/
+app_state finish_background_save(app_state state, const async_message& m)
+  {
+  auto it = g_background_saves.find(m.job_id);
+  if (it == g_background_saves.end())
+    return state;
+  if (!m.str.empty())
+    state = add_error_text(std::move(state), m.str);
+  else
+    {
+    for (const auto& w : state.windows)
+      {
+      if (w.is_command_window)
+        continue;
+      auto& f = state.file_state.files[w.file_id];
+      if (f.filename == it->second.filename && shares_all_nodes(f.content, it->second.content))
+        jamlib::mark_as_saved(f);
+      }
+    if (m.version.time >= 0)
+      g_compared_files[remove_quotes_from_path(it->second.filename)] = compared_file{ it->second.content, m.version };
+    }
+  g_background_saves.erase(it);
+  return state;
+  }
+
+// returns the error message, or an empty string if the file was written, in which case version is set to its version
+std::string save_in_background(const std::string& filename, const jamlib::buffer& content, jamlib::encoding enc, JAM::file_version& version)
+  {
+  try
+    {
+    if (!jamlib::write_buffer_to_file(filename, content, enc))
+      return "Cannot write file: " + filename;
+    }
+  catch (std::exception& e)
+    {
+    return filename + ": " + e.what();
+    }
+  version = get_saved_version(filename);
+  return std::string();
+  }
+
+/*
+Called when jam closes: the files that Putall is still writing are finished first. Only the saves themselves are
+waited for: a save that no worker has started yet, for instance because a long Grep keeps the workers busy, is
+written here on the main thread.
+*/
+app_state wait_for_background_saves(app_state state)
+  {
+  while (!g_background_saves.empty())
+    {
+    auto it = g_background_saves.begin();
+    save_job& job = *it->second.job;
+    async_message m;
+    m.m = ASYNC_MESSAGE_SAVE_RESULT;
+    m.job_id = it->first;
+    std::unique_lock<std::mutex> lock(job.mt);
+    if (!job.started)
+      {
+      job.started = true;
+      lock.unlock();
+      m.str = save_in_background(remove_quotes_from_path(it->second.filename), it->second.content, it->second.enc, m.version);
+      }
+    else
+      {
+      job.cv.wait(lock, [&]() { return job.done; });
+      m.str = job.error;
+      m.version = job.version;
+      lock.unlock();
+      }
+    state = finish_background_save(std::move(state), m);
+    }
+  return state;
+  }
+
+/*
+Called on the thread of the watcher. Gives up if the queue stays full for 100ms, as it does when jam closes and messages are not read anymore.
+As the lost change may have been in any cached folder, all cached folder listings are read again when they are used next.
+*/
+void post_watched_path_change(async_messages& messages, const std::string& path)
+  {
+  async_message m;
+  m.m = ASYNC_MESSAGE_FILE_CHANGED;
+  m.str = path;
+  const auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  if (!messages.push_until(std::move(m), [&]() { return std::chrono::steady_clock::now() > give_up; }))
+    folder_lists_changed();
+  }
+
+// Keeps the watcher watching the files of the windows, called after each change of the windows.
+void watch_files_of_windows(const app_state& state, JAM::file_watcher& watcher)
+  {
+  std::set<std::string> paths;
+  for (const auto& w : state.windows)
+    {
+    if (w.is_command_window || w.piped)
+      continue;
+    const auto& f = state.file_state.files[w.file_id];
+    if (f.filename.empty() || f.filename.front() == '+')
+      continue;
+    paths.insert(remove_quotes_from_path(f.filename));
+    }
+  for (auto it = g_followed_files.begin(); it != g_followed_files.end();)
+    {
+    if (has_window(state, it->first, it->second.filename))
+      ++it;
+    else
+      it = g_followed_files.erase(it);
+    }
+  for (auto it = g_compared_files.begin(); it != g_compared_files.end();)
+    {
+    if (paths.find(it->first) != paths.end())
+      ++it;
+    else
+      it = g_compared_files.erase(it);
+    }
+  for (auto it = g_watched_files.begin(); it != g_watched_files.end();)
+    {
+    if (paths.find(it->first) != paths.end())
+      {
+      ++it;
+      continue;
+      }
+    if (it->second)
+      watcher.unwatch(it->first);
+    it = g_watched_files.erase(it);
+    }
+  for (const auto& path : paths)
+    {
+    if (g_watched_files.find(path) != g_watched_files.end())
+      continue;
+    const bool is_file = !JAM::is_directory(path); // folders are watched by the folder list cache
+    if (is_file)
+      watcher.watch(path);
+    g_watched_files[path] = is_file;
+    }
+  }
+
+// sets the text of on_disk that differs from content, and the range of content that it replaces, see read_reload_result
+void set_changed_text(async_message& m, const jamlib::buffer& content, const jamlib::buffer& on_disk)
+  {
+  const int64_t old_size = (int64_t)content.size();
+  const int64_t new_size = (int64_t)on_disk.size();
+  const int64_t prefix = (int64_t)immutable::first_difference(content, on_disk);
+  const int64_t suffix = std::min<int64_t>((int64_t)immutable::common_suffix_length(content, on_disk), std::min<int64_t>(old_size, new_size) - prefix);
+  m.dot.p1 = prefix;
+  m.dot.p2 = old_size - suffix;
+  m.content = std::make_shared<jamlib::buffer>(on_disk.slice((uint32_t)prefix, (uint32_t)(new_size - suffix)));
+  }
+
+/*
+Reads filename on a worker thread and compares it with content. Only the text between the common prefix and the
+common suffix is posted, with the range of content that it replaces in dot. The main thread splices it into the
+content, so that the text before and after the change keeps sharing its nodes with the previous content and its undo history.
+
+The file is not read at all if it still has version compared, the version that was found to hold content before, as
+the watcher reports several changes for a single save. A file that is truncated while it is read does not crash jam:
+read_buffer_from_file only reads the mapping of the file through guarded reads, and reads the file again with an
+ifstream if a guarded read fails. If content is lazy and its file was written in place, the text of content that was not
+used yet changed along with it, see jamlib::lazy_text_changed, so all of content is replaced.
+*/
+async_message read_reload_result(const std::string& filename, const jamlib::buffer& content, jamlib::encoding enc, const JAM::file_version& compared)
+  {
+  async_message m;
+  m.m = ASYNC_MESSAGE_RELOAD_RESULT;
+  m.version = JAM::get_file_version(filename); // before the file is read, so that a write during the read changes the version that is kept
+  if (m.version.time < 0 || !JAM::file_exists(filename))
+    {
+    m.str = filename + " was removed from disk";
+    return m;
+    }
+  m.enc = enc;
+  if (m.version == compared)
+    {
+    m.dot.p1 = m.dot.p2 = (int64_t)content.size();
+    m.content = std::make_shared<jamlib::buffer>();
+    return m;
+    }
+  distrust_recent_time(m.version);
+  try
+    {
+    jamlib::buffer on_disk = jamlib::read_buffer_from_file(filename, m.enc);
+    if (jamlib::lazy_text_changed(content))
+      {
+      m.dot.p1 = 0;
+      m.dot.p2 = (int64_t)content.size();
+      m.content = std::make_shared<jamlib::buffer>(on_disk);
+      }
+    else
+      set_changed_text(m, content, on_disk);
+    }
+  catch (std::exception& e)
+    {
+    m.str = filename + ": " + e.what();
+    }
+  return m;
+  }
+
+/*
+As read_reload_result, for a file that is followed. Only the bytes after the first offset bytes of the file are read,
+and they are appended to content, so the cost does not depend on the size of the file. The complete file is compared
+with content instead if offset is -1, or if the file was replaced, as when a log is rotated: then it became shorter
+than offset, or it has another device or inode than followed, the version of the file at the last reload.
+*/
+async_message read_followed_file(const std::string& filename, const jamlib::buffer& content, jamlib::encoding enc, int64_t offset, const JAM::file_version& followed)
+  {
+  async_message m;
+  m.m = ASYNC_MESSAGE_RELOAD_RESULT;
+  m.enc = enc;
+  m.version = JAM::get_file_version(filename); // before the file is read, so that a later replacement is found by the next reload
+  const bool replaced = m.version.device != followed.device || m.version.inode != followed.inode;
+  distrust_recent_time(m.version);
+  try
+    {
+    jamlib::buffer text;
+    m.file_pos = offset;
+    if (offset >= 0 && !replaced && jamlib::read_appended_text(text, filename, m.file_pos, enc))
+      {
+      m.dot.p1 = m.dot.p2 = (int64_t)content.size();
+      m.content = std::make_shared<jamlib::buffer>(text);
+      return m;
+      }
+    m.file_pos = 0;
+    if (!jamlib::read_appended_text(text, filename, m.file_pos, enc))
+      {
+      m.str = filename + " was removed from disk";
+      return m;
+      }
+    set_changed_text(m, content, text);
+    }
+  catch (std::exception& e)
+    {
+    m.str = filename + ": " + e.what();
+    }
+  return m;
+  }
+
+/*
+Compares file_id with its file on disk on the thread pool, see read_reload_result. A file with unsaved edits is not
+reloaded, and a file that is being read or written in the background is left alone, as the change is the one jam makes.
+*/
+app_state start_reload(app_state state, int64_t file_id)
+  {
+  const auto& f = state.file_state.files[file_id];
+  if (g_files_being_read.count(f.filename))
+    return state;
+  for (const auto& bs : g_background_saves)
+    {
+    if (bs.second.filename == f.filename)
+      return state;
+    }
+  for (auto& br : g_background_reloads)
+    {
+    if (br.second.file_id == file_id)
+      {
+      br.second.again = true;
+      return state;
+      }
+    }
+  if (is_modified(f))
+    {
+    if (!g_reload_conflicts.insert(f.filename).second)
+      return state;
+    const std::string error = f.filename + " changed on disk while it has unsaved edits: Get reloads it, Put overwrites it";
+    return add_error_text(std::move(state), error);
+    }
+  const uint64_t job_id = ++g_last_reload_job_id;
+  background_reload& br = g_background_reloads[job_id];
+  br.file_id = file_id;
+  br.filename = f.filename;
+  br.content = make_worker_copy(f.content);
+  br.again = false;
+  auto followed = g_followed_files.find(file_id);
+  br.follow = followed != g_followed_files.end();
+  br.offset = br.follow && shares_all_nodes(f.content, followed->second.content) ? followed->second.offset : -1; // edited, undone or read again since the last reload otherwise
+  const jamlib::buffer* content = &br.content;
+  const std::string filename = remove_quotes_from_path(f.filename);
+  const jamlib::encoding enc = f.enc;
+  const bool follow = br.follow;
+  const int64_t offset = br.offset;
+  br.followed_version = br.follow ? followed->second.version : JAM::file_version();
+  const JAM::file_version followed_version = br.followed_version;
+  JAM::file_version compared;
+  auto cf = g_compared_files.find(filename);
+  if (cf != g_compared_files.end() && shares_all_nodes(f.content, cf->second.content))
+    compared = cf->second.version;
+  gp_pool->push([job_id, filename, content, enc, follow, offset, followed_version, compared]()
+    {
+    async_message m = follow ? read_followed_file(filename, *content, enc, offset, followed_version) : read_reload_result(filename, *content, enc, compared);
+    m.job_id = job_id;
+    gp_messages->push_until(std::move(m), [&]() { return gp_pool->stopped(); });
+    });
+  return state;
+  }
+
+// Handles a change reported by the watcher: a watched file is reloaded, other paths are folders of the folder list cache or of a file index.
+app_state file_changed_on_disk(app_state state, const std::string& path)
+  {
+  auto watched = g_watched_files.find(path);
+  if (watched == g_watched_files.end() || !watched->second)
+    {
+    folder_changed(path);
+    file_index_folder_changed(path);
+    return state;
+    }
+  std::vector<int64_t> file_ids;
+  for (const auto& w : state.windows)
+    {
+    if (!w.is_command_window && !w.piped && remove_quotes_from_path(state.file_state.files[w.file_id].filename) == path)
+      file_ids.push_back(w.file_id);
+    }
+  for (auto file_id : file_ids)
+    state = start_reload(std::move(state), file_id);
+  return state;
+  }
+
+// number of rows from the top of window w to the last row of f, counted as in check_boundaries
+int64_t rows_to_end(const window& w, const jamlib::file& f)
+  {
+  const int64_t size = (int64_t)f.content.size();
+  if (w.word_wrap)
+    {
+    const int64_t last_line = line_begin(f.content, size);
+    return wrapped_rows_before(f.content, last_line, w.cols, gp_settings->tab_space) + wrapped_row_in_line(f.content, size, w.cols, gp_settings->tab_space) - get_top_wrapped_row(w, f);
+    }
+  return line_number(f.content, size) - line_number(f.content, w.file_pos);
+  }
+
+/*
+Splices the changed text of a reload into the content of its file, as one step that undo can take back. Dot and the
+first visible line of the window stay on the same text, except in a followed file whose last line was shown: that
+window scrolls along with the appended text. If the file was changed or changed on disk again in the meantime,
+it is compared again.
+*/
+app_state finish_reload(app_state state, const async_message& m)
+  {
+  auto it = g_background_reloads.find(m.job_id);
+  if (it == g_background_reloads.end())
+    return state;
+  const background_reload br = std::move(it->second);
+  g_background_reloads.erase(it);
+  if (br.file_id >= (int64_t)state.file_state.files.size() || br.file_id >= (int64_t)state.file_id_to_window_id.size())
+    return state;
+  const uint32_t window_id = state.file_id_to_window_id[br.file_id];
+  if (window_id >= state.windows.size() || state.windows[window_id].file_id != br.file_id || state.file_state.files[br.file_id].filename != br.filename)
+    return state; // the window was closed
+  if (!m.str.empty())
+    return add_error_text(std::move(state), m.str);
+  auto& f = state.file_state.files[br.file_id];
+  if (br.again || !shares_all_nodes(f.content, br.content))
+    return start_reload(std::move(state), br.file_id);
+  g_reload_conflicts.erase(f.filename);
+  auto followed = g_followed_files.find(br.file_id);
+  if (!br.follow)
+    followed = g_followed_files.end(); // Follow was given while the whole file was being compared
+  if (followed != g_followed_files.end())
+    {
+    followed->second.offset = m.file_pos;
+    followed->second.version = m.version;
+    }
+  const int64_t p1 = m.dot.p1;
+  const int64_t p2 = m.dot.p2;
+  const int64_t inserted = (int64_t)m.content->size();
+  const std::string path = remove_quotes_from_path(f.filename);
+  if (p1 == p2 && inserted == 0)
+    {
+    if (followed != g_followed_files.end())
+      followed->second.content = f.content;
+    g_compared_files[path] = compared_file{ f.content, m.version };
+    return state;
+    }
+  auto& w = state.windows[window_id];
+  const bool scroll_along = followed != g_followed_files.end() && rows_to_end(w, f) < w.rows;
+  jamlib::snapshot ss;
+  ss.content = f.content;
+  ss.dot = f.dot;
+  ss.modification_mask = 1; // after undo the content differs from the file on disk
+  ss.enc = f.enc;
+  jamlib::buffer content = f.content;
+  if (p2 > p1)
+    content = content.erase((uint32_t)p1, (uint32_t)p2);
+  if (inserted > 0)
+    content = content.insert((uint32_t)p1, *m.content);
+  f.content = content;
+  f.enc = m.enc;
+  f.modification_mask = 0;
+  auto shift = [&](int64_t pos)
+    {
+    if (pos < p1)
+      return pos;
+    if (pos >= p2)
+      return pos + inserted - (p2 - p1);
+    return p1;
+    };
+  f.dot.r.p1 = shift(f.dot.r.p1);
+  f.dot.r.p2 = shift(f.dot.r.p2);
+  jamlib::append_snapshot(f, ss);
+  f.undo_redo_index = f.history.size();
+  if (followed != g_followed_files.end())
+    followed->second.content = f.content;
+  g_compared_files[path] = compared_file{ f.content, m.version };
+  const int64_t file_pos = get_line_begin(f, shift(w.file_pos));
+  if (file_pos != w.file_pos)
+    {
+    w.file_pos = file_pos;
+    w.wordwrap_row = 0;
+    }
+  const int64_t rows_below = scroll_along ? rows_to_end(w, f) - w.rows + 1 : 0;
+  if (rows_below > 0)
+    {
+    if (w.word_wrap)
+      set_top_wrapped_row(w, f, get_top_wrapped_row(w, f) + rows_below);
+    else
+      w.file_pos = line_position(f.content, line_number(f.content, w.file_pos) + rows_below);
+    }
+  return state;
+  }
+
+engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s), watcher([this](const std::string& path) { post_watched_path_change(messages, path); }), pending_restores(0), reported_drops(0), startup_time(false), scroll_benchmark(false)
   {
   //gp_cursor = init_system_cursor(arrow);
   //SDL_SetCursor(gp_cursor);
+  startup_tic = std::chrono::steady_clock::now();
+  for (int j = 1; j < argc; ++j)
+    {
+    if (std::string(argv[j]) == "--startup-time")
+      startup_time = true;
+    if (std::string(argv[j]) == "--scroll-benchmark")
+      scroll_benchmark = true;
+    }
 
   TTF_SizeText(pdc_ttffont, "W", &font_width, &font_height);
   gp_settings = &sett;
+  gp_messages = &messages;
+  gp_pool = &pool;
+  scan_tokens_in_background(&pool, &messages);
+  cache_folder_lists(&watcher);
+  find_files_in_background(&pool, &messages, &watcher);
+  jamlib::set_undo_settings(jamlib::undo_settings{ sett.undo_history_mb > 0 ? (uint64_t)sett.undo_history_mb * 1024 * 1024 : 0, true });
   start_color();
   use_default_colors();
   nodelay(stdscr, TRUE);
@@ -422,51 +1194,18 @@ engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
 
   // load previously saved state
   //if (argc < 2)
-  state = load_from_file(get_file_in_executable_path("temp.txt"));
+  std::string session_filename = get_file_in_executable_path("session.bin");
+  if (!JAM::file_exists(session_filename))
+    session_filename = get_file_in_executable_path("temp.txt"); // session file of older versions of jam
+  state = load_from_file(session_filename);
+  std::vector<recovered_file> unopened_recovered_files;
+  std::vector<std::string> recovery_messages;
+  state = recover_unsaved_edits(std::move(state), unopened_recovered_files, recovery_messages);
   uint32_t sz = (uint32_t)state.windows.size();
   auto active_file = state.file_state.active_file;
+  state = restore_session(std::move(state), messages, pool, pending_restores);
   for (uint32_t j = 0; j < sz; ++j)
     {
-    if (!state.windows[j].is_command_window && !state.windows[j].piped) // load files or folders
-      {
-      uint32_t file_id = state.windows[j].file_id;
-      std::string filename = remove_quotes_from_path(state.file_state.files[file_id].filename);
-      if (JAM::file_exists(filename))
-        {
-        std::stringstream load_file_command;
-        load_file_command << "r " << state.file_state.files[file_id].filename;
-        auto d = state.file_state.files[file_id].dot;
-        state.file_state.active_file = file_id;
-        state.file_state = *jamlib::handle_command(state.file_state, load_file_command.str());
-        state.file_state.files[file_id].modification_mask = 0;
-        state.file_state.files[file_id].history = immutable::vector<jamlib::snapshot, false>();
-        state.file_state.files[file_id].undo_redo_index = 0;
-        if (d.r.p1 > state.file_state.files[file_id].content.size())
-          d.r.p1 = state.file_state.files[file_id].content.size();
-        if (d.r.p2 > state.file_state.files[file_id].content.size())
-          d.r.p2 = state.file_state.files[file_id].content.size();
-        state.file_state.files[file_id].dot = d;
-        if (state.windows[j].file_pos > state.file_state.files[file_id].content.size())
-          state.windows[j].file_pos = 0;
-        state.file_state.files[file_id].filename = flip_backslash_to_slash_in_filename(cleanup(filename));
-        }
-      else if (JAM::is_directory(filename))
-        {
-        state.file_state.files[file_id].content = get_folder_list(filename);
-        auto d = state.file_state.files[file_id].dot;
-        if (d.r.p1 > state.file_state.files[file_id].content.size())
-          d.r.p1 = state.file_state.files[file_id].content.size();
-        if (d.r.p2 > state.file_state.files[file_id].content.size())
-          d.r.p2 = state.file_state.files[file_id].content.size();
-        state.file_state.files[file_id].dot = d;
-        if (state.windows[j].file_pos > state.file_state.files[file_id].content.size())
-          state.windows[j].file_pos = 0;
-        }
-
-      if (!has_valid_file_pos(state.windows[j], state))
-        state.windows[j].file_pos = 0;
-
-      }
     if (state.windows[j].piped)
       {
       uint32_t file_id = state.windows[j].file_id;
@@ -475,16 +1214,17 @@ engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
       }
     }
   state.file_state.active_file = active_file;
-  for (auto& f : state.file_state.files)
+  for (size_t j = 0; j < state.file_state.files.size(); ++j)
     {
+    const auto& f = std::as_const(state.file_state.files)[j]; // reading through a non-const reference would copy each file that is shared with another state
     if (f.dot.r.p1 > f.content.size() || f.dot.r.p2 > f.content.size())
       {
-      f.dot.r.p1 = 0;
-      f.dot.r.p2 = 0;
+      state.file_state.files[j].dot.r.p1 = 0;
+      state.file_state.files[j].dot.r.p2 = 0;
       }
     }
 
-  if (state.file_state.files.empty()) // if temp.txt was an invalid file then initialise
+  if (state.file_state.files.empty()) // if the session file was invalid then initialise
     {
     state.file_state.active_file = 0;
     state.file_state.files.emplace_back();
@@ -504,12 +1244,14 @@ engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
 
   for (int j = 1; j < argc; ++j) // open any files/folders that were given as argument, if not yet opened
     {
+    if (std::string(argv[j]) == "--startup-time" || std::string(argv[j]) == "--scroll-benchmark")
+      continue;
     std::string filename = cleanup(argv[j]);
     if (JAM::is_directory(filename))
       filename = cleanup_foldername(filename);
     filename = flip_backslash_to_slash_in_filename(filename);
     bool already_open = false;
-    for (const auto& f : state.file_state.files)
+    for (const auto& f : std::as_const(state.file_state.files))
       {
       if (f.filename == filename)
         {
@@ -536,9 +1278,30 @@ engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
       }
     }
 
+  for (const auto& rf : unopened_recovered_files)
+    {
+    const std::string filename = remove_quotes_from_path(rf.filename);
+    if (!JAM::file_exists(filename))
+      {
+      recovery_messages.push_back("Could not open " + filename + " to restore its unsaved edits");
+      continue;
+      }
+    if (state.g.columns.empty() || state.g.columns.front().items.empty())
+      state = *load_file(filename, state, -1);
+    else
+      {
+      state.file_state.active_file = state.windows[state.window_pairs[state.g.columns.front().items.back().window_pair_id].window_id].file_id;
+      state = *load_file(filename, state, state.file_state.active_file);
+      }
+    state = restore_unsaved_edits(std::move(state), (uint32_t)state.file_state.files.size() - 1, rf);
+    }
+
   state = check_tags_at_startup(state);
   state = set_fileids(state);
 
+  for (const auto& message : recovery_messages)
+    state = add_error_text(std::move(state), message);
+
   state.w = w;
   state.h = h;
 
@@ -569,7 +1332,15 @@ engine::engine(int w, int h, int argc, char** argv, const settings& s) : sett(s)
 
 engine::~engine()
   {
-  save_to_file(get_file_in_executable_path("temp.txt"), state);
+  state = wait_for_background_saves(std::move(state));
+  cache_folder_lists(nullptr);
+  find_files_in_background(nullptr, nullptr, nullptr);
+  g_file_finders.clear();
+  g_watched_files.clear(); // the watcher goes away with the engine
+  g_followed_files.clear();
+  state = keep_positions_of_background_reads(std::move(state));
+  save_to_file(get_file_in_executable_path("session.bin"), state, sett.save_undo_history);
+  unsaved_edits.clear(); // jam was closed on purpose: the edits that were not saved are not needed anymore
   for (auto& w : state.windows)
     w.kill_pipe();
   //SDL_FreeCursor(gp_cursor);
@@ -697,32 +1468,12 @@ int64_t get_line_length(jamlib::file f, int64_t pos);
 
 int64_t get_begin_of_line(jamlib::file f)
   {
-  int64_t pos = f.dot.r.p1;
-  auto it = f.content.rbegin() + (f.content.size() - pos);
-  auto it_end = f.content.rend();
-  for (; it != it_end; ++it, --pos)
-    {
-    if (*it == '\n')
-      return pos;
-    }
-  return 0;
+  return line_begin(f.content, f.dot.r.p1);
   }
 
-int64_t get_end_of_line(jamlib::file f)
-  {
-  int64_t pos = f.dot.r.p1;
-  auto it = f.content.begin() + pos;
-  auto it_end = f.content.end();
-  if (it == it_end)
-    return pos;
-  for (; it != it_end; ++it, ++pos)
-    {
-    if (*it == '\n')
-      return pos;
-    }
-  if (pos == f.content.size())
-    return pos;
-  return pos - 1;
+int64_t get_end_of_line(jamlib::file f)
+  {
+  return line_end(f.content, f.dot.r.p1);
   }
 
 int64_t get_line_begin(jamlib::file f, int64_t pos)
@@ -757,9 +1508,7 @@ bool on_last_line(jamlib::file f, int64_t pos)
 
 app_state draw(app_state state, const settings& sett)
   {
-  erase();
-
-  state.windows = draw(state.g, state.window_pairs, state.windows, state.file_state, sett);
+  state.windows = draw(state.g, state.window_pairs, std::move(state.windows), state.file_state, sett);
 
   curs_set(0);
   refresh();
@@ -767,203 +1516,61 @@ app_state draw(app_state state, const settings& sett)
   return state;
   }
 
+// the wrapped row of the file that is shown at the top of word wrapped window w
+int64_t get_top_wrapped_row(const window& w, const jamlib::file& f)
+  {
+  return wrapped_rows_before(f.content, w.file_pos, w.cols, gp_settings->tab_space) + w.wordwrap_row;
+  }
+
+// scrolls word wrapped window w such that wrapped row row of the file is shown at its top
+void set_top_wrapped_row(window& w, const jamlib::file& f, int64_t row)
+  {
+  w.file_pos = line_of_wrapped_row(f.content, row, w.cols, gp_settings->tab_space);
+  w.wordwrap_row = row;
+  }
+
 app_state check_boundaries(app_state state, bool word_wrap)
   {
   assert(has_valid_file_pos(state));
   auto& f = state.file_state.files[state.file_state.active_file];
+  auto& w = state.windows[state.file_id_to_window_id[state.file_state.active_file]];
 
-  if (state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col < 0)
-    state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col = 0;
-  if (state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos < 0)
-    state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos = 0;
+  if (w.file_col < 0)
+    w.file_col = 0;
+  if (w.file_pos < 0)
+    w.file_pos = 0;
 
   if (word_wrap)
     {
-    state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col = 0;
-    auto r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-
-    /*
-    while (f.dot.r.p1 >= r.p2 && f.dot.r.p1 < f.content.size())
-      {
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = 0;
-      auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos);
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos += le+1;
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      }
-      */
-
-
-    while (f.dot.r.p1 >= r.p2 && f.dot.r.p1 < f.content.size())
-      {
-      auto it = f.content.begin() + r.p2;
-      auto it_end = f.content.end();
-      bool last_line = false;
-      for (; it != it_end; ++it, ++r.p2)
-        {
-        if (f.dot.r.p1 <= r.p2)
-          last_line = true;
-        if (*it == '\n')
-          {
-          auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos);
-          state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos += le + 1;
-          assert(has_valid_file_pos(state));
-          if (last_line)
-            break;
-          }
-        }
-      if (it == it_end)
-        {
-        auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos);
-        state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos += le + 1;
-        assert(has_valid_file_pos(state));
-        }
-
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = 0;
-
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      assert(r.p2 > f.dot.r.p1);
-      }
-
-    /*
-    while (f.dot.r.p1 < r.p1)
-      {
-      auto old_r = r;
-      auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos - 1);
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos -= le+1;
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      int64_t line_length = old_r.p1 - r.p1;
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = line_length / (state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols - 1);
-      }
-      */
-
-    while (f.dot.r.p1 < r.p1)
-      {
-      auto it = f.content.rbegin() + (f.content.size() - r.p1);
-      auto it_end = f.content.rend();
-      int64_t last_line_pos = r.p1;
-
-      for (; it != it_end; ++it, --r.p1)
-        {
-        if (f.dot.r.p1 >= r.p1)
-          break;
-        if (*it == '\n')
-          {
-          last_line_pos = r.p1;
-          auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos - 1);
-          state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos -= le + 1;
-          assert(has_valid_file_pos(state));
-          }
-        }
-      while (it != it_end && *it != '\n')
-        {
-        ++it;
-        --r.p1;
-        }
-      int64_t line_length = last_line_pos - r.p1;
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = line_length / (state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols - 1);
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      assert(r.p1 <= f.dot.r.p1);
-      }
-
-    auto it = f.content.begin() + r.p1;
-    auto it_end = f.content.begin() + f.dot.r.p1;
-    int64_t row = 0;
-    int64_t col = 0;
-    for (; it != it_end; ++it)
-      {
-      if (*it == '\n')
-        {
-        col = 0;
-        ++row;
-        }
-      else
-        {
-        ++col;
-        if (col >= state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols - 1)
-          {
-          col = 0;
-          ++row;
-          }
-        }
-      }
-    if (row - state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row >= state.windows[state.file_id_to_window_id[state.file_state.active_file]].rows)
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = row - state.windows[state.file_id_to_window_id[state.file_state.active_file]].rows + 1;
-    if (row - state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row < 0)
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = row;
-
+    w.file_col = 0;
+    const int64_t dot_row = wrapped_rows_before(f.content, f.dot.r.p1, w.cols, gp_settings->tab_space) + wrapped_row_in_line(f.content, f.dot.r.p1, w.cols, gp_settings->tab_space);
+    const int64_t top = get_top_wrapped_row(w, f);
+    if (dot_row < top)
+      set_top_wrapped_row(w, f, dot_row);
+    else if (dot_row - top >= w.rows)
+      set_top_wrapped_row(w, f, dot_row - w.rows + 1);
     }
   else
     {
-    state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = 0;
+    w.wordwrap_row = 0;
     int64_t b = get_begin_of_line(f);
     int64_t e = get_end_of_line(f);
-    int64_t pos = b + state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col;
+    int64_t pos = b + w.file_col;
     if (pos > e)
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col = f.dot.r.p1 - b;
-    else if (f.dot.r.p1 - pos >= state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols)
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col = (f.dot.r.p1 - b) - state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols + 1;
+      w.file_col = f.dot.r.p1 - b;
+    else if (f.dot.r.p1 - pos >= w.cols)
+      w.file_col = (f.dot.r.p1 - b) - w.cols + 1;
     else if (pos - f.dot.r.p1 > 0)
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_col = f.dot.r.p1 - b;
-
-    auto r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
+      w.file_col = f.dot.r.p1 - b;
 
-    while (f.dot.r.p1 >= r.p2 && f.dot.r.p1 < f.content.size())
-      {
-      auto it = f.content.begin() + r.p2;
-      auto it_end = f.content.end();
-      bool last_line = false;
-      for (; it != it_end; ++it, ++r.p2)
-        {
-        if (f.dot.r.p1 <= r.p2)
-          last_line = true;
-        if (*it == '\n')
-          {
-          auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos);
-          state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos += le + 1;
-          assert(has_valid_file_pos(state));
-          if (last_line)
-            break;
-          }
-        }
-      if (it == it_end)
-        {
-        auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos);
-        state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos += le + 1;
-        assert(has_valid_file_pos(state));
-        }
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = 0;
-
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      assert(r.p2 > f.dot.r.p1);
-      }
-    while (f.dot.r.p1 < r.p1)
-      {
-      auto it = f.content.rbegin() + (f.content.size() - r.p1);
-      auto it_end = f.content.rend();
-      //int64_t last_line_pos = r.p1;
-      for (; it != it_end; ++it, --r.p1)
-        {
-        if (f.dot.r.p1 >= r.p1)
-          break;
-        if (*it == '\n')
-          {
-          //last_line_pos = r.p1;
-          auto le = get_line_length(f, state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos - 1);
-          state.windows[state.file_id_to_window_id[state.file_state.active_file]].file_pos -= le + 1;
-          assert(has_valid_file_pos(state));
-          }
-        }
-      //while (it != it_end && *it != '\n')
-      //  {
-      //  ++it;
-      //  --r.p1;
-      //  }
-      //int64_t line_length = last_line_pos - r.p1;
-      state.windows[state.file_id_to_window_id[state.file_state.active_file]].wordwrap_row = 0;// line_length / (state.windows[state.file_id_to_window_id[state.file_state.active_file]].cols - 1);
-      r = get_window_range(state.windows[state.file_id_to_window_id[state.file_state.active_file]], state.file_state);
-      assert(r.p1 <= f.dot.r.p1);
-      }
+    const int64_t dot_line = line_number(f.content, f.dot.r.p1);
+    const int64_t top_line = line_number(f.content, w.file_pos);
+    if (dot_line < top_line)
+      w.file_pos = b;
+    else if (dot_line - top_line >= w.rows)
+      w.file_pos = line_position(f.content, dot_line - w.rows + 1);
     }
+  assert(has_valid_file_pos(state));
 
   // dealing with selection here (i.e. left or right shift is pressed)
   if (keyb_data.selecting != 0 && keyb_data.selection_id == state.file_state.active_file)
@@ -985,7 +1592,7 @@ app_state move_right(app_state state)
     f.dot.r.p2 = f.content.size();
   f.dot.r.p1 = f.dot.r.p2;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state move_left(app_state state)
@@ -999,7 +1606,7 @@ app_state move_left(app_state state)
     f.dot.r.p1 = 0;
   f.dot.r.p2 = f.dot.r.p1;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state move_to_begin_of_line(app_state state)
@@ -1012,7 +1619,7 @@ app_state move_to_begin_of_line(app_state state)
   f.dot.r.p1 = p1;
   f.dot.r.p2 = p1;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state move_to_end_of_line(app_state state)
@@ -1029,7 +1636,7 @@ app_state move_to_end_of_line(app_state state)
   f.dot.r.p1 = p1;
   f.dot.r.p2 = p1;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state text_input(app_state state, const char* txt);
@@ -1088,7 +1695,7 @@ app_state move_down(app_state state)
         {
         if (ep == f.content.size() - 1)
           {
-          return check_boundaries(state, word_wrap);
+          return check_boundaries(std::move(state), word_wrap);
           }
         int64_t empty_space = w.cols - (line_length % (w.cols - 1));
         new_pos -= empty_space - 2;
@@ -1107,7 +1714,7 @@ app_state move_down(app_state state)
         new_pos = f.content.size();
       f.dot.r.p1 = new_pos;
       f.dot.r.p2 = new_pos;
-      return check_boundaries(state, word_wrap);
+      return check_boundaries(std::move(state), word_wrap);
       }
     }
 
@@ -1133,7 +1740,7 @@ app_state move_down(app_state state)
     f.dot.r.p2 += col;
     }
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state move_up(app_state state)
@@ -1176,7 +1783,7 @@ app_state move_up(app_state state)
         {
         if (bp == 0)
           {
-          return check_boundaries(state, word_wrap);
+          return check_boundaries(std::move(state), word_wrap);
           }
         f.dot.r.p1 = bp - 1;
         f.dot.r.p2 = bp - 1;
@@ -1192,12 +1799,12 @@ app_state move_up(app_state state)
         new_pos = 0;
       f.dot.r.p1 = new_pos;
       f.dot.r.p2 = new_pos;
-      return check_boundaries(state, word_wrap);
+      return check_boundaries(std::move(state), word_wrap);
       }
     }
 
   if (bp == 0)
-    return check_boundaries(state, word_wrap);
+    return check_boundaries(std::move(state), word_wrap);
 
   int64_t col = p1 - bp;
   if (bp > 0)
@@ -1224,7 +1831,7 @@ app_state move_up(app_state state)
     f.dot.r.p2 = bp + col;
     }
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 int64_t get_line_length(jamlib::file f, int64_t pos)
@@ -1254,34 +1861,9 @@ app_state move_page_up_without_cursor(app_state state, int64_t steps)
   auto& w = state.windows[state.file_id_to_window_id[state.file_state.active_file]];
 
   auto& f = state.file_state.files[state.file_state.active_file];
-  int64_t pos = w.file_pos;
 
   if (word_wrap)
-    {
-
-    w.wordwrap_row -= steps;
-
-    while (w.wordwrap_row < 0)
-      {
-      if (w.file_pos <= 0)
-        {
-        w.wordwrap_row = 0;
-        break;
-        }
-      int64_t le = pos ? get_line_length(f, pos - 1) : 0;
-      w.file_pos -= le + 1;
-      assert(has_valid_file_pos(state));
-      w.wordwrap_row += (le / (w.cols - 1)) + 1;
-      if (pos <= 0)
-        break;
-      pos = get_line_begin(f, pos - 1);
-      if (pos < 0)
-        pos = 0;
-      }
-
-    if (w.wordwrap_row < 0)
-      w.wordwrap_row = 0;
-    }
+    set_top_wrapped_row(w, f, std::max<int64_t>(get_top_wrapped_row(w, f) - steps, 0));
   else
     {
     auto it = f.content.rbegin() + (f.content.size() - w.file_pos);
@@ -1323,6 +1905,17 @@ app_state move_page_down_without_cursor(app_state state, int64_t steps)
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
   auto& w = state.windows[state.file_id_to_window_id[state.file_state.active_file]];
 
+  if (word_wrap)
+    {
+    const auto& f = state.file_state.files[state.file_state.active_file];
+    const int64_t top = get_top_wrapped_row(w, f);
+    const int64_t last = number_of_wrapped_rows(f.content, w.cols, gp_settings->tab_space) - 1;
+    if (last - top < w.rows) // we reached the end of the file
+      return state;
+    set_top_wrapped_row(w, f, std::min<int64_t>(top + steps, last));
+    return state;
+    }
+
   std::stringstream str;
   str << "#" << w.file_pos << ", #" << w.file_pos << "+" << w.rows + w.wordwrap_row;
   auto fs = *jamlib::handle_command(state.file_state, str.str());
@@ -1330,124 +1923,32 @@ app_state move_page_down_without_cursor(app_state state, int64_t steps)
 
   if (f1.dot.r.p2 == f1.content.size()) // at the end of the file
     {
-    if (word_wrap)
-      {
-      int64_t p1 = f1.dot.r.p1;
-      int64_t p2 = f1.dot.r.p2;
-
-      auto it = f1.content.begin() + p1;
-      auto it_end = f1.content.begin() + p2;
-
-      int64_t row = 0;
-      int64_t col = 0;
-
-      int64_t pos = p1;
-      for (; it != it_end; ++it, ++pos)
-        {
-        if (*it == '\n')
-          {
-          col = 0;
-          ++row;
-          }
-        else
-          {
-          ++col;
-          if (col >= w.cols - 1)
-            {
-            col = 0;
-            ++row;
-            }
-          }
-        if (row - w.wordwrap_row >= w.rows) // we didn't reach the end of the file yet
-          break;
-        }
-      if (row - w.wordwrap_row < w.rows) // we reached the end of the file
-        return state;
-      }
-    else
-      {
-      std::stringstream str2;
-      str2 << "$-" << w.rows;
-      auto fs2 = *jamlib::handle_command(state.file_state, str2.str());
-      auto f2 = fs2.files[state.file_state.active_file];
-      if (w.file_pos >= f2.dot.r.p1) // end of file
-        return state;
-      }
+    std::stringstream str2;
+    str2 << "$-" << w.rows;
+    auto fs2 = *jamlib::handle_command(state.file_state, str2.str());
+    auto f2 = fs2.files[state.file_state.active_file];
+    if (w.file_pos >= f2.dot.r.p1) // end of file
+      return state;
     }
 
-  if (word_wrap)
-    {
-    int64_t p1 = f1.dot.r.p1;
-    int64_t p2 = f1.dot.r.p2;
-
-    auto it = f1.content.begin() + p1;
-    auto it_end = f1.content.begin() + p2;
-
-    int64_t last_row = 0;
-    int64_t row = 0;
-    int64_t col = 0;
-    int64_t nr_of_wordwraps_passed = 0;
-
-    w.wordwrap_row += steps;
+  auto it = f1.content.begin() + w.file_pos;
+  auto it_end = f1.content.end();
 
-    for (; it != it_end; ++it)
-      {
-      if (*it == '\n')
-        {
-        col = 0;
-        ++row;
-        auto wrapped_lines = row - last_row;
-        if (wrapped_lines <= w.wordwrap_row)
-          {
-          auto le = get_line_length(f1, w.file_pos);
-          w.file_pos += le + 1;
-          assert(has_valid_file_pos(state));
-          w.wordwrap_row -= wrapped_lines;
-          }
-        else
-          break;
-        last_row = row;
-        }
-      else
-        {
-        ++col;
-        if (col >= w.cols - 1)
-          {
-          col = 0;
-          ++row;
-          ++nr_of_wordwraps_passed;
-          }
-        }
-      }
+  int64_t file_pos_increases = 0;
 
-    if (w.wordwrap_row > nr_of_wordwraps_passed)
-      w.wordwrap_row = nr_of_wordwraps_passed;
+  int st = steps;
 
-    //state.windows[state.file_id_to_window_id[state.file_state.active_file]] = w;
-    }
-  else
+  while (it != it_end && st > 0)
     {
-    auto it = f1.content.begin() + w.file_pos;
-    auto it_end = f1.content.end();
-
-    int64_t file_pos_increases = 0;
-
-    int st = steps;
-
-    while (it != it_end && st > 0)
+    if (*it == '\n')
       {
-      if (*it == '\n')
-        {
-        --st;
-        }
-      ++it;
-      ++file_pos_increases;
+      --st;
       }
-    w.file_pos += file_pos_increases;
-    //state.windows[state.file_id_to_window_id[state.file_state.active_file]] = w;
+    ++it;
+    ++file_pos_increases;
     }
+  w.file_pos += file_pos_increases;
   return state;
-
   }
 
 app_state move_cursor_page_up(app_state state)
@@ -1461,42 +1962,7 @@ app_state move_cursor_page_up(app_state state)
   auto& f = state.file_state.files[state.file_state.active_file];
 
   if (word_wrap)
-    {
-
-    w.wordwrap_row -= steps;
-    /*
-    while (w.wordwrap_row < 0)
-      {
-      --w.file_row;
-      std::stringstream str;
-      str << w.file_row + 1;
-      auto fs = *jamlib::handle_command(state.file_state, str.str());
-      w.wordwrap_row += get_number_of_wrapped_lines(fs.files[fs.active_file], fs.files[fs.active_file].dot.r.p1, w.cols);
-      }
-      */
-
-    int64_t pos = w.file_pos;
-    while (w.wordwrap_row < 0)
-      {
-      if (w.file_pos <= 0)
-        {
-        w.wordwrap_row = 0;
-        break;
-        }
-      int64_t le = pos ? get_line_length(f, pos - 1) : 0;
-      w.file_pos -= le + 1;
-      assert(has_valid_file_pos(state));
-      w.wordwrap_row += (le / (w.cols - 1)) + 1;
-      if (pos <= 0)
-        break;
-      pos = get_line_begin(f, pos - 1);
-      if (pos < 0)
-        pos = 0;
-      }
-
-    if (w.wordwrap_row < 0)
-      w.wordwrap_row = 0;
-    }
+    set_top_wrapped_row(w, f, std::max<int64_t>(get_top_wrapped_row(w, f) - steps, 0));
   else
     {
     auto it = f.content.rbegin() + (f.content.size() - w.file_pos);
@@ -1525,13 +1991,13 @@ app_state move_cursor_page_up(app_state state)
 
 
   if (steps < 1)
-    return check_boundaries(state, word_wrap);
+    return check_boundaries(std::move(state), word_wrap);
 
   int64_t p1 = f.dot.r.p1;
   int64_t bp = get_begin_of_line(f);
   if (bp == 0 && !word_wrap)
     {
-    return check_boundaries(state, word_wrap);
+    return check_boundaries(std::move(state), word_wrap);
     }
   int64_t col = p1 - bp;
   if (word_wrap)
@@ -1605,7 +2071,7 @@ app_state move_cursor_page_up(app_state state)
       f.dot.r.p2 = bp + col;
       }
     }
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state move_cursor_page_down(app_state state)
@@ -1615,116 +2081,37 @@ app_state move_cursor_page_down(app_state state)
     return state;
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
   auto& w = state.windows[state.file_id_to_window_id[state.file_state.active_file]];
-  auto steps = state.windows[state.file_id_to_window_id[state.file_state.active_file]].rows;
-  auto& f = state.file_state.files[state.file_state.active_file];
-
-
-  std::stringstream str;
-  str << "#" << w.file_pos << ", #" << w.file_pos << "+" << w.rows + w.wordwrap_row;
-  auto fs = *jamlib::handle_command(state.file_state, str.str());
-
-  auto f1 = fs.files[state.file_state.active_file];
-
-  if (f1.dot.r.p2 == f1.content.size()) // at the end of the file
-    {
-    if (word_wrap)
-      {
-      int64_t p1 = f1.dot.r.p1;
-      int64_t p2 = f1.dot.r.p2;
-
-      auto it = f1.content.begin() + p1;
-      auto it_end = f1.content.begin() + p2;
-
-      int64_t row = 0;
-      int64_t col = 0;
-
-      int64_t pos = p1;
-      for (; it != it_end; ++it, ++pos)
-        {
-        if (*it == '\n')
-          {
-          col = 0;
-          ++row;
-          }
-        else
-          {
-          ++col;
-          if (col >= w.cols - 1)
-            {
-            col = 0;
-            ++row;
-            }
-          }
-        if (row - w.wordwrap_row >= w.rows) // we didn't reach the end of the file yet
-          break;
-        }
-      if (row - w.wordwrap_row < w.rows) // we reached the end of the file
-        {
-        state.file_state.files[state.file_state.active_file].dot.r.p1 = state.file_state.files[state.file_state.active_file].dot.r.p2 = state.file_state.files[state.file_state.active_file].content.size();
-        return state;
-        }
-      }
-    else
-      {
-      std::stringstream str2;
-      str2 << "$-" << w.rows;
-      auto fs2 = *jamlib::handle_command(state.file_state, str2.str());
-      auto f2 = fs2.files[state.file_state.active_file];
-      if (w.file_pos >= f2.dot.r.p1) // end of file
-        {
-        state.file_state.files[state.file_state.active_file].dot.r.p1 = state.file_state.files[state.file_state.active_file].dot.r.p2 = state.file_state.files[state.file_state.active_file].content.size();
-        return state;
-        }
-      }
-    }
-
-
-  if (word_wrap)
-    {
-
-    int64_t p1 = f1.dot.r.p1;
-    int64_t p2 = f1.dot.r.p2;
-
-    auto it = f1.content.begin() + p1;
-    auto it_end = f1.content.begin() + p2;
-
-    int64_t last_row = 0;
-    int64_t row = 0;
-    int64_t col = 0;
-
-    w.wordwrap_row += steps - 1;
-
-    for (; it != it_end; ++it)
-      {
-      if (*it == '\n')
-        {
-        col = 0;
-        ++row;
-        auto wrapped_lines = row - last_row;
-        if (wrapped_lines <= w.wordwrap_row)
-          {
-          auto le = get_line_length(f, w.file_pos);
-          w.file_pos += le + 1;
-          assert(has_valid_file_pos(state));
-          w.wordwrap_row -= wrapped_lines;
-          }
-        else
-          break;
-        last_row = row;
-        }
-      else
-        {
-        ++col;
-        if (col >= w.cols - 1)
-          {
-          col = 0;
-          ++row;
-          }
-        }
+  auto steps = state.windows[state.file_id_to_window_id[state.file_state.active_file]].rows;
+  auto& f = state.file_state.files[state.file_state.active_file];
+
+
+  if (word_wrap)
+    {
+    const int64_t top = get_top_wrapped_row(w, f);
+    if (number_of_wrapped_rows(f.content, w.cols, gp_settings->tab_space) - 1 - top < w.rows) // we reached the end of the file
+      {
+      f.dot.r.p1 = f.dot.r.p2 = f.content.size();
+      return state;
       }
+    set_top_wrapped_row(w, f, top + steps - 1);
     }
-  else // not wordwrap
+  else
     {
+    std::stringstream str;
+    str << "#" << w.file_pos << ", #" << w.file_pos << "+" << w.rows + w.wordwrap_row;
+    auto fs = *jamlib::handle_command(state.file_state, str.str());
+    if (fs.files[state.file_state.active_file].dot.r.p2 == f.content.size()) // at the end of the file
+      {
+      std::stringstream str2;
+      str2 << "$-" << w.rows;
+      auto fs2 = *jamlib::handle_command(state.file_state, str2.str());
+      if (w.file_pos >= fs2.files[state.file_state.active_file].dot.r.p1) // end of file
+        {
+        f.dot.r.p1 = f.dot.r.p2 = f.content.size();
+        return state;
+        }
+      }
+
     auto it = f.content.begin() + w.file_pos;
     auto it_end = f.content.end();
 
@@ -1745,7 +2132,7 @@ app_state move_cursor_page_down(app_state state)
     }
 
   if (steps < 1)
-    return check_boundaries(state, word_wrap);
+    return check_boundaries(std::move(state), word_wrap);
 
   int64_t p1 = f.dot.r.p1;
   int64_t col = p1 - get_begin_of_line(f);
@@ -1818,7 +2205,7 @@ app_state move_cursor_page_down(app_state state)
       }
     }
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 void invalidate_column_item(app_state state, uint64_t c, uint64_t ci)
@@ -1864,7 +2251,7 @@ app_state move_column(app_state state, uint64_t c, int x, int y)
         --x;
       column.left = x / double(icols);
       state.g.columns[c - 1].right = column.left;
-      return resize(state);
+      return resize(std::move(state));
       }
     }
   else // left > x
@@ -1880,7 +2267,7 @@ app_state move_column(app_state state, uint64_t c, int x, int y)
         ++x;
       column.left = x / double(icols);
       state.g.columns[c - 1].right = column.left;
-      return resize(state);
+      return resize(std::move(state));
       }
     }
   return state;
@@ -1962,7 +2349,7 @@ app_state move_window_to_other_column(app_state state, uint64_t c, uint64_t ci,
     target_column.items[new_pos].top_layer = 0.0;
     target_column.items[new_pos].bottom_layer = 1.0;
     }
-  return resize(state);
+  return resize(std::move(state));
   }
 
 app_state move_window_to_top(app_state state, uint64_t c, int64_t ci)
@@ -1977,7 +2364,7 @@ app_state move_window_to_top(app_state state, uint64_t c, int64_t ci)
   for (int i = 1; i < column.items.size() - 1; ++i)
     column.items[i].bottom_layer = column.items[i + 1].top_layer;
   column.items.back().bottom_layer = 1.0;
-  return resize(state);
+  return resize(std::move(state));
   //return *optimize_column(state, state.windows[state.window_pairs[col_item.window_pair_id].window_id].file_id);
   }
 
@@ -2008,7 +2395,7 @@ app_state move_window_up_down(app_state state, uint64_t c, int64_t ci, int x, in
       {
       int top_top = (int)std::round(column.items[0].top_layer*irows);
       if (y < top_top)
-        return move_window_to_top(state, c, ci);
+        return move_window_to_top(std::move(state), c, ci);
       }
 
     int minimum_size_for_higher_items = 0;
@@ -2088,7 +2475,7 @@ app_state move_window_up_down(app_state state, uint64_t c, int64_t ci, int x, in
       }
     */
     }
-  return resize(state);
+  return resize(std::move(state));
   }
 
 app_state enlarge_window_as_much_as_possible(app_state state, int64_t file_id)
@@ -2145,7 +2532,7 @@ app_state enlarge_window_as_much_as_possible(app_state state, int64_t file_id)
           column.items[other].top_layer = new_top;
           }
 
-        return resize(state);
+        return resize(std::move(state));
         }
       }
     }
@@ -2167,7 +2554,7 @@ app_state enlarge_window(app_state state, int64_t file_id)
         if (column.maximized)
           {
           column.maximized = false;
-          return enlarge_window_as_much_as_possible(state, file_id);
+          return enlarge_window_as_much_as_possible(std::move(state), file_id);
           }
         int icols = get_cols();
         auto& col_item = column.items[ci];
@@ -2240,7 +2627,7 @@ app_state enlarge_window(app_state state, int64_t file_id)
         int top = (int)std::round(col_item.top_layer*irows) + get_y_offset_from_top(column, right - left, state);
         SDL_WarpMouseInWindow(pdc_window, left*font_width + font_width / 2.0, top*font_height + font_height / 2.0); // move mouse on icon, so that you can keep clicking
 
-        return resize(state);
+        return resize(std::move(state));
         }
       }
     }
@@ -2276,7 +2663,7 @@ app_state maximize_window(app_state state, int64_t file_id)
           column.items[other].bottom_layer = 0.0;
           }
 
-        return resize(state);
+        return resize(std::move(state));
         }
       }
     }
@@ -2292,7 +2679,7 @@ app_state adapt_grid(app_state state, int x, int y)
   for (uint64_t c = 0; c < state.g.columns.size(); ++c)
     {
     if (state.g.columns[c].column_command_window_id == win_id)
-      return move_column(state, c, x, y);
+      return move_column(std::move(state), c, x, y);
 
     auto& column = state.g.columns[c];
 
@@ -2305,9 +2692,9 @@ app_state adapt_grid(app_state state, int x, int y)
       if (state.window_pairs[win_pair].window_id == win_id || state.window_pairs[win_pair].command_window_id == win_id)
         {
         if (x >= left - 2 && x <= right + 2)
-          return move_window_up_down(state, c, ci, x, y);
+          return move_window_up_down(std::move(state), c, ci, x, y);
         else
-          return move_window_to_other_column(state, c, ci, x, y);
+          return move_window_to_other_column(std::move(state), c, ci, x, y);
         }
       }
     }
@@ -2441,11 +2828,11 @@ std::optional<app_state> optimize_column(app_state state, int64_t id)
             c.items[j + 1].top_layer = c.items[j].bottom_layer;
           }
         c.items.back().bottom_layer = 1.0;
-        return resize(state);
+        return resize(std::move(state));
         }
       }
     }
-  return resize(state);
+  return resize(std::move(state));
   }
 
 std::optional<app_state> new_column_command(app_state state, int64_t id, const std::string&)
@@ -2474,24 +2861,23 @@ std::optional<app_state> new_column_command(app_state state, int64_t id, const s
     }
   c.right = 1.0;
   state.g.columns.push_back(c);
-  return resize(state);
+  return resize(std::move(state));
   }
 
-app_state add_error_window(app_state state)
+// Adds a window for filename, such as +Errors, that shows text jam writes to it
+app_state add_output_window(app_state state, const std::string& filename)
   {
   if (state.g.columns.empty())
-    state = *new_column_command(state, 0, "");
+    state = *new_column_command(std::move(state), 0, "");
 
   assert(!state.g.columns.empty());
 
   int icols = get_cols();
   int irows = get_lines();
 
-  std::string error_filename("+Errors");
-
   state.file_state.files.emplace_back();
   auto command_window = state.file_state.files.back().content.transient();
-  state.file_state.files.back().filename = error_filename;
+  state.file_state.files.back().filename = filename;
   auto text = make_command_text(state, state.file_state.files.size() - 1);
   for (auto ch : text)
     command_window.push_back(ch);
@@ -2506,7 +2892,7 @@ app_state add_error_window(app_state state)
   state.file_state.files.back().dot.r.p1 = 0;
   state.file_state.files.back().dot.r.p2 = 0;
   state.file_state.files.back().enc = jamlib::ENC_UTF8;
-  state.file_state.files.back().filename = error_filename;
+  state.file_state.files.back().filename = filename;
   state.file_id_to_window_id.push_back((uint32_t)state.windows.size() + 1);
 
 
@@ -2529,25 +2915,26 @@ app_state add_error_window(app_state state)
   return *optimize_column(state, state.file_state.files.size() - 1);
   }
 
-app_state add_error_text(app_state state, const std::string& errortext)
+// the id of the file of the window for filename, the window is added if there is none
+int64_t get_output_file_id(app_state& state, const std::string& filename)
   {
-  std::string error_filename("+Errors");
-  int64_t file_id = -1;
   for (const auto& w : state.windows)
     {
     if (!w.is_command_window)
       {
       const auto& f = state.file_state.files[w.file_id];
-      if (f.filename == error_filename)
-        file_id = w.file_id;
+      if (f.filename == filename)
+        return w.file_id;
       }
     }
+  state = add_output_window(std::move(state), filename);
+  return state.file_state.files.size() - 1;
+  }
 
-  if (file_id < 0)
-    {
-    state = add_error_window(state);
-    file_id = state.file_state.files.size() - 1;
-    }
+// appends text on a new line to the window for filename
+app_state add_output_text(app_state state, const std::string& filename, const std::string& text)
+  {
+  const int64_t file_id = get_output_file_id(state, filename);
   auto active = state.file_state.active_file;
 
   state.file_state.active_file = file_id;
@@ -2561,7 +2948,7 @@ app_state add_error_text(app_state state, const std::string& errortext)
     ss << resolve_jamlib_escape_characters("\n");
     added_newline = true;
     }
-  ss << resolve_jamlib_escape_characters(errortext) << "/";
+  ss << resolve_jamlib_escape_characters(text) << "/";
   state.file_state = *jamlib::handle_command(state.file_state, ss.str());
   if (added_newline)
     ++state.file_state.files[file_id].dot.r.p1;
@@ -2591,6 +2978,11 @@ app_state add_error_text(app_state state, const std::string& errortext)
   */
   }
 
+app_state add_error_text(app_state state, const std::string& errortext)
+  {
+  return add_output_text(std::move(state), "+Errors", errortext);
+  }
+
 std::optional<app_state> exit_command(app_state state, int64_t, const std::string&)
   {
   std::stringstream str;
@@ -2612,7 +3004,7 @@ std::optional<app_state> exit_command(app_state state, int64_t, const std::strin
     }
   if (show_error_window)
     {
-    return add_error_text(state, str.str());
+    return add_error_text(std::move(state), str.str());
     }
   return std::nullopt;
   }
@@ -2635,19 +3027,24 @@ std::optional<app_state> del_window(app_state state, int64_t id, const std::stri
           f.modification_mask = 2;
           std::stringstream str;
           str << f.filename << " modified";
-          return add_error_text(state, str.str());
+          return add_error_text(std::move(state), str.str());
           }
         else
           {
           invalidate_column_item(state, i, j);
           c.items.erase(c.items.begin() + j);
 
+          if (f.filename == "+Grep")
+            stop_grep();
+
           int64_t f1 = w.file_id;
           int64_t f2 = w.nephew_id;
           if (f1 > f2)
             std::swap(f1, f2);
           state.file_state.files.erase(state.file_state.files.begin() + f2);
           state.file_state.files.erase(state.file_state.files.begin() + f1);
+          forget_file_tokens((uint32_t)f2);
+          forget_file_tokens((uint32_t)f1);
 
           int64_t w1 = state.file_id_to_window_id[f1];
           int64_t w2 = state.file_id_to_window_id[f2];
@@ -2761,7 +3158,7 @@ std::optional<app_state> del_column(app_state state, int64_t id, const std::stri
         }
       if (show_error_window)
         {
-        return add_error_text(state, str.str());
+        return add_error_text(std::move(state), str.str());
         }
       else
         {
@@ -2778,7 +3175,7 @@ std::optional<app_state> del_column(app_state state, int64_t id, const std::stri
         else if (state.g.columns.size() > 1)
           state.g.columns[1].left = 0.0;
         state.g.columns.erase(state.g.columns.begin() + i);
-        return resize(state);
+        return resize(std::move(state));
         }
       }
     }
@@ -2792,7 +3189,7 @@ std::optional<app_state> new_window(app_state state, int64_t id, const std::stri
   //id = state.file_state.active_file;
 
   if (state.g.columns.empty())
-    state = *new_column_command(state, id, "");
+    state = *new_column_command(std::move(state), id, "");
 
   uint32_t column_id = get_column_id(state, id);
 
@@ -2900,7 +3297,7 @@ app_state make_window_piped(app_state state, int64_t file_id, std::string win_co
     {
     std::stringstream str;
     str << "Could not create a piped window";
-    return add_error_text(state, str.str());
+    return add_error_text(std::move(state), str.str());
     }
 
   uint32_t command_id = state.windows[state.file_id_to_window_id[file_id]].nephew_id;
@@ -2956,7 +3353,7 @@ std::optional<app_state> win_command(app_state state, int64_t id, const std::str
     }
 
   uint32_t file_id = (uint32_t)(state.file_state.files.size() - 1);
-  return make_window_piped(state, file_id, ss.str());
+  return make_window_piped(std::move(state), file_id, ss.str());
   }
 
 app_state update_window_to_dot(app_state state)
@@ -2979,7 +3376,7 @@ app_state update_window_to_dot(app_state state)
     w.file_pos = get_line_begin(f, w.file_pos);
     w.wordwrap_row = 0;
     }
-  return check_boundaries(state, w.word_wrap);
+  return check_boundaries(std::move(state), w.word_wrap);
   }
 
 app_state update_window_file_pos(app_state state)
@@ -3028,9 +3425,9 @@ app_state update_corresponding_command_window(app_state state)
   {
   const auto& w = state.windows[state.file_id_to_window_id[state.file_state.active_file]];
   if (w.is_command_window)
-    return update_command_text(state, w.file_id);
+    return update_command_text(std::move(state), w.file_id);
   else
-    return update_command_text(state, w.nephew_id);
+    return update_command_text(std::move(state), w.nephew_id);
   }
 
 std::string get_filename_from_command_tag(const app_state& state, uint32_t command_id)
@@ -3071,57 +3468,6 @@ app_state update_filename(app_state state)
   }
 
 
-jamlib::buffer get_folder_list(const std::string& foldername)
-  {
-  jamlib::buffer newfoldertextbuffer;
-  auto folder_content = newfoldertextbuffer.transient();
-
-  folder_content.push_back('.');
-  folder_content.push_back('.');
-  folder_content.push_back('\n');
-
-  auto items = JAM::get_subdirectories_from_directory(foldername, false);
-  //std::sort(items.begin(), items.end());
-
-  //sort vector of strings case insensitive
-  std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs) 
-    {
-    const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
-    return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
-    });
-
-  for (auto& item : items)
-    {
-    item = JAM::get_filename(item);
-    auto witem = JAM::convert_string_to_wstring(item);
-    for (auto ch : witem)
-      folder_content.push_back(ch);
-    folder_content.push_back('/');
-    folder_content.push_back('\n');
-    }
-
-  items = JAM::get_files_from_directory(foldername, false);
-  //std::sort(items.begin(), items.end());
-  
-  //sort vector of strings case insensitive
-  std::sort(items.begin(), items.end(), [](const std::string& lhs, const std::string& rhs)
-    {
-    const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs) {return tolower(lhs) == tolower(rhs); });
-    return result.second != rhs.cend() && (result.first == lhs.cend() || tolower(*result.first) < tolower(*result.second));
-    });
-
-  for (auto& item : items)
-    {
-    item = JAM::get_filename(item);
-    auto witem = JAM::convert_string_to_wstring(item);
-    for (auto ch : witem)
-      folder_content.push_back(ch);
-    folder_content.push_back('\n');
-    }
-
-  return folder_content.persistent();
-  }
-
 std::optional<app_state> get_command(app_state state, int64_t id, const std::string&)
   {
   auto& w = state.windows[state.file_id_to_window_id[get_active_file_id(state, id)]];
@@ -3130,7 +3476,7 @@ std::optional<app_state> get_command(app_state state, int64_t id, const std::str
   auto& f = state.file_state.files[get_active_file_id(state, id)];
 
   if (JAM::is_directory(f.filename))
-    f.content = get_folder_list(f.filename);
+    f.content = get_folder_list(f.filename, true);
 
   if (JAM::file_exists(f.filename))
     {
@@ -3146,37 +3492,232 @@ std::optional<app_state> get_command(app_state state, int64_t id, const std::str
   return state;
   }
 
+// the windows whose file Put and Putall write: a text window with its command window, not a command window of a column or the top
+bool can_put(const app_state& state, const window& w)
+  {
+  if (w.is_command_window || w.nephew_id == (uint32_t)-1)
+    return false;
+  assert(state.file_state.files[w.file_id].filename == state.file_state.files[w.nephew_id].filename);
+  return true;
+  }
+
 std::optional<app_state> put_command(app_state state, int64_t id, const std::string&)
   {
   auto& w = state.windows[state.file_id_to_window_id[get_active_file_id(state, id)]];
-  if (w.nephew_id == (uint32_t)-1)
+  if (!can_put(state, w))
     return state;
   auto& f = state.file_state.files[w.file_id];
-  assert(f.filename == state.file_state.files[w.nephew_id].filename);
+  if (g_files_being_read.count(f.filename))
+    return add_error_text(std::move(state), f.filename + " is still being read, it cannot be written yet");
   state.file_state.active_file = w.file_id;
   std::stringstream str;
   str << "w " << f.filename;
-  state.file_state = *jamlib::handle_command(state.file_state, str.str());
+  try
+    {
+    state.file_state = *jamlib::handle_command(state.file_state, str.str());
+    const std::string path = remove_quotes_from_path(state.file_state.files[w.file_id].filename);
+    const JAM::file_version version = get_saved_version(path);
+    if (version.time >= 0)
+      g_compared_files[path] = compared_file{ state.file_state.files[w.file_id].content, version };
+    }
+  catch (std::runtime_error e)
+    {
+    state = add_error_text(std::move(state), e.what());
+    }
   return state;
   }
 
-std::optional<app_state> putall_command(app_state state, int64_t id, const std::string& cmd)
+/*
+Grep pattern [folder]: searches the files in folder and its subfolders for pattern, see start_grep.
+The folder defaults to the folder of the window, and a relative folder is relative to it. The matching lines
+are streamed into the +Grep window as ASYNC_MESSAGE_SEARCH_RESULTS messages.
+*/
+std::optional<app_state> grep_command(app_state state, int64_t id, const std::string& cmd)
+  {
+  std::string cmd_id, remainder, pattern, folder;
+  split_command(cmd_id, remainder, cmd);
+  split_command(pattern, folder, cleanup(remainder));
+  pattern = remove_quotes_from_path(pattern);
+  folder = remove_quotes_from_path(folder);
+  if (pattern.empty())
+    return add_error_text(std::move(state), "Grep needs a pattern: Grep pattern [folder]");
+  const std::string window_folder = JAM::get_folder(state.file_state.files[id].filename);
+  if (folder.empty())
+    folder = window_folder;
+  else if (!JAM::is_directory(folder))
+    folder = window_folder + folder;
+  if (!JAM::is_directory(folder))
+    return add_error_text(std::move(state), "Grep: " + folder + " is not a folder");
+  folder = cleanup_foldername(folder);
+  const int64_t file_id = get_output_file_id(state, "+Grep");
+  std::string error;
+  if (!start_grep(pattern, folder, (int64_t)gp_settings->grep_max_file_mb * 1024 * 1024, file_id, *gp_pool, *gp_messages, error))
+    return add_error_text(std::move(state), error);
+  return add_output_text(std::move(state), "+Grep", "Grep " + pattern + " " + folder);
+  }
+
+// the first line of the +Open window file_id, which holds the query
+std::string get_file_finder_query(const app_state& state, int64_t file_id)
+  {
+  const auto& f = state.file_state.files[file_id];
+  const int64_t query_end = line_end(f.content, 0);
+  return jamlib::convert_wstring_to_string(std::wstring(f.content.begin(), f.content.begin() + query_end), f.enc);
+  }
+
+/*
+Open [folder]: opens the window folder/+Open to find a file in folder and its subfolders, see start_file_search. The
+first line of the window is the query, and the files that match it best are listed below it. They are ranked again
+after each edit of the query, and right clicking one opens it. The folder defaults to the folder of the window.
+*/
+std::optional<app_state> open_command(app_state state, int64_t id, const std::string& cmd)
+  {
+  std::string cmd_id, folder;
+  split_command(cmd_id, folder, cmd);
+  folder = remove_quotes_from_path(cleanup(folder));
+  const std::string window_folder = JAM::get_folder(state.file_state.files[id].filename);
+  if (folder.empty())
+    folder = window_folder;
+  else if (!JAM::is_directory(folder))
+    folder = window_folder + folder;
+  if (!JAM::is_directory(folder))
+    return add_error_text(std::move(state), "Open: " + folder + " is not a folder");
+  const std::string root = cleanup_foldername(folder);
+  const int64_t file_id = get_output_file_id(state, root + "+Open");
+  auto& f = state.file_state.files[file_id];
+  f.dot.r.p1 = f.dot.r.p2 = line_end(f.content, 0);
+  state.file_state.active_file = file_id;
+  file_finder_window& ffw = g_file_finders[file_id];
+  ffw.root = root;
+  ffw.query = get_file_finder_query(state, file_id);
+  ffw.job_id = start_file_search(root, ffw.query, file_id, true);
+  return state;
+  }
+
+// Searches again for the +Open windows whose query was edited, called after each input.
+void update_file_finders(const app_state& state)
   {
-  size_t nr_win = state.windows.size();
-  for (size_t j = 0; j < nr_win; ++j)
+  for (auto it = g_file_finders.begin(); it != g_file_finders.end();)
     {
-    auto& w = state.windows[j];
-    if (!w.is_command_window)
+    if (!has_window(state, it->first, it->second.root + "+Open"))
+      {
+      it = g_file_finders.erase(it);
+      continue;
+      }
+    const std::string query = get_file_finder_query(state, it->first);
+    if (query != it->second.query)
+      {
+      it->second.query = query;
+      it->second.job_id = start_file_search(it->second.root, query, it->first, false);
+      }
+    ++it;
+    }
+  }
+
+// Replaces the files that are listed below the query of a +Open window by the results of its last search.
+app_state show_file_finder_results(app_state state, const async_message& m)
+  {
+  auto it = g_file_finders.find(m.file_id);
+  if (it == g_file_finders.end() || it->second.job_id != m.job_id || !has_window(state, m.file_id, it->second.root + "+Open"))
+    return state;
+  auto& f = state.file_state.files[m.file_id];
+  const int64_t query_end = line_end(f.content, 0);
+  auto content = f.content.take((uint32_t)query_end).transient();
+  content.push_back('\n');
+  for (auto ch : jamlib::convert_string_to_wstring(m.str, f.enc))
+    content.push_back(ch);
+  f.content = content.persistent();
+  f.dot.r.p1 = std::min<int64_t>(f.dot.r.p1, query_end);
+  f.dot.r.p2 = std::min<int64_t>(f.dot.r.p2, query_end);
+  auto& w = state.windows[state.file_id_to_window_id[m.file_id]];
+  w.file_pos = 0;
+  w.wordwrap_row = 0;
+  return state;
+  }
+
+/*
+Writes all modified files on the thread pool, so that editing goes on meanwhile. Each file is marked as saved
+when its ASYNC_MESSAGE_SAVE_RESULT comes in, see finish_background_save.
+*/
+std::optional<app_state> putall_command(app_state state, int64_t, const std::string&)
+  {
+  std::vector<std::string> errors;
+  for (const auto& w : state.windows)
+    {
+    if (!can_put(state, w))
+      continue;
+    const auto& f = state.file_state.files[w.file_id];
+    if (!is_modified(f) || g_files_being_read.count(f.filename))
+      continue;
+    bool saving = false;
+    for (const auto& bs : g_background_saves)
+      saving |= bs.second.filename == f.filename;
+    if (saving)
+      continue; // Putall was given again before the previous save of this file finished
+    if (jamlib::lazy_text_changed(f.content))
       {
-      uint32_t file_id = w.file_id;
-      const auto& f = state.file_state.files[file_id];
-      if (is_modified(f))
-        state = *put_command(state, file_id, cmd);
+      errors.push_back(f.filename + " changed on disk before all of its text was read, reread it before writing it");
+      continue;
+      }
+    const uint64_t job_id = ++g_last_save_job_id;
+    background_save& bs = g_background_saves[job_id];
+    bs.filename = f.filename;
+    bs.content = make_worker_copy(f.content);
+    bs.enc = f.enc;
+    bs.job = std::make_shared<save_job>();
+    const jamlib::buffer* content = &bs.content;
+    const std::string filename = remove_quotes_from_path(f.filename);
+    const jamlib::encoding enc = f.enc;
+    std::shared_ptr<save_job> job = bs.job;
+    gp_pool->push([job_id, filename, content, enc, job]()
+      {
+      {
+      std::scoped_lock<std::mutex> lock(job->mt);
+      if (job->started)
+        return; // jam closed and wrote the file itself, see wait_for_background_saves
+      job->started = true;
       }
+      async_message m;
+      m.m = ASYNC_MESSAGE_SAVE_RESULT;
+      m.job_id = job_id;
+      m.str = save_in_background(filename, *content, enc, m.version);
+      {
+      std::scoped_lock<std::mutex> lock(job->mt);
+      job->done = true;
+      job->error = m.str;
+      job->version = m.version;
+      }
+      job->cv.notify_all();
+      gp_messages->push_until(std::move(m), [&]() { return gp_pool->stopped(); });
+      });
     }
+  for (const auto& error : errors)
+    state = add_error_text(std::move(state), error);
   return state;
   }
 
+/*
+Follow: turns following the file of the window on or off, for logs that grow while they are open. A followed file is
+reloaded as described at read_followed_file, reading only the bytes that were appended since the previous reload, and
+the window scrolls along with the appended text as long as it shows the end of the file.
+*/
+std::optional<app_state> follow_command(app_state state, int64_t id, const std::string&)
+  {
+  const int64_t file_id = get_active_file_id(state, id);
+  const auto& w = state.windows[state.file_id_to_window_id[file_id]];
+  const auto& f = state.file_state.files[w.file_id];
+  if (g_followed_files.erase(w.file_id) > 0)
+    return state;
+  const std::string filename = f.filename;
+  if (w.piped || filename.empty() || filename.front() == '+' || !JAM::file_exists(remove_quotes_from_path(filename)))
+    return add_error_text(std::move(state), "Follow: " + filename + " is not a file on disk");
+  if (is_modified(f))
+    return add_error_text(std::move(state), "Follow: " + filename + " has unsaved edits");
+  followed_file& ff = g_followed_files[file_id];
+  ff.filename = filename;
+  ff.offset = -1;
+  return start_reload(std::move(state), file_id); // compares the content with the file once, from then on the appended bytes are read
+  }
+
 std::optional<app_state> highlight_comments_command(app_state state, int64_t id, const std::string&)
   {
   auto& w = state.windows[state.file_id_to_window_id[get_active_file_id(state, id)]];
@@ -3225,19 +3766,19 @@ std::optional<app_state> allchars_command(app_state state, int64_t, const std::s
 std::optional<app_state> dejavu_command(app_state state, int64_t, const std::string&)
   {
   gp_settings->font = JAM::get_folder(JAM::get_executable_path()) + "Font/DejaVuSansMono.ttf";
-  return resize_font(state, gp_settings->font_size);
+  return resize_font(std::move(state), gp_settings->font_size);
   }
 
 std::optional<app_state> hack_command(app_state state, int64_t, const std::string&)
   {
   gp_settings->font = JAM::get_folder(JAM::get_executable_path()) + "Font/Hack-Regular.ttf";
-  return resize_font(state, gp_settings->font_size);
+  return resize_font(std::move(state), gp_settings->font_size);
   }
 
 std::optional<app_state> noto_command(app_state state, int64_t, const std::string&)
   {
   gp_settings->font = JAM::get_folder(JAM::get_executable_path()) + "Font/NotoMono-Regular.ttf";
-  return resize_font(state, gp_settings->font_size);
+  return resize_font(std::move(state), gp_settings->font_size);
   }
 
 std::optional<app_state> tab_command(app_state state, int64_t, const std::string& cmd)
@@ -3263,7 +3804,7 @@ std::optional<app_state> tab_command(app_state state, int64_t, const std::string
 std::optional<app_state> consola_command(app_state state, int64_t, const std::string&)
   {
   gp_settings->font = "C:/Windows/Fonts/consola.ttf";
-  return resize_font(state, gp_settings->font_size);
+  return resize_font(std::move(state), gp_settings->font_size);
   }
 
 std::optional<app_state> edit_command(app_state state, int64_t id, const std::string& cmd)
@@ -3278,10 +3819,10 @@ std::optional<app_state> edit_command(app_state state, int64_t id, const std::st
     }
   catch (std::runtime_error e)
     {
-    state = add_error_text(state, e.what());
+    state = add_error_text(std::move(state), e.what());
     }
   if (should_update_corresponding_command_window(state))
-    state = update_corresponding_command_window(state);
+    state = update_corresponding_command_window(std::move(state));
   auto& f = state.file_state.files[state.file_state.active_file];
   if (f.history.size() == history_size + 1)
     {
@@ -3289,7 +3830,7 @@ std::optional<app_state> edit_command(app_state state, int64_t id, const std::st
     ss.dot = dot;
     f.history = f.history.set(f.history.size() - 1, ss);
     }
-  return update_window_to_dot(state);
+  return update_window_to_dot(std::move(state));
   }
 
 std::optional<app_state> redo_command(app_state state, int64_t id, const std::string&)
@@ -3297,7 +3838,7 @@ std::optional<app_state> redo_command(app_state state, int64_t id, const std::st
   state.file_state.active_file = get_active_file_id(state, id);
   state.file_state = *jamlib::handle_command(state.file_state, "R");
   if (should_update_corresponding_command_window(state))
-    state = update_corresponding_command_window(state);
+    state = update_corresponding_command_window(std::move(state));
   return ensure_selection_is_visible(state, state.file_state.active_file);
   }
 
@@ -3306,7 +3847,7 @@ std::optional<app_state> undo_command(app_state state, int64_t id, const std::st
   state.file_state.active_file = get_active_file_id(state, id);
   state.file_state = *jamlib::handle_command(state.file_state, "u");
   if (should_update_corresponding_command_window(state))
-    state = update_corresponding_command_window(state);
+    state = update_corresponding_command_window(std::move(state));
   return ensure_selection_is_visible(state, state.file_state.active_file);
   }
 
@@ -3315,7 +3856,7 @@ std::optional<app_state> local_redo_command(app_state state, int64_t id, const s
   state.file_state.active_file = id;
   state.file_state = *jamlib::handle_command(state.file_state, "R");
   if (should_update_corresponding_command_window(state))
-    state = update_corresponding_command_window(state);
+    state = update_corresponding_command_window(std::move(state));
   return ensure_selection_is_visible(state, state.file_state.active_file);
   }
 
@@ -3324,7 +3865,7 @@ std::optional<app_state> local_undo_command(app_state state, int64_t id, const s
   state.file_state.active_file = id;
   state.file_state = *jamlib::handle_command(state.file_state, "u");
   if (should_update_corresponding_command_window(state))
-    state = update_corresponding_command_window(state);
+    state = update_corresponding_command_window(std::move(state));
   return ensure_selection_is_visible(state, state.file_state.active_file);
   }
 
@@ -3359,6 +3900,16 @@ std::optional<app_state> dostheme_command(app_state state, int64_t id, const std
   gp_settings->selection_tag_green = 0;
   gp_settings->selection_tag_blue = 0;
 
+  gp_settings->keyword_red = 0;
+  gp_settings->keyword_green = 255;
+  gp_settings->keyword_blue = 255;
+  gp_settings->string_red = 255;
+  gp_settings->string_green = 170;
+  gp_settings->string_blue = 255;
+  gp_settings->number_red = 170;
+  gp_settings->number_green = 255;
+  gp_settings->number_blue = 170;
+
   init_colors(*gp_settings);
 
   stdscr->_clear = TRUE;
@@ -3410,6 +3961,16 @@ std::optional<app_state> darktheme_command(app_state state, int64_t id, const st
   gp_settings->selection_tag_green = 130;
   gp_settings->selection_tag_blue = 241;
 
+  gp_settings->keyword_red = 120;
+  gp_settings->keyword_green = 170;
+  gp_settings->keyword_blue = 255;
+  gp_settings->string_red = 230;
+  gp_settings->string_green = 180;
+  gp_settings->string_blue = 100;
+  gp_settings->number_red = 200;
+  gp_settings->number_green = 140;
+  gp_settings->number_blue = 220;
+
   init_colors(*gp_settings);
 
   stdscr->_clear = TRUE;
@@ -3461,6 +4022,16 @@ std::optional<app_state> lotustheme_command(app_state state, int64_t id, const s
   gp_settings->selection_tag_green = 255;
   gp_settings->selection_tag_blue = 0;
 
+  gp_settings->keyword_red = 0;
+  gp_settings->keyword_green = 255;
+  gp_settings->keyword_blue = 255;
+  gp_settings->string_red = 255;
+  gp_settings->string_green = 128;
+  gp_settings->string_blue = 0;
+  gp_settings->number_red = 255;
+  gp_settings->number_green = 0;
+  gp_settings->number_blue = 255;
+
   init_colors(*gp_settings);
 
   stdscr->_clear = TRUE;
@@ -3508,6 +4079,16 @@ std::optional<app_state> lighttheme_command(app_state state, int64_t id, const s
   gp_settings->selection_tag_green = 235;
   gp_settings->selection_tag_blue = 239;
 
+  gp_settings->keyword_red = 0;
+  gp_settings->keyword_green = 32;
+  gp_settings->keyword_blue = 160;
+  gp_settings->string_red = 160;
+  gp_settings->string_green = 80;
+  gp_settings->string_blue = 0;
+  gp_settings->number_red = 128;
+  gp_settings->number_green = 0;
+  gp_settings->number_blue = 128;
+
   init_colors(*gp_settings);
 
   stdscr->_clear = TRUE;
@@ -3530,7 +4111,7 @@ app_state copy_to_snarf_buffer(app_state state);
 
 std::optional<app_state> cut_command(app_state state, int64_t id, const std::string&)
   {
-  state = copy_to_snarf_buffer(state);
+  state = copy_to_snarf_buffer(std::move(state));
 
   auto& f = state.file_state.files[state.file_state.active_file];
 
@@ -3545,7 +4126,7 @@ std::optional<app_state> cut_command(app_state state, int64_t id, const std::str
     f.content = f.content.erase((uint32_t)f.dot.r.p1, (uint32_t)f.dot.r.p2);
     f.dot.r.p2 = f.dot.r.p1;
     f.modification_mask |= 1;
-    f.history = f.history.push_back(ss);
+    jamlib::append_snapshot(f, ss);
     f.undo_redo_index = f.history.size();
     }
 
@@ -3554,12 +4135,12 @@ std::optional<app_state> cut_command(app_state state, int64_t id, const std::str
 
 std::optional<app_state> paste_command(app_state state, int64_t id, const std::string&)
   {
-  return paste_from_snarf_buffer(state);
+  return paste_from_snarf_buffer(std::move(state));
   }
 
 std::optional<app_state> snarf_command(app_state state, int64_t id, const std::string&)
   {
-  return copy_to_snarf_buffer(state);
+  return copy_to_snarf_buffer(std::move(state));
   }
 
 const auto executable_commands = std::map<std::string, std::function<std::optional<app_state>(app_state, int64_t, const std::string&)>>
@@ -3572,11 +4153,14 @@ const auto executable_commands = std::map<std::string, std::function<std::option
       {"Dostheme", dostheme_command},
       {"Exit", exit_command},
       {"Edit", edit_command},
+      {"Follow", follow_command},
       {"Get", get_command},
+      {"Grep", grep_command},
       {"Lighttheme", lighttheme_command},
       {"Lotustheme", lotustheme_command},
       {"New", new_window},
       {"Newcol", new_column_command},
+      {"Open", open_command},
       {"Comment", highlight_comments_command},
       {"Paste", paste_command},
       {"Put", put_command},
@@ -3757,13 +4341,13 @@ std::optional<app_state> execute(app_state state, int64_t p1, int64_t p2, int64_
     f.dot.r.p1 = f.content.size();
     f.dot.r.p2 = f.content.size();
     f.modification_mask |= 1;
-    f.history = f.history.push_back(ss);
+    jamlib::append_snapshot(f, ss);
     f.undo_redo_index = f.history.size();
     w.file_pos = get_line_begin(f, w.file_pos);
     w.piped_prompt = get_piped_prompt(f);
     if (should_update_corresponding_command_window(state))
       state = update_corresponding_command_window(state);
-    return check_boundaries(state, w.word_wrap);
+    return check_boundaries(std::move(state), w.word_wrap);
     }
 
   //auto cmd_id = get_first_word(cmd);
@@ -3776,11 +4360,11 @@ std::optional<app_state> execute(app_state state, int64_t p1, int64_t p2, int64_
     return it->second(state, id, cmd);
     }
   if (cmd.substr(0, 4) == "Edit")
-    return edit_command(state, id, cmd);
+    return edit_command(std::move(state), id, cmd);
   if (cmd.substr(0, 3) == "Win")
-    return win_command(state, id, cmd);
+    return win_command(std::move(state), id, cmd);
   if (cmd.substr(0, 3) == "Tab")
-    return tab_command(state, id, cmd);
+    return tab_command(std::move(state), id, cmd);
 
   char pipe_cmd = cmd_id[0];
   if (pipe_cmd == '!' || pipe_cmd == '<' || pipe_cmd == '>' || pipe_cmd == '|')
@@ -3867,6 +4451,21 @@ uint32_t get_column_id(const app_state& state, int64_t id)
   return (uint32_t)state.g.columns.size() - (uint32_t)1;
   }
 
+/*
+Reads a large file on the thread pool, so that its window shows up right away. The window stays empty until the
+ASYNC_MESSAGE_FILE_CONTENT message fills it in, and meanwhile Put and Putall refuse to write the file. The file is
+only scanned, its text is decoded from a mapping of the file as the window shows or scans it.
+*/
+void read_file_in_background(const std::string& filename, int64_t file_id)
+  {
+  const uint64_t job_id = start_background_read(file_id, filename, jamlib::range{ 0, 0 }, 0);
+  gp_pool->push([filename, job_id]()
+    {
+    auto result = read_window_content(ASYNC_MESSAGE_FILE_CONTENT, filename, jamlib::ENC_UTF8, job_id, gp_pool, true);
+    gp_messages->push_until(std::move(result), [&]() { return gp_pool->stopped(); });
+    });
+  }
+
 std::optional<app_state> load_file(std::string filename, app_state state, int64_t id)
   {
   filename = flip_backslash_to_slash_in_filename(filename);
@@ -3878,7 +4477,7 @@ std::optional<app_state> load_file(std::string filename, app_state state, int64_
     }
 
   if (state.g.columns.empty())
-    state = *new_column_command(state, 0, "");
+    state = *new_column_command(std::move(state), 0, "");
 
 
   uint32_t column_id = get_empty_column_id(state);
@@ -3907,10 +4506,16 @@ std::optional<app_state> load_file(std::string filename, app_state state, int64_
 
   state.file_state.active_file = state.file_state.files.size() - 1;
 
-  std::stringstream load_file_command;
-  load_file_command << "r " << filename;
+  const bool read_in_background = gp_pool && is_large_file(remove_quotes_from_path(filename));
   state.file_state.files.back().enc = jamlib::ENC_UTF8;
-  state.file_state = *jamlib::handle_command(state.file_state, load_file_command.str());
+  if (read_in_background)
+    read_file_in_background(filename, state.file_state.files.size() - 1);
+  else
+    {
+    std::stringstream load_file_command;
+    load_file_command << "r " << filename;
+    state.file_state = *jamlib::handle_command(state.file_state, load_file_command.str());
+    }
   state.file_state.files.back().modification_mask = 0;
   state.file_state.files.back().history = immutable::vector<jamlib::snapshot, false>();
   state.file_state.files.back().undo_redo_index = 0;
@@ -3955,7 +4560,7 @@ std::optional<app_state> load_folder(std::string foldername, app_state state, in
   foldername = flip_backslash_to_slash_in_filename(cleanup_foldername(foldername));
 
   if (state.g.columns.empty())
-    state = *new_column_command(state, 0, "");
+    state = *new_column_command(std::move(state), 0, "");
 
   assert(!state.g.columns.empty());
 
@@ -4067,9 +4672,9 @@ app_state find_text_instance_in_active_file(app_state state, const std::string&
     }
   catch (std::runtime_error e)
     {
-    return add_error_text(state, e.what());
+    return add_error_text(std::move(state), e.what());
     }
-  return update_window_to_dot(state);
+  return update_window_to_dot(std::move(state));
   }
 
 std::optional<app_state> load(app_state state, int64_t p1, int64_t p2, int64_t id)
@@ -4129,7 +4734,7 @@ std::optional<app_state> load(app_state state, int64_t p1, int64_t p2, int64_t i
     }
 
   state.file_state.active_file = get_active_file_id(state, id);
-  return find_text_instance_in_active_file(state, cmd);
+  return find_text_instance_in_active_file(std::move(state), cmd);
   /*
   std::stringstream find_str;
   bool fullsearch = false;
@@ -4151,9 +4756,9 @@ std::optional<app_state> load(app_state state, int64_t p1, int64_t p2, int64_t i
     }
   catch (std::runtime_error e)
     {
-    return add_error_text(state, e.what());
+    return add_error_text(std::move(state), e.what());
     }
-  return update_window_to_dot(state);
+  return update_window_to_dot(std::move(state));
   */
   }
 
@@ -4199,7 +4804,7 @@ app_state backspace(app_state state)
     state = update_corresponding_command_window(state);
 
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state select_all_command(app_state state)
@@ -4215,7 +4820,7 @@ app_state delete_press(app_state state, bool shift)
   if (invalid_command_window_position(state))
     return state;
   if (shift)
-    state = copy_to_snarf_buffer(state);
+    state = copy_to_snarf_buffer(std::move(state));
 
   std::string command;
   command.push_back('d');
@@ -4236,7 +4841,7 @@ app_state delete_press(app_state state, bool shift)
 
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 std::wstring resolve_piped_command_escape_characters(const std::wstring& cmd)
@@ -4297,7 +4902,7 @@ std::string get_piped_command(const std::wstring& prompt, jamlib::file f)
   return jamlib::convert_wstring_to_string(out, f.enc);
   }
 
-uint32_t get_history_index(const std::vector<std::string>& history, const std::string& piped_cmd)
+uint32_t get_history_index(const immutable::vector<std::string, false>& history, const std::string& piped_cmd)
   {
   auto it = std::find(history.begin(), history.end(), piped_cmd);
   if (it == history.end())
@@ -4348,7 +4953,7 @@ app_state tab(app_state state)
 
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state enter(app_state state)
@@ -4373,7 +4978,7 @@ app_state enter(app_state state)
         if (idx == (uint32_t)-1)
           {
           w.piped_prompt_index = (uint32_t)w.piped_prompt_history.size();
-          w.piped_prompt_history.push_back(piped_cmd);
+          w.piped_prompt_history = w.piped_prompt_history.push_back(piped_cmd);
           }
         else
           {
@@ -4417,13 +5022,13 @@ app_state enter(app_state state)
       f.dot.r.p1 = f.content.size();
       f.dot.r.p2 = f.content.size();
       f.modification_mask |= 1;
-      f.history = f.history.push_back(ss);
+      jamlib::append_snapshot(f, ss);
       f.undo_redo_index = f.history.size();
       w.file_pos = get_line_begin(f, w.file_pos);
       w.piped_prompt = get_piped_prompt(f);
       if (should_update_corresponding_command_window(state))
         state = update_corresponding_command_window(state);
-      return check_boundaries(state, w.word_wrap);
+      return check_boundaries(std::move(state), w.word_wrap);
       }
     }
 
@@ -4467,7 +5072,7 @@ app_state enter(app_state state)
 
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state text_input(app_state state, const char* txt)
@@ -4517,7 +5122,7 @@ app_state text_input(app_state state, const char* txt)
 
   bool word_wrap = state.windows[state.file_id_to_window_id[state.file_state.active_file]].word_wrap;
 
-  return check_boundaries(state, word_wrap);
+  return check_boundaries(std::move(state), word_wrap);
   }
 
 app_state stop_selection(app_state state)
@@ -4549,7 +5154,7 @@ app_state paste_from_windows_clipboard(app_state state)
   auto wtext = JAM::convert_string_to_wstring(str);
   wtext.erase(std::remove(wtext.begin(), wtext.end(), '\r'), wtext.end());
   str = JAM::convert_wstring_to_string(wtext);
-  return text_input(state, str.c_str());
+  return text_input(std::move(state), str.c_str());
   }
 
 app_state paste_from_snarf_buffer(app_state state)
@@ -4568,7 +5173,7 @@ app_state paste_from_snarf_buffer(app_state state)
   f.dot.r.p2 = f.dot.r.p1 + state.snarf_buffer.size();
   f.modification_mask |= 1;
 
-  f.history = f.history.push_back(ss);
+  jamlib::append_snapshot(f, ss);
   f.undo_redo_index = f.history.size();
 
   if (should_update_filename(state))
@@ -4577,7 +5182,7 @@ app_state paste_from_snarf_buffer(app_state state)
   if (should_update_corresponding_command_window(state))
     state = update_corresponding_command_window(state);
 
-  return update_window_file_pos(state);
+  return update_window_file_pos(std::move(state));
   }
 
 app_state copy_to_snarf_buffer(app_state state)
@@ -4591,7 +5196,7 @@ app_state next_instance_of_find_buffer(app_state state)
   {
   std::wstring wcmd(state.find_buffer.begin(), state.find_buffer.end());
   std::string cmd = JAM::convert_wstring_to_string(wcmd);
-  return find_text_instance_in_active_file(state, cmd);
+  return find_text_instance_in_active_file(std::move(state), cmd);
   /*
   std::stringstream find_str;
   bool fullsearch = false;
@@ -4613,16 +5218,16 @@ app_state next_instance_of_find_buffer(app_state state)
     }
   catch (std::runtime_error e)
     {
-    return add_error_text(state, e.what());
+    return add_error_text(std::move(state), e.what());
     }
-  return update_window_to_dot(state);*/
+  return update_window_to_dot(std::move(state));*/
   }
 
 app_state copy_to_find_buffer(app_state state)
   {
   const auto& f = state.file_state.files[state.file_state.active_file];
   state.find_buffer = f.content.slice(f.dot.r.p1, f.dot.r.p2);
-  return next_instance_of_find_buffer(state);
+  return next_instance_of_find_buffer(std::move(state));
   }
 
 void copy_to_windows_clipboard(const app_state& state)
@@ -4650,6 +5255,39 @@ void copy_to_windows_clipboard(const app_state& state)
   copy_to_windows_clipboard(str);
   }
 
+app_state insert_pipe_text(app_state state, size_t window_id, const std::string& text)
+  {
+  auto& w = state.windows[window_id];
+  auto& f = state.file_state.files[w.file_id];
+  jamlib::snapshot ss;
+  ss.content = f.content;
+  ss.dot = f.dot;
+  ss.modification_mask = f.modification_mask;
+  ss.enc = f.enc;
+
+  jamlib::buffer txt;
+  auto tr = txt.transient();
+  auto wtext = jamlib::convert_string_to_wstring(text, f.enc);
+  wtext.erase(std::remove(wtext.begin(), wtext.end(), '\r'), wtext.end());
+  tr.push_back('\n');
+  for (auto ch : wtext)
+    {
+    tr.push_back(ch);
+    }
+  txt = tr.persistent();
+  f.content = f.content.insert((uint32_t)f.dot.r.p1, txt);
+  f.dot.r.p1 = f.content.size();
+  f.dot.r.p2 = f.content.size();
+  f.modification_mask |= 1;
+  jamlib::append_snapshot(f, ss);
+  f.undo_redo_index = f.history.size();
+  w.file_pos = get_line_begin(f, w.file_pos);
+  w.piped_prompt = get_piped_prompt(f);
+  if (should_update_corresponding_command_window(state))
+    state = update_corresponding_command_window(state);
+  return check_boundaries(state, state.windows[window_id].word_wrap);
+  }
+
 app_state check_pipes(bool& modifications, app_state state)
   {
   modifications = false;
@@ -4660,7 +5298,6 @@ app_state check_pipes(bool& modifications, app_state state)
     if (w.piped)
       {
       std::string text;
-      auto& f = state.file_state.files[w.file_id];
       try
         {
         text = JAM::read_from_pipe(w.process, 10);
@@ -4679,33 +5316,7 @@ app_state check_pipes(bool& modifications, app_state state)
       if (text.empty())
         continue;
       modifications = true;
-      jamlib::snapshot ss;
-      ss.content = f.content;
-      ss.dot = f.dot;
-      ss.modification_mask = f.modification_mask;
-      ss.enc = f.enc;
-
-      jamlib::buffer txt;
-      auto tr = txt.transient();
-      auto wtext = jamlib::convert_string_to_wstring(text, f.enc);
-      wtext.erase(std::remove(wtext.begin(), wtext.end(), '\r'), wtext.end());
-      tr.push_back('\n');
-      for (auto ch : wtext)
-        {
-        tr.push_back(ch);
-        }
-      txt = tr.persistent();
-      f.content = f.content.insert((uint32_t)f.dot.r.p1, txt);
-      f.dot.r.p1 = f.content.size();
-      f.dot.r.p2 = f.content.size();
-      f.modification_mask |= 1;
-      f.history = f.history.push_back(ss);
-      f.undo_redo_index = f.history.size();
-      w.file_pos = get_line_begin(f, w.file_pos);
-      w.piped_prompt = get_piped_prompt(f);
-      if (should_update_corresponding_command_window(state))
-        state = update_corresponding_command_window(state);
-      state = check_boundaries(state, w.word_wrap);
+      state = insert_pipe_text(state, i, text);
       }
     }
   return state;
@@ -4858,6 +5469,18 @@ void get_window_first_last_pos(int64_t& p1, int64_t& p2, const app_state& state,
 
   for (; it != it_end; ++it, ++pos)
     {
+    if (*it != '\n')
+      {
+      const int64_t skip_to = skip_invisible_columns(f.content, pos, col, w);
+      if (skip_to > pos)
+        {
+        col += skip_to - pos;
+        pos = skip_to;
+        it = f.content.begin() + pos;
+        if (it == it_end)
+          break;
+        }
+      }
     if (*it == '\n')
       {
       if (w.word_wrap)
@@ -4912,7 +5535,7 @@ void get_window_first_last_pos(int64_t& p1, int64_t& p2, const app_state& state,
           col += character_width(*it, col, f.enc, *gp_settings);
           }
         else
-          col += character_width(*it, col, f.enc, *gp_settings);
+          ++col;
         }
       }
 
@@ -4959,12 +5582,14 @@ void get_window_box(int& top, int& top_without_tag, int& bottom, int& left, int&
     }
   }
 
-std::optional<app_state> process_input(app_state state, const settings& sett)
+std::optional<app_state> process_input(app_state state, const settings& sett, const async_messages& messages)
   {
   SDL_Event event;
   auto tic = std::chrono::steady_clock::now();
   for (;;)
     {
+    if (!messages.empty())
+      return state; // return so that we can process the messages queue
     while (SDL_PollEvent(&event))
       {
       keyb.handle_event(event);
@@ -4973,7 +5598,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
         case SDL_SYSWMEVENT:
         {
 #ifdef _WIN32
-        if (event.syswm.msg->msg.win.msg == WM_COPYDATA)
+        if (event.syswm.msg->msg.win.msg == WM_COPYDATA && !messages.empty())
           {
           return state; // return so that we can process the messages queue
           }
@@ -5014,7 +5639,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
 
           SDL_FillRect(pdc_screen, &dest, SDL_MapRGB(pdc_screen->format, (uint8_t)sett.win_bg_red, (uint8_t)sett.win_bg_green, (uint8_t)sett.win_bg_blue));
 
-          return resize(state);
+          return resize(std::move(state));
           }
         break;
         }
@@ -5023,9 +5648,9 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           if (state.file_state.files[state.file_state.active_file].dot.r.p2 < state.file_state.files[state.file_state.active_file].dot.r.p1)
             std::swap(state.file_state.files[state.file_state.active_file].dot.r.p1, state.file_state.files[state.file_state.active_file].dot.r.p2);
           if (keyb_data.selecting)
-            state = stop_selection(state);
+            state = stop_selection(std::move(state));
           mouse.left_dragging = mouse.middle_dragging = mouse.right_dragging = false;
-          return text_input(state, event.text.text);
+          return text_input(std::move(state), event.text.text);
           break;
 
         case SDL_KEYDOWN:
@@ -5073,7 +5698,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           {
           if (keyb.is_down(SDLK_LCTRL) || keyb.is_down(SDLK_RCTRL)) // select all
             {
-            return select_all_command(state);
+            return select_all_command(std::move(state));
             }
           break;
           }
@@ -5084,12 +5709,12 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             if (keyb.is_down(SDLK_LSHIFT) || keyb.is_down(SDLK_RSHIFT)) // copy to clipboard
               {
               if (keyb_data.selecting)
-                state = stop_selection(state);
+                state = stop_selection(std::move(state));
               copy_to_windows_clipboard(state);
               return state;
               }
             else
-              return copy_to_snarf_buffer(state);
+              return copy_to_snarf_buffer(std::move(state));
             }
           break;
           }
@@ -5100,10 +5725,10 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             if (keyb.is_down(SDLK_LSHIFT) || keyb.is_down(SDLK_RSHIFT)) // paste from clipboard        
               {
               if (keyb_data.selecting)
-                state = stop_selection(state);
-              return paste_from_windows_clipboard(state);
+                state = stop_selection(std::move(state));
+              return paste_from_windows_clipboard(std::move(state));
               }
-            return paste_from_snarf_buffer(state);
+            return paste_from_snarf_buffer(std::move(state));
             }
           break;
           }
@@ -5135,11 +5760,11 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           {
           if (keyb.is_down(SDLK_LCTRL) || keyb.is_down(SDLK_RCTRL)) // copy
             {
-            return copy_to_find_buffer(state);
+            return copy_to_find_buffer(std::move(state));
             }
           else
             {
-            return next_instance_of_find_buffer(state);
+            return next_instance_of_find_buffer(std::move(state));
             }
           break;
           }
@@ -5156,13 +5781,13 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           case SDLK_LSHIFT:
           {
           if (keyb_data.selecting)
-            return stop_selection(state);
+            return stop_selection(std::move(state));
           break;
           }
           case SDLK_RSHIFT:
           {
           if (keyb_data.selecting)
-            return stop_selection(state);
+            return stop_selection(std::move(state));
           break;
           }
           default: break;
@@ -5370,7 +5995,8 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             if (mouse.rwd.x + 1 < SP->cols)
               addch(mouse.rwd.icon_sign);
             refresh();
-            SDL_UpdateWindowSurface(pdc_window);
+            invalidate_window_draw_cache();
+            PDC_update_rects();
             break;
             }
           else
@@ -5420,7 +6046,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             // dragging, but mouse is outside of window, so we want the page to move up or down
             if (top_without_tag >= 0 && y < top_without_tag)
               {
-              state = move_page_up_without_cursor(state, 1);
+              state = move_page_up_without_cursor(std::move(state), 1);
               int64_t p1, p2;
               get_window_first_last_pos(p1, p2, state, mouse.left_drag_start.id);
               //state.file_state.files[mouse.left_drag_start.id].dot.r.p1 = p1;              
@@ -5448,7 +6074,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
               }
             if (bottom >= 0 && y > bottom)
               {
-              state = move_page_down_without_cursor(state, 1);
+              state = move_page_down_without_cursor(std::move(state), 1);
               int64_t p1, p2;
               get_window_first_last_pos(p1, p2, state, mouse.left_drag_start.id);
               //state.file_state.files[mouse.left_drag_start.id].dot.r.p2 = p2;
@@ -5624,7 +6250,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             auto p = get_ex(y, x);
             if (p.id >= 0 && p.type == SET_TEXT)
               {
-              return select_word(state, p.id, p.pos);
+              return select_word(std::move(state), p.id, p.pos);
               }
             }
           mouse.left_button_down = true;
@@ -5706,9 +6332,9 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             mouse.rearranging_windows = false;
             if (p.id == mouse.rwd.rearranging_file_id && p.type == SET_ICON)
               {
-              return enlarge_window(state, p.id);
+              return enlarge_window(std::move(state), p.id);
               }
-            return adapt_grid(state, event.button.x / font_width, event.button.y / font_height);
+            return adapt_grid(std::move(state), event.button.x / font_width, event.button.y / font_height);
             }
           bool was_dragging = mouse.left_dragging;
           mouse.left_button_down = false;
@@ -5730,7 +6356,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             int64_t steps = (int64_t)(scroll_fract*(w.rows - 1));
             if (steps <= 0)
               steps = 1;
-            return move_page_up_without_cursor(state, steps);
+            return move_page_up_without_cursor(std::move(state), steps);
             }
 
           while (x > 0 && p.id < 0)
@@ -5762,7 +6388,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           mouse.middle_dragging = false;
           if (mouse.left_button_down) // chord 1-2 = Cut
             {
-            return cut_command(state, mouse.left_drag_start.id, "");
+            return cut_command(std::move(state), mouse.left_drag_start.id, "");
             }
           int x = event.button.x / font_width;
           int y = event.button.y / font_height;
@@ -5773,7 +6399,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             }
           if (p.type == SET_ICON)
             {
-            return enlarge_window_as_much_as_possible(state, p.id);
+            return enlarge_window_as_much_as_possible(std::move(state), p.id);
             }
           if (was_dragging || p.type == SET_TEXT)
             {
@@ -5792,7 +6418,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
                 }
               p2 = p2 < state.file_state.files[id].content.size() ? p2 + 1 : state.file_state.files[id].content.size();
               }
-            return execute(state, p1, p2, id);
+            return execute(std::move(state), p1, p2, id);
             }
           return state;
           }
@@ -5803,7 +6429,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
           mouse.right_dragging = false;
           if (mouse.left_button_down) // chord 1-3 = Paste
             {
-            return paste_command(state, mouse.left_drag_start.id, "");
+            return paste_command(std::move(state), mouse.left_drag_start.id, "");
             }
           int x = event.button.x / font_width;
           int y = event.button.y / font_height;
@@ -5811,7 +6437,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
 
           if (p.type == SET_ICON)
             {
-            return maximize_window(state, p.id);
+            return maximize_window(std::move(state), p.id);
             }
 
           if (p.id >= 0 && p.type == SET_SCROLLBAR)
@@ -5823,7 +6449,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             int64_t steps = (int64_t)(scroll_fract*(w.rows - 1));
             if (steps <= 0)
               steps = 1;
-            return move_page_down_without_cursor(state, steps);
+            return move_page_down_without_cursor(std::move(state), steps);
             return state;
             }
 
@@ -5844,7 +6470,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
                 }
               p2 = p2 < state.file_state.files[id].content.size() ? p2 + 1 : state.file_state.files[id].content.size();
               }
-            return load(state, p1, p2, id);
+            return load(std::move(state), p1, p2, id);
             }
 
           return state;
@@ -5861,7 +6487,7 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
             --pdc_font_size;
           if (pdc_font_size < 1)
             pdc_font_size = 1;
-          return resize_font(state, pdc_font_size);
+          return resize_font(std::move(state), pdc_font_size);
           }
         auto active_file = state.file_state.active_file;
         auto id = find_window_pair_id(mouse.mouse_x / font_width, mouse.mouse_y / font_height, state);
@@ -5901,24 +6527,178 @@ std::optional<app_state> process_input(app_state state, const settings& sett)
   //return std::nullopt;
   }
 
+app_state process_message(app_state state, const async_message& m)
+  {
+  switch (m.m)
+    {
+    case ASYNC_MESSAGE_LOAD:
+    {
+    if (JAM::file_exists(m.str))
+      {
+      if (auto loaded = load_file(m.str, state, state.file_state.active_file))
+        state = *loaded;
+      }
+    break;
+    }
+    case ASYNC_MESSAGE_SEARCH_RESULTS:
+    {
+    // file ids shift down when a window is closed, so the results only go to file_id while it is still the +Grep window
+    if (has_window(state, m.file_id, "+Grep"))
+      state = insert_pipe_text(std::move(state), state.file_id_to_window_id[m.file_id], m.str);
+    break;
+    }
+    case ASYNC_MESSAGE_PIPE_OUTPUT:
+    {
+    if (m.file_id >= 0 && m.file_id < (int64_t)state.file_id_to_window_id.size())
+      {
+      auto window_id = state.file_id_to_window_id[m.file_id];
+      if (window_id < state.windows.size() && state.windows[window_id].file_id == m.file_id) // output for a window that was closed in the meantime has nowhere to go
+        state = insert_pipe_text(std::move(state), window_id, m.str);
+      }
+    else if (!m.str.empty())
+      state = add_error_text(std::move(state), m.str);
+    break;
+    }
+    case ASYNC_MESSAGE_HIGHLIGHT_RESULTS:
+    {
+    if (finish_token_scan(m.job_id)) // the window signatures do not change, so the windows have to be drawn again to show the new colors
+      invalidate_window_draw_cache();
+    break;
+    }
+    case ASYNC_MESSAGE_RESTORE_FILE:
+    case ASYNC_MESSAGE_RESTORE_FOLDER:
+    case ASYNC_MESSAGE_FILE_CONTENT:
+    {
+    state = restore_session_content(std::move(state), m);
+    break;
+    }
+    case ASYNC_MESSAGE_SAVE_RESULT:
+    {
+    state = finish_background_save(std::move(state), m);
+    break;
+    }
+    case ASYNC_MESSAGE_FILE_CHANGED:
+    {
+    state = file_changed_on_disk(std::move(state), m.str);
+    break;
+    }
+    case ASYNC_MESSAGE_RELOAD_RESULT:
+    {
+    state = finish_reload(std::move(state), m);
+    break;
+    }
+    case ASYNC_MESSAGE_FILE_INDEX:
+    {
+    finish_file_index(m.job_id);
+    break;
+    }
+    case ASYNC_MESSAGE_OPEN_RESULTS:
+    {
+    state = show_file_finder_results(std::move(state), m);
+    break;
+    }
+    }
+  return state;
+  }
+
+std::string startup_time_text(const std::string& what, std::chrono::steady_clock::time_point tic)
+  {
+  auto toc = std::chrono::steady_clock::now();
+  std::stringstream str;
+  str << what << " after " << std::chrono::duration_cast<std::chrono::milliseconds>(toc - tic).count() << "ms";
+  return str.str();
+  }
+
+/*
+--scroll-benchmark: drags the scrollbar of the active window from the top to the bottom of its file, one frame for
+each step, and reports the frame times. The first frame also builds the line index of the file, so it is reported
+apart. Run it on a large file, e.g. jam --scroll-benchmark big.log.
+*/
+app_state run_scroll_benchmark(app_state state, const settings& sett)
+  {
+  const uint32_t file_id = (uint32_t)state.file_state.active_file;
+  const uint32_t window_id = file_id < state.file_id_to_window_id.size() ? state.file_id_to_window_id[file_id] : (uint32_t)-1;
+  if (window_id >= state.windows.size() || state.windows[window_id].is_command_window)
+    return add_error_text(std::move(state), "Scroll benchmark: the active window does not show a file");
+  const int frames = 200;
+  const int64_t size = (int64_t)state.file_state.files[file_id].content.size();
+  double first_ms = 0.0, total_ms = 0.0, max_ms = 0.0;
+  for (int k = 0; k < frames; ++k)
+    {
+    const auto tic = std::chrono::steady_clock::now();
+    const int64_t pos = (int64_t)((double)k / (double)(frames - 1) * (double)size); // as the scrollbar positions are computed in window.cpp
+    state = jump_to_pos(pos, file_id, std::move(state));
+    state = draw(std::move(state), sett);
+    PDC_update_rects();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tic).count();
+    if (k == 0)
+      first_ms = ms;
+    else
+      {
+      total_ms += ms;
+      max_ms = std::max<double>(max_ms, ms);
+      }
+    }
+  std::stringstream str;
+  str << "Scrollbar drag over " << size << " characters: first frame " << first_ms << "ms, then " << total_ms / (frames - 1) << "ms per frame on average and " << max_ms << "ms at most";
+  return add_error_text(std::move(state), str.str());
+  }
+
 void engine::run()
   {
   state = draw(state, sett);
-  SDL_UpdateWindowSurface(pdc_window);
-  while (auto new_state = process_input(state, sett))
+  PDC_present();
+  unsaved_edits.record(state);
+  watch_files_of_windows(state, watcher);
+  if (startup_time)
+    {
+    state = add_error_text(std::move(state), startup_time_text("First frame", startup_tic));
+    if (pending_restores == 0)
+      state = add_error_text(std::move(state), startup_time_text("Session restored", startup_tic));
+    state = draw(state, sett);
+    PDC_present();
+    }
+  if (scroll_benchmark && g_background_reads.empty())
+    {
+    scroll_benchmark = false;
+    state = draw(run_scroll_benchmark(std::move(state), sett), sett);
+    PDC_present();
+    }
+  std::vector<async_message> pending;
+  while (auto new_state = process_input(state, sett, messages))
     {
-    while (!messages.empty())
+    pending.clear();
+    messages.pop_all(pending);
+    for (const auto& m : pending)
       {
-      auto m = messages.pop();
-      if (m.m == ASYNC_MESSAGE_LOAD && JAM::file_exists(m.str))
+      new_state = process_message(std::move(*new_state), m);
+      if (m.m == ASYNC_MESSAGE_RESTORE_FILE || m.m == ASYNC_MESSAGE_RESTORE_FOLDER)
         {
-        new_state = load_file(m.str, *new_state, new_state->file_state.active_file);
-        //new_state = enlarge_window_as_much_as_possible(*new_state, new_state->file_state.active_file);
+        if (--pending_restores == 0 && startup_time)
+          new_state = add_error_text(std::move(*new_state), startup_time_text("Session restored", startup_tic));
         }
       }
 
-    state = draw(*new_state, sett);
+    if (messages.dropped() != reported_drops)
+      {
+      reported_drops = messages.dropped();
+      new_state = add_error_text(std::move(*new_state), "Messages of background tasks were lost because the message queue was full");
+      }
+
+    if (scroll_benchmark && g_background_reads.empty()) // after the file to scroll through was read
+      {
+      scroll_benchmark = false;
+      new_state = run_scroll_benchmark(std::move(*new_state), sett);
+      }
+
+    for (const auto& filename : unsaved_edits.take_failed_files())
+      new_state = add_error_text(std::move(*new_state), "The unsaved edits of " + filename + " cannot be journaled (is the disk full?): they are lost if jam crashes before it is saved");
+
+    update_file_finders(*new_state);
+    state = draw(std::move(*new_state), sett);
+    unsaved_edits.record(state);
+    watch_files_of_windows(state, watcher);
 
-    SDL_UpdateWindowSurface(pdc_window);
+    PDC_update_rects();
     }
   }
@@ -4,8 +4,12 @@
 #include "window.h"
 #include "grid.h"
 #include "async_messages.h"
+#include "journal.h"
 
 #include <jamlib/jam.h>
+#include <jam_file_watcher.h>
+#include <jam_thread_pool.h>
+#include <chrono>
 #include <vector>
 
 
@@ -26,6 +30,15 @@ struct engine
   app_state state;
   settings sett;
   async_messages messages;
+  JAM::file_watcher watcher; // changes of the listed folders and of the files in the windows, declared after messages, which it posts to
+  JAM::thread_pool pool; // declared after messages and watcher: tasks that are still running can use them while the pool joins
+  journal unsaved_edits;
+
+  size_t pending_restores; // files of the previous session that are still being read in the background
+  uint64_t reported_drops; // the number of dropped messages that was reported already, see async_messages::push_until
+  bool startup_time; // --startup-time: report how long restoring the previous session took
+  bool scroll_benchmark; // --scroll-benchmark: report the frame times of dragging the scrollbar through the active file, see run_scroll_benchmark
+  std::chrono::steady_clock::time_point startup_tic;
 
   engine(int w, int h, int argc, char** argv, const settings& s);
   ~engine();
@@ -0,0 +1,687 @@
+#include "file_finder.h"
+
+#include <jam_file_utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace
+  {
+  const size_t max_results = 100;
+  const size_t max_indexes = 4; // the least recently searched index is dropped when another folder is indexed
+  const size_t max_watched_folders = 7680; // of all indexes together, below 8192, the default limit of inotify watches of a user on many systems
+  const size_t folders_per_step = 64; // a search task takes this many folders at a time, and checks whether it was stopped
+
+  // scores of a match, see score_match
+  const int score_character = 16;
+  const int bonus_boundary = 8; // the character starts a part of the path or a word
+  const int bonus_consecutive = 6; // the character follows the previous character of the match
+  const int bonus_filename = 2; // the character lies in the filename
+  const int penalty_gap = 1; // per character between two characters of the match
+
+  struct folder_files
+    {
+    std::string folder; // relative to the root: empty for the root, otherwise ending in a '/'
+    std::string folder_lower;
+    uint64_t folder_mask;
+    std::string names; // the names of the files, one after the other
+    std::string lower; // names in lower case
+    std::vector<uint32_t> starts; // the start of each name in names, followed by the size of names
+    std::vector<uint64_t> masks; // the characters of each name, see character_mask
+    };
+
+  typedef std::vector<std::shared_ptr<const folder_files>> folder_list;
+
+  struct file_index
+    {
+    std::map<std::string, std::shared_ptr<const folder_files>> folders; // by relative folder
+    std::shared_ptr<const folder_list> snapshot; // the folders as searches see them, made again after a change
+    bool built = false;
+    bool watched = false; // all folders are watched, and the watcher reports their changes as they happen
+    uint64_t build_job = 0; // the build that is running, 0 if none
+    uint64_t last_used = 0;
+    std::set<std::string> relisting; // folders that are listed again on the thread pool
+    std::set<std::string> changed_again; // folders that changed while a folder was listed again, handled when it is done
+    };
+
+  struct index_build
+    {
+    std::string root;
+    std::mutex mt;
+    std::condition_variable cv;
+    std::vector<std::string> queue; // relative folders that still have to be listed
+    int busy = 0; // number of tasks that are listing a folder
+    int tasks_left = 0;
+    folder_list folders;
+    };
+
+  // a folder of a watched index that changed or is new, listed again on the thread pool, see file_index_folder_changed
+  struct folder_update
+    {
+    std::string root;
+    std::string folder; // relative to the root
+    bool exists = true;
+    std::shared_ptr<const folder_files> listed;
+    std::vector<std::string> subfolders; // of folder
+    };
+
+  struct ranked_file
+    {
+    int score;
+    uint32_t length;
+    const folder_files* folder;
+    uint32_t index;
+    };
+
+  struct file_search
+    {
+    uint64_t job_id;
+    int64_t file_id;
+    std::string query; // in lower case, without spaces
+    uint64_t mask;
+    std::shared_ptr<const folder_list> folders;
+    std::atomic<size_t> next_folder{ 0 };
+    std::mutex mt;
+    std::vector<ranked_file> best;
+    int tasks_left = 0;
+    };
+
+  struct waiting_search
+    {
+    std::string root;
+    std::string query;
+    int64_t file_id;
+    uint64_t job_id;
+    };
+
+  JAM::thread_pool* gp_pool = nullptr;
+  async_messages* gp_messages = nullptr;
+  JAM::file_watcher* gp_watcher = nullptr;
+  std::map<std::string, file_index> indexes; // by root
+  std::map<uint64_t, std::shared_ptr<index_build>> builds; // by job id
+  std::map<uint64_t, std::shared_ptr<folder_update>> updates; // by job id
+  std::vector<waiting_search> waiting; // searches of indexes that are being built
+  uint64_t last_job_id = 0;
+  uint64_t use_counter = 0;
+  std::atomic<uint64_t> latest_search{ 0 };
+
+  char to_lower(char ch)
+    {
+    return (ch >= 'A' && ch <= 'Z') ? (char)(ch - 'A' + 'a') : ch;
+    }
+
+  // letters and digits have a bit of their own, the other bytes share the remaining bits
+  uint64_t character_bit(unsigned char ch)
+    {
+    if (ch >= 'a' && ch <= 'z')
+      return 1ull << (ch - 'a');
+    if (ch >= '0' && ch <= '9')
+      return 1ull << (26 + ch - '0');
+    return 1ull << (36 + ch % 28);
+    }
+
+  uint64_t character_mask(const char* first, const char* last)
+    {
+    uint64_t mask = 0;
+    for (; first != last; ++first)
+      mask |= character_bit((unsigned char)*first);
+    return mask;
+    }
+
+  std::string lower_case(const std::string& str)
+    {
+    std::string lower(str);
+    for (auto& ch : lower)
+      ch = to_lower(ch);
+    return lower;
+    }
+
+  bool starts_with(const std::string& str, const std::string& prefix)
+    {
+    return str.compare(0, prefix.size(), prefix) == 0;
+    }
+
+  std::string name_of(const std::string& path)
+    {
+    return path.substr(path.find_last_of("/\\") + 1);
+    }
+
+  // lists root + folder, and appends the relative paths of its subfolders to subfolders
+  std::shared_ptr<const folder_files> read_folder(const std::string& root, const std::string& folder, std::vector<std::string>& subfolders)
+    {
+    std::vector<std::string> files, folders;
+    JAM::get_files_and_subdirectories_from_directory(root + folder, files, folders);
+    for (const auto& path : folders)
+      subfolders.push_back(folder + name_of(path) + "/");
+    std::vector<std::string> names;
+    names.reserve(files.size());
+    for (const auto& path : files)
+      names.push_back(name_of(path));
+    std::sort(names.begin(), names.end());
+    auto ff = std::make_shared<folder_files>();
+    ff->folder = folder;
+    ff->folder_lower = lower_case(folder);
+    ff->folder_mask = character_mask(ff->folder_lower.data(), ff->folder_lower.data() + ff->folder_lower.size());
+    ff->starts.reserve(names.size() + 1);
+    ff->masks.reserve(names.size());
+    for (const auto& name : names)
+      {
+      ff->starts.push_back((uint32_t)ff->names.size());
+      ff->names.append(name);
+      }
+    ff->starts.push_back((uint32_t)ff->names.size());
+    ff->lower = lower_case(ff->names);
+    for (size_t i = 0; i + 1 < ff->starts.size(); ++i)
+      ff->masks.push_back(character_mask(ff->lower.data() + ff->starts[i], ff->lower.data() + ff->starts[i + 1]));
+    return ff;
+    }
+
+  void post(JAM::thread_pool& pool, async_messages& messages, async_message&& m)
+    {
+    messages.push_until(std::move(m), [&]() { return pool.stopped(); });
+    }
+
+  // Takes folders from the queue of the build until it is empty and no other task can add to it anymore.
+  void build_task(std::shared_ptr<index_build> ib, uint64_t job_id, JAM::thread_pool& pool, async_messages& messages)
+    {
+    for (;;)
+      {
+      std::string folder;
+      {
+      std::unique_lock<std::mutex> lock(ib->mt);
+      ib->cv.wait(lock, [&]() { return !ib->queue.empty() || ib->busy == 0; });
+      if (ib->queue.empty() || pool.stopped())
+        break;
+      folder = std::move(ib->queue.back());
+      ib->queue.pop_back();
+      ++ib->busy;
+      }
+      std::vector<std::string> subfolders;
+      auto ff = read_folder(ib->root, folder, subfolders);
+      {
+      std::scoped_lock<std::mutex> lock(ib->mt);
+      ib->folders.push_back(std::move(ff));
+      ib->queue.insert(ib->queue.end(), subfolders.begin(), subfolders.end());
+      --ib->busy;
+      }
+      ib->cv.notify_all();
+      }
+    ib->cv.notify_all();
+    bool last_task = false;
+    {
+    std::scoped_lock<std::mutex> lock(ib->mt);
+    last_task = --ib->tasks_left == 0;
+    }
+    if (last_task && !pool.stopped())
+      {
+      async_message m;
+      m.m = ASYNC_MESSAGE_FILE_INDEX;
+      m.job_id = job_id;
+      post(pool, messages, std::move(m));
+      }
+    }
+
+  void start_build(const std::string& root, file_index& index)
+    {
+    auto ib = std::make_shared<index_build>();
+    ib->root = root;
+    ib->queue.push_back(std::string());
+    const int nr_of_tasks = (int)std::max<size_t>(gp_pool->size(), 2) - 1;
+    ib->tasks_left = nr_of_tasks; // the tasks count it down as they finish, so it cannot bound the loop below
+    index.build_job = ++last_job_id;
+    builds[index.build_job] = ib;
+    JAM::thread_pool* pool = gp_pool;
+    async_messages* messages = gp_messages;
+    const uint64_t job_id = index.build_job;
+    for (int i = 0; i < nr_of_tasks; ++i)
+      pool->push([ib, job_id, pool, messages]() { build_task(ib, job_id, *pool, *messages); });
+    }
+
+  // Returns false if a folder could only be watched by polling, the index is not watched then.
+  bool watch_folders(const std::string& root, file_index& index, bool watch)
+    {
+    bool immediate = true;
+    for (const auto& f : index.folders)
+      {
+      if (watch)
+        immediate = gp_watcher->watch(root + f.first) && immediate;
+      else
+        gp_watcher->unwatch(root + f.first);
+      }
+    index.watched = watch;
+    if (!immediate)
+      watch_folders(root, index, false);
+    return immediate;
+    }
+
+  size_t nr_of_watched_folders()
+    {
+    size_t n = 0;
+    for (const auto& index : indexes)
+      {
+      if (index.second.watched)
+        n += index.second.folders.size();
+      }
+    return n;
+    }
+
+  void drop_least_recently_used_index()
+    {
+    auto oldest = indexes.end();
+    for (auto it = indexes.begin(); it != indexes.end(); ++it)
+      {
+      if (it->second.build_job == 0 && (oldest == indexes.end() || it->second.last_used < oldest->second.last_used))
+        oldest = it;
+      }
+    if (oldest == indexes.end())
+      return;
+    if (oldest->second.watched)
+      watch_folders(oldest->first, oldest->second, false);
+    indexes.erase(oldest);
+    }
+
+  // removes folder and its subfolders from a watched index
+  void remove_folder_tree(const std::string& root, file_index& index, const std::string& folder)
+    {
+    auto it = index.folders.lower_bound(folder);
+    while (it != index.folders.end() && starts_with(it->first, folder))
+      {
+      gp_watcher->unwatch(root + it->first);
+      it = index.folders.erase(it);
+      }
+    }
+
+  // the entry of a new folder in an index, until its listing comes in
+  std::shared_ptr<const folder_files> unlisted_folder(const std::string& folder)
+    {
+    auto ff = std::make_shared<folder_files>();
+    ff->folder = folder;
+    ff->folder_lower = lower_case(folder);
+    ff->folder_mask = character_mask(ff->folder_lower.data(), ff->folder_lower.data() + ff->folder_lower.size());
+    ff->starts.push_back(0);
+    return ff;
+    }
+
+  // Lists the folder of fu again on a thread of the pool, see finish_update.
+  void update_task(std::shared_ptr<folder_update> fu, uint64_t job_id, JAM::thread_pool& pool, async_messages& messages)
+    {
+    fu->exists = JAM::is_directory(fu->root + fu->folder);
+    if (fu->exists)
+      fu->listed = read_folder(fu->root, fu->folder, fu->subfolders);
+    if (pool.stopped())
+      return;
+    async_message m;
+    m.m = ASYNC_MESSAGE_FILE_INDEX;
+    m.job_id = job_id;
+    post(pool, messages, std::move(m));
+    }
+
+  void start_update(const std::string& root, file_index& index, const std::string& folder)
+    {
+    auto fu = std::make_shared<folder_update>();
+    fu->root = root;
+    fu->folder = folder;
+    index.relisting.insert(folder);
+    const uint64_t job_id = ++last_job_id;
+    updates[job_id] = fu;
+    JAM::thread_pool* pool = gp_pool;
+    async_messages* messages = gp_messages;
+    pool->push([fu, job_id, pool, messages]() { update_task(fu, job_id, *pool, *messages); });
+    }
+
+  /*
+  Replaces the part of its index that the folder of fu held by the new listing, or drops the listing if the index is not
+  watched anymore. The subfolders that are not in the index yet are added without files, watched, and then listed by
+  updates of their own, so that no change after a folder is read is missed, and the watcher is only used by the main thread.
+  */
+  void finish_update(const folder_update& fu)
+    {
+    auto iit = indexes.find(fu.root);
+    file_index* fi = iit != indexes.end() ? &iit->second : nullptr;
+    if (fi)
+      fi->relisting.erase(fu.folder);
+    if (!fi || !fi->watched || fi->folders.find(fu.folder) == fi->folders.end())
+      return;
+    const std::string& root = fu.root;
+    bool watched = true;
+    if (!fu.exists)
+      remove_folder_tree(root, *fi, fu.folder);
+    else
+      {
+      fi->folders[fu.folder] = fu.listed;
+      const std::set<std::string> present(fu.subfolders.begin(), fu.subfolders.end());
+      std::vector<std::string> removed;
+      for (auto it = fi->folders.upper_bound(fu.folder); it != fi->folders.end() && starts_with(it->first, fu.folder); ++it)
+        {
+        const bool child = it->first.find('/', fu.folder.size()) == it->first.size() - 1;
+        if (child && present.find(it->first) == present.end())
+          removed.push_back(it->first);
+        }
+      for (const auto& f : removed)
+        remove_folder_tree(root, *fi, f);
+      for (const auto& f : fu.subfolders)
+        {
+        if (!watched || !fi->folders.emplace(f, unlisted_folder(f)).second)
+          continue;
+        watched = gp_watcher->watch(root + f);
+        start_update(root, *fi, f);
+        }
+      }
+    fi->snapshot.reset();
+    if (!watched || nr_of_watched_folders() > max_watched_folders)
+      {
+      watch_folders(root, *fi, false);
+      fi->relisting.clear();
+      fi->changed_again.clear();
+      return;
+      }
+    for (auto it = fi->changed_again.begin(); it != fi->changed_again.end();)
+      {
+      if (fi->relisting.find(*it) != fi->relisting.end())
+        ++it;
+      else
+        {
+        if (fi->folders.find(*it) != fi->folders.end())
+          start_update(root, *fi, *it);
+        it = fi->changed_again.erase(it);
+        }
+      }
+    if (fi->relisting.empty())
+      fi->changed_again.clear();
+    }
+
+  bool is_separator(char ch)
+    {
+    return ch == '/' || ch == '\\' || ch == '_' || ch == '-' || ch == '.' || ch == ' ';
+    }
+
+  /*
+  Scores the match of query in [first, last) of path, or returns -1 if the characters of query do not occur there in
+  order. The scored match ends where the leftmost match ends, and starts as late as possible, so that it is the
+  shortest match that ends there.
+  */
+  int score_match(const std::string& path, const std::string& lower, size_t first, size_t last, size_t filename_start, const std::string& query)
+    {
+    size_t q = 0;
+    size_t end = first;
+    for (size_t i = first; i < last; ++i)
+      {
+      if (lower[i] == query[q] && ++q == query.size())
+        {
+        end = i + 1;
+        break;
+        }
+      }
+    if (q < query.size())
+      return -1;
+    size_t start = end;
+    for (q = query.size(); q > 0;)
+      {
+      --start;
+      if (lower[start] == query[q - 1])
+        --q;
+      }
+    int score = 0;
+    bool consecutive = false;
+    for (size_t i = start; i < end; ++i)
+      {
+      if (q == query.size() || lower[i] != query[q])
+        {
+        score -= penalty_gap;
+        consecutive = false;
+        continue;
+        }
+      score += score_character;
+      if (i == 0 || is_separator(path[i - 1]) || (path[i] >= 'A' && path[i] <= 'Z' && path[i - 1] >= 'a' && path[i - 1] <= 'z'))
+        score += bonus_boundary;
+      if (consecutive)
+        score += bonus_consecutive;
+      if (i >= filename_start)
+        score += bonus_filename;
+      consecutive = true;
+      ++q;
+      }
+    return score;
+    }
+
+  // the best of the leftmost match in the complete path and the leftmost match in the filename only
+  int score_path(const std::string& path, const std::string& lower, size_t filename_start, const std::string& query)
+    {
+    if (query.empty())
+      return 0;
+    int score = score_match(path, lower, 0, path.size(), filename_start, query);
+    if (score >= 0 && filename_start > 0)
+      score = std::max(score, score_match(path, lower, filename_start, path.size(), filename_start, query));
+    return score;
+    }
+
+  std::string path_of(const ranked_file& r)
+    {
+    const auto& ff = *r.folder;
+    return ff.folder + ff.names.substr(ff.starts[r.index], ff.starts[r.index + 1] - ff.starts[r.index]);
+    }
+
+  bool better(const ranked_file& lhs, const ranked_file& rhs)
+    {
+    if (lhs.score != rhs.score)
+      return lhs.score > rhs.score;
+    if (lhs.length != rhs.length)
+      return lhs.length < rhs.length;
+    if (lhs.folder != rhs.folder)
+      return lhs.folder->folder < rhs.folder->folder;
+    return lhs.index < rhs.index; // the names of a folder are sorted
+    }
+
+  // best is a heap with the worst of the best files in front
+  void add_ranked_file(std::vector<ranked_file>& best, const ranked_file& r)
+    {
+    if (best.size() < max_results)
+      {
+      best.push_back(r);
+      std::push_heap(best.begin(), best.end(), better);
+      }
+    else if (better(r, best.front()))
+      {
+      std::pop_heap(best.begin(), best.end(), better);
+      best.back() = r;
+      std::push_heap(best.begin(), best.end(), better);
+      }
+    }
+
+  void search_folder(const file_search& fs, const folder_files& ff, std::vector<ranked_file>& best, std::string& path, std::string& lower)
+    {
+    const uint64_t not_in_folder = fs.mask & ~ff.folder_mask;
+    const size_t nr_of_files = ff.masks.size();
+    for (size_t i = 0; i < nr_of_files; ++i)
+      {
+      if ((not_in_folder & ~ff.masks[i]) != 0)
+        continue;
+      const size_t name_size = ff.starts[i + 1] - ff.starts[i];
+      path.assign(ff.folder);
+      path.append(ff.names, ff.starts[i], name_size);
+      lower.assign(ff.folder_lower);
+      lower.append(ff.lower, ff.starts[i], name_size);
+      const int score = score_path(path, lower, ff.folder.size(), fs.query);
+      if (score >= 0)
+        add_ranked_file(best, ranked_file{ score, (uint32_t)path.size(), &ff, (uint32_t)i });
+      }
+    }
+
+  bool stopped(const file_search& fs, const JAM::thread_pool& pool)
+    {
+    return pool.stopped() || latest_search.load() != fs.job_id;
+    }
+
+  // Takes folders from the search until all folders are searched, the last task to finish posts the results.
+  void search_task(std::shared_ptr<file_search> fs, JAM::thread_pool& pool, async_messages& messages)
+    {
+    std::vector<ranked_file> best;
+    std::string path, lower;
+    const auto& folders = *fs->folders;
+    for (size_t f = fs->next_folder.fetch_add(folders_per_step); f < folders.size() && !stopped(*fs, pool); f = fs->next_folder.fetch_add(folders_per_step))
+      {
+      const size_t last = std::min(folders.size(), f + folders_per_step);
+      for (size_t i = f; i < last; ++i)
+        search_folder(*fs, *folders[i], best, path, lower);
+      }
+    bool last_task = false;
+    {
+    std::scoped_lock<std::mutex> lock(fs->mt);
+    for (const auto& r : best)
+      add_ranked_file(fs->best, r);
+    last_task = --fs->tasks_left == 0;
+    }
+    if (!last_task || stopped(*fs, pool))
+      return;
+    std::sort(fs->best.begin(), fs->best.end(), better);
+    async_message m;
+    m.m = ASYNC_MESSAGE_OPEN_RESULTS;
+    m.file_id = fs->file_id;
+    m.job_id = fs->job_id;
+    for (const auto& r : fs->best)
+      {
+      if (!m.str.empty())
+        m.str.push_back('\n');
+      m.str.append(path_of(r));
+      }
+    post(pool, messages, std::move(m));
+    }
+
+  void run_search(file_index& index, const std::string& query, int64_t file_id, uint64_t job_id)
+    {
+    if (!index.snapshot)
+      {
+      auto folders = std::make_shared<folder_list>();
+      folders->reserve(index.folders.size());
+      for (const auto& f : index.folders)
+        folders->push_back(f.second);
+      index.snapshot = folders;
+      }
+    auto fs = std::make_shared<file_search>();
+    fs->job_id = job_id;
+    fs->file_id = file_id;
+    for (char ch : query)
+      {
+      if (ch != ' ')
+        fs->query.push_back(to_lower(ch));
+      }
+    fs->mask = character_mask(fs->query.data(), fs->query.data() + fs->query.size());
+    fs->folders = index.snapshot;
+    const int nr_of_tasks = (int)std::max<size_t>(gp_pool->size(), 2) - 1;
+    fs->tasks_left = nr_of_tasks; // the tasks count it down as they finish, so it cannot bound the loop below
+    JAM::thread_pool* pool = gp_pool;
+    async_messages* messages = gp_messages;
+    for (int i = 0; i < nr_of_tasks; ++i)
+      pool->push([fs, pool, messages]() { search_task(fs, *pool, *messages); });
+    }
+  }
+
+void find_files_in_background(JAM::thread_pool* pool, async_messages* messages, JAM::file_watcher* watcher)
+  {
+  for (auto& index : indexes)
+    {
+    if (index.second.watched)
+      watch_folders(index.first, index.second, false);
+    }
+  indexes.clear();
+  builds.clear();
+  updates.clear();
+  waiting.clear();
+  ++latest_search;
+  gp_pool = pool;
+  gp_messages = messages;
+  gp_watcher = watcher;
+  }
+
+uint64_t start_file_search(const std::string& root, const std::string& query, int64_t file_id, bool reread)
+  {
+  const uint64_t job_id = ++last_job_id;
+  latest_search = job_id;
+  if (!gp_pool)
+    return job_id;
+  if (indexes.find(root) == indexes.end() && indexes.size() >= max_indexes)
+    drop_least_recently_used_index();
+  file_index& index = indexes[root];
+  index.last_used = ++use_counter;
+  if (index.build_job == 0 && (!index.built || (reread && !index.watched)))
+    start_build(root, index);
+  if (index.built)
+    run_search(index, query, file_id, job_id); // while the index is built again, the previous index is searched
+  if (index.build_job != 0)
+    {
+    waiting.erase(std::remove_if(waiting.begin(), waiting.end(), [&](const waiting_search& ws) { return ws.file_id == file_id; }), waiting.end());
+    waiting.push_back(waiting_search{ root, query, file_id, job_id });
+    }
+  return job_id;
+  }
+
+void finish_file_index(uint64_t job_id)
+  {
+  auto uit = updates.find(job_id);
+  if (uit != updates.end())
+    {
+    const std::shared_ptr<folder_update> fu = uit->second;
+    updates.erase(uit);
+    finish_update(*fu);
+    return;
+    }
+  auto it = builds.find(job_id);
+  if (it == builds.end())
+    return;
+  std::shared_ptr<index_build> ib = it->second;
+  builds.erase(it);
+  auto iit = indexes.find(ib->root);
+  if (iit == indexes.end() || iit->second.build_job != job_id)
+    return;
+  file_index& index = iit->second;
+  if (index.watched)
+    watch_folders(ib->root, index, false);
+  index.folders.clear();
+  for (auto& ff : ib->folders)
+    index.folders[ff->folder] = ff;
+  index.snapshot.reset();
+  index.built = true;
+  index.build_job = 0;
+  if (nr_of_watched_folders() + index.folders.size() <= max_watched_folders)
+    watch_folders(ib->root, index, true);
+  std::vector<waiting_search> ready;
+  for (auto wit = waiting.begin(); wit != waiting.end();)
+    {
+    if (wit->root == ib->root)
+      {
+      ready.push_back(*wit);
+      wit = waiting.erase(wit);
+      }
+    else
+      ++wit;
+    }
+  for (const auto& ws : ready)
+    {
+    if (ws.job_id == latest_search.load())
+      run_search(index, ws.query, ws.file_id, ws.job_id);
+    }
+  }
+
+void file_index_folder_changed(const std::string& folder)
+  {
+  for (auto& index : indexes)
+    {
+    const std::string& root = index.first;
+    file_index& fi = index.second;
+    if (!fi.watched || !starts_with(folder, root))
+      continue;
+    const std::string relative = folder.substr(root.size());
+    if (fi.relisting.find(relative) != fi.relisting.end() || (!fi.relisting.empty() && fi.folders.find(relative) == fi.folders.end()))
+      fi.changed_again.insert(relative); // a listing that is running may miss it, or it is a new folder that is being added
+    else if (fi.folders.find(relative) != fi.folders.end())
+      start_update(root, fi, relative);
+    }
+  }
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <jam_file_watcher.h>
+#include <jam_thread_pool.h>
+
+#include "async_messages.h"
+
+/*
+Fuzzy search for files by their path, for the Open command.
+
+The files in a folder and its subfolders are kept in an index in memory. The index is built on the thread pool by tasks
+that share a queue of folders, as in start_grep, and is kept up to date by watching its folders: a folder that changes
+is listed again on the thread pool, and only its own part of the index is replaced. An index is only watched if each of
+its folders gets a watch that reports changes as they happen, and all indexes together watch at most max_watched_folders
+folders. Each folder keeps the names of its files one after the other in one block, together with a mask of the
+characters that occur in each name, so that most paths that cannot match a query are rejected by comparing two masks,
+without looking at their characters.
+
+A path matches if the characters of the query occur in it in the same order, ignoring case and spaces. Matches rank
+higher when their characters follow each other, start a word or a part of the path, or lie in the filename. Equal
+scores rank shorter paths first.
+*/
+
+// Lets the file finder work on pool, post to messages and watch the indexed folders with watcher. Main thread only, nullptrs clear the indexes.
+void find_files_in_background(JAM::thread_pool* pool, async_messages* messages, JAM::file_watcher* watcher);
+
+/*
+Ranks the files under root for query on the thread pool. The best matches are posted as ASYNC_MESSAGE_OPEN_RESULTS
+for file_id with the returned job id, one path relative to root per line. The index of root is built first if it does
+not exist yet, or if reread is true and the index is not watched, as for a tree with too many folders to watch.
+Starting a search stops the search that is still running. Main thread only.
+*/
+uint64_t start_file_search(const std::string& root, const std::string& query, int64_t file_id, bool reread);
+
+/*
+Called by the main thread for ASYNC_MESSAGE_FILE_INDEX. Takes the index of the background build job_id and starts the search
+that waited for it, or takes the new listing of a folder that changed.
+*/
+void finish_file_index(uint64_t job_id);
+
+// Lists folder, a path that the watcher reported, again on the thread pool if it is an indexed folder. Main thread only.
+void file_index_folder_changed(const std::string& folder);
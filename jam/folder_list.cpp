@@ -0,0 +1,249 @@
+#include "folder_list.h"
+
+#include <jam_encoding.h>
+#include <jam_file_utils.h>
+
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace
+  {
+  const size_t max_cached_folders = 32;
+
+  struct folder_entry
+    {
+    std::string key; // name in lower case
+    std::string name;
+    bool is_folder;
+    int64_t length; // number of characters of the line of the entry in the listing
+    };
+
+  // folders first, then on key, and on name for names that only differ in case
+  bool operator < (const folder_entry& lhs, const folder_entry& rhs)
+    {
+    if (lhs.is_folder != rhs.is_folder)
+      return lhs.is_folder;
+    const int c = lhs.key.compare(rhs.key);
+    if (c != 0)
+      return c < 0;
+    return lhs.name < rhs.name;
+    }
+
+  bool same_entry(const folder_entry& lhs, const folder_entry& rhs)
+    {
+    return lhs.is_folder == rhs.is_folder && lhs.name == rhs.name;
+    }
+
+  void add_entries(std::vector<folder_entry>& entries, const std::vector<std::string>& paths, bool is_folder)
+    {
+    for (const auto& path : paths)
+      {
+      folder_entry e;
+      e.name = path.substr(path.find_last_of("/\\") + 1);
+      e.key = e.name;
+      for (auto& ch : e.key)
+        ch = (char)tolower((unsigned char)ch);
+      e.is_folder = is_folder;
+      e.length = -1;
+      entries.push_back(std::move(e));
+      }
+    }
+
+  std::vector<folder_entry> read_entries(const std::string& foldername)
+    {
+    std::vector<std::string> files, folders;
+    JAM::get_files_and_subdirectories_from_directory(foldername, files, folders);
+    std::vector<folder_entry> entries;
+    entries.reserve(files.size() + folders.size());
+    add_entries(entries, folders, true);
+    add_entries(entries, files, false);
+    std::sort(entries.begin(), entries.end());
+    return entries;
+    }
+
+  std::wstring entry_line(const folder_entry& e)
+    {
+    std::wstring line = JAM::convert_string_to_wstring(e.name);
+    if (e.is_folder)
+      line.push_back('/');
+    line.push_back('\n');
+    return line;
+    }
+
+  jamlib::buffer make_list(std::vector<folder_entry>& entries)
+    {
+    auto content = jamlib::buffer().transient();
+    content.push_back('.');
+    content.push_back('.');
+    content.push_back('\n');
+    for (auto& e : entries)
+      {
+      const std::wstring line = entry_line(e);
+      e.length = (int64_t)line.size();
+      for (auto ch : line)
+        content.push_back(ch);
+      }
+    return content.persistent();
+    }
+
+  struct cached_folder
+    {
+    std::vector<folder_entry> entries; // sorted
+    jamlib::buffer content;
+    uint64_t last_used;
+    };
+
+  std::map<std::string, cached_folder> cache;
+  uint64_t use_counter = 0;
+  JAM::file_watcher* gp_watcher = nullptr;
+  std::mutex changed_mt;
+  std::set<std::string> changed_folders; // reported by the watcher thread, protected by changed_mt
+  bool all_folders_changed = false; // protected by changed_mt
+
+  /*
+  Merges the new entries with the cached entries of cf. Entries that are in both keep their line in the listing, the
+  other lines are erased from or inserted in the cached listing. Returns false, and leaves cf as it is, if so many
+  entries changed that making the listing again is faster.
+  */
+  bool update_list(cached_folder& cf, std::vector<folder_entry>& entries)
+    {
+    const auto& old_entries = cf.entries;
+    size_t differences = 0;
+    for (size_t i = 0, j = 0; i < old_entries.size() || j < entries.size();)
+      {
+      if (i < old_entries.size() && j < entries.size() && same_entry(old_entries[i], entries[j]))
+        {
+        ++i;
+        ++j;
+        }
+      else if (j == entries.size() || (i < old_entries.size() && old_entries[i] < entries[j]))
+        {
+        ++differences;
+        ++i;
+        }
+      else
+        {
+        ++differences;
+        ++j;
+        }
+      }
+    if (differences * 8 > entries.size())
+      return false;
+
+    jamlib::buffer content = cf.content;
+    int64_t pos = 3; // after "..\n"
+    for (size_t i = 0, j = 0; i < old_entries.size() || j < entries.size();)
+      {
+      if (i < old_entries.size() && j < entries.size() && same_entry(old_entries[i], entries[j]))
+        {
+        entries[j].length = old_entries[i].length;
+        pos += entries[j].length;
+        ++i;
+        ++j;
+        }
+      else if (j == entries.size() || (i < old_entries.size() && old_entries[i] < entries[j]))
+        {
+        content = content.erase((uint32_t)pos, (uint32_t)(pos + old_entries[i].length));
+        ++i;
+        }
+      else
+        {
+        const std::wstring line = entry_line(entries[j]);
+        entries[j].length = (int64_t)line.size();
+        auto text = jamlib::buffer().transient();
+        for (auto ch : line)
+          text.push_back(ch);
+        content = content.insert((uint32_t)pos, text.persistent());
+        pos += entries[j].length;
+        ++j;
+        }
+      }
+    cf.entries.swap(entries);
+    cf.content = content;
+    return true;
+    }
+
+  void evict_least_recently_used()
+    {
+    auto oldest = cache.begin();
+    for (auto it = cache.begin(); it != cache.end(); ++it)
+      {
+      if (it->second.last_used < oldest->second.last_used)
+        oldest = it;
+      }
+    gp_watcher->unwatch(oldest->first);
+    cache.erase(oldest);
+    }
+  }
+
+jamlib::buffer read_folder_list(const std::string& foldername)
+  {
+  auto entries = read_entries(foldername);
+  return make_list(entries);
+  }
+
+jamlib::buffer get_folder_list(const std::string& foldername, bool reread)
+  {
+  if (!gp_watcher)
+    return read_folder_list(foldername);
+  bool changed = false;
+  {
+  std::scoped_lock<std::mutex> lock(changed_mt);
+  if (all_folders_changed)
+    {
+    for (const auto& cf : cache)
+      changed_folders.insert(cf.first);
+    all_folders_changed = false;
+    }
+  changed = changed_folders.erase(foldername) > 0;
+  }
+  auto it = cache.find(foldername);
+  if (it != cache.end() && !changed && !reread)
+    {
+    it->second.last_used = ++use_counter;
+    return it->second.content;
+    }
+  if (it == cache.end())
+    {
+    if (cache.size() >= max_cached_folders)
+      evict_least_recently_used();
+    gp_watcher->watch(foldername); // before the folder is read, so that no change after reading it is missed
+    it = cache.emplace(foldername, cached_folder()).first;
+    }
+  cached_folder& cf = it->second;
+  auto entries = read_entries(foldername);
+  if (cf.entries.empty() || !update_list(cf, entries))
+    {
+    cf.content = make_list(entries);
+    cf.entries.swap(entries);
+    }
+  cf.last_used = ++use_counter;
+  return cf.content;
+  }
+
+void cache_folder_lists(JAM::file_watcher* watcher)
+  {
+  if (gp_watcher)
+    {
+    for (const auto& cf : cache)
+      gp_watcher->unwatch(cf.first);
+    }
+  cache.clear();
+  gp_watcher = watcher;
+  }
+
+void folder_changed(const std::string& folder)
+  {
+  std::scoped_lock<std::mutex> lock(changed_mt);
+  changed_folders.insert(folder);
+  }
+
+void folder_lists_changed()
+  {
+  std::scoped_lock<std::mutex> lock(changed_mt);
+  all_folders_changed = true;
+  }
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+#include <jamlib/jam.h>
+#include <jam_file_watcher.h>
+
+/*
+Listing of a folder as it is shown in a folder window: "..", the subfolders followed by a '/', and the files.
+The subfolders and the files are each sorted without regard to case. Can be called from any thread.
+*/
+jamlib::buffer read_folder_list(const std::string& foldername);
+
+/*
+The listing of read_folder_list, for the folders that were listed last. Main thread only.
+
+Each cached folder keeps its entries with their case folded sort keys, and is watched by the watcher passed to
+cache_folder_lists. Until the watcher reports a change, the cached listing is returned as is. After a change, or
+when reread is true (as for Get, since a change can get lost), the folder is read again and its sorted entries are merged with
+the cached ones: an unchanged folder returns the same buffer as before, and a few added or removed entries are
+inserted in or erased from the cached buffer, so that the rest of the buffer is shared with the previous listing.
+*/
+jamlib::buffer get_folder_list(const std::string& foldername, bool reread = false);
+
+// Lets get_folder_list watch the folders it caches with watcher, which has to call folder_changed. Without a watcher nothing is cached.
+void cache_folder_lists(JAM::file_watcher* watcher);
+
+// Marks the cached listing of the watched path folder as out of date. Can be called from any thread.
+void folder_changed(const std::string& folder);
+
+// Marks all cached listings as out of date, as when changes reported by the watcher were lost. Can be called from any thread.
+void folder_lists_changed();
@@ -0,0 +1,328 @@
+#include "grep.h"
+
+#include <jam_file_utils.h>
+#include <jam_mapped_file.h>
+#include <jam_utf8.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+  {
+  const size_t binary_check_size = 8000; // as git does, a file with a 0 byte in its first 8000 bytes is binary
+  const size_t max_line_length = 256; // longer matching lines are cut off in the results
+  const size_t max_message_size = 64 * 1024; // the results of a file with many matches are posted in parts
+
+  struct grep_search
+    {
+    uint64_t generation;
+    int64_t file_id;
+    int64_t max_file_size;
+    std::string literal; // every matching line contains literal
+    bool use_regex;
+    std::regex re;
+
+    std::mutex mt;
+    std::condition_variable cv;
+    std::vector<std::string> folders, files; // still to be listed or searched
+    int busy = 0; // number of tasks that are listing a folder or searching a file
+    int tasks_left = 0;
+    std::atomic<uint64_t> matches{ 0 };
+    std::atomic<uint64_t> files_searched{ 0 };
+    };
+
+  std::atomic<uint64_t> g_generation{ 0 };
+
+  bool is_literal(const std::string& pattern)
+    {
+    return pattern.find_first_of(".^$|()[]{}*+?\\") == std::string::npos;
+    }
+
+  /*
+  The longest run of plain characters outside of groups and character classes, without the characters that a
+  quantifier makes optional. Alternatives outside of a group make every part optional, so then there is no required string.
+  */
+  std::string required_literal(const std::string& pattern)
+    {
+    std::string best, run;
+    int depth = 0;
+    auto end_run = [&]()
+      {
+      if (run.size() > best.size())
+        best = run;
+      run.clear();
+      };
+    auto add = [&](char ch, size_t i)
+      {
+      const char next = i + 1 < pattern.size() ? pattern[i + 1] : 0;
+      if (depth > 0 || next == '*' || next == '?' || next == '{')
+        end_run();
+      else
+        run.push_back(ch);
+      };
+    for (size_t i = 0; i < pattern.size(); ++i)
+      {
+      const char ch = pattern[i];
+      switch (ch)
+        {
+        case '\\':
+        {
+        if (i + 1 == pattern.size())
+          break;
+        ++i;
+        if (isalnum((unsigned char)pattern[i])) // a character class such as \d, or an assertion such as \b
+          end_run();
+        else
+          add(pattern[i], i);
+        break;
+        }
+        case '[':
+        {
+        end_run();
+        ++i;
+        if (i < pattern.size() && pattern[i] == '^')
+          ++i;
+        if (i < pattern.size() && pattern[i] == ']')
+          ++i;
+        while (i < pattern.size() && pattern[i] != ']')
+          {
+          if (pattern[i] == '\\')
+            ++i;
+          ++i;
+          }
+        break;
+        }
+        case '{':
+        {
+        end_run();
+        while (i < pattern.size() && pattern[i] != '}')
+          ++i;
+        break;
+        }
+        case '(':
+          ++depth;
+          end_run();
+          break;
+        case ')':
+          --depth;
+          end_run();
+          break;
+        case '|':
+          if (depth == 0)
+            return std::string();
+          end_run();
+          break;
+        case '.':
+        case '^':
+        case '$':
+        case '*':
+        case '+':
+        case '?':
+          end_run();
+          break;
+        default:
+          add(ch, i);
+          break;
+        }
+      }
+    end_run();
+    return best;
+    }
+
+  // memchr is vectorized by the C library, so most of the text is skipped without comparing the rest of literal
+  const char* find_literal(const char* first, const char* last, const std::string& literal)
+    {
+    const char front = literal[0];
+    const size_t rest = literal.size() - 1;
+    while (last - first > (ptrdiff_t)rest)
+      {
+      const char* p = (const char*)memchr(first, front, (size_t)(last - first) - rest);
+      if (!p)
+        return nullptr;
+      if (memcmp(p + 1, literal.data() + 1, rest) == 0)
+        return p;
+      first = p + 1;
+      }
+    return nullptr;
+    }
+
+  void post(grep_search& gs, JAM::thread_pool& pool, async_messages& messages, std::string&& text)
+    {
+    async_message m;
+    m.m = ASYNC_MESSAGE_SEARCH_RESULTS;
+    m.file_id = gs.file_id;
+    m.str = std::move(text);
+    messages.push_until(std::move(m), [&]() { return pool.stopped(); });
+    }
+
+  bool stopped(const grep_search& gs, const JAM::thread_pool& pool)
+    {
+    return pool.stopped() || g_generation.load() != gs.generation;
+    }
+
+  void search_file(grep_search& gs, JAM::thread_pool& pool, async_messages& messages, const std::string& filename)
+    {
+    JAM::mapped_file mf;
+    if (!mf.open(filename) || mf.size() == 0 || (gs.max_file_size > 0 && mf.size() > (uint64_t)gs.max_file_size))
+      return;
+    const char* data = mf.data();
+    const char* last = data + mf.size();
+    if (memchr(data, 0, std::min<size_t>((size_t)mf.size(), binary_check_size)))
+      return;
+    ++gs.files_searched;
+    std::string results;
+    int64_t line_nr = 1;
+    const char* counted = data;
+    const char* p = data; // always at the beginning of a line
+    while (p < last)
+      {
+      const char* line_begin = p;
+      if (!gs.literal.empty())
+        {
+        const char* hit = find_literal(p, last, gs.literal);
+        if (!hit)
+          break;
+        line_begin = hit;
+        while (line_begin > p && line_begin[-1] != '\n')
+          --line_begin;
+        }
+      const char* line_end = (const char*)memchr(line_begin, '\n', (size_t)(last - line_begin));
+      if (!line_end)
+        line_end = last;
+      p = line_end + 1;
+      if (line_end > line_begin && line_end[-1] == '\r')
+        --line_end;
+      if (gs.use_regex && !std::regex_search(line_begin, line_end, gs.re))
+        continue;
+      line_nr += std::count(counted, line_begin, '\n');
+      counted = line_begin;
+      ++gs.matches;
+      if (!results.empty())
+        results.push_back('\n');
+      results.append(filename);
+      results.push_back(':');
+      results.append(std::to_string(line_nr));
+      results.append(": ");
+      const char* text_end = line_begin + std::min<size_t>((size_t)(line_end - line_begin), max_line_length);
+      utf8::replace_invalid(line_begin, text_end, std::back_inserter(results));
+      if (results.size() >= max_message_size)
+        {
+        if (stopped(gs, pool))
+          return;
+        post(gs, pool, messages, std::move(results));
+        results.clear();
+        }
+      }
+    if (!results.empty() && !stopped(gs, pool))
+      post(gs, pool, messages, std::move(results));
+    }
+
+  void list_folder(grep_search& gs, const std::string& folder)
+    {
+    std::vector<std::string> files, folders;
+    JAM::get_files_and_subdirectories_from_directory(folder, files, folders);
+    std::scoped_lock<std::mutex> lock(gs.mt);
+    gs.files.insert(gs.files.end(), files.begin(), files.end());
+    gs.folders.insert(gs.folders.end(), folders.begin(), folders.end());
+    }
+
+  // Takes folders and files from the queue until it is empty and no other task can add to it anymore.
+  void grep_task(std::shared_ptr<grep_search> gs, JAM::thread_pool& pool, async_messages& messages)
+    {
+    for (;;)
+      {
+      std::string path;
+      bool is_folder = false;
+      {
+      std::unique_lock<std::mutex> lock(gs->mt);
+      gs->cv.wait(lock, [&]() { return !gs->files.empty() || !gs->folders.empty() || gs->busy == 0; });
+      if (stopped(*gs, pool))
+        {
+        gs->files.clear();
+        gs->folders.clear();
+        }
+      if (!gs->files.empty()) // files first, so that results come in early
+        {
+        path = std::move(gs->files.back());
+        gs->files.pop_back();
+        }
+      else if (!gs->folders.empty())
+        {
+        path = std::move(gs->folders.back());
+        gs->folders.pop_back();
+        is_folder = true;
+        }
+      else
+        break;
+      ++gs->busy;
+      }
+      if (is_folder)
+        list_folder(*gs, path);
+      else
+        search_file(*gs, pool, messages, path);
+      {
+      std::scoped_lock<std::mutex> lock(gs->mt);
+      --gs->busy;
+      }
+      gs->cv.notify_all();
+      }
+    gs->cv.notify_all();
+    bool last_task = false;
+    {
+    std::scoped_lock<std::mutex> lock(gs->mt);
+    last_task = --gs->tasks_left == 0;
+    }
+    if (last_task && !stopped(*gs, pool))
+      {
+      std::stringstream str;
+      str << "Grep found " << gs->matches.load() << (gs->matches.load() == 1 ? " match" : " matches") << " in " << gs->files_searched.load() << " files";
+      post(*gs, pool, messages, str.str());
+      }
+    }
+  }
+
+bool start_grep(const std::string& pattern, const std::string& folder, int64_t max_file_size, int64_t file_id, JAM::thread_pool& pool, async_messages& messages, std::string& error)
+  {
+  auto gs = std::make_shared<grep_search>();
+  gs->file_id = file_id;
+  gs->max_file_size = max_file_size;
+  gs->use_regex = !is_literal(pattern);
+  if (gs->use_regex)
+    {
+    try
+      {
+      gs->re = std::regex(pattern);
+      }
+    catch (const std::regex_error& e)
+      {
+      error = "Grep: " + pattern + " is not a valid regular expression: " + e.what();
+      return false;
+      }
+    gs->literal = required_literal(pattern);
+    }
+  else
+    gs->literal = pattern;
+  gs->generation = ++g_generation;
+  gs->folders.push_back(folder);
+  const int nr_of_tasks = (int)std::max<size_t>(pool.size(), 2) - 1;
+  gs->tasks_left = nr_of_tasks; // the tasks count it down as they finish, so it cannot bound the loop
+  for (int i = 0; i < nr_of_tasks; ++i)
+    pool.push([gs, &pool, &messages]() { grep_task(gs, pool, messages); });
+  return true;
+  }
+
+void stop_grep()
+  {
+  ++g_generation;
+  }
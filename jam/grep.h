@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+
+#include <jam_thread_pool.h>
+
+#include "async_messages.h"
+
+/*
+Searches the files in folder and its subfolders for pattern on the thread pool.
+
+The folders are listed and the files are searched by pool.size() - 1 tasks that share a queue of folders and files,
+so that one thread of the pool stays free for the other background work of jam. A file is read through a memory
+mapping. The lines that match are posted to messages as ASYNC_MESSAGE_SEARCH_RESULTS for file_id in the form
+"file:line: text", one message per file with matches, followed by a last message with the number of matches.
+
+Pattern is an ECMAScript regular expression, matched line by line. A pattern without special characters is searched
+as a plain string. Otherwise the longest string that every match has to contain is looked for first, and only the lines
+that contain it are matched against the regular expression.
+
+Files that are larger than max_file_size bytes (if max_file_size > 0), files with a 0 byte in their first block (binary
+files), and subfolders whose name starts with a '.' are skipped.
+
+Starting a search stops the search that is still running. Returns false and sets error if pattern is not a valid regular expression.
+*/
+bool start_grep(const std::string& pattern, const std::string& folder, int64_t max_file_size, int64_t file_id, JAM::thread_pool& pool, async_messages& messages, std::string& error);
+
+// Stops the search that is still running, if any, e.g. because its window was closed.
+void stop_grep();
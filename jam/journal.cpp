@@ -0,0 +1,519 @@
+#include "journal.h"
+#include "engine.h"
+#include "utils.h"
+
+#include <jamlib/undo.h>
+#include <jam_file_utils.h>
+#include <jam_filename.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+/*
+Journal format
+
+  header: "JAMJ" | version (u32) | filename | encoding (u32) | modification time of the file (i64, -1 if unknown) | size of its content (u64)
+  record: payload size (u32) | checksum of the payload (u64) | position (i64) | removed length (u32) | inserted length (u32) | inserted characters (u32 each)
+
+All integers are little endian, the filename is prefixed with its length. A record that was not written
+completely when jam crashed fails its checksum, and ends the replay.
+*/
+
+namespace
+  {
+  const char journal_magic[4] = { 'J', 'A', 'M', 'J' };
+  const uint32_t journal_version = 1;
+  const std::string journal_prefix("journal_");
+  const std::string journal_extension(".journal");
+  const std::string lock_extension(".lock");
+  const uint32_t record_header_size = 4 + 8;
+  const uint32_t max_record_size = 1 << 30;
+  const int batch_interval_ms = 200; // edits that are made within this time are flushed to disk together
+
+  uint64_t checksum(const char* data, size_t size)
+    {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < size; ++i)
+      {
+      hash ^= (uint8_t)data[i];
+      hash *= 1099511628211ULL;
+      }
+    return hash;
+    }
+
+  void write_u32(std::string& out, uint32_t v)
+    {
+    for (int i = 0; i < 4; ++i)
+      out.push_back((char)((v >> (8 * i)) & 0xff));
+    }
+
+  void write_u64(std::string& out, uint64_t v)
+    {
+    for (int i = 0; i < 8; ++i)
+      out.push_back((char)((v >> (8 * i)) & 0xff));
+    }
+
+  struct journal_reader
+    {
+    const std::string& data;
+    size_t pos;
+
+    journal_reader(const std::string& d) : data(d), pos(0) {}
+
+    bool can_read(size_t bytes) const
+      {
+      return pos <= data.size() && bytes <= data.size() - pos;
+      }
+
+    uint64_t read_bytes(int bytes)
+      {
+      uint64_t v = 0;
+      for (int i = 0; i < bytes; ++i)
+        v |= ((uint64_t)(uint8_t)data[pos++]) << (8 * i);
+      return v;
+      }
+    };
+
+  std::string journal_path(const std::string& owner, const std::string& filename)
+    {
+    std::stringstream str;
+    str << journal_prefix << owner << '_' << std::hex << checksum(filename.data(), filename.size()) << journal_extension;
+    return get_file_in_executable_path(str.str());
+    }
+
+  std::string owner_path(const std::string& owner)
+    {
+    return get_file_in_executable_path(journal_prefix + owner + lock_extension);
+    }
+
+  std::string process_id()
+    {
+    std::stringstream str;
+#ifdef _WIN32
+    str << std::hex << GetCurrentProcessId();
+#else
+    str << std::hex << getpid();
+#endif
+    return str.str();
+    }
+
+  // Opens path and locks it exclusively without waiting. Returns -1 if another process holds the lock.
+  intptr_t try_lock_file(const std::string& path)
+    {
+#ifdef _WIN32
+    HANDLE h = CreateFileW(JAM::convert_string_to_wstring(path).c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE)
+      return -1;
+    OVERLAPPED ov = {};
+    if (!LockFileEx(h, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &ov))
+      {
+      CloseHandle(h);
+      return -1;
+      }
+    return (intptr_t)h;
+#else
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+      return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+      {
+      close(fd);
+      return -1;
+      }
+    return fd;
+#endif
+    }
+
+  // Removes the owner file at path and releases its lock.
+  void remove_lock_file(const std::string& path, intptr_t lock)
+    {
+    ::remove(path.c_str()); // while it is locked, so that no other jam can lock it in between
+#ifdef _WIN32
+    CloseHandle((HANDLE)lock);
+#else
+    close((int)lock);
+#endif
+    }
+
+  /*
+  Splits the name of a journal or owner file as journal_<owner>_<hash>.journal or journal_<owner>.lock. Journals of older
+  versions of jam are named journal_<hash>.journal and have no owner. Returns false for other files.
+  */
+  bool parse_journal_name(const std::string& name, std::string& owner, bool& is_journal)
+    {
+    if (name.compare(0, journal_prefix.size(), journal_prefix) != 0)
+      return false;
+    for (const std::string* extension : { &journal_extension, &lock_extension })
+      {
+      if (name.size() <= journal_prefix.size() + extension->size() || name.compare(name.size() - extension->size(), extension->size(), *extension) != 0)
+        continue;
+      const std::string middle = name.substr(journal_prefix.size(), name.size() - journal_prefix.size() - extension->size());
+      is_journal = extension == &journal_extension;
+      const size_t sep = middle.find('_');
+      if (is_journal)
+        owner = sep == std::string::npos ? std::string() : middle.substr(0, sep);
+      else
+        owner = middle;
+      return true;
+      }
+    return false;
+    }
+
+  std::string journal_header(const jamlib::file& f, int64_t modification_time, uint64_t size)
+    {
+    std::string out(journal_magic, sizeof(journal_magic));
+    write_u32(out, journal_version);
+    write_u32(out, (uint32_t)f.filename.size());
+    out.append(f.filename);
+    write_u32(out, (uint32_t)f.enc);
+    write_u64(out, (uint64_t)modification_time);
+    write_u64(out, size);
+    return out;
+    }
+
+  std::string journal_record(const jamlib::delta& d)
+    {
+    std::string payload;
+    payload.reserve(8 + 4 + 4 + d.inserted.size() * 4);
+    write_u64(payload, (uint64_t)d.pos);
+    write_u32(payload, d.removed.size());
+    write_u32(payload, d.inserted.size());
+    for (wchar_t ch : d.inserted)
+      write_u32(payload, (uint32_t)ch);
+    std::string out;
+    out.reserve(record_header_size + payload.size());
+    write_u32(out, (uint32_t)payload.size());
+    write_u64(out, checksum(payload.data(), payload.size()));
+    return out + payload;
+    }
+
+  bool replay_journal(recovered_file& rf, const std::string& data, std::string& error)
+    {
+    journal_reader r(data);
+    if (!r.can_read(sizeof(journal_magic) + 8) || memcmp(data.data(), journal_magic, sizeof(journal_magic)) != 0)
+      {
+      error = "is not a journal";
+      return false;
+      }
+    r.pos += sizeof(journal_magic);
+    if (r.read_bytes(4) != journal_version)
+      {
+      error = "has an unknown version";
+      return false;
+      }
+    const uint32_t filename_size = (uint32_t)r.read_bytes(4);
+    if (!r.can_read((size_t)filename_size + 4 + 8 + 8))
+      {
+      error = "is truncated";
+      return false;
+      }
+    rf.filename = data.substr(r.pos, filename_size);
+    r.pos += filename_size;
+    rf.enc = (jamlib::encoding)r.read_bytes(4);
+    const int64_t modification_time = (int64_t)r.read_bytes(8);
+    const uint64_t size = r.read_bytes(8);
+    const std::string path = remove_quotes_from_path(rf.filename);
+    if (JAM::file_exists(path))
+      {
+      jamlib::encoding enc = rf.enc;
+      rf.saved_content = jamlib::read_buffer_from_file(path, enc);
+      }
+    if (modification_time >= 0)
+      {
+      if (modification_time != JAM::file_modification_time(path) || size != rf.saved_content.size())
+        {
+        error = "cannot be replayed: " + path + " was changed on disk";
+        return false;
+        }
+      rf.content = rf.saved_content;
+      }
+    while (r.can_read(record_header_size))
+      {
+      const uint32_t payload_size = (uint32_t)r.read_bytes(4);
+      const uint64_t payload_checksum = r.read_bytes(8);
+      if (payload_size < 16 || payload_size > max_record_size || !r.can_read(payload_size) || payload_checksum != checksum(data.data() + r.pos, payload_size))
+        break; // the last record was not written completely
+      const int64_t pos = (int64_t)r.read_bytes(8);
+      const uint32_t removed = (uint32_t)r.read_bytes(4);
+      const uint32_t inserted = (uint32_t)r.read_bytes(4);
+      if (pos < 0 || (uint64_t)pos + removed > rf.content.size() || payload_size != 16 + (uint64_t)inserted * 4)
+        break;
+      auto text = jamlib::buffer().transient();
+      for (uint32_t i = 0; i < inserted; ++i)
+        text.push_back((wchar_t)r.read_bytes(4));
+      rf.content = rf.content.erase((uint32_t)pos, (uint32_t)pos + removed).insert((uint32_t)pos, text.persistent());
+      }
+    return true;
+    }
+  }
+
+journal::journal() : owner(process_id()), owner_lock(try_lock_file(owner_path(owner))), stop(false)
+  {
+  writer = std::thread([this]() { write_jobs(); });
+  }
+
+journal::~journal()
+  {
+  {
+  std::scoped_lock<std::mutex> lock(mt);
+  stop = true;
+  }
+  cv.notify_all();
+  writer.join();
+  if (owner_lock != -1)
+    remove_lock_file(owner_path(owner), owner_lock);
+  }
+
+void journal::record(const app_state& state)
+  {
+  for (auto& tf : files)
+    tf.second.seen = false;
+  for (const auto& w : state.windows)
+    {
+    if (w.is_command_window || w.piped || w.file_id >= state.file_state.files.size())
+      continue;
+    const auto& f = state.file_state.files[w.file_id];
+    if (f.filename.empty() || f.filename.front() == '+')
+      continue;
+    tracked_file& tf = files[f.filename];
+    tf.seen = true;
+    if (!(f.modification_mask & 1))
+      {
+      if (tf.journaling)
+        push(job{ journal_path(owner, f.filename), std::string(), false, true });
+      tf.journaling = false;
+      tf.not_journaled = false;
+      tf.content = f.content;
+      tf.saved = true;
+      continue;
+      }
+    if (tf.not_journaled)
+      continue;
+    if (!tf.journaling)
+      {
+      if (!ask_user_to_save_modified_file(f)) // looks at the disk, so it is only asked when the file becomes modified
+        {
+        tf.not_journaled = true;
+        continue;
+        }
+      const int64_t modification_time = tf.saved ? JAM::file_modification_time(remove_quotes_from_path(f.filename)) : -1;
+      if (modification_time < 0)
+        tf.content = jamlib::buffer();
+      push(job{ journal_path(owner, f.filename), journal_header(f, modification_time, tf.content.size()), true, false });
+      tf.journaling = true;
+      }
+    else if (tf.content.raw().ptr == f.content.raw().ptr)
+      continue;
+    push(job{ journal_path(owner, f.filename), journal_record(jamlib::make_delta(tf.content, f.content)), false, false });
+    tf.content = f.content;
+    }
+  for (auto it = files.begin(); it != files.end();)
+    {
+    if (it->second.seen)
+      {
+      ++it;
+      continue;
+      }
+    if (it->second.journaling) // the window was closed, or the file was renamed
+      push(job{ journal_path(owner, it->first), std::string(), false, true });
+    it = files.erase(it);
+    }
+  }
+
+void journal::clear()
+  {
+  for (const auto& tf : files)
+    {
+    if (tf.second.journaling)
+      push(job{ journal_path(owner, tf.first), std::string(), false, true });
+    }
+  files.clear();
+  }
+
+std::vector<std::string> journal::take_failed_files()
+  {
+  std::vector<std::string> paths;
+  {
+  std::scoped_lock<std::mutex> lock(mt);
+  paths.swap(failed);
+  }
+  std::vector<std::string> filenames;
+  if (paths.empty())
+    return filenames;
+  const std::set<std::string> failed_paths(paths.begin(), paths.end());
+  for (auto& tf : files)
+    {
+    const std::string path = journal_path(owner, tf.first);
+    if (!tf.second.journaling || failed_paths.find(path) == failed_paths.end())
+      continue;
+    push(job{ path, std::string(), false, true }); // in case it was created again in the meantime
+    tf.second.journaling = false;
+    tf.second.not_journaled = true;
+    filenames.push_back(tf.first);
+    }
+  return filenames;
+  }
+
+void journal::push(job j)
+  {
+  {
+  std::scoped_lock<std::mutex> lock(mt);
+  jobs.push_back(std::move(j));
+  }
+  cv.notify_one();
+  }
+
+void journal::write_jobs()
+  {
+  std::vector<job> batch;
+  std::unique_lock<std::mutex> lock(mt);
+  for (;;)
+    {
+    cv.wait(lock, [this] { return stop || !jobs.empty(); });
+    if (!stop)
+      cv.wait_for(lock, std::chrono::milliseconds(batch_interval_ms), [this] { return stop; });
+    batch.clear();
+    batch.swap(jobs);
+    const bool last_batch = stop;
+    lock.unlock();
+
+    // a journal that is not written completely would be replayed up to the first missing record, so it is removed
+    auto fail = [&](const std::string& path)
+      {
+      auto it = open_journals.find(path);
+      if (it != open_journals.end())
+        {
+        fclose(it->second);
+        open_journals.erase(it);
+        }
+      ::remove(path.c_str());
+      failed_journals.insert(path);
+      std::scoped_lock<std::mutex> failed_lock(mt);
+      failed.push_back(path);
+      };
+
+    std::set<std::string> written;
+    for (const auto& j : batch)
+      {
+      if (j.create || j.remove)
+        failed_journals.erase(j.path);
+      else if (failed_journals.find(j.path) != failed_journals.end())
+        continue;
+      auto it = open_journals.find(j.path);
+      if ((j.create || j.remove) && it != open_journals.end())
+        {
+        fclose(it->second);
+        open_journals.erase(it);
+        it = open_journals.end();
+        }
+      if (j.remove)
+        {
+        ::remove(j.path.c_str());
+        written.erase(j.path);
+        continue;
+        }
+      if (it == open_journals.end())
+        {
+#ifdef _WIN32
+        FILE* f = _wfopen(JAM::convert_string_to_wstring(j.path).c_str(), j.create ? L"wb" : L"ab");
+#else
+        FILE* f = fopen(j.path.c_str(), j.create ? "wb" : "ab");
+#endif
+        if (!f)
+          {
+          fail(j.path);
+          continue;
+          }
+        it = open_journals.emplace(j.path, f).first;
+        }
+      if (fwrite(j.data.data(), 1, j.data.size(), it->second) != j.data.size())
+        {
+        fail(j.path);
+        written.erase(j.path);
+        continue;
+        }
+      written.insert(j.path);
+      }
+    for (const auto& path : written)
+      {
+      FILE* f = open_journals[path];
+#ifdef _WIN32
+      const bool flushed = fflush(f) == 0 && _commit(_fileno(f)) == 0;
+#else
+      const bool flushed = fflush(f) == 0 && fsync(fileno(f)) == 0;
+#endif
+      if (!flushed)
+        fail(path);
+      }
+
+    lock.lock();
+    if (last_batch && jobs.empty())
+      break;
+    }
+  for (auto& j : open_journals)
+    fclose(j.second);
+  open_journals.clear();
+  }
+
+std::vector<recovered_file> recover_journals(std::vector<std::string>& errors)
+  {
+  std::vector<recovered_file> recovered;
+  std::map<std::string, std::vector<std::string>> journals_by_owner; // journals without owner under the empty string
+  const auto paths = JAM::get_files_from_directory(get_file_in_executable_path(""), false);
+  for (const auto& path : paths)
+    {
+    std::string owner;
+    bool is_journal = false;
+    if (!parse_journal_name(JAM::get_filename(path), owner, is_journal))
+      continue;
+    auto& journals = journals_by_owner[owner];
+    if (is_journal)
+      journals.push_back(path);
+    }
+  for (const auto& jo : journals_by_owner)
+    {
+    intptr_t lock = -1;
+    if (!jo.first.empty())
+      {
+      lock = try_lock_file(owner_path(jo.first));
+      if (lock == -1)
+        continue; // its jam is still running
+      }
+    for (const auto& path : jo.second)
+      {
+      if (!JAM::file_exists(path)) // recovered by another jam in the meantime
+        continue;
+      std::ifstream f(path, std::ios::binary);
+      std::stringstream ss;
+      ss << f.rdbuf();
+      f.close();
+      recovered_file rf;
+      std::string error;
+      if (replay_journal(rf, ss.str(), error))
+        {
+        recovered.push_back(rf);
+        ::remove(path.c_str());
+        }
+      else
+        {
+        errors.push_back("Journal " + path + " " + error + ", it was kept as " + path + ".failed");
+        ::rename(path.c_str(), (path + ".failed").c_str());
+        }
+      }
+    if (lock != -1)
+      remove_lock_file(owner_path(jo.first), lock);
+    }
+  return recovered;
+  }
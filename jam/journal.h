@@ -0,0 +1,98 @@
+#pragma once
+
+#include <jamlib/jam.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct app_state;
+
+/*
+Write-ahead journal of the edits that were not saved yet, so that they survive a crash of jam.
+
+Each modified file gets an append-only journal file next to the executable. The journal files of a jam carry its process
+id in their name, and jam holds an exclusive lock on its owner file journal_<id>.lock for as long as it runs, so that
+another jam only recovers the journals of a jam that is not running anymore. The journal starts with the
+modification time of the file on disk when the first edit was made, followed by the deltas (see jamlib/undo.h)
+between the versions of the content that were recorded. When the content of the file on disk was not known,
+the first delta inserts the complete content. A journal is removed as soon as its file is not modified anymore.
+
+Recording costs a comparison of the content with the previously recorded version, plus the encoding of the
+delta when it changed. The journal files are written and flushed to disk in batches by a background thread. If a
+journal cannot be written, e.g. because the disk is full, it is removed, and its file is not journaled until it is saved.
+*/
+class journal
+  {
+  public:
+    journal();
+    ~journal();
+
+    journal(const journal&) = delete;
+    journal& operator = (const journal&) = delete;
+
+    // records the edits that were made to the files of state since the previous call, main thread only
+    void record(const app_state& state);
+
+    // removes all journals, e.g. when jam exits normally and the unsaved edits are dropped on purpose
+    void clear();
+
+    // the files whose journal could not be written since the previous call, which are not journaled anymore, main thread only
+    std::vector<std::string> take_failed_files();
+
+  private:
+    struct tracked_file
+      {
+      jamlib::buffer content; // the content when record was called last
+      bool saved = false; // content was recorded while the file was not modified, so it is the content of the file on disk
+      bool journaling = false;
+      bool not_journaled = false; // the modified content is not journaled, as for a folder listing, decided once per modification
+      bool seen = false;
+      };
+
+    struct job
+      {
+      std::string path;
+      std::string data;
+      bool create = false; // starts a new journal at path
+      bool remove = false; // removes the journal at path
+      };
+
+    void push(job j);
+    void write_jobs();
+
+  private:
+    std::map<std::string, tracked_file> files; // by filename, main thread only
+    std::string owner; // the id of this jam in the names of its journals
+    intptr_t owner_lock; // the locked owner file, -1 if it could not be locked
+
+    std::vector<job> jobs;
+    std::vector<std::string> failed; // journals that could not be written, protected by mt
+    std::mutex mt;
+    std::condition_variable cv;
+    bool stop;
+    std::map<std::string, FILE*> open_journals; // writer thread only
+    std::set<std::string> failed_journals; // writer thread only, written again when they are created again
+    std::thread writer;
+  };
+
+struct recovered_file
+  {
+  std::string filename;
+  jamlib::encoding enc;
+  jamlib::buffer content; // the content with the journaled edits
+  jamlib::buffer saved_content; // the content of the file on disk
+  };
+
+/*
+Replays the journals that were left behind by a jam that crashed onto the files on disk, and removes them. The journals
+of a jam that still runs, i.e. whose owner file is locked, are left alone.
+A journal that cannot be replayed, e.g. because its file was changed on disk since, adds an error to errors.
+*/
+std::vector<recovered_file> recover_journals(std::vector<std::string>& errors);
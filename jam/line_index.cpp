@@ -0,0 +1,470 @@
+#include "line_index.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace
+  {
+  const int64_t min_indexed_size = 1 << 16; // smaller buffers are scanned directly
+  const size_t max_block_lines = 1024;
+  const size_t max_cached_indices = 32;
+  const int64_t max_cached_lines = 1 << 24; // the least recently used indices are dropped when the cache holds more lines
+  const uint64_t max_unused = 1 << 14; // indices that were not used in this many lookups are dropped, e.g. those of closed buffers
+
+  struct line_block
+    {
+    std::vector<uint32_t> lengths; // number of characters of each line, including its '\n'
+    std::vector<uint8_t> tabbed; // per line, 1 if the line holds a tab, whose width depends on the column that it starts in
+    std::vector<uint32_t> line_rows; // wrapped rows of each line if a line of the block holds a tab, else empty and rows_of_line gives them
+    int64_t chars = 0;
+    int64_t rows = 0; // wrapped rows of the lines, for line_index::nr_of_cols and line_index::tab_space
+    };
+
+  struct line_index
+    {
+    jamlib::buffer content; // the version the index was made for
+    std::vector<line_block> blocks; // never empty, the last line of the last block has no '\n'
+    std::vector<int64_t> first_pos, first_line, first_row; // per block, with an extra entry for the end of the buffer
+    int64_t nr_of_cols = 0; // the width the rows were counted for, 0 if they were not counted
+    int64_t tab_space = 0; // the distance between tab stops the rows were counted for
+    uint64_t last_used = 0;
+    };
+
+  struct line_location
+    {
+    size_t block;
+    size_t line; // within the block
+    int64_t begin;
+    };
+
+  std::vector<line_index> cache;
+  uint64_t use_counter = 0;
+
+  int64_t rows_of_line(uint32_t length, bool has_newline, int64_t nr_of_cols)
+    {
+    const int64_t le = (int64_t)length - (has_newline ? 1 : 0);
+    return le / std::max<int64_t>(nr_of_cols - 1, 1) + 1;
+    }
+
+  // the wrapped row of the characters [begin, pos) of a line on which pos is drawn, see line_of_wrapped_row
+  int64_t rows_in_line(const jamlib::buffer& content, int64_t begin, int64_t pos, int64_t nr_of_cols, int64_t tab_space)
+    {
+    const int64_t wrap = std::max<int64_t>(nr_of_cols - 1, 1);
+    tab_space = std::max<int64_t>(tab_space, 1);
+    int64_t row = 0;
+    int64_t col = 0;
+    content.for_each_run((uint32_t)begin, (uint32_t)pos, [&](const wchar_t* it, const wchar_t* end)
+      {
+      for (; it != end; ++it)
+        {
+        col += *it == '\t' ? tab_space - col % tab_space : 1;
+        if (col >= wrap)
+          {
+          col = 0;
+          ++row;
+          }
+        }
+      });
+    return row;
+    }
+
+  // the lines in [first, last) of content, as scanned by scan_lines
+  struct scanned_lines
+    {
+    std::vector<uint32_t> lengths;
+    std::vector<uint8_t> tabbed;
+
+    void append(const std::vector<uint32_t>& more_lengths, const std::vector<uint8_t>& more_tabbed, size_t first, size_t last)
+      {
+      lengths.insert(lengths.end(), more_lengths.begin() + first, more_lengths.begin() + last);
+      tabbed.insert(tabbed.end(), more_tabbed.begin() + first, more_tabbed.begin() + last);
+      }
+    };
+
+  // appends the lines in [first, last) of content, the characters after the last '\n' only count as a line at the end of content
+  void scan_lines(scanned_lines& lines, const jamlib::buffer& content, int64_t first, int64_t last)
+    {
+    uint32_t length = 0;
+    uint8_t tabbed = 0;
+    content.for_each_run((uint32_t)first, (uint32_t)last, [&](const wchar_t* it, const wchar_t* end) // does not fill in a lazy buffer
+      {
+      for (; it != end; ++it)
+        {
+        ++length;
+        if (*it == '\n')
+          {
+          lines.lengths.push_back(length);
+          lines.tabbed.push_back(tabbed);
+          length = 0;
+          tabbed = 0;
+          }
+        else if (*it == '\t')
+          tabbed = 1;
+        }
+      });
+    if (last == (int64_t)content.size())
+      {
+      lines.lengths.push_back(length);
+      lines.tabbed.push_back(tabbed);
+      }
+    }
+
+  void append_blocks(std::vector<line_block>& blocks, const scanned_lines& lines)
+    {
+    const size_t nr_of_lines = lines.lengths.size();
+    const size_t nr_of_blocks = std::max<size_t>((nr_of_lines + max_block_lines - 1) / max_block_lines, 1);
+    for (size_t k = 0; k < nr_of_blocks; ++k)
+      {
+      line_block b;
+      b.lengths.assign(lines.lengths.begin() + k * nr_of_lines / nr_of_blocks, lines.lengths.begin() + (k + 1) * nr_of_lines / nr_of_blocks);
+      b.tabbed.assign(lines.tabbed.begin() + k * nr_of_lines / nr_of_blocks, lines.tabbed.begin() + (k + 1) * nr_of_lines / nr_of_blocks);
+      for (auto len : b.lengths)
+        b.chars += len;
+      blocks.push_back(std::move(b));
+      }
+    }
+
+  // counts the wrapped rows of block b, whose position ix.first_pos[b] must be up to date
+  void count_rows(line_index& ix, size_t b)
+    {
+    auto& blk = ix.blocks[b];
+    const bool last_block = b + 1 == ix.blocks.size();
+    blk.rows = 0;
+    blk.line_rows.clear();
+    if (ix.nr_of_cols == 0)
+      return;
+    if (std::find(blk.tabbed.begin(), blk.tabbed.end(), 1) == blk.tabbed.end())
+      {
+      for (size_t i = 0; i < blk.lengths.size(); ++i)
+        blk.rows += rows_of_line(blk.lengths[i], !last_block || i + 1 < blk.lengths.size(), ix.nr_of_cols);
+      return;
+      }
+    int64_t begin = ix.first_pos[b];
+    blk.line_rows.resize(blk.lengths.size());
+    for (size_t i = 0; i < blk.lengths.size(); ++i)
+      {
+      const bool has_newline = !last_block || i + 1 < blk.lengths.size();
+      if (blk.tabbed[i])
+        blk.line_rows[i] = (uint32_t)rows_in_line(ix.content, begin, begin + blk.lengths[i] - (has_newline ? 1 : 0), ix.nr_of_cols, ix.tab_space) + 1;
+      else
+        blk.line_rows[i] = (uint32_t)rows_of_line(blk.lengths[i], has_newline, ix.nr_of_cols);
+      blk.rows += blk.line_rows[i];
+      begin += blk.lengths[i];
+      }
+    }
+
+  // wrapped rows of line i of block b, which has a '\n' unless it is the last line of the buffer
+  int64_t rows_of_line(const line_index& ix, size_t b, size_t i)
+    {
+    const auto& blk = ix.blocks[b];
+    if (!blk.line_rows.empty())
+      return blk.line_rows[i];
+    return rows_of_line(blk.lengths[i], b + 1 < ix.blocks.size() || i + 1 < blk.lengths.size(), ix.nr_of_cols);
+    }
+
+  // recomputes the positions and lines before the blocks from block b on
+  void update_positions(line_index& ix, size_t b)
+    {
+    ix.first_pos.resize(ix.blocks.size() + 1);
+    ix.first_line.resize(ix.blocks.size() + 1);
+    if (b == 0)
+      ix.first_pos[0] = ix.first_line[0] = 0;
+    for (size_t j = b; j < ix.blocks.size(); ++j)
+      {
+      ix.first_pos[j + 1] = ix.first_pos[j] + ix.blocks[j].chars;
+      ix.first_line[j + 1] = ix.first_line[j] + (int64_t)ix.blocks[j].lengths.size();
+      }
+    }
+
+  // recomputes the rows before the blocks from block b on
+  void update_rows(line_index& ix, size_t b)
+    {
+    ix.first_row.resize(ix.blocks.size() + 1);
+    if (b == 0)
+      ix.first_row[0] = 0;
+    for (size_t j = b; j < ix.blocks.size(); ++j)
+      ix.first_row[j + 1] = ix.first_row[j] + ix.blocks[j].rows;
+    }
+
+  void count_all_rows(line_index& ix)
+    {
+    for (size_t b = 0; b < ix.blocks.size(); ++b)
+      count_rows(ix, b);
+    update_rows(ix, 0);
+    }
+
+  void build(line_index& ix, const jamlib::buffer& content)
+    {
+    scanned_lines lines;
+    scan_lines(lines, content, 0, (int64_t)content.size());
+    ix.blocks.clear();
+    append_blocks(ix.blocks, lines);
+    ix.content = content;
+    update_positions(ix, 0);
+    count_all_rows(ix);
+    }
+
+  line_location locate(const line_index& ix, int64_t pos)
+    {
+    line_location loc;
+    loc.block = (size_t)(std::upper_bound(ix.first_pos.begin(), ix.first_pos.end() - 1, pos) - ix.first_pos.begin()) - 1;
+    loc.line = 0;
+    loc.begin = ix.first_pos[loc.block];
+    const auto& lengths = ix.blocks[loc.block].lengths;
+    while (loc.line + 1 < lengths.size() && loc.begin + lengths[loc.line] <= pos)
+      loc.begin += lengths[loc.line++];
+    return loc;
+    }
+
+  // brings the index of a previous version of content up to date, by scanning the lines that were modified again
+  void update(line_index& ix, const jamlib::buffer& content)
+    {
+    const int64_t old_size = (int64_t)ix.content.size();
+    const int64_t new_size = (int64_t)content.size();
+    const int64_t first_modified = (int64_t)immutable::first_difference(ix.content, content);
+    const int64_t suffix = std::min<int64_t>((int64_t)immutable::common_suffix_length(ix.content, content), std::min(old_size, new_size) - first_modified);
+    const line_location first = locate(ix, first_modified);
+    const line_location last = locate(ix, old_size - suffix);
+    const int64_t old_end = last.begin + ix.blocks[last.block].lengths[last.line];
+
+    const auto& first_block = ix.blocks[first.block];
+    scanned_lines lines;
+    lines.append(first_block.lengths, first_block.tabbed, 0, first.line);
+    scan_lines(lines, content, first.begin, old_end + new_size - old_size);
+    const auto& last_block = ix.blocks[last.block];
+    lines.append(last_block.lengths, last_block.tabbed, last.line + 1, last_block.lengths.size());
+    size_t end_block = last.block + 1;
+    if (lines.lengths.size() < max_block_lines / 2 && end_block < ix.blocks.size()) // merge with the next block, so that blocks do not become small
+      {
+      lines.append(ix.blocks[end_block].lengths, ix.blocks[end_block].tabbed, 0, ix.blocks[end_block].lengths.size());
+      ++end_block;
+      }
+
+    std::vector<line_block> blocks;
+    append_blocks(blocks, lines);
+    const size_t nr_of_blocks = blocks.size();
+    ix.blocks.erase(ix.blocks.begin() + first.block, ix.blocks.begin() + end_block);
+    ix.blocks.insert(ix.blocks.begin() + first.block, std::make_move_iterator(blocks.begin()), std::make_move_iterator(blocks.end()));
+    ix.content = content;
+    update_positions(ix, first.block);
+    for (size_t b = first.block; b < first.block + nr_of_blocks; ++b)
+      count_rows(ix, b);
+    update_rows(ix, first.block);
+    }
+
+  std::vector<line_index>::iterator least_recently_used()
+    {
+    return std::min_element(cache.begin(), cache.end(), [](const line_index& left, const line_index& right) { return left.last_used < right.last_used; });
+    }
+
+  int64_t cached_lines()
+    {
+    int64_t lines = 0;
+    for (const auto& ix : cache)
+      lines += ix.first_line.back();
+    return lines;
+    }
+
+  // drops the indices that were not used for a long time, and the least recently used ones while the cache is too large
+  void drop_indices(int64_t new_lines)
+    {
+    for (size_t i = cache.size(); i > 0; --i)
+      {
+      if (use_counter - cache[i - 1].last_used > max_unused)
+        cache.erase(cache.begin() + (i - 1));
+      }
+    while (!cache.empty() && (cache.size() >= max_cached_indices || cached_lines() + new_lines > max_cached_lines))
+      cache.erase(least_recently_used());
+    }
+
+  /*
+  Returns the index of content. A cached index of a version that shares most of its characters with content
+  is updated, otherwise a new index is added. The cache is bounded by the number of lines that it holds rather than
+  by a small number of indices, so that drawing more windows of large buffers than that in turn does not rebuild
+  their indices each time.
+  */
+  line_index& get_index(const jamlib::buffer& content)
+    {
+    ++use_counter;
+    for (auto& ix : cache)
+      {
+      if (ix.content.raw().ptr == content.raw().ptr)
+        {
+        ix.last_used = use_counter;
+        return ix;
+        }
+      }
+    line_index* best = nullptr;
+    int64_t best_shared = (int64_t)content.size() / 2;
+    for (auto& ix : cache)
+      {
+      const int64_t shared = (int64_t)immutable::first_difference(ix.content, content) + (int64_t)immutable::common_suffix_length(ix.content, content);
+      if (shared > best_shared)
+        {
+        best = &ix;
+        best_shared = shared;
+        }
+      }
+    if (best)
+      update(*best, content);
+    else
+      {
+      line_index ix;
+      build(ix, content);
+      drop_indices(ix.first_line.back());
+      cache.push_back(std::move(ix));
+      best = &cache.back();
+      }
+    best->last_used = use_counter;
+    return *best;
+    }
+
+  // calls f with the index of content, small buffers get an index that is not cached
+  template <class F>
+  int64_t with_index(const jamlib::buffer& content, F f)
+    {
+    if ((int64_t)content.size() < min_indexed_size)
+      {
+      line_index ix;
+      build(ix, content);
+      return f(ix);
+      }
+    return f(get_index(content));
+    }
+
+  // calls f with the index of content with its rows counted for nr_of_cols and tab_space, small buffers get an index that is not cached
+  template <class F>
+  int64_t with_rows(const jamlib::buffer& content, int64_t nr_of_cols, int64_t tab_space, F f)
+    {
+    if ((int64_t)content.size() < min_indexed_size)
+      {
+      line_index ix;
+      ix.nr_of_cols = nr_of_cols;
+      ix.tab_space = tab_space;
+      build(ix, content);
+      return f(ix);
+      }
+    line_index& ix = get_index(content);
+    if (ix.nr_of_cols != nr_of_cols || ix.tab_space != tab_space)
+      {
+      ix.nr_of_cols = nr_of_cols;
+      ix.tab_space = tab_space;
+      count_all_rows(ix);
+      }
+    return f(ix);
+    }
+  }
+
+int64_t line_begin(const jamlib::buffer& content, int64_t pos)
+  {
+  if ((int64_t)content.size() >= min_indexed_size)
+    return locate(get_index(content), pos).begin;
+  auto it = content.rbegin() + (content.size() - pos);
+  auto it_end = content.rend();
+  for (; it != it_end; ++it, --pos)
+    {
+    if (*it == '\n')
+      return pos;
+    }
+  return 0;
+  }
+
+int64_t line_end(const jamlib::buffer& content, int64_t pos)
+  {
+  if ((int64_t)content.size() >= min_indexed_size)
+    {
+    const line_index& ix = get_index(content);
+    const line_location loc = locate(ix, pos);
+    const bool last_line = loc.block + 1 == ix.blocks.size() && loc.line + 1 == ix.blocks[loc.block].lengths.size();
+    return last_line ? (int64_t)content.size() : loc.begin + ix.blocks[loc.block].lengths[loc.line] - 1;
+    }
+  auto it = content.begin() + pos;
+  auto it_end = content.end();
+  for (; it != it_end; ++it, ++pos)
+    {
+    if (*it == '\n')
+      return pos;
+    }
+  return pos;
+  }
+
+int64_t skip_in_line(const jamlib::buffer& content, int64_t pos, int64_t nr_of_chars)
+  {
+  const int64_t last = std::min<int64_t>(pos + nr_of_chars, (int64_t)content.size());
+  if ((int64_t)content.size() >= min_indexed_size)
+    return std::min<int64_t>(last, line_end(content, pos));
+  auto it = content.begin() + pos;
+  for (; pos < last; ++it, ++pos)
+    {
+    if (*it == '\n')
+      return pos;
+    }
+  return pos;
+  }
+
+int64_t line_number(const jamlib::buffer& content, int64_t pos)
+  {
+  return with_index(content, [&](const line_index& ix)
+    {
+    const line_location loc = locate(ix, pos);
+    return ix.first_line[loc.block] + (int64_t)loc.line;
+    });
+  }
+
+int64_t line_position(const jamlib::buffer& content, int64_t line)
+  {
+  return with_index(content, [&](const line_index& ix)
+    {
+    line = std::max<int64_t>(std::min<int64_t>(line, ix.first_line.back() - 1), 0);
+    const size_t b = (size_t)(std::upper_bound(ix.first_line.begin(), ix.first_line.end() - 1, line) - ix.first_line.begin()) - 1;
+    const auto& lengths = ix.blocks[b].lengths;
+    int64_t begin = ix.first_pos[b];
+    for (int64_t i = ix.first_line[b]; i < line; ++i)
+      begin += lengths[(size_t)(i - ix.first_line[b])];
+    return begin;
+    });
+  }
+
+int64_t wrapped_rows_before(const jamlib::buffer& content, int64_t pos, int64_t nr_of_cols, int64_t tab_space)
+  {
+  return with_rows(content, nr_of_cols, tab_space, [&](const line_index& ix)
+    {
+    const line_location loc = locate(ix, pos);
+    int64_t rows = ix.first_row[loc.block];
+    for (size_t i = 0; i < loc.line; ++i)
+      rows += rows_of_line(ix, loc.block, i);
+    return rows;
+    });
+  }
+
+int64_t wrapped_row_in_line(const jamlib::buffer& content, int64_t pos, int64_t nr_of_cols, int64_t tab_space)
+  {
+  return rows_in_line(content, line_begin(content, pos), pos, nr_of_cols, tab_space);
+  }
+
+int64_t number_of_wrapped_rows(const jamlib::buffer& content, int64_t nr_of_cols, int64_t tab_space)
+  {
+  return with_rows(content, nr_of_cols, tab_space, [](const line_index& ix) { return ix.first_row.back(); });
+  }
+
+int64_t line_of_wrapped_row(const jamlib::buffer& content, int64_t& row, int64_t nr_of_cols, int64_t tab_space)
+  {
+  return with_rows(content, nr_of_cols, tab_space, [&](const line_index& ix)
+    {
+    row = std::max<int64_t>(std::min<int64_t>(row, ix.first_row.back() - 1), 0);
+    const size_t b = (size_t)(std::upper_bound(ix.first_row.begin(), ix.first_row.end() - 1, row) - ix.first_row.begin()) - 1;
+    const auto& lengths = ix.blocks[b].lengths;
+    int64_t begin = ix.first_pos[b];
+    int64_t first_row = ix.first_row[b];
+    for (size_t i = 0; i + 1 < lengths.size(); ++i)
+      {
+      const int64_t rows = rows_of_line(ix, b, i);
+      if (row < first_row + rows)
+        break;
+      first_row += rows;
+      begin += lengths[i];
+      }
+    row -= first_row;
+    return begin;
+    });
+  }
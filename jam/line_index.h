@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <jamlib/jam.h>
+
+/*
+Line and wrapped row lookups in a buffer that take logarithmic time in the number of lines.
+
+The lengths of the lines of a buffer are kept in blocks of about a thousand lines, together with the number of
+characters, lines and wrapped rows before each block. These totals are checkpoints from which a lookup only has
+to walk the lines of a single block. The indices of the buffers that were asked for recently are cached, up to a
+bound on the lines that they hold, so that the windows of many large buffers can use their indices in turn. A buffer that was derived from a cached buffer by an edit updates the index of that buffer: only the
+lines between the first and the last modified position are scanned again, so typing in a large file costs time
+in proportion to a block, and not to the file. Small buffers are scanned directly instead.
+
+A line holds nr_of_cols - 1 columns per wrapped row, as in the word wrap code of the engine, so a line of length le
+takes le / (nr_of_cols - 1) + 1 rows. A tab takes the columns up to the next multiple of tab_space of its row, so the
+rows of a line with tabs are counted by walking its characters. The rows are counted for the last nr_of_cols and
+tab_space that were asked for, and counted again when they change.
+*/
+
+// position of the first character of the line that contains pos
+int64_t line_begin(const jamlib::buffer& content, int64_t pos);
+
+// position of the '\n' that ends the line that contains pos, or the size of content for the last line
+int64_t line_end(const jamlib::buffer& content, int64_t pos);
+
+// min(pos + nr_of_chars, line_end(content, pos)), but without scanning more than nr_of_chars characters of a small buffer
+int64_t skip_in_line(const jamlib::buffer& content, int64_t pos, int64_t nr_of_chars);
+
+// number of the line that contains pos, counting from 0
+int64_t line_number(const jamlib::buffer& content, int64_t pos);
+
+// position of the first character of line number line, lines past the last line give the last line
+int64_t line_position(const jamlib::buffer& content, int64_t line);
+
+// number of wrapped rows of the lines before the line that contains pos
+int64_t wrapped_rows_before(const jamlib::buffer& content, int64_t pos, int64_t nr_of_cols, int64_t tab_space);
+
+// the wrapped row within its line on which pos is drawn, counting from 0
+int64_t wrapped_row_in_line(const jamlib::buffer& content, int64_t pos, int64_t nr_of_cols, int64_t tab_space);
+
+// number of wrapped rows of the complete buffer
+int64_t number_of_wrapped_rows(const jamlib::buffer& content, int64_t nr_of_cols, int64_t tab_space);
+
+/*
+Returns the first position of the line that holds wrapped row row of the buffer, and sets row to the row
+within that line. Rows past the last row give the last row.
+*/
+int64_t line_of_wrapped_row(const jamlib::buffer& content, int64_t& row, int64_t nr_of_cols, int64_t tab_space);
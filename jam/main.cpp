@@ -535,7 +535,7 @@ int CopyEventFilter(void* userdata, SDL_Event* event)
         async_message m;
         m.m = ASYNC_MESSAGE_LOAD;
         m.str = message_data;
-        p_messages->push(m);
+        p_messages->push_until(std::move(m), []() { return true; }); // the filter runs on the main thread, which reads the queue, so it cannot wait for room
         }
       }
     }
@@ -3,9 +3,548 @@
 #include "grid.h"
 
 #include <jamlib/encoding.h>
+#include <immutable/serialize.h>
+#include <jam_file_utils.h>
 
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <sstream>
+#include <stdexcept>
 
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+Binary session format
+
+  header:  "JAMS" | version (u32) | flags (u32) | payload size (u64) | checksum of the payload (u64)
+  payload: width, height, windows, file_id_to_window_id, window pairs, grid, files
+
+All integers are little endian, strings and lists are prefixed with their length.
+The content of a file and its undo history are written with immutable/serialize.h: a node that is shared by
+several versions of a buffer is written once, and loading rebuilds the same sharing, so a long history of a
+big file costs on disk and in memory about as much as the edits that were made.
+*/
+
+namespace
+  {
+  const char session_magic[4] = { 'J', 'A', 'M', 'S' };
+  const uint32_t session_version = 2; // version 2 writes the undo history as checkpoints and deltas
+  const uint32_t session_first_version = 1;
+  const uint32_t session_flag_undo_history = 1;
+  const size_t session_header_size = 4 + 4 + 4 + 8 + 8;
+
+  uint64_t checksum(const char* data, size_t size)
+    {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < size; ++i)
+      {
+      hash ^= (uint8_t)data[i];
+      hash *= 1099511628211ULL;
+      }
+    return hash;
+    }
+
+  // wchar_t is 2 bytes on Windows and 4 bytes elsewhere: characters are always written as 4 bytes
+  struct wchar_codec
+    {
+    enum { element_size = 4 };
+
+    static void write(std::string& out, wchar_t ch)
+      {
+      for (int i = 0; i < 4; ++i)
+        out.push_back((char)(((uint32_t)ch >> (8 * i)) & 0xff));
+      }
+
+    static wchar_t read(const char* data)
+      {
+      uint32_t v = 0;
+      for (int i = 0; i < 4; ++i)
+        v |= ((uint32_t)(uint8_t)data[i]) << (8 * i);
+      return (wchar_t)v;
+      }
+    };
+
+  typedef immutable::vector_writer<wchar_t, false, 5, wchar_codec> buffer_writer;
+  typedef immutable::vector_reader<wchar_t, false, 5, wchar_codec> buffer_reader;
+
+  class binary_writer
+    {
+    public:
+      void write_u8(uint8_t v)
+        {
+        data.push_back((char)v);
+        }
+
+      void write_u32(uint32_t v)
+        {
+        for (int i = 0; i < 4; ++i)
+          data.push_back((char)((v >> (8 * i)) & 0xff));
+        }
+
+      void write_u64(uint64_t v)
+        {
+        for (int i = 0; i < 8; ++i)
+          data.push_back((char)((v >> (8 * i)) & 0xff));
+        }
+
+      void write_i32(int32_t v)
+        {
+        write_u32((uint32_t)v);
+        }
+
+      void write_i64(int64_t v)
+        {
+        write_u64((uint64_t)v);
+        }
+
+      void write_bool(bool v)
+        {
+        write_u8(v ? 1 : 0);
+        }
+
+      void write_double(double v)
+        {
+        uint64_t u;
+        memcpy(&u, &v, sizeof(double));
+        write_u64(u);
+        }
+
+      void write_string(const std::string& s)
+        {
+        write_u32((uint32_t)s.size());
+        data.append(s);
+        }
+
+      std::string data;
+    };
+
+  class binary_reader
+    {
+    public:
+      binary_reader(const char* d, size_t sz) : data(d), size(sz), pos(0) {}
+
+      uint8_t read_u8()
+        {
+        _check(1);
+        return (uint8_t)data[pos++];
+        }
+
+      uint32_t read_u32()
+        {
+        _check(4);
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i)
+          v |= ((uint32_t)(uint8_t)data[pos++]) << (8 * i);
+        return v;
+        }
+
+      uint64_t read_u64()
+        {
+        _check(8);
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i)
+          v |= ((uint64_t)(uint8_t)data[pos++]) << (8 * i);
+        return v;
+        }
+
+      int32_t read_i32()
+        {
+        return (int32_t)read_u32();
+        }
+
+      int64_t read_i64()
+        {
+        return (int64_t)read_u64();
+        }
+
+      bool read_bool()
+        {
+        return read_u8() != 0;
+        }
+
+      double read_double()
+        {
+        uint64_t u = read_u64();
+        double v;
+        memcpy(&v, &u, sizeof(double));
+        return v;
+        }
+
+      std::string read_string()
+        {
+        uint32_t sz = read_u32();
+        _check(sz);
+        std::string s(data + pos, data + pos + sz);
+        pos += sz;
+        return s;
+        }
+
+      jamlib::buffer read_buffer(buffer_reader& br)
+        {
+        return br.read(data, size, pos);
+        }
+
+      // number of items of a list of which each item takes at least item_size bytes
+      uint32_t read_count(size_t item_size)
+        {
+        uint32_t sz = read_u32();
+        _check((size_t)sz * item_size);
+        return sz;
+        }
+
+    private:
+      void _check(size_t bytes) const
+        {
+        if (bytes > size - pos)
+          throw std::runtime_error("session file is truncated");
+        }
+
+    private:
+      const char* data;
+      size_t size;
+      size_t pos;
+    };
+
+  void write_window(binary_writer& w, const window& wn)
+    {
+    w.write_i32(wn.outer_x);
+    w.write_i32(wn.outer_y);
+    w.write_i32(wn.outer_cols);
+    w.write_i32(wn.outer_rows);
+    w.write_i32(wn.x);
+    w.write_i32(wn.y);
+    w.write_i32(wn.cols);
+    w.write_i32(wn.rows);
+    w.write_u32(wn.file_id);
+    w.write_u32(wn.nephew_id);
+    w.write_bool(wn.is_command_window);
+    w.write_bool(wn.highlight_comments);
+    w.write_bool(wn.piped);
+    w.write_i64(wn.file_pos);
+    w.write_i64(wn.file_col);
+    w.write_i64(wn.wordwrap_row);
+    w.write_bool(wn.word_wrap);
+    w.write_double(wn.scroll_fraction);
+    }
+
+  window read_window(binary_reader& r)
+    {
+    window wn(0, 0, 0, 0, 0, 0, false);
+    wn.outer_x = r.read_i32();
+    wn.outer_y = r.read_i32();
+    wn.outer_cols = r.read_i32();
+    wn.outer_rows = r.read_i32();
+    wn.x = r.read_i32();
+    wn.y = r.read_i32();
+    wn.cols = r.read_i32();
+    wn.rows = r.read_i32();
+    wn.file_id = r.read_u32();
+    wn.nephew_id = r.read_u32();
+    wn.is_command_window = r.read_bool();
+    wn.highlight_comments = r.read_bool();
+    wn.piped = r.read_bool();
+    wn.file_pos = r.read_i64();
+    wn.file_col = r.read_i64();
+    wn.wordwrap_row = r.read_i64();
+    wn.word_wrap = r.read_bool();
+    wn.scroll_fraction = r.read_double();
+    return wn;
+    }
+
+  void write_window_pair(binary_writer& w, const window_pair& wp)
+    {
+    w.write_u32(wp.window_id);
+    w.write_u32(wp.command_window_id);
+    w.write_i32(wp.x);
+    w.write_i32(wp.y);
+    w.write_i32(wp.cols);
+    w.write_i32(wp.rows);
+    }
+
+  window_pair read_window_pair(binary_reader& r)
+    {
+    window_pair wp(0, 0, 0, 0, 0, 0);
+    wp.window_id = r.read_u32();
+    wp.command_window_id = r.read_u32();
+    wp.x = r.read_i32();
+    wp.y = r.read_i32();
+    wp.cols = r.read_i32();
+    wp.rows = r.read_i32();
+    return wp;
+    }
+
+  void write_grid(binary_writer& w, const grid& g)
+    {
+    w.write_u32(g.topline_window_id);
+    w.write_u32((uint32_t)g.columns.size());
+    for (const auto& c : g.columns)
+      {
+      w.write_double(c.left);
+      w.write_double(c.right);
+      w.write_u32(c.column_command_window_id);
+      w.write_bool(c.maximized);
+      w.write_u32((uint32_t)c.items.size());
+      for (const auto& ci : c.items)
+        {
+        w.write_u32(ci.column_id);
+        w.write_double(ci.top_layer);
+        w.write_double(ci.bottom_layer);
+        w.write_u32(ci.window_pair_id);
+        }
+      }
+    }
+
+  grid read_grid(binary_reader& r)
+    {
+    grid g;
+    g.topline_window_id = r.read_u32();
+    uint32_t nr_of_columns = r.read_count(1);
+    for (uint32_t i = 0; i < nr_of_columns; ++i)
+      {
+      column c;
+      c.left = r.read_double();
+      c.right = r.read_double();
+      c.column_command_window_id = r.read_u32();
+      c.maximized = r.read_bool();
+      uint32_t nr_of_items = r.read_count(1);
+      for (uint32_t j = 0; j < nr_of_items; ++j)
+        {
+        column_item ci;
+        ci.column_id = r.read_u32();
+        ci.top_layer = r.read_double();
+        ci.bottom_layer = r.read_double();
+        ci.window_pair_id = r.read_u32();
+        c.items.push_back(ci);
+        }
+      g.columns.push_back(c);
+      }
+    return g;
+    }
+
+  void write_address(binary_writer& w, const jamlib::address& a)
+    {
+    w.write_i64(a.r.p1);
+    w.write_i64(a.r.p2);
+    w.write_u64(a.file_id);
+    }
+
+  jamlib::address read_address(binary_reader& r)
+    {
+    jamlib::address a;
+    a.r.p1 = r.read_i64();
+    a.r.p2 = r.read_i64();
+    a.file_id = r.read_u64();
+    return a;
+    }
+
+  /*
+  The content of a command window is always written. The content and the undo history of other files are
+  only written if save_undo_history is true and the file has a history: the other files are read again from disk.
+  */
+  void write_file(binary_writer& w, buffer_writer& bw, const jamlib::file& f, bool command, bool save_undo_history)
+    {
+    w.write_string(f.filename);
+    w.write_bool(command);
+    w.write_u32((uint32_t)f.enc);
+    write_address(w, f.dot);
+    w.write_u64(f.file_id);
+    w.write_u64(f.modification_mask);
+    const bool save_content = command || (save_undo_history && !f.history.empty());
+    w.write_bool(save_content);
+    if (!save_content)
+      return;
+    w.write_i64(command ? -1 : JAM::file_modification_time(f.filename));
+    bw.write(w.data, f.content);
+    const uint32_t history_size = command ? 0 : (uint32_t)f.history.size();
+    w.write_u64(command ? 0 : f.undo_redo_index);
+    w.write_u32(history_size);
+    for (uint32_t i = 0; i < history_size; ++i)
+      {
+      const auto& ss = f.history[i];
+      w.write_bool(ss.checkpoint);
+      if (ss.checkpoint)
+        bw.write(w.data, ss.content);
+      else
+        {
+        w.write_i64(ss.change.pos);
+        bw.write(w.data, ss.change.removed);
+        bw.write(w.data, ss.change.inserted);
+        }
+      write_address(w, ss.dot);
+      w.write_u64(ss.modification_mask);
+      w.write_u32((uint32_t)ss.enc);
+      }
+    }
+
+  jamlib::file read_file(binary_reader& r, buffer_reader& br, uint32_t version)
+    {
+    jamlib::file f;
+    f.filename = r.read_string();
+    bool command = r.read_bool();
+    f.enc = (jamlib::encoding)r.read_u32();
+    f.dot = read_address(r);
+    f.file_id = r.read_u64();
+    f.dot.file_id = f.file_id;
+    f.modification_mask = r.read_u64();
+    f.undo_redo_index = 0;
+    if (!r.read_bool())
+      {
+      f.modification_mask = 0;
+      return f;
+      }
+    int64_t modification_time = r.read_i64();
+    f.content = r.read_buffer(br);
+    f.undo_redo_index = r.read_u64();
+    uint32_t history_size = r.read_count(1);
+    auto history = f.history.transient();
+    for (uint32_t i = 0; i < history_size; ++i)
+      {
+      jamlib::snapshot ss;
+      ss.checkpoint = version < 2 || r.read_bool();
+      if (i + 1 == history_size && !ss.checkpoint)
+        throw std::runtime_error("session file has an undo history that does not end with a checkpoint");
+      if (ss.checkpoint)
+        ss.content = r.read_buffer(br);
+      else
+        {
+        ss.change.pos = r.read_i64();
+        ss.change.removed = r.read_buffer(br);
+        ss.change.inserted = r.read_buffer(br);
+        }
+      ss.dot = read_address(r);
+      ss.modification_mask = r.read_u64();
+      ss.enc = (jamlib::encoding)r.read_u32();
+      history.push_back(ss);
+      }
+    f.history = history.persistent();
+    if (f.undo_redo_index > f.history.size())
+      f.undo_redo_index = f.history.size();
+    if (!command && !(f.modification_mask & 1) && modification_time != JAM::file_modification_time(f.filename))
+      {
+      // the file was changed by another program since the session was saved: read it again from disk
+      f.content = jamlib::buffer();
+      f.history = immutable::vector<jamlib::snapshot, false>();
+      f.undo_redo_index = 0;
+      }
+    return f;
+    }
+
+  std::string save_to_binary(const app_state& state, bool save_undo_history)
+    {
+    binary_writer w;
+    w.write_i32(state.w);
+    w.write_i32(state.h);
+    w.write_u32((uint32_t)state.windows.size());
+    for (const auto& wn : state.windows)
+      write_window(w, wn);
+    w.write_u32((uint32_t)state.file_id_to_window_id.size());
+    for (auto v : state.file_id_to_window_id)
+      w.write_u32(v);
+    w.write_u32((uint32_t)state.window_pairs.size());
+    for (const auto& wp : state.window_pairs)
+      write_window_pair(w, wp);
+    write_grid(w, state.g);
+    w.write_u64(state.file_state.active_file);
+    w.write_u32((uint32_t)state.file_state.files.size());
+    buffer_writer bw;
+    uint32_t id = 0;
+    for (const auto& f : state.file_state.files)
+      {
+      write_file(w, bw, f, state.windows[state.file_id_to_window_id[id]].is_command_window, save_undo_history);
+      ++id;
+      }
+
+    binary_writer header;
+    header.data.append(session_magic, sizeof(session_magic));
+    header.write_u32(session_version);
+    header.write_u32(save_undo_history ? session_flag_undo_history : 0);
+    header.write_u64(w.data.size());
+    header.write_u64(checksum(w.data.data(), w.data.size()));
+    return header.data + w.data;
+    }
+
+  app_state load_from_binary(const std::string& data)
+    {
+    binary_reader header(data.data(), data.size());
+    for (size_t i = 0; i < sizeof(session_magic); ++i)
+      header.read_u8();
+    const uint32_t version = header.read_u32();
+    if (version < session_first_version || version > session_version)
+      throw std::runtime_error("session file has an unknown version");
+    header.read_u32(); // flags
+    uint64_t payload_size = header.read_u64();
+    uint64_t payload_checksum = header.read_u64();
+    if (payload_size != data.size() - session_header_size)
+      throw std::runtime_error("session file is truncated");
+    const char* payload = data.data() + session_header_size;
+    if (payload_checksum != checksum(payload, (size_t)payload_size))
+      throw std::runtime_error("session file is corrupt");
+
+    binary_reader r(payload, (size_t)payload_size);
+    app_state result;
+    result.w = r.read_i32();
+    result.h = r.read_i32();
+    uint32_t sz = r.read_count(1);
+    for (uint32_t i = 0; i < sz; ++i)
+      result.windows.push_back(read_window(r));
+    sz = r.read_count(4);
+    for (uint32_t i = 0; i < sz; ++i)
+      result.file_id_to_window_id.push_back(r.read_u32());
+    sz = r.read_count(1);
+    for (uint32_t i = 0; i < sz; ++i)
+      result.window_pairs.push_back(read_window_pair(r));
+    result.g = read_grid(r);
+    result.file_state.active_file = r.read_u64();
+    sz = r.read_count(1);
+    buffer_reader br;
+    for (uint32_t i = 0; i < sz; ++i)
+      result.file_state.files.push_back(read_file(r, br, version));
+    return result;
+    }
+
+  bool is_binary_session(const std::string& data)
+    {
+    return data.size() >= session_header_size && memcmp(data.data(), session_magic, sizeof(session_magic)) == 0;
+    }
+
+  // writes data to filename.tmp, flushes it to disk, and then replaces filename by it
+  bool write_file_atomically(const std::string& filename, const std::string& data)
+    {
+    const std::string temp_filename = filename + ".tmp";
+#ifdef _WIN32
+    FILE* f = _wfopen(JAM::convert_string_to_wstring(temp_filename).c_str(), L"wb");
+#else
+    FILE* f = fopen(temp_filename.c_str(), "wb");
+#endif
+    if (!f)
+      return false;
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fflush(f) == 0) && ok;
+#ifdef _WIN32
+    ok = (_commit(_fileno(f)) == 0) && ok;
+#else
+    ok = (fsync(fileno(f)) == 0) && ok;
+#endif
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+      {
+#ifdef _WIN32
+      ok = MoveFileExW(JAM::convert_string_to_wstring(temp_filename).c_str(), JAM::convert_string_to_wstring(filename).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+      ok = rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+      }
+    if (!ok)
+      remove(temp_filename.c_str());
+    return ok;
+    }
+  }
 
 void save_to_stream(std::ostream& str, const app_state& state)
   {
@@ -27,7 +566,7 @@ void save_to_stream(std::ostream& str, const app_state& state)
 app_state load_from_stream(std::istream& str)
   {
   app_state result;
-  str >> result.w >> result.w;
+  str >> result.w >> result.h;
   uint32_t sz;
   str >> sz;
   for (uint32_t i = 0; i < sz; ++i)
@@ -51,24 +590,33 @@ app_state load_from_stream(std::istream& str)
   return result;
   }
 
-void save_to_file(const std::string& filename, const app_state& state)
+void save_to_file(const std::string& filename, const app_state& state, bool save_undo_history)
   {
-  std::ofstream f(filename);
-  if (f.is_open())
-    {
-    save_to_stream(f, state);
-    }
-  f.close();
+  write_file_atomically(filename, save_to_binary(state, save_undo_history));
   }
 
 app_state load_from_file(const std::string& filename)
   {
   app_state result;
-  std::ifstream f(filename);
-  if (f.is_open())
+  std::ifstream f(filename, std::ios::binary);
+  if (!f.is_open())
+    return result;
+  std::stringstream ss;
+  ss << f.rdbuf();
+  f.close();
+  std::string data = ss.str();
+  if (!is_binary_session(data))
     {
-    result = load_from_stream(f);
-    f.close();
+    std::stringstream str(data); // session files of older versions of jam were text files
+    return load_from_stream(str);
+    }
+  try
+    {
+    result = load_from_binary(data);
+    }
+  catch (std::runtime_error&)
+    {
+    result = app_state();
     }
   return result;
   }
@@ -154,7 +702,7 @@ jamlib::file load_file_from_stream(std::istream& str)
   str >> f.file_id;
   f.dot.file_id = f.file_id;
   f.modification_mask = 0;
-  f.undo_redo_index = 0;  
+  f.undo_redo_index = 0;
   return f;
   }
 
@@ -169,4 +717,4 @@ jamlib::app_state load_file_state_from_stream(std::istream& str)
     file_state.files.push_back(load_file_from_stream(str));
     }
   return file_state;
-  }
\ No newline at end of file
+  }
@@ -8,8 +8,14 @@ void save_to_stream(std::ostream& str, const app_state& state);
 
 app_state load_from_stream(std::istream& str);
 
-void save_to_file(const std::string& filename, const app_state& state);
-
+/*
+Writes the session in the binary session format (see serialize.cpp) to a temporary file first, and then replaces
+filename by it, so that a crash while saving never leaves a broken session behind.
+If save_undo_history is true, the content and the undo history of each file that has a history are saved as well.
+*/
+void save_to_file(const std::string& filename, const app_state& state, bool save_undo_history);
+
+// reads a session in the binary session format, or in the text format of older versions of jam
 app_state load_from_file(const std::string& filename);
 
 void save_file_state_to_stream(std::ostream& str, const app_state& state);
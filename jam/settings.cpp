@@ -39,6 +39,18 @@ settings read_settings(const char* filename)
   s.selection_tag_green = 235;
   s.selection_tag_blue = 239;
 
+  s.keyword_red = 0;
+  s.keyword_green = 32;
+  s.keyword_blue = 160;
+
+  s.string_red = 160;
+  s.string_green = 80;
+  s.string_blue = 0;
+
+  s.number_red = 128;
+  s.number_green = 0;
+  s.number_blue = 128;
+
   s.font_size = 17;
   s.font = JAM::get_folder(JAM::get_executable_path()) + "Font/DejaVuSansMono.ttf";
 
@@ -51,6 +63,13 @@ settings read_settings(const char* filename)
 
   s.show_all_characters = false;
 
+  s.save_undo_history = false;
+  s.undo_history_mb = 256;
+
+  s.large_file_mb = 16;
+
+  s.grep_max_file_mb = 64;
+
   pref_file f(filename, pref_file::READ);
   f["win_bg_red"] >> s.win_bg_red;
   f["win_bg_green"] >> s.win_bg_green;
@@ -82,12 +101,26 @@ settings read_settings(const char* filename)
   f["selection_tag_green"] >> s.selection_tag_green;
   f["selection_tag_blue"] >> s.selection_tag_blue;
 
+  f["keyword_red"] >> s.keyword_red;
+  f["keyword_green"] >> s.keyword_green;
+  f["keyword_blue"] >> s.keyword_blue;
+  f["string_red"] >> s.string_red;
+  f["string_green"] >> s.string_green;
+  f["string_blue"] >> s.string_blue;
+  f["number_red"] >> s.number_red;
+  f["number_green"] >> s.number_green;
+  f["number_blue"] >> s.number_blue;
+
   f["font"] >> s.font;
   f["font_size"] >> s.font_size;
 
   f["use_spaces_for_tab"] >> s.use_spaces_for_tab;
   f["tab_space"] >> s.tab_space;
   f["show_all_characters"] >> s.show_all_characters;
+  f["save_undo_history"] >> s.save_undo_history;
+  f["undo_history_mb"] >> s.undo_history_mb;
+  f["large_file_mb"] >> s.large_file_mb;
+  f["grep_max_file_mb"] >> s.grep_max_file_mb;
   return s;
   }
 
@@ -121,6 +154,15 @@ void write_settings(const settings& s, const char* filename)
   f << "selection_tag_red" << s.selection_tag_red;
   f << "selection_tag_green" << s.selection_tag_green;
   f << "selection_tag_blue" << s.selection_tag_blue;
+  f << "keyword_red" << s.keyword_red;
+  f << "keyword_green" << s.keyword_green;
+  f << "keyword_blue" << s.keyword_blue;
+  f << "string_red" << s.string_red;
+  f << "string_green" << s.string_green;
+  f << "string_blue" << s.string_blue;
+  f << "number_red" << s.number_red;
+  f << "number_green" << s.number_green;
+  f << "number_blue" << s.number_blue;
 
   f << "font" << s.font;
   f << "font_size" << s.font_size;
@@ -128,6 +170,10 @@ void write_settings(const settings& s, const char* filename)
   f << "use_spaces_for_tab" << s.use_spaces_for_tab;
   f << "tab_space" << s.tab_space;
   f << "show_all_characters" << s.show_all_characters;
+  f << "save_undo_history" << s.save_undo_history;
+  f << "undo_history_mb" << s.undo_history_mb;
+  f << "large_file_mb" << s.large_file_mb;
+  f << "grep_max_file_mb" << s.grep_max_file_mb;
 
   f.release();
   }
\ No newline at end of file
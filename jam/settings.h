@@ -16,6 +16,10 @@ struct settings
   int selection_red, selection_green, selection_blue;
   int selection_tag_red, selection_tag_green, selection_tag_blue;
 
+  int keyword_red, keyword_green, keyword_blue;
+  int string_red, string_green, string_blue;
+  int number_red, number_green, number_blue;
+
   std::string command_text;
   std::string column_text;
   std::string main_text;
@@ -25,6 +29,13 @@ struct settings
 
   bool show_all_characters;
 
+  bool save_undo_history; // keep the content and undo history of edited files in the session file
+  int undo_history_mb; // memory the undo history of a file may hold before its oldest steps are dropped, 0 for no limit
+
+  int large_file_mb; // files that are larger are read in the background when they are opened and decoded page by page as they are used, 0 to always read them right away
+
+  int grep_max_file_mb; // Grep skips files that are larger, 0 to search all files
+
   std::string font;
   int font_size;
   };
@@ -1,6 +1,7 @@
 #include "syntax_highlight.h"
 #include "utils.h"
 
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 #include <json.hpp>
@@ -8,89 +9,115 @@
 namespace
   {
 
-  comment_data make_comment_data_for_cpp()
+  syntax_data make_syntax_data_for_cpp()
     {
-    comment_data cd;
+    syntax_data cd;
     cd.multiline_begin = "/*";
     cd.multiline_end = "*/";
     cd.single_line = "//";
+    cd.string_delimiters = "\"'";
+    cd.numbers = true;
+    cd.keywords = { "auto", "bool", "break", "case", "catch", "char", "class", "const", "constexpr", "continue", "default", "delete", "do", "double",
+      "else", "enum", "explicit", "extern", "false", "float", "for", "friend", "goto", "if", "inline", "int", "long", "namespace", "new", "noexcept",
+      "nullptr", "operator", "private", "protected", "public", "return", "short", "signed", "sizeof", "static", "struct", "switch", "template",
+      "this", "throw", "true", "try", "typedef", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "while" };
     return cd;
     }
 
-  comment_data make_comment_data_for_assembly()
+  syntax_data make_syntax_data_for_assembly()
     {
-    comment_data cd;
+    syntax_data cd;
     cd.single_line = ";";
+    cd.numbers = true;
     return cd;
     }
 
-  comment_data make_comment_data_for_scheme()
+  syntax_data make_syntax_data_for_scheme()
     {
-    comment_data cd;
+    syntax_data cd;
     cd.multiline_begin = "#|";
     cd.multiline_end = "|#";
     cd.single_line = ";";
+    cd.word_characters = "!$%&*/:<=>?^~+-.";
+    cd.numbers = true;
+    cd.keywords = { "and", "begin", "case", "cond", "define", "define-syntax", "delay", "do", "else", "if", "lambda", "let", "let*", "letrec",
+      "or", "quasiquote", "quote", "set!", "syntax-rules", "unless", "when" };
     return cd;
     }
 
-  comment_data make_comment_data_for_python_and_cmake()
+  syntax_data make_syntax_data_for_python()
     {
-    comment_data cd;
+    syntax_data cd;
     cd.single_line = "#";
+    cd.string_delimiters = "\"'";
+    cd.numbers = true;
+    cd.keywords = { "False", "None", "True", "and", "as", "assert", "async", "await", "break", "class", "continue", "def", "del", "elif", "else",
+      "except", "finally", "for", "from", "global", "if", "import", "in", "is", "lambda", "nonlocal", "not", "or", "pass", "raise", "return",
+      "try", "while", "with", "yield" };
     return cd;
     }
 
-  comment_data make_comment_data_for_xml()
+  syntax_data make_syntax_data_for_cmake()
     {
-    comment_data cd;
+    syntax_data cd;
+    cd.single_line = "#";
+    return cd;
+    }
+
+  syntax_data make_syntax_data_for_xml()
+    {
+    syntax_data cd;
     cd.multiline_begin = "<!--";
     cd.multiline_end = "-->";
     return cd;
     }
 
-  comment_data make_comment_data_for_forth()
+  syntax_data make_syntax_data_for_forth()
     {
-    comment_data cd;
+    syntax_data cd;
     cd.multiline_begin = "(";
     cd.multiline_end = ")";
     cd.single_line = "\\\\";
     return cd;
     }
 
-  std::map<std::string, comment_data> build_map_hardcoded()
+  std::map<std::string, syntax_data> build_map_hardcoded()
     {
-    std::map<std::string, comment_data> m;
+    std::map<std::string, syntax_data> m;
+
+    m["c"] = make_syntax_data_for_cpp();
+    m["cc"] = make_syntax_data_for_cpp();
+    m["cpp"] = make_syntax_data_for_cpp();
+    m["h"] = make_syntax_data_for_cpp();
+    m["hpp"] = make_syntax_data_for_cpp();
 
-    m["c"] = make_comment_data_for_cpp();
-    m["cc"] = make_comment_data_for_cpp();
-    m["cpp"] = make_comment_data_for_cpp();
-    m["h"] = make_comment_data_for_cpp();
-    m["hpp"] = make_comment_data_for_cpp();
+    m["scm"] = make_syntax_data_for_scheme();
 
-    m["scm"] = make_comment_data_for_scheme();
+    m["py"] = make_syntax_data_for_python();
+    m["cmake"] = make_syntax_data_for_cmake();
 
-    m["py"] = make_comment_data_for_python_and_cmake();
-    m["cmake"] = make_comment_data_for_python_and_cmake();
+    m["cmakelists.txt"] = make_syntax_data_for_cmake();
 
-    m["cmakelists.txt"] = make_comment_data_for_python_and_cmake();
+    m["xml"] = make_syntax_data_for_xml();
+    m["html"] = make_syntax_data_for_xml();
 
-    m["xml"] = make_comment_data_for_xml();
-    m["html"] = make_comment_data_for_xml();
+    m["s"] = make_syntax_data_for_assembly();
+    m["asm"] = make_syntax_data_for_assembly();
 
-    m["s"] = make_comment_data_for_assembly();
-    m["asm"] = make_comment_data_for_assembly();
+    m["4th"] = make_syntax_data_for_forth();
 
-    m["4th"] = make_comment_data_for_forth();
+    for (auto& lang : m)
+      std::sort(lang.second.keywords.begin(), lang.second.keywords.end());
     return m;
     }
 
 
 
-  std::map<std::string, comment_data> read_map_from_json(const std::string& filename)
+  std::map<std::string, syntax_data> read_map_from_json(const std::string& filename)
     {
     nlohmann::json j;
 
-    std::map<std::string, comment_data> m;
+    std::map<std::string, syntax_data> m;
     std::ifstream i(filename);
     if (i.is_open())
       {
@@ -103,7 +130,7 @@ namespace
           auto element = *ext_it;
           if (element.is_object())
             {
-            comment_data cd;
+            syntax_data cd;
             for (auto it = element.begin(); it != element.end(); ++it)
               {
               if (it.key() == "multiline_begin")
@@ -121,7 +148,34 @@ namespace
                 if (it.value().is_string())
                   cd.single_line = it.value().get<std::string>();
                 }
+              if (it.key() == "string_delimiters")
+                {
+                if (it.value().is_string())
+                  cd.string_delimiters = it.value().get<std::string>();
+                }
+              if (it.key() == "word_characters")
+                {
+                if (it.value().is_string())
+                  cd.word_characters = it.value().get<std::string>();
+                }
+              if (it.key() == "numbers")
+                {
+                if (it.value().is_boolean())
+                  cd.numbers = it.value().get<bool>();
+                }
+              if (it.key() == "keywords")
+                {
+                if (it.value().is_array())
+                  {
+                  for (const auto& keyword : it.value())
+                    {
+                    if (keyword.is_string())
+                      cd.keywords.push_back(keyword.get<std::string>());
+                    }
+                  }
+                }
               }
+            std::sort(cd.keywords.begin(), cd.keywords.end());
             m[ext_it.key()] = cd;
             }
           }
@@ -138,6 +192,18 @@ namespace
     }
   }
 
+bool operator == (const syntax_data& left, const syntax_data& right)
+  {
+  return left.multiline_begin == right.multiline_begin && left.multiline_end == right.multiline_end && left.single_line == right.single_line &&
+    left.string_delimiters == right.string_delimiters && left.word_characters == right.word_characters && left.keywords == right.keywords &&
+    left.numbers == right.numbers;
+  }
+
+bool operator != (const syntax_data& left, const syntax_data& right)
+  {
+  return !(left == right);
+  }
+
 syntax_highlighter::syntax_highlighter()
   {
   extension_to_data = read_map_from_json(get_file_in_executable_path("comments.json"));
@@ -152,7 +218,7 @@ bool syntax_highlighter::extension_or_filename_has_syntax_highlighter(const std:
   return extension_to_data.find(ext_or_filename) != extension_to_data.end();
   }
 
-comment_data syntax_highlighter::get_syntax_highlighter(const std::string& ext_or_filename) const
+syntax_data syntax_highlighter::get_syntax_highlighter(const std::string& ext_or_filename) const
   {
   assert(extension_or_filename_has_syntax_highlighter(ext_or_filename));
   return extension_to_data.find(ext_or_filename)->second;
@@ -2,13 +2,23 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
-struct comment_data
+/*
+The lexical rules of a language, as far as they are needed for highlighting its keywords, strings, numbers and comments.
+*/
+struct syntax_data
   {
   std::string multiline_begin, multiline_end;
   std::string single_line;
+  std::string string_delimiters = "\""; // each character starts a string that ends at the same character or at the end of the line
+  std::string word_characters; // characters that can be part of a keyword next to letters, digits and '_'
+  std::vector<std::string> keywords; // sorted
+  bool numbers = false; // highlight numbers
   };
 
+bool operator == (const syntax_data& left, const syntax_data& right);
+bool operator != (const syntax_data& left, const syntax_data& right);
 
 class syntax_highlighter
   {
@@ -18,8 +28,8 @@ class syntax_highlighter
 
     bool extension_or_filename_has_syntax_highlighter(const std::string& ext_or_filename) const;
 
-    comment_data get_syntax_highlighter(const std::string& ext_or_filename) const;
+    syntax_data get_syntax_highlighter(const std::string& ext_or_filename) const;
 
   private:
-    std::map<std::string, comment_data> extension_to_data;
+    std::map<std::string, syntax_data> extension_to_data;
   };
\ No newline at end of file
@@ -0,0 +1,459 @@
+#include "token_cache.h"
+#include "utils.h"
+
+#include <jam_encoding.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+
+namespace
+  {
+  enum lexer_state
+    {
+    LS_CODE,
+    LS_MULTILINE_COMMENT,
+    LS_SINGLELINE_COMMENT,
+    LS_STRING
+    };
+
+  struct checkpoint
+    {
+    int64_t pos;
+    lexer_state state;
+    wchar_t string_delimiter; // the character that ends the string if state is LS_STRING
+    bool verified; // false for a checkpoint after an edit that no scan has passed yet
+    };
+
+  const int64_t checkpoint_distance = 4096;
+  const int64_t synchronous_scan_length = 16 * checkpoint_distance; // longer scans are done on the thread pool, if there is one
+
+  struct file_token_cache
+    {
+    jamlib::buffer content; // the version the checkpoints were computed for
+    syntax_data sd;
+    std::vector<std::wstring> keywords; // sorted
+    std::wstring word_characters;
+    size_t longest_keyword = 0;
+    std::vector<checkpoint> checkpoints; // sorted on pos, the first checkpoint is always {0, LS_CODE}, the verified checkpoints come first
+    int64_t last_p1 = -1, last_p2 = -1;
+    token_spans last_spans; // the result of the last call for content
+    uint64_t job_id = 0; // the background scan that will replace content and its results, 0 if there is none
+    };
+
+  struct token_scan_job
+    {
+    uint32_t file_id;
+    jamlib::buffer content; // the version that is scanned, owned by the main thread
+    file_token_cache fc; // its content is a worker copy of content, the worker scans it and fills in last_spans
+    };
+
+  std::map<uint32_t, file_token_cache> cache;
+  std::map<uint64_t, token_scan_job> jobs; // by job id, main thread only
+  uint64_t last_job_id = 0;
+  JAM::thread_pool* gp_pool = nullptr;
+  async_messages* gp_messages = nullptr;
+
+  int64_t longest_delimiter(const syntax_data& sd)
+    {
+    size_t len = std::max(sd.multiline_begin.size(), std::max(sd.multiline_end.size(), sd.single_line.size()));
+    return std::max<int64_t>((int64_t)len, 1);
+    }
+
+  bool matches(const jamlib::buffer::const_iterator& it, wchar_t ch, int64_t pos, int64_t size, const std::string& delimiter)
+    {
+    if (delimiter.empty() || ch != (wchar_t)delimiter[0] || pos + (int64_t)delimiter.size() > size)
+      return false;
+    auto it2 = it;
+    for (size_t j = 1; j < delimiter.size(); ++j)
+      {
+      ++it2;
+      if (*it2 != (wchar_t)delimiter[j])
+        return false;
+      }
+    return true;
+    }
+
+  bool is_digit(wchar_t ch)
+    {
+    return ch >= '0' && ch <= '9';
+    }
+
+  bool is_word_character(const file_token_cache& fc, wchar_t ch)
+    {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || is_digit(ch) || ch == '_' || ch > 127 || fc.word_characters.find(ch) != std::wstring::npos;
+    }
+
+  void set_syntax_data(file_token_cache& fc, const syntax_data& sd)
+    {
+    fc.sd = sd;
+    fc.keywords.clear();
+    fc.longest_keyword = 0;
+    for (const auto& keyword : sd.keywords)
+      {
+      fc.keywords.push_back(JAM::convert_string_to_wstring(keyword));
+      fc.longest_keyword = std::max(fc.longest_keyword, fc.keywords.back().size());
+      }
+    std::sort(fc.keywords.begin(), fc.keywords.end());
+    fc.word_characters = JAM::convert_string_to_wstring(sd.word_characters);
+    fc.checkpoints.clear();
+    }
+
+  // the text of content before first_modified and the last suffix characters of content are the same as in fc.content
+  void find_unmodified_text(const file_token_cache& fc, const jamlib::buffer& content, int64_t& first_modified, int64_t& suffix)
+    {
+    first_modified = (int64_t)immutable::first_difference(fc.content, content);
+    suffix = std::min<int64_t>((int64_t)immutable::common_suffix_length(fc.content, content), std::min<int64_t>((int64_t)fc.content.size(), (int64_t)content.size()) - first_modified);
+    }
+
+  /*
+  Returns the checkpoints of fc that do not depend on the modified text of content, and the checkpoints in the unmodified
+  text at the end of content, shifted. The shifted checkpoints are not verified: the text before them changed, and so might their state.
+  */
+  std::vector<checkpoint> updated_checkpoints(const file_token_cache& fc, const jamlib::buffer& content)
+    {
+    const int64_t old_size = (int64_t)fc.content.size();
+    const int64_t new_size = (int64_t)content.size();
+    int64_t first_modified, suffix;
+    find_unmodified_text(fc, content, first_modified, suffix);
+    // A checkpoint depends on the text before it, and on the look ahead of a delimiter or token that starts before it.
+    const int64_t look_ahead = longest_delimiter(fc.sd);
+    std::vector<checkpoint> kept;
+    for (auto cp : fc.checkpoints)
+      {
+      if (cp.pos == 0 || cp.pos + look_ahead <= first_modified)
+        kept.push_back(cp);
+      else if (cp.pos >= old_size - suffix)
+        {
+        cp.pos += new_size - old_size;
+        cp.verified = false;
+        kept.push_back(cp);
+        }
+      }
+    return kept;
+    }
+
+  // the last verified checkpoint at or before pos
+  size_t find_start_checkpoint(const std::vector<checkpoint>& checkpoints, int64_t pos)
+    {
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), pos, [](int64_t p, const checkpoint& cp) { return p < cp.pos; });
+    size_t i = (size_t)std::distance(checkpoints.begin(), it) - 1;
+    while (i > 0 && !checkpoints[i].verified)
+      --i;
+    return i;
+    }
+
+  void add_token(token_spans& ts, int64_t low, int64_t high, token_type type)
+    {
+    ts.low.push_back(low);
+    ts.high.push_back(high);
+    ts.type.push_back(type);
+    }
+
+  /*
+  Scans content from the last verified checkpoint before p1 up to p2, and reports the tokens that end at or after p1.
+  New checkpoints are added while scanning, and the checkpoints that are passed are verified.
+  */
+  token_spans scan(file_token_cache& fc, const jamlib::buffer& content, int64_t p1, int64_t p2)
+    {
+    token_spans ts;
+    const syntax_data& sd = fc.sd;
+    const int64_t size = (int64_t)content.size();
+    if (p2 > size)
+      p2 = size;
+
+    size_t next = find_start_checkpoint(fc.checkpoints, p1);
+    lexer_state state = fc.checkpoints[next].state;
+    wchar_t string_delimiter = fc.checkpoints[next].string_delimiter;
+    int64_t pos = fc.checkpoints[next].pos;
+    int64_t token_start = pos;
+    int64_t last_checkpoint = pos;
+    auto it = content.begin() + pos;
+    ++next;
+    std::wstring word;
+    while (pos < p2)
+      {
+      while (next < fc.checkpoints.size() && fc.checkpoints[next].pos < pos) // a token was scanned over this checkpoint
+        fc.checkpoints.erase(fc.checkpoints.begin() + next);
+      if (next < fc.checkpoints.size() && fc.checkpoints[next].pos == pos)
+        {
+        checkpoint& cp = fc.checkpoints[next];
+        if (!cp.verified)
+          {
+          if (cp.state == state && cp.string_delimiter == string_delimiter) // the scan re-synchronized with the checkpoints after the edit
+            {
+            for (size_t i = next; i < fc.checkpoints.size(); ++i)
+              fc.checkpoints[i].verified = true;
+            const size_t start = find_start_checkpoint(fc.checkpoints, p1);
+            if (start > next) // continue at the checkpoint before p1, the checkpoints in between are valid
+              {
+              next = start;
+              state = fc.checkpoints[next].state;
+              string_delimiter = fc.checkpoints[next].string_delimiter;
+              pos = token_start = fc.checkpoints[next].pos;
+              it = content.begin() + pos;
+              }
+            }
+          else
+            {
+            cp.state = state;
+            cp.string_delimiter = string_delimiter;
+            cp.verified = true;
+            }
+          }
+        last_checkpoint = pos;
+        ++next;
+        }
+      else if (pos >= last_checkpoint + checkpoint_distance)
+        {
+        fc.checkpoints.insert(fc.checkpoints.begin() + next, checkpoint{ pos, state, string_delimiter, true });
+        last_checkpoint = pos;
+        ++next;
+        }
+
+      wchar_t ch = *it;
+      int64_t step = 1;
+      switch (state)
+        {
+        case LS_CODE:
+        {
+        if (matches(it, ch, pos, size, sd.multiline_begin))
+          {
+          state = LS_MULTILINE_COMMENT;
+          token_start = pos;
+          step = (int64_t)sd.multiline_begin.size();
+          }
+        else if (matches(it, ch, pos, size, sd.single_line))
+          {
+          state = LS_SINGLELINE_COMMENT;
+          token_start = pos;
+          step = (int64_t)sd.single_line.size();
+          }
+        else if (ch < 128 && sd.string_delimiters.find((char)ch) != std::string::npos)
+          {
+          state = LS_STRING;
+          string_delimiter = ch;
+          token_start = pos;
+          }
+        else if (is_word_character(fc, ch))
+          {
+          const bool number = sd.numbers && is_digit(ch);
+          const bool hex = number && ch == '0' && pos + 1 < size && (*(it + 1) == 'x' || *(it + 1) == 'X');
+          word.clear();
+          auto it2 = it;
+          int64_t end = pos;
+          wchar_t previous = 0;
+          for (; end < size; ++end, ++it2)
+            {
+            const wchar_t c = *it2;
+            const bool exponent_sign = number && !hex && (c == '+' || c == '-') && (previous == 'e' || previous == 'E');
+            if (!is_word_character(fc, c) && !(number && c == '.') && !exponent_sign)
+              break;
+            if (word.size() <= fc.longest_keyword)
+              word.push_back(c);
+            previous = c;
+            }
+          step = end - pos;
+          if (end - 1 >= p1)
+            {
+            if (number)
+              add_token(ts, pos, end - 1, TT_NUMBER);
+            else if (word.size() <= fc.longest_keyword && std::binary_search(fc.keywords.begin(), fc.keywords.end(), word))
+              add_token(ts, pos, end - 1, TT_KEYWORD);
+            }
+          }
+        break;
+        }
+        case LS_MULTILINE_COMMENT:
+        {
+        if (matches(it, ch, pos, size, sd.multiline_end))
+          {
+          state = LS_CODE;
+          step = (int64_t)sd.multiline_end.size();
+          if (pos + step - 1 >= p1)
+            add_token(ts, token_start, pos + step - 1, TT_COMMENT);
+          }
+        break;
+        }
+        case LS_SINGLELINE_COMMENT:
+        {
+        if (ch == '\n')
+          {
+          state = LS_CODE;
+          if (pos >= p1)
+            add_token(ts, token_start, pos, TT_COMMENT);
+          }
+        break;
+        }
+        case LS_STRING:
+        {
+        if (ch == '\\' && pos + 1 < size)
+          step = 2;
+        else if (ch == string_delimiter)
+          {
+          state = LS_CODE;
+          if (pos >= p1)
+            add_token(ts, token_start, pos, TT_STRING);
+          }
+        else if (ch == '\n')
+          {
+          state = LS_CODE;
+          if (pos - 1 >= p1)
+            add_token(ts, token_start, pos - 1, TT_STRING);
+          }
+        break;
+        }
+        }
+      pos += step;
+      it += step;
+      }
+    if (state == LS_MULTILINE_COMMENT || state == LS_SINGLELINE_COMMENT)
+      add_token(ts, token_start, p2, TT_COMMENT);
+    else if (state == LS_STRING)
+      add_token(ts, token_start, p2, TT_STRING);
+    return ts;
+    }
+
+  /*
+  The results of the last scan of fc, for the text of content that did not change since. Tokens in the unmodified text
+  at the end are shifted, even though an edit before them can change them: they are only shown until the next scan is done.
+  */
+  token_spans tokens_in_unmodified_text(const file_token_cache& fc, const jamlib::buffer& content)
+    {
+    if (fc.content.raw().ptr == content.raw().ptr)
+      return fc.last_spans;
+    const int64_t old_size = (int64_t)fc.content.size();
+    const int64_t new_size = (int64_t)content.size();
+    int64_t first_modified, suffix;
+    find_unmodified_text(fc, content, first_modified, suffix);
+    token_spans ts;
+    for (size_t i = 0; i < fc.last_spans.low.size(); ++i)
+      {
+      if (fc.last_spans.high[i] < first_modified)
+        add_token(ts, fc.last_spans.low[i], fc.last_spans.high[i], fc.last_spans.type[i]);
+      else if (fc.last_spans.low[i] >= old_size - suffix)
+        add_token(ts, fc.last_spans.low[i] + new_size - old_size, fc.last_spans.high[i] + new_size - old_size, fc.last_spans.type[i]);
+      }
+    return ts;
+    }
+
+  /*
+  Scans content on the thread pool. The worker reads a worker copy of content, and the job keeps both alive until
+  finish_token_scan takes the results. The checkpoints of fc are not touched: until the job is done fc keeps the results
+  of the previous scan, see tokens_in_unmodified_text.
+  */
+  void start_token_scan(file_token_cache& fc, uint32_t file_id, const jamlib::buffer& content, std::vector<checkpoint>&& checkpoints, int64_t p1, int64_t p2)
+    {
+    const uint64_t job_id = ++last_job_id;
+    token_scan_job* job = &jobs[job_id];
+    job->file_id = file_id;
+    job->content = content;
+    job->fc = fc;
+    job->fc.content = make_worker_copy(content);
+    job->fc.checkpoints.swap(checkpoints);
+    job->fc.last_p1 = p1;
+    job->fc.last_p2 = p2;
+    job->fc.job_id = 0;
+    fc.job_id = job_id;
+    gp_pool->push([job, job_id, file_id, p1, p2]()
+      {
+      job->fc.last_spans = scan(job->fc, job->fc.content, p1, p2);
+      async_message m;
+      m.m = ASYNC_MESSAGE_HIGHLIGHT_RESULTS;
+      m.file_id = file_id;
+      m.job_id = job_id;
+      gp_messages->push_until(std::move(m), [&]() { return gp_pool->stopped(); });
+      });
+    }
+  }
+
+token_type get_token_type(const token_spans& spans, int64_t pos)
+  {
+  auto it = std::lower_bound(spans.high.begin(), spans.high.end(), pos);
+  if (it == spans.high.end())
+    return TT_NONE;
+  size_t i = std::distance(spans.high.begin(), it);
+  return pos >= spans.low[i] ? spans.type[i] : TT_NONE;
+  }
+
+bool is_comment(const token_spans& spans, int64_t pos)
+  {
+  return get_token_type(spans, pos) == TT_COMMENT;
+  }
+
+token_spans find_tokens(uint32_t file_id, const jamlib::buffer& content, const syntax_data& sd, int64_t p1, int64_t p2)
+  {
+  auto& fc = cache[file_id];
+  if (fc.sd != sd || fc.checkpoints.empty())
+    {
+    set_syntax_data(fc, sd);
+    fc.checkpoints.push_back(checkpoint{ 0, LS_CODE, 0, true });
+    fc.content = content;
+    fc.last_spans = token_spans();
+    fc.last_p1 = fc.last_p2 = -1;
+    fc.job_id = 0; // a running scan for other syntax data is ignored when it is done
+    }
+  else if (fc.content.raw().ptr == content.raw().ptr && fc.last_p1 == p1 && fc.last_p2 == p2)
+    return fc.last_spans;
+  if (fc.job_id != 0)
+    return tokens_in_unmodified_text(fc, content);
+
+  std::vector<checkpoint> checkpoints = fc.content.raw().ptr == content.raw().ptr ? fc.checkpoints : updated_checkpoints(fc, content);
+  const int64_t start = checkpoints[find_start_checkpoint(checkpoints, p1)].pos;
+  if (gp_pool && std::min<int64_t>(p2, (int64_t)content.size()) - start > synchronous_scan_length)
+    {
+    start_token_scan(fc, file_id, content, std::move(checkpoints), p1, p2);
+    return tokens_in_unmodified_text(fc, content);
+    }
+  fc.checkpoints.swap(checkpoints);
+  fc.content = content;
+  fc.last_spans = scan(fc, content, p1, p2);
+  fc.last_p1 = p1;
+  fc.last_p2 = p2;
+  return fc.last_spans;
+  }
+
+void scan_tokens_in_background(JAM::thread_pool* pool, async_messages* messages)
+  {
+  gp_pool = pool;
+  gp_messages = messages;
+  }
+
+bool finish_token_scan(uint64_t job_id)
+  {
+  auto it = jobs.find(job_id);
+  if (it == jobs.end())
+    return false;
+  bool used = false;
+  auto fit = cache.find(it->second.file_id);
+  if (fit != cache.end() && fit->second.job_id == job_id)
+    {
+    fit->second = std::move(it->second.fc);
+    fit->second.content = it->second.content;
+    used = true;
+    }
+  jobs.erase(it);
+  return used;
+  }
+
+void forget_file_tokens(uint32_t file_id)
+  {
+  std::map<uint32_t, file_token_cache> renumbered;
+  for (auto& c : cache)
+    {
+    if (c.first < file_id)
+      renumbered.emplace(c.first, std::move(c.second));
+    else if (c.first > file_id)
+      renumbered.emplace(c.first - 1, std::move(c.second));
+    }
+  cache.swap(renumbered);
+  for (auto& j : jobs)
+    {
+    if (j.second.file_id == file_id)
+      j.second.file_id = (uint32_t)-1; // its results are dropped when its message comes in
+    else if (j.second.file_id > file_id && j.second.file_id != (uint32_t)-1)
+      --j.second.file_id;
+    }
+  }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <jamlib/jam.h>
+
+#include "syntax_highlight.h"
+#include "async_messages.h"
+
+#include <jam_thread_pool.h>
+
+enum token_type
+  {
+  TT_NONE,
+  TT_KEYWORD,
+  TT_STRING,
+  TT_NUMBER,
+  TT_COMMENT
+  };
+
+struct token_spans
+  {
+  std::vector<int64_t> low, high; // inclusive bounds, sorted
+  std::vector<token_type> type;
+  };
+
+token_type get_token_type(const token_spans& spans, int64_t pos);
+
+bool is_comment(const token_spans& spans, int64_t pos);
+
+/*
+Returns the keywords, strings, numbers and comments that intersect [p1, p2) in content, which is the content of the file with id file_id.
+
+The state of the lexer (code, multiline comment, single line comment, string) is cached per file at checkpoints. When the content of the
+file changed, the checkpoints before the first modified position are kept, and the checkpoints in the unmodified text at the end are
+shifted but not trusted yet. The next scan that passes the edit compares its state with theirs: as soon as they agree the scan has
+re-synchronized, and all later checkpoints are valid again. The result of the last call is cached as well, for redraws of the same version.
+
+Scans that have to start far before p2, such as the first scan of a large file or a scan after an edit far above the view, are done on
+the thread pool if scan_tokens_in_background was called. Until the scan is done, find_tokens returns the tokens of the previous scan
+in the text that was not modified since, so that drawing never waits for the lexer. Drawing a slightly older version only shows less
+highlighting, as a missing token is drawn as plain text.
+*/
+token_spans find_tokens(uint32_t file_id, const jamlib::buffer& content, const syntax_data& sd, int64_t p1, int64_t p2);
+
+// Lets find_tokens scan on pool. A finished scan posts an ASYNC_MESSAGE_HIGHLIGHT_RESULTS message with its job id to messages.
+void scan_tokens_in_background(JAM::thread_pool* pool, async_messages* messages);
+
+// Takes the results of the background scan job_id, called by the main thread when its message comes in. Returns false if they were out of date.
+bool finish_token_scan(uint64_t job_id);
+
+// Forgets the tokens of file_id, whose window was closed, and renumbers the files after it as del_window does.
+void forget_file_tokens(uint32_t file_id);
@@ -185,3 +185,9 @@ std::string flip_backslash_to_slash_in_filename(const std::string& filename)
   std::replace(wfilename.begin(), wfilename.end(), '\\', '/'); // replace all '\\' to '/'
   return JAM::convert_wstring_to_string(wfilename);
   }
+
+jamlib::buffer make_worker_copy(const jamlib::buffer& content)
+  {
+  typedef immutable::rrb<wchar_t, false, 5> rrb_type;
+  return jamlib::buffer(immutable::ref<rrb_type>(immutable::rrb_details::rrb_head_clone(content.raw().ptr)));
+  }
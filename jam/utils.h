@@ -17,6 +17,12 @@ std::string get_file_in_executable_path(const std::string& filename);
 
 std::string flip_backslash_to_slash_in_filename(const std::string& filename);
 
+/*
+Returns a copy of content that shares all its nodes, but not its header. A worker thread can read the copy through
+a pointer while the main thread keeps editing the file, as long as the main thread keeps the copy alive until the worker is done.
+*/
+jamlib::buffer make_worker_copy(const jamlib::buffer& content);
+
 
 /*
 Input is a filename and the filename of the window.
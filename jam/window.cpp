@@ -7,6 +7,7 @@
 #include <set>
 #include <algorithm>
 #include <cctype>
+#include <utility>
 
 #include <curses.h>
 #include <jam_filename.h>
@@ -14,6 +15,8 @@
 #include "mouse.h"
 #include "keyboard.h"
 #include "syntax_highlight.h"
+#include "token_cache.h"
+#include "line_index.h"
 
 #include <jam_encoding.h>
 #include <jam_pipe.h>
@@ -34,10 +37,21 @@ uint32_t character_width(uint32_t character, int64_t col, jamlib::encoding enc,
       }
     }  
 
+int64_t skip_invisible_columns(const jamlib::buffer& content, int64_t pos, int64_t col, const window& w)
+  {
+  if (w.word_wrap)
+    return pos;
+  if (col < w.file_col)
+    return skip_in_line(content, pos, w.file_col - col);
+  if (col >= w.cols + w.file_col)
+    return line_end(content, pos);
+  return pos;
+  }
+
 namespace
   {
 
-  bool has_syntax_highlight(comment_data& cd, const std::string& filename_or_extension)
+  bool has_syntax_highlight(syntax_data& cd, const std::string& filename_or_extension)
     {
     static syntax_highlighter sh;
     if (sh.extension_or_filename_has_syntax_highlighter(filename_or_extension))
@@ -50,6 +64,25 @@ namespace
 
 #define ALL_CHARS_FORMAT A_BOLD
 
+  chtype token_format(token_type type)
+    {
+    switch (type)
+      {
+      case TT_KEYWORD: return COLOR_PAIR(keyword);
+      case TT_STRING: return COLOR_PAIR(string_literal);
+      case TT_NUMBER: return COLOR_PAIR(number_literal);
+      case TT_COMMENT: return COLOR_PAIR(comment);
+      default: return 0;
+      }
+    }
+
+  // brackets in comments and strings are not matched
+  bool is_code(const token_spans& tokens, int64_t pos)
+    {
+    const token_type type = get_token_type(tokens, pos);
+    return type != TT_COMMENT && type != TT_STRING;
+    }
+
   bool character_invert(uint32_t character, const settings& sett)
     {
     if (sett.show_all_characters)
@@ -96,7 +129,7 @@ namespace
 
 window::window(int ix, int iy, int icols, int irows, uint32_t fid, uint32_t nid, bool command_window) : file_id(fid),
 nephew_id(nid), is_command_window(command_window), file_pos(0), file_col(0), wordwrap_row(0), word_wrap(true), scroll_fraction(0.1),
-piped(false), highlight_comments(true), piped_prompt_index(0), previous_file_pos(-1), previous_file_pos_was_comment(false)
+piped(false), highlight_comments(true), piped_prompt_index(0)
   {
 #ifdef _WIN32
     process = nullptr;
@@ -180,414 +213,7 @@ namespace
       }
     }
 
-  struct comment_ranges
-    {
-    std::vector<int64_t> low, high;
-    };
-
-  bool is_comment(const comment_ranges& ranges, int64_t pos)
-    {
-    auto it = std::lower_bound(ranges.high.begin(), ranges.high.end(), pos);
-    if (it == ranges.high.end())
-      return false;
-    size_t i = std::distance(ranges.high.begin(), it);
-    int64_t low = ranges.low[i];
-    return (pos >= low);
-    }
-
-  bool in_quotes(const jamlib::file& f, int64_t p1, int64_t p2)
-    {    
-    int nr_of_left_quotes = 0;
-    auto it = f.content.begin() + p1;
-    while (p1 > 0 && (*it != '\n'))
-      {
-      --p1;
-      --it;
-      if (*it == '"')        
-        ++nr_of_left_quotes;        
-      }
-    return (nr_of_left_quotes % 2 == 1);
-    //if (nr_of_left_quotes % 2 == 0)
-    //  return false;
-    /*
-    it = f.content.begin() + p2;
-    while (p2 < f.content.size() && (*it != '\n'))
-      {
-      ++p2;
-      ++it;
-      if (*it == '"')
-        return true;
-      }
-      */
-    }
-
-  int64_t find_previous_comment_sign(jamlib::app_state state, bool begin, int64_t p1, int64_t p2, const comment_data& cd)
-    {    
-    const std::string* p_target = (begin ? &cd.multiline_begin : &cd.multiline_end);
-    if (state.files[state.active_file].content.size() < p_target->size())
-      return -1;
-
-    p2 += p_target->size(); // It's possible that p2 itself is the start of the comment sign, so we have to add the length of the comment sign to p2
-    if (p2 > state.files[state.active_file].content.size())
-      p2 = state.files[state.active_file].content.size();
-
-    state.files[state.active_file].dot.r.p1 = p1;
-    state.files[state.active_file].dot.r.p2 = p2;
-    bool found = false;
-    while (!found)
-      {
-      std::stringstream ss;
-      ss << "s/" << resolve_regex_escape_characters(*p_target) << "/" << resolve_jamlib_escape_characters(*p_target) << "/";
-      state = *jamlib::handle_command(state, ss.str());
-      if (state.files[state.active_file].dot.r.p2 - state.files[state.active_file].dot.r.p1 != p_target->size())
-        return -1;
-      int64_t candidate = state.files[state.active_file].dot.r.p1;
-
-      for (int j = 0; j < p_target->size(); ++j)
-        {
-        if (state.files[state.active_file].content[candidate + j] != (*p_target)[j])
-          return -1;
-        }
-      /*
-      ss << ".-/" << resolve_regex_escape_characters(*p_target) << "/";
-      state = *jamlib::handle_command(state, ss.str());
-      int64_t candidate = state.files[state.active_file].dot.r.p1;
-      if (candidate == 0)
-        {
-        for (int j = 0; j < p_target->size(); ++j)
-          {
-          if (state.files[state.active_file].content[j] != (*p_target)[j])
-            return -1;
-          }
-        return 0;
-        }
-        */
-      found = true; // we found a candidate, but have to check whether it is not commented out by the single line comment, or is in quotes
-
-      bool is_quoted = in_quotes(state.files[state.active_file], state.files[state.active_file].dot.r.p1, state.files[state.active_file].dot.r.p2);
-      if (is_quoted)
-        {
-        found = false;
-        state.files[state.active_file].dot.r.p1 = p1; // restart search
-        state.files[state.active_file].dot.r.p2 = candidate;
-        continue;
-        }
-
-      //if (!begin)
-      //  return candidate;
-      int64_t linebegin = candidate;
-      auto it = state.files[state.active_file].content.begin() + linebegin;
-      while (linebegin && (*it != '\n'))
-        {
-        --it;
-        --linebegin;
-        }
-      state.files[state.active_file].dot.r.p1 = linebegin;
-      state.files[state.active_file].dot.r.p2 = candidate;
-      std::stringstream ss2;
-      ss2 << "s/" << resolve_regex_escape_characters(cd.single_line) << "/" << resolve_jamlib_escape_characters(cd.single_line) << "/";
-      is_quoted = true;
-      while (is_quoted)
-        {
-        is_quoted = false;
-
-        state = *jamlib::handle_command(state, ss2.str()); // find single line comment and substitute by single line comment
-        if (state.files[state.active_file].dot.r.p2 - state.files[state.active_file].dot.r.p1 == cd.single_line.size())
-          {
-          int64_t t = state.files[state.active_file].dot.r.p1;
-          found = false;
-          is_quoted = in_quotes(state.files[state.active_file], state.files[state.active_file].dot.r.p1, state.files[state.active_file].dot.r.p2);
-          if (!is_quoted)
-            {
-            for (int j = 0; j < cd.single_line.size(); ++j)
-              if (state.files[state.active_file].content[t + j] != cd.single_line[j])
-                found = true;
-            }
-          else
-            {
-            state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2;
-            state.files[state.active_file].dot.r.p2 = candidate;
-            }
-          }
-        }
-      if (found)
-        return candidate;
-      state.files[state.active_file].dot.r.p1 = p1; // restart search
-      state.files[state.active_file].dot.r.p2 = candidate;
-      }
-    return -1;
-    }
-
-  int64_t find_next_comment_sign(jamlib::app_state state, bool begin, int64_t p1, int64_t p2, const comment_data& cd)
-    {
-    const std::string* p_target = (begin ? &cd.multiline_begin : &cd.multiline_end);
-    if (state.files[state.active_file].content.size() < p_target->size())
-      return -1;
-    state.files[state.active_file].dot.r.p1 = p1;
-    state.files[state.active_file].dot.r.p2 = p2;
-    bool found = false;
-    while (!found)
-      {
-      std::stringstream ss;
-      ss << "s/" << resolve_regex_escape_characters(*p_target) << "/" << resolve_jamlib_escape_characters(*p_target) << "/";
-      state = *jamlib::handle_command(state, ss.str());
-      if (state.files[state.active_file].dot.r.p2 - state.files[state.active_file].dot.r.p1 != p_target->size())
-        return -1;
-      int64_t candidate = state.files[state.active_file].dot.r.p1;
-
-      for (int j = 0; j < p_target->size(); ++j)
-        {
-        if (state.files[state.active_file].content[candidate + j] != (*p_target)[j])
-          return -1;
-        }
-      found = true; // we found a candidate, but have to check whether it is not commented out by the single line comment or in quotes
-
-      bool is_quoted = in_quotes(state.files[state.active_file], state.files[state.active_file].dot.r.p1, state.files[state.active_file].dot.r.p2);
-      if (is_quoted)
-        {
-        found = false;
-        state.files[state.active_file].dot.r.p1 = candidate + p_target->size(); // restart search
-        state.files[state.active_file].dot.r.p2 = p2;
-        continue;
-        }
-
-      //if (!begin || cd.single_line.empty())
-      //  return candidate;
-      if (cd.single_line.empty())
-        return candidate;
-      int64_t linebegin = candidate;
-      auto it = state.files[state.active_file].content.begin() + linebegin;
-      while (linebegin && (*it != '\n'))
-        {
-        --it;
-        --linebegin;
-        }
-      state.files[state.active_file].dot.r.p1 = linebegin;
-      state.files[state.active_file].dot.r.p2 = candidate;
-
-      std::stringstream ss2;
-      ss2 << "s/" << resolve_regex_escape_characters(cd.single_line) << "/" << resolve_jamlib_escape_characters(cd.single_line) << "/";
-      is_quoted = true;
-      while (is_quoted)
-        {
-        is_quoted = false;
-        state = *jamlib::handle_command(state, ss2.str()); // find single line comment and substitute by single line comment      
-        if (state.files[state.active_file].dot.r.p2 - state.files[state.active_file].dot.r.p1 == cd.single_line.size())
-          {
-          int64_t t = state.files[state.active_file].dot.r.p1;
-          found = false;
-          is_quoted = in_quotes(state.files[state.active_file], state.files[state.active_file].dot.r.p1, state.files[state.active_file].dot.r.p2);
-          if (!is_quoted)
-            {
-            for (int j = 0; j < cd.single_line.size(); ++j)
-              if (state.files[state.active_file].content[t + j] != cd.single_line[j])
-                found = true;
-            }
-          else
-            {
-            state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2;
-            state.files[state.active_file].dot.r.p2 = candidate;
-            }
-          }
-        }
-      if (found)
-        return candidate;
-      state.files[state.active_file].dot.r.p1 = candidate + p_target->size(); // restart search
-      state.files[state.active_file].dot.r.p2 = p2;
-      }
-    return -1;
-    }
-
-  bool compute_pos_is_in_comment(jamlib::app_state state, int64_t pos, const comment_data& cd)
-    {
-    state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2 = pos;
-    int64_t first_comment_start = find_previous_comment_sign(state, true, 0, pos, cd); // << this is the slow step
-
-    if (first_comment_start == -1)
-      return false;
-
-    state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2 = first_comment_start;
-    //int64_t first_comment_stop = find_next_comment_sign(state, false, first_comment_start, pos + 1, cd);
-    int64_t first_comment_stop = find_next_comment_sign(state, false, first_comment_start, pos, cd);
-    if (first_comment_stop == -1)
-      return true;
-    return first_comment_stop > pos;
-    }
-
-  bool compute_pos_is_in_comment(jamlib::app_state state, int64_t pos, const comment_data& cd, int64_t previous_pos_computed, bool previous_pos_was_comment)
-    {
-    if (pos == previous_pos_computed)
-      return previous_pos_was_comment;
-    if (previous_pos_computed < pos) // look forward
-      {
-      bool currently_inside_comment = previous_pos_was_comment;
-      int64_t current_pos = previous_pos_computed;
-      for (;;)
-        {
-        //int64_t next_comment_token = find_next_comment_sign(state, !currently_inside_comment, current_pos, pos + 1, cd);
-        int64_t next_comment_token = find_next_comment_sign(state, !currently_inside_comment, current_pos, pos, cd);
-        if (next_comment_token == -1)
-          return currently_inside_comment;
-        current_pos = next_comment_token;
-        currently_inside_comment = !currently_inside_comment;
-        }
-      }
-    else // look backward
-      {
-      bool currently_inside_comment = previous_pos_was_comment;
-      int64_t current_pos = previous_pos_computed;
-      for (;;)
-        {
-        int64_t previous_comment_token = find_previous_comment_sign(state, currently_inside_comment, pos, current_pos, cd);
-        if (previous_comment_token == -1)
-          return currently_inside_comment;
-        current_pos = previous_comment_token;
-        currently_inside_comment = !currently_inside_comment;
-        }
-      }
-    return compute_pos_is_in_comment(state, pos, cd);
-    }
-
-  bool pos_is_in_comment(const jamlib::app_state& state, int64_t pos, const comment_data& cd, int64_t previous_pos_computed, bool previous_pos_was_comment)
-    {
-    if (previous_pos_computed < 0)
-      return compute_pos_is_in_comment(state, pos, cd);
-    if (std::abs(previous_pos_computed - pos) > pos)
-      return compute_pos_is_in_comment(state, pos, cd);
-    return compute_pos_is_in_comment(state, pos, cd, previous_pos_computed, previous_pos_was_comment);
-    }
-
-  comment_ranges find_cpp_multiline_comments(jamlib::app_state state, int64_t p1, int64_t p2, const comment_data& cd, int64_t previous_pos_computed, bool previous_pos_was_comment)
-    {
-    comment_ranges cr;
-    if (cd.multiline_begin.empty())
-      return cr;
-    bool start_as_comment = pos_is_in_comment(state, p1, cd, previous_pos_computed, previous_pos_was_comment);
-    int64_t current_pos = p1;
-    if (start_as_comment)
-      {
-      state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2 = p1;
-      int64_t first_comment_stop = find_next_comment_sign(state, false, p1, p2, cd);
-      if (first_comment_stop == -1)
-        {
-        cr.low.push_back(p1);
-        cr.high.push_back(p2);
-        return cr;
-        }
-      cr.low.push_back(p1);
-      cr.high.push_back(first_comment_stop + cd.multiline_end.length()-1);
-      if (first_comment_stop + cd.multiline_end.length() >= p2)
-        return cr;
-      current_pos = first_comment_stop + cd.multiline_end.length();
-      }
-
-    while (current_pos < p2)
-      {
-      state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2 = current_pos;
-      int64_t comment_start = find_next_comment_sign(state, true, current_pos, p2, cd);
-      if (comment_start == -1)
-        return cr;
-      if (comment_start >= p2)
-        return cr;
-      state.files[state.active_file].dot.r.p1 = state.files[state.active_file].dot.r.p2 = comment_start;
-      int64_t comment_stop = find_next_comment_sign(state, false, current_pos, p2, cd);
-      if (comment_stop == -1)
-        {
-        cr.low.push_back(comment_start);
-        cr.high.push_back(p2);
-        return cr;
-        }
-      cr.low.push_back(comment_start);
-      cr.high.push_back(comment_stop + cd.multiline_end.length() - 1);
-      if (comment_stop + cd.multiline_end.length() >= p2)
-        return cr;
-      current_pos = comment_stop + cd.multiline_end.length();
-      }
-    return cr;
-    }
-
-  comment_ranges find_cpp_singleline_comments(jamlib::app_state state, int64_t p1, int64_t p2, const comment_data& cd)
-    {
-    comment_ranges cr;
-    if (cd.single_line.empty())
-      return cr;
-    int64_t current_pos = p1;
-    while (current_pos < p2)
-      {
-      state.files[state.active_file].dot.r.p1 = current_pos;
-      state.files[state.active_file].dot.r.p2 = p2;
-
-      std::stringstream ss;
-      ss << "s/" << resolve_regex_escape_characters(cd.single_line) << "/" << resolve_jamlib_escape_characters(cd.single_line) << "/";
-      
-      jamlib::app_state new_state = *jamlib::handle_command(state, ss.str()); // find single line comment and substitute by single line comment
-
-      if (new_state.files[new_state.active_file].dot.r.p2 - new_state.files[new_state.active_file].dot.r.p1 == cd.single_line.size())
-        {
-        int64_t t = new_state.files[new_state.active_file].dot.r.p1;
-        for (int j = 0; j < cd.single_line.size(); ++j)
-          if (new_state.files[new_state.active_file].content[t + j] != cd.single_line[j])
-            return cr;
-
-        bool is_quoted = in_quotes(new_state.files[state.active_file], new_state.files[state.active_file].dot.r.p1, new_state.files[state.active_file].dot.r.p2);
-        if (is_quoted)
-          {
-          current_pos = new_state.files[new_state.active_file].dot.r.p2;
-          continue;
-          }
-
-        auto it = state.files[state.active_file].content.begin() + t;
-        auto it_end = state.files[state.active_file].content.begin() + p2;
-        current_pos = t;
-        for (; it != it_end; ++it, ++current_pos)
-          {
-          if (*it == '\n')
-            {
-            cr.low.push_back(t);
-            cr.high.push_back(current_pos);
-            break;
-            }
-          }
-        if (it == it_end)
-          {
-          cr.low.push_back(t);
-          cr.high.push_back(current_pos);
-          }
-
-        }
-      else
-        return cr;
-      }
-
-    return cr;
-    }
-
-  comment_ranges find_cpp_comments(const jamlib::app_state& state, int64_t p1, int64_t p2, const comment_data& cd, int64_t previous_pos_computed, int64_t current_pos, bool& previous_pos_was_multiline_comment)
-    {
-    comment_ranges cr = find_cpp_multiline_comments(state, p1, p2, cd, previous_pos_computed, previous_pos_was_multiline_comment);
-    previous_pos_was_multiline_comment = is_comment(cr, current_pos); // update boolean: current_pos will become previous_pos_computed.
-    if (cr.low.empty())
-      {
-      return find_cpp_singleline_comments(state, p1, p2, cd);
-      }
-    comment_ranges out = find_cpp_singleline_comments(state, p1, cr.low[0], cd);
-    out.low.push_back(cr.low[0]);
-    out.high.push_back(cr.high[0]);
-    for (int i = 1; i < cr.low.size(); ++i)
-      {
-      comment_ranges sl = find_cpp_singleline_comments(state, cr.high[i - 1], cr.low[i], cd);
-      out.low.insert(out.low.end(), sl.low.begin(), sl.low.end());
-      out.high.insert(out.high.end(), sl.high.begin(), sl.high.end());
-      out.low.push_back(cr.low[i]);
-      out.high.push_back(cr.high[i]);
-      }
-    comment_ranges sl = find_cpp_singleline_comments(state, cr.high.back(), p2, cd);
-    out.low.insert(out.low.end(), sl.low.begin(), sl.low.end());
-    out.high.insert(out.high.end(), sl.high.begin(), sl.high.end());
-    return out;
-    }
-
-  int64_t find_next(const jamlib::file& f, wchar_t left_sign, wchar_t right_sign, int64_t pos, bool reverse, int64_t p1, int64_t p2, comment_ranges comments)
+  int64_t find_next(const jamlib::file& f, wchar_t left_sign, wchar_t right_sign, int64_t pos, bool reverse, int64_t p1, int64_t p2, const token_spans& tokens)
     {
     if (reverse)
       {
@@ -598,9 +224,9 @@ namespace
         {
         if (pos < p1) // match is not visible in current view
           break;
-        if (*it == right_sign && !is_comment(comments, pos))
+        if (*it == right_sign && is_code(tokens, pos))
           ++cnt;
-        if (*it == left_sign && !is_comment(comments, pos))
+        if (*it == left_sign && is_code(tokens, pos))
           --cnt;
         if (cnt == 0)
           break;
@@ -617,9 +243,9 @@ namespace
         {
         if (pos > p2) // match is not visible in current view
           break;
-        if (*it == left_sign && !is_comment(comments, pos))
+        if (*it == left_sign && is_code(tokens, pos))
           ++cnt;
-        if (*it == right_sign && !is_comment(comments, pos))
+        if (*it == right_sign && is_code(tokens, pos))
           --cnt;
         if (cnt == 0)
           break;
@@ -630,7 +256,7 @@ namespace
     return -1;
     }
 
-  std::set<int64_t> find_highlights(const jamlib::file& f, int64_t p1, int64_t p2, comment_ranges comments)
+  std::set<int64_t> find_highlights(const jamlib::file& f, int64_t p1, int64_t p2, const token_spans& tokens)
     {
     std::set<int64_t> h;
     if (f.dot.r.p1 != f.dot.r.p2)
@@ -639,7 +265,7 @@ namespace
       return h;
     if (f.dot.r.p1 < 0)
       return h;
-    if (is_comment(comments, f.dot.r.p1))
+    if (!is_code(tokens, f.dot.r.p1))
       return h;
     wchar_t ch = f.content[f.dot.r.p1];
 
@@ -649,7 +275,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 + 1;
-      int64_t res = find_next(f, '(', ')', pos, false, p1, p2, comments);
+      int64_t res = find_next(f, '(', ')', pos, false, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -658,7 +284,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 - 1;
-      int64_t res = find_next(f, '(', ')', pos, true, p1, p2, comments);
+      int64_t res = find_next(f, '(', ')', pos, true, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -667,7 +293,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 + 1;
-      int64_t res = find_next(f, '{', '}', pos, false, p1, p2, comments);
+      int64_t res = find_next(f, '{', '}', pos, false, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -676,7 +302,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 - 1;
-      int64_t res = find_next(f, '{', '}', pos, true, p1, p2, comments);
+      int64_t res = find_next(f, '{', '}', pos, true, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -685,7 +311,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 + 1;
-      int64_t res = find_next(f, '[', ']', pos, false, p1, p2, comments);
+      int64_t res = find_next(f, '[', ']', pos, false, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -694,7 +320,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 - 1;
-      int64_t res = find_next(f, '[', ']', pos, true, p1, p2, comments);
+      int64_t res = find_next(f, '[', ']', pos, true, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -703,7 +329,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 + 1;
-      int64_t res = find_next(f, '<', '>', pos, false, p1, p2, comments);
+      int64_t res = find_next(f, '<', '>', pos, false, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -712,7 +338,7 @@ namespace
       {
       h.insert(f.dot.r.p1);
       int64_t pos = f.dot.r.p1 - 1;
-      int64_t res = find_next(f, '<', '>', pos, true, p1, p2, comments);
+      int64_t res = find_next(f, '<', '>', pos, true, p1, p2, tokens);
       if (res >= 0)
         h.insert(res);
       break;
@@ -734,7 +360,7 @@ namespace
     return false;
     }
 
-  void draw(window& w, jamlib::app_state state, const settings& sett, window_type wt)
+  void draw(window& w, const jamlib::app_state& state, const settings& sett, window_type wt)
     {
     int64_t the_active_file_id = state.active_file;
 
@@ -879,38 +505,35 @@ namespace
       }
 
 
-    jamlib::file file_for_finding_highlights = state.files[w.file_id];
+    const jamlib::file& file_for_finding_highlights = state.files[w.file_id];
 
-    state.active_file = w.file_id;
+    jamlib::app_state visible_state = state; // shares the files with state, only the dot of w.file_id changes below
+    visible_state.active_file = w.file_id;
 
     if (w.is_command_window)
       {
-      std::stringstream str;
-      state = *jamlib::handle_command(state, ",");
+      visible_state = *jamlib::handle_command(std::move(visible_state), ",");
       }
     else
       {
       std::stringstream str;
       str << "#" << w.file_pos << ",#" << w.file_pos << " + " << w.rows + w.wordwrap_row;
-      state = *jamlib::handle_command(state, str.str());
+      visible_state = *jamlib::handle_command(std::move(visible_state), str.str());
       }
 
-    int64_t p1 = state.files[state.active_file].dot.r.p1;
-    int64_t p2 = state.files[state.active_file].dot.r.p2;    
-
-    bool this_window_might_have_comments = false;
+    const auto& visible_range = visible_state.files[w.file_id].dot.r;
+    int64_t p1 = visible_range.p1;
+    int64_t p2 = visible_range.p2;
 
-    comment_ranges comments;
+    token_spans tokens;
     if (!w.is_command_window && w.highlight_comments)
       {
       auto ext = JAM::get_extension(remove_quotes_from_path(state.files[w.file_id].filename));
       std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return std::tolower(c); });
-      comment_data cd;
+      syntax_data cd;
       if (has_syntax_highlight(cd, ext))
         {
-        this_window_might_have_comments = true;
-        comments = find_cpp_comments(state, p1, p2, cd, w.previous_file_pos, w.file_pos, w.previous_file_pos_was_comment);
-        w.previous_file_pos = w.file_pos;
+        tokens = find_tokens(w.file_id, state.files[w.file_id].content, cd, p1, p2);
         }
       else
         {
@@ -918,26 +541,18 @@ namespace
         std::transform(fn.begin(), fn.end(), fn.begin(), [](unsigned char c) { return std::tolower(c); });
         if (has_syntax_highlight(cd, fn))
           {
-          this_window_might_have_comments = true;
-          comments = find_cpp_comments(state, p1, p2, cd, w.previous_file_pos, w.file_pos, w.previous_file_pos_was_comment);
-          w.previous_file_pos = w.file_pos;
+          tokens = find_tokens(w.file_id, state.files[w.file_id].content, cd, p1, p2);
           }
         } 
       }
 
-    if (!this_window_might_have_comments)
-      {
-      w.previous_file_pos = -1;
-      w.previous_file_pos_was_comment = false;
-      }
-
-    auto highlights = find_highlights(file_for_finding_highlights, p1, p2, comments); // p1 and p2 are lower and upper bounds for finding matches (,) {,}
+    auto highlights = find_highlights(file_for_finding_highlights, p1, p2, tokens); // p1 and p2 are lower and upper bounds for finding matches (,) {,}
 
     int64_t row = 0;
     int64_t col = 0;
 
-    auto it = state.files[state.active_file].content.begin() + p1;
-    auto it_end = state.files[state.active_file].content.begin() + p2;
+    auto it = state.files[w.file_id].content.begin() + p1;
+    auto it_end = state.files[w.file_id].content.begin() + p2;
 
     int64_t pos = p1;
 
@@ -951,7 +566,24 @@ namespace
 
     for (; it != it_end; ++it, ++pos)
       {
-      assert(it == state.files[state.active_file].content.begin() + pos);
+      if (*it != '\n')
+        {
+        int64_t skip_to = std::min<int64_t>(skip_invisible_columns(state.files[w.file_id].content, pos, col, w), p2);
+        for (int64_t change : { orig_p1, orig_p2, middle_p1, middle_p2, right_p1, right_p2 }) // the attributes change at these positions, so they cannot be skipped
+          {
+          if (change >= pos && change < skip_to)
+            skip_to = change;
+          }
+        if (skip_to > pos)
+          {
+          col += skip_to - pos;
+          pos = skip_to;
+          if (pos == p2)
+            break;
+          it = state.files[w.file_id].content.begin() + pos;
+          }
+        }
+      assert(it == state.files[w.file_id].content.begin() + pos);
       if (w.is_command_window && (col == 0) && (row > 0))
         {
         set_normal_attr(attribute_stack, wt);
@@ -1111,17 +743,17 @@ namespace
             if (first_pos < 0)
               first_pos = pos;
             auto character = *it;
-            bool should_show_as_comment = is_comment(comments, pos);
-            if (should_show_as_comment)
+            chtype token_attr = token_format(get_token_type(tokens, pos));
+            if (token_attr)
               {
               if (is_selecting(attribute_stack.back()))
-                should_show_as_comment = false;
+                token_attr = 0;
               }
             bool should_highlight = highlights.find(pos) != highlights.end();
             if (should_highlight)
-              should_show_as_comment = false;
-            if (should_show_as_comment)
-              attron(COLOR_PAIR(comment));
+              token_attr = 0;
+            if (token_attr)
+              attron(token_attr);
             if (should_highlight)
               attron(COLOR_PAIR(highlight));
             bool ch_invert = character_invert(character, sett);
@@ -1143,9 +775,9 @@ namespace
               attroff(COLOR_PAIR(highlight));
               attron(attribute_stack.back());
               }
-            if (should_show_as_comment)
+            if (token_attr)
               {
-              attroff(COLOR_PAIR(comment));
+              attroff(token_attr);
               attron(attribute_stack.back());
               }
             col += cwidth;
@@ -1174,17 +806,17 @@ namespace
             if (first_pos < 0)
               first_pos = pos;
             auto character = *it;
-            bool should_show_as_comment = is_comment(comments, pos);
-            if (should_show_as_comment)
+            chtype token_attr = token_format(get_token_type(tokens, pos));
+            if (token_attr)
               {
               if (is_selecting(attribute_stack.back()))
-                should_show_as_comment = false;
+                token_attr = 0;
               }
             bool should_highlight = highlights.find(pos) != highlights.end();
             if (should_highlight)
-              should_show_as_comment = false;
-            if (should_show_as_comment)
-              attron(COLOR_PAIR(comment));
+              token_attr = 0;
+            if (token_attr)
+              attron(token_attr);
             if (should_highlight)
               attron(COLOR_PAIR(highlight));
             bool ch_invert = character_invert(character, sett);
@@ -1206,9 +838,9 @@ namespace
               attroff(COLOR_PAIR(highlight));
               attron(attribute_stack.back());
               }
-            if (should_show_as_comment)
+            if (token_attr)
               {
-              attroff(COLOR_PAIR(comment));
+              attroff(token_attr);
               attron(attribute_stack.back());
               }
             col += cwidth;
@@ -1237,9 +869,9 @@ namespace
       }
 
     set_normal_attr(wt);
-    if (it_end == state.files[state.active_file].content.end())
+    if (it_end == state.files[w.file_id].content.end())
       {
-      if (orig_p1 == state.files[state.active_file].content.size())
+      if (orig_p1 == state.files[w.file_id].content.size())
         attron(dot_format);
       move((int)(w.y + (row - w.wordwrap_row)), (int)(w.x + (col - w.file_col)));
       if (w.word_wrap)
@@ -1316,10 +948,10 @@ namespace
       int scroll1 = 0;
       int scroll2 = (w.rows - 2);
 
-      if (!state.files[state.active_file].content.empty())
+      if (!state.files[w.file_id].content.empty())
         {
-        scroll1 = (int)((double)first_pos / (double)state.files[state.active_file].content.size() * (w.rows - 2));
-        scroll2 = (int)((double)pos / (double)state.files[state.active_file].content.size() * (w.rows - 2));
+        scroll1 = (int)((double)first_pos / (double)state.files[w.file_id].content.size() * (w.rows - 2));
+        scroll2 = (int)((double)pos / (double)state.files[w.file_id].content.size() * (w.rows - 2));
         }
 
       const unsigned char scrollbar_ascii_sign = 219;
@@ -1339,9 +971,9 @@ namespace
         {
         //int64_t scrollbar_pos = 0;
         //if (w.rows - 2 - nr_of_scroll_rows > 0)
-        //  scrollbar_pos = (int64_t)(state.files[state.active_file].content.size()*std::min<double>(1.0, (r - 1) / (double)(w.rows - 2 - nr_of_scroll_rows)));
+        //  scrollbar_pos = (int64_t)(state.files[w.file_id].content.size()*std::min<double>(1.0, (r - 1) / (double)(w.rows - 2 - nr_of_scroll_rows)));
         move(w.y + r, w.outer_x);
-        int64_t scrollbar_pos = (int64_t)((double)(r - 1) / (double)(w.rows - 2) * (double)state.files[state.active_file].content.size());
+        int64_t scrollbar_pos = (int64_t)((double)(r - 1) / (double)(w.rows - 2) * (double)state.files[w.file_id].content.size());
         add_ex(w.file_id, scrollbar_pos, SET_SCROLLBAR);
         //if (r - 1 >= scroll_pos && r - 1 < scroll_pos + nr_of_scroll_rows)
         if (r - 1 == scroll1)
@@ -1367,16 +999,172 @@ namespace
         attron(COLOR_PAIR(scroll_bar));
         }
       move(w.y + w.rows - 1, w.outer_x);
-      add_ex(w.file_id, state.files[state.active_file].content.size(), SET_SCROLLBAR);
+      add_ex(w.file_id, state.files[w.file_id].content.size(), SET_SCROLLBAR);
       //addch(ACS_LLCORNER);
       //addch(jamlib::ascii_to_utf16(200));
       addch(jamlib::ascii_to_utf16(scrollbar_ascii_sign));
       move(w.y + w.rows - 1, w.outer_x + 1);
-      add_ex(w.file_id, state.files[state.active_file].content.size(), SET_SCROLLBAR);
+      add_ex(w.file_id, state.files[w.file_id].content.size(), SET_SCROLLBAR);
       attroff(COLOR_PAIR(scroll_bar));
       }
     }
 
+  /*
+  Damage tracking: we remember for each window the state it was drawn with. A window is only redrawn
+  if something that influences its appearance changed. The content is compared by the identity of its
+  rrb root, which is cheap as any modification of an immutable buffer yields a new root.
+  */
+  struct window_draw_signature
+    {
+    bool valid = false;
+    int outer_x, outer_y, outer_cols, outer_rows;
+    uint32_t file_id, nephew_id;
+    int64_t file_pos, file_col, wordwrap_row;
+    bool word_wrap, highlight_comments;
+    jamlib::buffer content; // keeps the drawn root alive, so that its address cannot be reused by a newer version
+    jamlib::range dot;
+    jamlib::encoding enc;
+    std::string filename;
+    bool active, nephew_active, nephew_modified;
+    int64_t selection_p1, selection_p2, middle_p1, middle_p2, right_p1, right_p2;
+    };
+
+  struct layout_signature
+    {
+    int lines, cols;
+    int tab_space;
+    bool show_all_characters;
+    std::vector<int> rects; // outer rectangles of all windows
+    };
+
+  struct draw_cache
+    {
+    bool valid = false;
+    layout_signature layout;
+    std::vector<window_draw_signature> windows;
+    };
+
+  draw_cache last_frame;
+
+  window_draw_signature make_draw_signature(const window& w, const jamlib::app_state& state)
+    {
+    window_draw_signature sig;
+    const auto& f = state.files[w.file_id];
+    sig.valid = true;
+    sig.outer_x = w.outer_x;
+    sig.outer_y = w.outer_y;
+    sig.outer_cols = w.outer_cols;
+    sig.outer_rows = w.outer_rows;
+    sig.file_id = w.file_id;
+    sig.nephew_id = w.nephew_id;
+    sig.file_pos = w.file_pos;
+    sig.file_col = w.file_col;
+    sig.wordwrap_row = w.wordwrap_row;
+    sig.word_wrap = w.word_wrap;
+    sig.highlight_comments = w.highlight_comments;
+    sig.content = f.content;
+    sig.dot = f.dot.r;
+    sig.enc = f.enc;
+    sig.filename = f.filename;
+    sig.active = state.active_file == w.file_id;
+    sig.nephew_active = state.active_file == w.nephew_id;
+    sig.nephew_modified = w.is_command_window && w.nephew_id < state.files.size() && is_modified(state.files[w.nephew_id]);
+    sig.selection_p1 = sig.selection_p2 = sig.middle_p1 = sig.middle_p2 = sig.right_p1 = sig.right_p2 = -1;
+    if (keyb_data.selecting && keyb_data.selection_id == w.file_id)
+      {
+      sig.selection_p1 = keyb_data.selection_start;
+      sig.selection_p2 = keyb_data.selection_end;
+      }
+    if (mouse.middle_dragging && mouse.middle_drag_start.id == w.file_id && mouse.middle_drag_end.id == w.file_id)
+      {
+      sig.middle_p1 = mouse.middle_drag_start.pos;
+      sig.middle_p2 = mouse.middle_drag_end.pos;
+      }
+    if (mouse.right_dragging && mouse.right_drag_start.id == w.file_id && mouse.right_drag_end.id == w.file_id)
+      {
+      sig.right_p1 = mouse.right_drag_start.pos;
+      sig.right_p2 = mouse.right_drag_end.pos;
+      }
+    return sig;
+    }
+
+  bool same_draw_signature(const window_draw_signature& left, const window_draw_signature& right)
+    {
+    if (!left.valid || !right.valid)
+      return false;
+    return left.outer_x == right.outer_x && left.outer_y == right.outer_y && left.outer_cols == right.outer_cols && left.outer_rows == right.outer_rows &&
+      left.file_id == right.file_id && left.nephew_id == right.nephew_id &&
+      left.file_pos == right.file_pos && left.file_col == right.file_col && left.wordwrap_row == right.wordwrap_row &&
+      left.word_wrap == right.word_wrap && left.highlight_comments == right.highlight_comments &&
+      left.content.raw().ptr == right.content.raw().ptr &&
+      left.dot.p1 == right.dot.p1 && left.dot.p2 == right.dot.p2 && left.enc == right.enc && left.filename == right.filename &&
+      left.active == right.active && left.nephew_active == right.nephew_active && left.nephew_modified == right.nephew_modified &&
+      left.selection_p1 == right.selection_p1 && left.selection_p2 == right.selection_p2 &&
+      left.middle_p1 == right.middle_p1 && left.middle_p2 == right.middle_p2 &&
+      left.right_p1 == right.right_p1 && left.right_p2 == right.right_p2;
+    }
+
+  layout_signature make_layout_signature(const std::vector<window>& windows, const settings& sett)
+    {
+    layout_signature layout;
+    layout.lines = SP->lines;
+    layout.cols = SP->cols;
+    layout.tab_space = sett.tab_space;
+    layout.show_all_characters = sett.show_all_characters;
+    layout.rects.reserve(windows.size() * 4);
+    for (const auto& w : windows)
+      {
+      layout.rects.push_back(w.outer_x);
+      layout.rects.push_back(w.outer_y);
+      layout.rects.push_back(w.outer_cols);
+      layout.rects.push_back(w.outer_rows);
+      }
+    return layout;
+    }
+
+  bool same_layout(const layout_signature& left, const layout_signature& right)
+    {
+    return left.lines == right.lines && left.cols == right.cols && left.tab_space == right.tab_space &&
+      left.show_all_characters == right.show_all_characters && left.rects == right.rects;
+    }
+
+  void erase_area(int x, int y, int cols, int rows)
+    {
+    int x_end = std::min<int>(x + cols, stdscr->_maxx);
+    int y_end = std::min<int>(y + rows, stdscr->_maxy);
+    x = std::max<int>(x, 0);
+    y = std::max<int>(y, 0);
+    if (x >= x_end)
+      return;
+    for (int r = y; r < y_end; ++r)
+      {
+      chtype* ptr = stdscr->_y[r];
+      for (int c = x; c < x_end; ++c)
+        ptr[c] = stdscr->_bkgd;
+      if (stdscr->_firstch[r] == _NO_CHANGE || x < stdscr->_firstch[r])
+        stdscr->_firstch[r] = x;
+      if (x_end - 1 > stdscr->_lastch[r])
+        stdscr->_lastch[r] = x_end - 1;
+      }
+    }
+
+  void draw_if_damaged(std::vector<window>& windows, uint32_t id, const jamlib::app_state& state, const settings& sett, window_type wt, bool full_redraw)
+    {
+    window& w = windows[id];
+    auto sig = make_draw_signature(w, state);
+    if (!full_redraw && same_draw_signature(sig, last_frame.windows[id]))
+      return;
+    if (!full_redraw)
+      erase_area(w.outer_x, w.outer_y, w.outer_cols, w.outer_rows);
+    draw(w, state, sett, wt);
+    last_frame.windows[id] = std::move(sig);
+    }
+
+  }
+
+void invalidate_window_draw_cache()
+  {
+  last_frame.valid = false;
   }
 
 window_pair::window_pair(int ix, int iy, int icols, int irows, uint32_t wid, uint32_t cwid) :
@@ -1402,22 +1190,19 @@ void window_pair::move(int ix, int iy)
   y = iy;
   }
 
-jamlib::range get_window_range(window w, jamlib::app_state state)
+jamlib::range get_window_range(const window& w, jamlib::app_state state)
   {
   std::stringstream str;
   state.active_file = w.file_id;
   str << "#" << w.file_pos << ", #" << w.file_pos << "+" << w.rows;
-  state = *jamlib::handle_command(state, str.str());
+  state = *jamlib::handle_command(std::move(state), str.str());
   return state.files[w.file_id].dot.r;
   }
 
-std::vector<window> draw(const grid& g, const std::vector<window_pair>& window_pairs, std::vector<window> windows, jamlib::app_state state, const settings& sett)
+std::vector<window> draw(const grid& g, const std::vector<window_pair>& window_pairs, std::vector<window> windows, const jamlib::app_state& state, const settings& sett)
   {
   for (const auto& c : g.columns)
     {
-    window& column_win = windows[c.column_command_window_id];
-    draw(column_win, state, sett, WT_COLUMN);
-
     for (const auto& ci : c.items)
       {
       const auto& wp = window_pairs[ci.window_pair_id];
@@ -1432,17 +1217,40 @@ std::vector<window> draw(const grid& g, const std::vector<window_pair>& window_p
 
       cw.resize(wp.cols, wp.cols > ICON_LENGTH + 1 ? cw_size / (wp.cols - 1 - ICON_LENGTH) + 1 + COMMAND_BORDER_SIZE : 0);
       cw.move(wp.x, wp.y);
-      draw(cw, state, sett, WT_COMMAND);
 
       window& fw = windows[wp.window_id];
       fw.resize(wp.cols, wp.rows - cw.rows);
       fw.move(wp.x, wp.y + cw.rows);
-      draw(fw, state, sett, WT_BODY);
       }
     }
 
-  window& topw = windows[g.topline_window_id];
-  draw(topw, state, sett, WT_TOP);
+  auto layout = make_layout_signature(windows, sett);
+  bool full_redraw = !last_frame.valid || stdscr->_clear || !same_layout(layout, last_frame.layout);
+  if (full_redraw)
+    {
+    erase();
+    last_frame.windows.clear();
+    }
+  last_frame.windows.resize(windows.size());
+
+  for (const auto& c : g.columns)
+    {
+    draw_if_damaged(windows, c.column_command_window_id, state, sett, WT_COLUMN, full_redraw);
+
+    for (const auto& ci : c.items)
+      {
+      const auto& wp = window_pairs[ci.window_pair_id];
+      if (wp.rows == 0)
+        continue;
+      draw_if_damaged(windows, wp.command_window_id, state, sett, WT_COMMAND, full_redraw);
+      draw_if_damaged(windows, wp.window_id, state, sett, WT_BODY, full_redraw);
+      }
+    }
+
+  draw_if_damaged(windows, g.topline_window_id, state, sett, WT_TOP, full_redraw);
+
+  last_frame.layout = std::move(layout);
+  last_frame.valid = true;
 
   return windows;
   }
@@ -1468,8 +1276,8 @@ void save_window_to_stream(std::ostream& str, const window& w)
   str << w.wordwrap_row << std::endl;
   str << w.word_wrap << std::endl;
   str << w.scroll_fraction << std::endl;
-  str << w.previous_file_pos << std::endl;
-  str << w.previous_file_pos_was_comment << std::endl;
+  str << -1 << std::endl; // was previous_file_pos, kept for compatibility of the session file
+  str << 0 << std::endl; // was previous_file_pos_was_comment
   }
 
 window load_window_from_stream(std::istream& str)
@@ -1480,7 +1288,9 @@ window load_window_from_stream(std::istream& str)
   str >> w.file_id >> w.nephew_id;
   str >> w.is_command_window >> w.highlight_comments >> w.piped >> w.file_pos >> w.file_col;
   str >> w.wordwrap_row >> w.word_wrap >> w.scroll_fraction;
-  str >> w.previous_file_pos >> w.previous_file_pos_was_comment;
+  int64_t previous_file_pos;
+  bool previous_file_pos_was_comment;
+  str >> previous_file_pos >> previous_file_pos_was_comment; // no longer used, comment states are cached per file in token_cache
   return w;
   }
 
@@ -24,8 +24,6 @@ struct window
   uint32_t file_id, nephew_id;
   bool is_command_window;  
   int64_t file_pos, file_col, wordwrap_row;
-  int64_t previous_file_pos; // this is a history item for computing the multiline comment. We need to know whether the start of our window is inside or outside comment. This is a global problem, and thus slow. Therefore we save some data we already computed.
-  bool previous_file_pos_was_comment; // Idem as previous_file_pos.
   bool word_wrap;
   double scroll_fraction;
 
@@ -33,7 +31,7 @@ struct window
   bool highlight_comments;
   std::wstring piped_prompt;
   uint32_t piped_prompt_index;
-  std::vector<std::string> piped_prompt_history;
+  immutable::vector<std::string, false> piped_prompt_history; // shared between copies of the window
 #ifdef _WIN32
   void* process;
 #else
@@ -45,7 +43,15 @@ struct window
 
 uint32_t character_width(uint32_t character, int64_t col, jamlib::encoding enc, const settings& sett);
 
-jamlib::range get_window_range(window w, jamlib::app_state state);
+/*
+For window w without word wrap: the character at pos is drawn at column col of its line. If this column lies left or right
+of the visible columns, returns the position of the first character that can be visible again, i.e. at column w.file_col or
+the '\n' of the line. Otherwise returns pos. Hidden characters take one column each, as in draw.
+The skip costs a lookup in the line index of the content, and not a pass over the hidden characters.
+*/
+int64_t skip_invisible_columns(const jamlib::buffer& content, int64_t pos, int64_t col, const window& w);
+
+jamlib::range get_window_range(const window& w, jamlib::app_state state);
 
 struct window_pair
   {
@@ -61,7 +67,10 @@ struct window_pair
   int x, y, cols, rows;
   };
 
-std::vector<window> draw(const grid& g, const std::vector<window_pair>& window_pairs, std::vector<window> windows, jamlib::app_state state, const settings& sett);
+std::vector<window> draw(const grid& g, const std::vector<window_pair>& window_pairs, std::vector<window> windows, const jamlib::app_state& state, const settings& sett);
+
+// Forces the next draw to repaint all windows, e.g. after drawing directly on stdscr.
+void invalidate_window_draw_cache();
 
 
 void save_window_to_stream(std::ostream& str, const window& w);
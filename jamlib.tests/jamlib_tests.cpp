@@ -1,14 +1,24 @@
 #include "jamlib_tests.h"
 #include "test_assert.h"
 
+#include <jamlib/cow_vector.h>
 #include <jamlib/jam.h>
+#include <jamlib/undo.h>
 
 #include <utils/jam_encoding.h>
 #include <utils/jam_exepath.h>
+#include <utils/jam_file_utils.h>
 #include <utils/jam_filename.h>
+#include <utils/jam_thread_pool.h>
 
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <string>
+#include <thread>
 #include <sstream>
+#include <vector>
 
 using namespace jamlib;
 
@@ -131,6 +141,456 @@ namespace
       }
     };
 
+  struct many_files_fixture
+    {
+    app_state make_state(int nr_of_files)
+      {
+      std::vector<const char*> files(nr_of_files + 1, nullptr);
+      for (int j = 1; j <= nr_of_files; ++j)
+#ifdef _WIN32
+        files[j] = "data\\..\\data\\text.txt"; // longer than the small string buffer of std::string
+#else
+        files[j] = "./data/../data/text.txt"; // longer than the small string buffer of std::string
+#endif
+      return init_state(nr_of_files + 1, files.data());
+      }
+    };
+
+  struct test_copy_on_write_files : many_files_fixture
+    {
+    void test()
+      {
+      app_state state = make_state(3);
+      app_state copy = state;
+      copy.active_file = 1;
+      copy = *handle_command(copy, "1d");
+      TEST_EQ(3, copy.files.size());
+      TEST_EQ(43, state.files[1].content.size());
+      TEST_EQ(0, copy.files[1].content.size());
+      TEST_ASSERT(&copy.files[0] != &state.files[0]); // non-const access detaches
+      const app_state& const_state = state;
+      const app_state& const_copy = copy;
+      TEST_ASSERT(&const_copy.files[2] == &const_state.files[2]); // unmodified files are shared
+      TEST_ASSERT(&const_copy.files[1] != &const_state.files[1]);
+      }
+    };
+
+  // an item of a cow_vector that counts how often it is copied
+  struct counted_item
+    {
+    static size_t copies;
+
+    counted_item() : value(0) {}
+    counted_item(const counted_item& other) : value(other.value) { ++copies; }
+    counted_item& operator = (const counted_item& other) { value = other.value; ++copies; return *this; }
+
+    int value;
+    };
+
+  size_t counted_item::copies = 0;
+
+  struct test_copies_do_not_depend_on_number_of_files : many_files_fixture
+    {
+    size_t item_copies_per_keystroke(int nr_of_items)
+      {
+      cow_vector<counted_item> items;
+      for (int j = 0; j < nr_of_items; ++j)
+        items.emplace_back();
+      counted_item::copies = 0;
+      for (int j = 0; j < 10; ++j)
+        {
+        cow_vector<counted_item> copy = items; // the editor keeps the previous state around while handling a key
+        copy[nr_of_items / 2].value += 1;
+        items = copy;
+        }
+      return counted_item::copies / 10;
+      }
+
+    void test()
+      {
+      TEST_EQ(1, item_copies_per_keystroke(1));
+      TEST_EQ(1, item_copies_per_keystroke(100));
+
+      app_state state = make_state(100);
+      state.active_file = 50;
+      app_state copy = state;
+      copy = *handle_command(copy, "a/x/");
+      const app_state& const_state = state;
+      const app_state& const_copy = copy;
+      size_t shared = 0;
+      for (size_t j = 0; j < const_copy.files.size(); ++j)
+        {
+        if (&const_copy.files[j] == &const_state.files[j])
+          ++shared;
+        }
+      TEST_EQ(const_copy.files.size() - 1, shared); // only the edited file is copied
+      }
+    };
+
+  struct test_typing_is_undone_in_one_step : text_fixture
+    {
+    app_state type(app_state s, const std::string& command)
+      {
+      s = *handle_command(s, command);
+      auto& f = s.files[s.active_file];
+      f.dot.r.p1 = f.dot.r.p2; // the editor puts the cursor after the typed character
+      return s;
+      }
+
+    void test()
+      {
+      state = *handle_command(state, "0");
+      for (const char* ch : { "i/a/", "i/b/", "i/c/" })
+        state = type(state, ch);
+      TEST_EQ(1, state.files[state.active_file].history.size());
+      state = type(state, "i/\n/");
+      state = type(state, "i/d/");
+      TEST_EQ(3, state.files[state.active_file].history.size());
+      state = *handle_command(state, "u");
+      state = *handle_command(state, "u");
+      auto result = handle_command(state, ",p");
+      TEST_EQ("abcThe quick brown fox jumps over the lazy dog\n", get_output());
+      state = *handle_command(state, "u");
+      result = handle_command(state, ",p");
+      TEST_EQ("The quick brown fox jumps over the lazy dog\n", get_output());
+      }
+    };
+
+  struct test_history_memory_is_bounded : text_fixture
+    {
+    void test()
+      {
+      const undo_settings old_settings = get_undo_settings();
+      const uint64_t max_bytes = 64 * 1024;
+      set_undo_settings(undo_settings{ max_bytes, true });
+      std::string text(100000, 'x');
+      state = *handle_command(state, ", c/" + text + "/");
+      for (int i = 0; i < 1000; ++i)
+        state = *handle_command(state, "#" + std::to_string((i * 7919) % 100000) + " i/y/");
+      const auto& f = state.files[state.active_file];
+      TEST_ASSERT(f.history.size() < 1000);
+      TEST_ASSERT(history_bytes(f) <= max_bytes + 32 * 1024); // history is compacted every 32 snapshots
+      TEST_EQ(f.history.size(), f.undo_redo_index);
+      state = *handle_command(state, "u");
+      TEST_EQ(100000 + 999, state.files[state.active_file].content.size());
+      set_undo_settings(old_settings);
+      }
+    };
+
+  struct test_delta_of_an_edit
+    {
+    buffer make_buffer(const std::wstring& text)
+      {
+      buffer b;
+      for (auto ch : text)
+        b = b.push_back(ch);
+      return b;
+      }
+
+    std::wstring to_wstring(const buffer& b)
+      {
+      return std::wstring(b.begin(), b.end());
+      }
+
+    void test()
+      {
+      buffer before = make_buffer(L"The quick brown fox");
+      buffer after = make_buffer(L"The slow brown fox");
+      delta d = make_delta(before, after);
+      TEST_EQ(4, d.pos);
+      TEST_ASSERT(to_wstring(d.removed) == L"quick");
+      TEST_ASSERT(to_wstring(d.inserted) == L"slow");
+      TEST_ASSERT(to_wstring(apply_delta(before, d)) == L"The slow brown fox");
+      TEST_ASSERT(to_wstring(revert_delta(after, d)) == L"The quick brown fox");
+
+      delta appended = make_delta(before, before.push_back(L'!'));
+      TEST_EQ(19, appended.pos);
+      TEST_EQ(0, appended.removed.size());
+      TEST_ASSERT(to_wstring(appended.inserted) == L"!");
+
+      delta repeated = make_delta(make_buffer(L"aaa"), make_buffer(L"aaaa")); // prefix and suffix may not overlap
+      TEST_EQ(3, repeated.pos);
+      TEST_EQ(1, repeated.inserted.size());
+      }
+    };
+
+  struct test_undo_redo_over_checkpoints : text_fixture
+    {
+    void test()
+      {
+      std::vector<std::string> texts;
+      for (int i = 0; i < 100; ++i)
+        {
+        state = *handle_command(state, "$ a/" + std::to_string(i) + "/");
+        auto result = handle_command(state, ",p");
+        texts.push_back(get_output());
+        }
+      const auto& f = state.files[state.active_file];
+      TEST_EQ(100, f.history.size());
+      TEST_ASSERT(f.history.back().checkpoint);
+      TEST_ASSERT(!f.history[98].checkpoint);
+      for (int i = 98; i >= 0; --i)
+        {
+        state = *handle_command(state, "u");
+        auto result = handle_command(state, ",p");
+        TEST_EQ(texts[i], get_output());
+        }
+      for (int i = 1; i < 100; ++i)
+        {
+        state = *handle_command(state, "R");
+        auto result = handle_command(state, ",p");
+        TEST_EQ(texts[i], get_output());
+        }
+      TEST_EQ(101, state.files[state.active_file].history.size()); // undo and redo only move through the history
+      }
+    };
+
+  struct test_edit_after_undo_drops_redo : text_fixture
+    {
+    void test()
+      {
+      std::vector<std::string> texts;
+      for (int i = 0; i < 40; ++i)
+        {
+        state = *handle_command(state, "$ a/" + std::to_string(i) + "/");
+        auto result = handle_command(state, ",p");
+        texts.push_back(get_output());
+        }
+      state = *handle_command(state, "u 10");
+      state = *handle_command(state, "$ a/x/");
+      const auto& f = state.files[state.active_file];
+      TEST_EQ(31, f.history.size());
+      TEST_EQ(31, f.undo_redo_index);
+      TEST_ASSERT(f.history.back().checkpoint);
+      auto result = handle_command(state, ",p");
+      const std::string edited = get_output();
+      TEST_EQ(texts[29].substr(0, texts[29].size() - 1) + "x\n", edited);
+      for (int i = 29; i >= 0; --i)
+        {
+        state = *handle_command(state, "u");
+        result = handle_command(state, ",p");
+        TEST_EQ(texts[i], get_output());
+        }
+      state = *handle_command(state, "R 29");
+      result = handle_command(state, ",p");
+      TEST_EQ(texts[29], get_output());
+      state = *handle_command(state, "R");
+      result = handle_command(state, ",p");
+      TEST_EQ(edited, get_output());
+      }
+    };
+
+  struct test_write_buffer_to_file
+    {
+    void test()
+      {
+#ifdef _WIN32
+      const std::string filename("data\\written.txt");
+#else
+      const std::string filename("./data/written.txt");
+#endif
+      std::wstring text;
+      for (int i = 0; i < 100000; ++i)
+        text.push_back(i % 100 == 99 ? L'\n' : (i % 7 == 0 ? (wchar_t)0x00e9 : (wchar_t)(L'a' + i % 26)));
+      buffer content;
+      auto tr = content.transient();
+      for (auto ch : text)
+        tr.push_back(ch);
+      content = tr.persistent();
+      TEST_ASSERT(write_buffer_to_file(filename, content, ENC_UTF8));
+      encoding enc = ENC_UTF8;
+      buffer read_back = read_buffer_from_file(filename, enc);
+      TEST_EQ(ENC_UTF8, enc);
+      TEST_ASSERT(std::wstring(read_back.begin(), read_back.end()) == text);
+
+      // saves of the same file at the same time, as by Put and Putall, each write their own temporary file
+      std::vector<std::thread> savers;
+      std::atomic<int> saved{ 0 };
+      for (int i = 0; i < 4; ++i)
+        savers.emplace_back([&]() { if (write_buffer_to_file(filename, content, ENC_UTF8)) ++saved; });
+      for (auto& t : savers)
+        t.join();
+      TEST_EQ(4, saved.load());
+      read_back = read_buffer_from_file(filename, enc);
+      TEST_ASSERT(std::wstring(read_back.begin(), read_back.end()) == text);
+      for (const auto& path : JAM::get_files_from_directory(JAM::get_folder(filename), false))
+        TEST_ASSERT(path.find(".jam.") == std::string::npos); // no temporary file is left behind
+      std::remove(filename.c_str());
+
+      TEST_ASSERT(!write_buffer_to_file("./folder/that/does/not/exist.txt", content, ENC_UTF8));
+      }
+    };
+
+  struct test_read_buffer_from_large_file
+    {
+    void test()
+      {
+#ifdef _WIN32
+      const std::string filename("data\\large.txt");
+#else
+      const std::string filename("./data/large.txt");
+#endif
+      std::string bytes;
+      std::wstring text;
+      while (bytes.size() < 10 * 1024 * 1024 + 1) // several chunks that are decoded in parallel, cut in the middle of multibyte characters
+        {
+        bytes.append("ab\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\n");
+        text.append(L"ab");
+        text.push_back((wchar_t)0x00e9);
+        text.push_back((wchar_t)0x20ac);
+        text.push_back((wchar_t)0xd83d);
+        text.push_back((wchar_t)0xde00);
+        text.push_back(L'\n');
+        }
+      {
+      std::ofstream f(filename, std::ios::binary);
+      f << bytes;
+      }
+      encoding enc = ENC_UTF8;
+      buffer content = read_buffer_from_file(filename, enc);
+      TEST_EQ(ENC_UTF8, enc);
+      TEST_ASSERT(std::wstring(content.begin(), content.end()) == text);
+
+      {
+      std::ofstream f(filename, std::ios::binary | std::ios::app);
+      f << "\xff";
+      }
+      enc = ENC_UTF8;
+      content = read_buffer_from_file(filename, enc);
+      TEST_EQ(ENC_ASCII, enc);
+      TEST_EQ(bytes.size() + 1, (size_t)content.size());
+      TEST_EQ((wchar_t)'\n', content[(uint32_t)bytes.size() - 1]);
+      std::remove(filename.c_str());
+      }
+    };
+
+  struct test_read_buffer_from_file_lazily
+    {
+    void test()
+      {
+#ifdef _WIN32
+      const std::string filename("data\\lazy.txt");
+      const std::string written("data\\lazy_written.txt");
+#else
+      const std::string filename("./data/lazy.txt");
+      const std::string written("./data/lazy_written.txt");
+#endif
+      std::string bytes;
+      std::wstring text;
+      while (bytes.size() < 9 * 1024 * 1024) // pages of 1024 characters that start in the middle of surrogate pairs, and several chunks
+        {
+        bytes.append("ab\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\n");
+        text.append(L"ab");
+        text.push_back((wchar_t)0x00e9);
+        text.push_back((wchar_t)0x20ac);
+        text.push_back((wchar_t)0xd83d);
+        text.push_back((wchar_t)0xde00);
+        text.push_back(L'\n');
+        }
+      {
+      std::ofstream f(filename, std::ios::binary);
+      f << bytes;
+      }
+      JAM::thread_pool pool(4);
+      encoding enc = ENC_UTF8;
+      buffer content = read_buffer_from_file_lazily(filename, enc, &pool);
+      TEST_EQ(ENC_UTF8, enc);
+      TEST_EQ(text.size(), (size_t)content.size());
+      TEST_ASSERT(write_buffer_to_file(written, content, ENC_UTF8)); // reads the pages without filling in content
+      enc = ENC_UTF8;
+      buffer read_back = read_buffer_from_file(written, enc, &pool);
+      TEST_ASSERT(std::wstring(read_back.begin(), read_back.end()) == text);
+      TEST_ASSERT(std::wstring(content.begin(), content.end()) == text);
+      content = content.insert(5, L'x').erase(3 * 1024 + 1, 5 * 1024);
+      text.insert(text.begin() + 5, L'x');
+      text.erase(text.begin() + 3 * 1024 + 1, text.begin() + 5 * 1024);
+      TEST_ASSERT(std::wstring(content.begin(), content.end()) == text);
+
+      {
+      std::ofstream f(filename, std::ios::binary | std::ios::app);
+      f << "\xff";
+      }
+      enc = ENC_UTF8;
+      content = read_buffer_from_file_lazily(filename, enc, &pool);
+      TEST_EQ(ENC_ASCII, enc);
+      enc = ENC_UTF8;
+      read_back = read_buffer_from_file(filename, enc);
+      TEST_EQ(ENC_ASCII, enc);
+      TEST_EQ(read_back.size(), content.size());
+      TEST_ASSERT(content == read_back);
+
+      enc = ENC_UTF8;
+      content = read_buffer_from_file_lazily(filename, enc, &pool);
+      TEST_ASSERT(!lazy_text_changed(content));
+      TEST_ASSERT(write_buffer_to_file(filename, buffer(), enc)); // replaces the file, content keeps the text it read
+      TEST_ASSERT(!lazy_text_changed(content));
+      TEST_ASSERT(content == read_back);
+      TEST_ASSERT(write_buffer_to_file(filename, read_back, enc));
+
+#ifndef _WIN32 // a file that is mapped cannot be truncated on Windows
+      enc = ENC_UTF8;
+      content = read_buffer_from_file_lazily(filename, enc, &pool);
+      {
+      std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+      f << "new";
+      }
+      TEST_ASSERT(lazy_text_changed(content));
+      TEST_EQ((wchar_t)0, content[content.size() / 2]); // the text that is cut off reads as zeros
+#endif
+      std::remove(filename.c_str());
+      std::remove(written.c_str());
+      }
+    };
+
+  struct test_read_appended_text
+    {
+    void append(const std::string& filename, const std::string& bytes)
+      {
+      std::ofstream f(filename, std::ios::binary | std::ios::app);
+      f << bytes;
+      }
+
+    void test()
+      {
+#ifdef _WIN32
+      const std::string filename("data\\appended.txt");
+#else
+      const std::string filename("./data/appended.txt");
+#endif
+      std::remove(filename.c_str());
+      append(filename, "first line\n");
+      buffer text;
+      int64_t offset = 0;
+      TEST_ASSERT(read_appended_text(text, filename, offset, ENC_UTF8));
+      TEST_ASSERT(std::wstring(text.begin(), text.end()) == L"first line\n");
+      TEST_EQ(11, offset);
+
+      TEST_ASSERT(read_appended_text(text, filename, offset, ENC_UTF8));
+      TEST_EQ(0, (int)text.size());
+      TEST_EQ(11, offset);
+
+      append(filename, "caf\xc3"); // the second byte of the last character is not written yet
+      TEST_ASSERT(read_appended_text(text, filename, offset, ENC_UTF8));
+      TEST_ASSERT(std::wstring(text.begin(), text.end()) == L"caf");
+      TEST_EQ(14, offset);
+
+      append(filename, "\xa9\n");
+      TEST_ASSERT(read_appended_text(text, filename, offset, ENC_UTF8));
+      TEST_EQ(2, (int)text.size());
+      TEST_EQ((wchar_t)0x00e9, text[0]);
+      TEST_EQ(17, offset);
+
+      {
+      std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+      f << "new";
+      }
+      TEST_ASSERT(!read_appended_text(text, filename, offset, ENC_UTF8)); // truncated
+      TEST_EQ(17, offset);
+      std::remove(filename.c_str());
+      TEST_ASSERT(!read_appended_text(text, filename, offset, ENC_UTF8));
+      }
+    };
+
   }
 
 void run_all_jamlib_tests()
@@ -142,4 +602,15 @@ void run_all_jamlib_tests()
   test_command_x().test();
   test_command_addresses().test();
   test_piped_command().test();
+  test_copy_on_write_files().test();
+  test_copies_do_not_depend_on_number_of_files().test();
+  test_typing_is_undone_in_one_step().test();
+  test_history_memory_is_bounded().test();
+  test_delta_of_an_edit().test();
+  test_undo_redo_over_checkpoints().test();
+  test_edit_after_undo_drops_redo().test();
+  test_write_buffer_to_file().test();
+  test_read_buffer_from_large_file().test();
+  test_read_buffer_from_file_lazily().test();
+  test_read_appended_text().test();
   }
\ No newline at end of file
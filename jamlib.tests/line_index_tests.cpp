@@ -0,0 +1,172 @@
+#include "line_index_tests.h"
+#include "test_assert.h"
+
+#include <jam/line_index.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+  {
+  // the lines and wrapped rows of a text, counted directly from the characters
+  struct reference_lines
+    {
+    std::vector<int64_t> begin; // first position of each line
+    std::vector<int64_t> rows_before; // wrapped rows before each line, with an extra entry for the total
+
+    // the row within its line on which pos is drawn, a tab moves to the next multiple of tab_space of its row
+    static int64_t row_in_line(const std::wstring& text, int64_t first, int64_t pos, int64_t nr_of_cols, int64_t tab_space)
+      {
+      int64_t row = 0;
+      int64_t col = 0;
+      for (int64_t p = first; p < pos; ++p)
+        {
+        col += text[(size_t)p] == L'\t' ? tab_space - col % tab_space : 1;
+        if (col >= nr_of_cols - 1)
+          {
+          col = 0;
+          ++row;
+          }
+        }
+      return row;
+      }
+
+    reference_lines(const std::wstring& text, int64_t nr_of_cols, int64_t tab_space)
+      {
+      begin.push_back(0);
+      for (size_t p = 0; p < text.size(); ++p)
+        if (text[p] == L'\n')
+          begin.push_back((int64_t)p + 1);
+      rows_before.push_back(0);
+      for (size_t i = 0; i < begin.size(); ++i)
+        {
+        const int64_t end = i + 1 < begin.size() ? begin[i + 1] - 1 : (int64_t)text.size();
+        rows_before.push_back(rows_before.back() + row_in_line(text, begin[i], end, nr_of_cols, tab_space) + 1);
+        }
+      }
+
+    int64_t line_of(int64_t pos) const
+      {
+      return (int64_t)(std::upper_bound(begin.begin(), begin.end(), pos) - begin.begin()) - 1;
+      }
+    };
+
+  jamlib::buffer make_buffer(const std::wstring& text)
+    {
+    auto tr = jamlib::buffer().transient();
+    for (auto ch : text)
+      tr.push_back(ch);
+    return tr.persistent();
+    }
+
+  std::wstring random_text(std::mt19937& rng, size_t length)
+    {
+    static const wchar_t characters[] = L"abcdefghij \t\n";
+    std::uniform_int_distribution<int> pick(0, 12);
+    std::wstring text;
+    for (size_t i = 0; i < length; ++i)
+      {
+      const int c = pick(rng);
+      text.push_back(c == 12 && i % 3 != 0 ? L'x' : characters[c]); // about one line ending in 20 characters, and tabs
+      }
+    return text;
+    }
+
+  // compares the answers of the line index for buffer with those counted directly from text
+  void check_lines(const jamlib::buffer& buffer, const std::wstring& text, std::mt19937& rng, int64_t nr_of_cols, int64_t tab_space)
+    {
+    const reference_lines ref(text, nr_of_cols, tab_space);
+    const int64_t size = (int64_t)text.size();
+    TEST_EQ(ref.rows_before.back(), number_of_wrapped_rows(buffer, nr_of_cols, tab_space));
+    std::uniform_int_distribution<int64_t> any_pos(0, size);
+    for (int k = 0; k < 20; ++k)
+      {
+      const int64_t pos = k == 0 ? size : any_pos(rng);
+      const int64_t line = ref.line_of(pos);
+      TEST_EQ(line, line_number(buffer, pos));
+      TEST_EQ(ref.begin[(size_t)line], line_begin(buffer, pos));
+      TEST_EQ(line + 1 < (int64_t)ref.begin.size() ? ref.begin[(size_t)line + 1] - 1 : size, line_end(buffer, pos));
+      TEST_EQ(ref.begin[(size_t)line], line_position(buffer, line));
+      TEST_EQ(ref.rows_before[(size_t)line], wrapped_rows_before(buffer, pos, nr_of_cols, tab_space));
+      TEST_EQ(reference_lines::row_in_line(text, ref.begin[(size_t)line], pos, nr_of_cols, tab_space), wrapped_row_in_line(buffer, pos, nr_of_cols, tab_space));
+
+      const int64_t wanted_row = std::uniform_int_distribution<int64_t>(0, ref.rows_before.back() - 1)(rng);
+      int64_t row = wanted_row;
+      const int64_t row_line = (int64_t)(std::upper_bound(ref.rows_before.begin(), ref.rows_before.end() - 1, wanted_row) - ref.rows_before.begin()) - 1;
+      TEST_EQ(ref.begin[(size_t)row_line], line_of_wrapped_row(buffer, row, nr_of_cols, tab_space));
+      TEST_EQ(wanted_row - ref.rows_before[(size_t)row_line], row);
+      }
+    }
+
+  /*
+  Edits several large buffers in turn at random, and checks the index that is updated after each edit against the lines
+  counted from scratch. There are more buffers than the indices that are always cached, as with more visible windows.
+  */
+  struct test_line_index_updates
+    {
+    void test()
+      {
+      std::mt19937 rng(12345);
+      const size_t nr_of_buffers = 6;
+      std::vector<std::wstring> texts;
+      std::vector<jamlib::buffer> buffers;
+      for (size_t i = 0; i < nr_of_buffers; ++i)
+        {
+        texts.push_back(random_text(rng, 100000 + 20000 * i));
+        buffers.push_back(make_buffer(texts.back()));
+        }
+      int64_t nr_of_cols = 16; // lines of about 20 characters wrap
+      int64_t tab_space = 4;
+      for (int edit = 0; edit < 300; ++edit)
+        {
+        const size_t i = (size_t)edit % nr_of_buffers;
+        std::wstring& text = texts[i];
+        jamlib::buffer& buffer = buffers[i];
+        if (edit % 50 == 49) // the width of the window or the tab stops change
+          {
+          nr_of_cols = std::uniform_int_distribution<int64_t>(2, 40)(rng);
+          tab_space = std::uniform_int_distribution<int64_t>(1, 8)(rng);
+          }
+        const size_t max_length = edit % 10 == 0 ? 5000 : 100; // now and then an edit over several blocks of lines
+        const size_t pos = std::uniform_int_distribution<size_t>(0, text.size())(rng);
+        const size_t erased = std::min(std::uniform_int_distribution<size_t>(0, max_length)(rng), text.size() - pos);
+        const std::wstring inserted = random_text(rng, std::uniform_int_distribution<size_t>(0, max_length)(rng));
+        text.replace(pos, erased, inserted);
+        if (erased > 0)
+          buffer = buffer.erase((uint32_t)pos, (uint32_t)(pos + erased));
+        if (!inserted.empty())
+          buffer = buffer.insert((uint32_t)pos, make_buffer(inserted));
+        check_lines(buffer, text, rng, nr_of_cols, tab_space);
+        }
+      for (size_t i = 0; i < nr_of_buffers; ++i)
+        TEST_ASSERT(std::wstring(buffers[i].begin(), buffers[i].end()) == texts[i]);
+      }
+    };
+
+  struct test_wrapped_rows_with_tabs
+    {
+    void test()
+      {
+      std::wstring text(70000, L'a'); // indexed
+      text[5] = L'\n';
+      text.replace(6, 3, L"\t\tb"); // the tabs take 8 columns with tab_space 4, so the line wraps sooner
+      const jamlib::buffer buffer = make_buffer(text);
+      const int64_t without_tabs = number_of_wrapped_rows(buffer, 11, 1);
+      TEST_EQ(1 + (int64_t)(text.size() - 6) / 10 + 1, without_tabs);
+      int64_t row = 2;
+      TEST_EQ(6, line_of_wrapped_row(buffer, row, 11, 4));
+      TEST_EQ(1, row);
+      TEST_EQ(1, wrapped_row_in_line(buffer, 6 + 6, 11, 4)); // 2 tabs and 2 characters fill the first row of the line
+      TEST_EQ(0, wrapped_row_in_line(buffer, 6 + 6, 11, 1));
+      TEST_ASSERT(number_of_wrapped_rows(buffer, 11, 4) > without_tabs);
+      }
+    };
+  }
+
+void run_all_line_index_tests()
+  {
+  test_line_index_updates().test();
+  test_wrapped_rows_with_tabs().test();
+  }
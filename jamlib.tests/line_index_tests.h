@@ -0,0 +1,4 @@
+#pragma once
+
+
+void run_all_line_index_tests();
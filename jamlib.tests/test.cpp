@@ -1,6 +1,7 @@
 #include "test_assert.h"
 
 #include "jamlib_tests.h"
+#include "line_index_tests.h"
 
 #include <ctime>
 
@@ -10,6 +11,7 @@ int main(int /*argc*/, const char* /*argv*/[])
 
   auto tic = std::clock();
   run_all_jamlib_tests();
+  run_all_line_index_tests();
   auto toc = std::clock();
 
   if (!testing_fails) 
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace jamlib
+  {
+
+  /*
+  Copy-on-write vector with structural sharing.
+  Copying a cow_vector only copies a pointer: the array of items and the items themselves are shared.
+  The first non-const access to a shared cow_vector copies the array of item pointers (not the items),
+  and the first non-const access to a shared item copies that item only.
+  Hence copying a whole app_state costs the same for 1 or 100 open files, and changing a single file
+  in a copy costs one item copy.
+  A reference returned by a non-const accessor refers to an item that is owned by this cow_vector only, until
+  the cow_vector is copied: don't write through such a reference after copying, and don't keep it across an
+  assignment to the cow_vector.
+  */
+  template <class T>
+  class cow_vector
+    {
+    typedef std::shared_ptr<T> item_type;
+    typedef std::vector<item_type> items_type;
+
+    public:
+
+      class iterator
+        {
+        public:
+          typedef std::random_access_iterator_tag iterator_category;
+          typedef T value_type;
+          typedef T* pointer;
+          typedef T& reference;
+          typedef std::ptrdiff_t difference_type;
+
+          iterator() : _it() {}
+          explicit iterator(typename items_type::iterator it) : _it(it) {}
+
+          reference operator* () const { return cow_vector::_unique(*_it); }
+          pointer operator ->() const { return &(this->operator*()); }
+          iterator& operator++() { ++_it; return *this; }
+          iterator& operator--() { --_it; return *this; }
+          iterator operator++(int) { iterator tmp(*this); ++_it; return tmp; }
+          iterator operator--(int) { iterator tmp(*this); --_it; return tmp; }
+          iterator& operator += (difference_type n) { _it += n; return *this; }
+          iterator operator + (difference_type n) const { return iterator(_it + n); }
+          iterator operator - (difference_type n) const { return iterator(_it - n); }
+          difference_type operator - (const iterator& other) const { return _it - other._it; }
+          bool operator == (const iterator& other) const { return _it == other._it; }
+          bool operator != (const iterator& other) const { return _it != other._it; }
+
+        private:
+          typename items_type::iterator _it;
+          friend class cow_vector;
+        };
+
+      class const_iterator
+        {
+        public:
+          typedef std::random_access_iterator_tag iterator_category;
+          typedef T value_type;
+          typedef const T* pointer;
+          typedef const T& reference;
+          typedef std::ptrdiff_t difference_type;
+
+          const_iterator() : _it() {}
+          explicit const_iterator(typename items_type::const_iterator it) : _it(it) {}
+          const_iterator(const iterator& it) : _it(it._it) {}
+
+          reference operator* () const { return **_it; }
+          pointer operator ->() const { return _it->get(); }
+          const_iterator& operator++() { ++_it; return *this; }
+          const_iterator& operator--() { --_it; return *this; }
+          const_iterator operator++(int) { const_iterator tmp(*this); ++_it; return tmp; }
+          const_iterator operator--(int) { const_iterator tmp(*this); --_it; return tmp; }
+          const_iterator& operator += (difference_type n) { _it += n; return *this; }
+          const_iterator operator + (difference_type n) const { return const_iterator(_it + n); }
+          const_iterator operator - (difference_type n) const { return const_iterator(_it - n); }
+          difference_type operator - (const const_iterator& other) const { return _it - other._it; }
+          bool operator == (const const_iterator& other) const { return _it == other._it; }
+          bool operator != (const const_iterator& other) const { return _it != other._it; }
+
+        private:
+          typename items_type::const_iterator _it;
+          friend class cow_vector;
+        };
+
+      cow_vector() {}
+
+      size_t size() const
+        {
+        return _items ? _items->size() : 0;
+        }
+
+      bool empty() const
+        {
+        return size() == 0;
+        }
+
+      const T& operator[](size_t index) const
+        {
+        return *(*_items)[index];
+        }
+
+      T& operator[](size_t index)
+        {
+        return _unique(_unique_items()[index]);
+        }
+
+      const T& front() const
+        {
+        return *_items->front();
+        }
+
+      T& front()
+        {
+        return _unique(_unique_items().front());
+        }
+
+      const T& back() const
+        {
+        return *_items->back();
+        }
+
+      T& back()
+        {
+        return _unique(_unique_items().back());
+        }
+
+      void push_back(const T& value)
+        {
+        _unique_items().push_back(std::make_shared<T>(value));
+        }
+
+      void push_back(T&& value)
+        {
+        _unique_items().push_back(std::make_shared<T>(std::move(value)));
+        }
+
+      template <class... Args>
+      void emplace_back(Args&&... args)
+        {
+        _unique_items().push_back(std::make_shared<T>(std::forward<Args>(args)...));
+        }
+
+      void pop_back()
+        {
+        _unique_items().pop_back();
+        }
+
+      iterator erase(const_iterator pos)
+        {
+        const auto index = pos._it - _items->cbegin();
+        items_type& items = _unique_items();
+        return iterator(items.erase(items.begin() + index));
+        }
+
+      void clear()
+        {
+        _items.reset();
+        }
+
+      iterator begin()
+        {
+        return iterator(_unique_items().begin());
+        }
+
+      iterator end()
+        {
+        return iterator(_unique_items().end());
+        }
+
+      const_iterator begin() const
+        {
+        return _items ? const_iterator(_items->cbegin()) : const_iterator();
+        }
+
+      const_iterator end() const
+        {
+        return _items ? const_iterator(_items->cend()) : const_iterator();
+        }
+
+      const_iterator cbegin() const
+        {
+        return begin();
+        }
+
+      const_iterator cend() const
+        {
+        return end();
+        }
+
+    private:
+
+      items_type& _unique_items()
+        {
+        if (!_items)
+          _items = std::make_shared<items_type>();
+        else if (_items.use_count() > 1)
+          _items = std::make_shared<items_type>(*_items);
+        return *_items;
+        }
+
+      static T& _unique(item_type& item)
+        {
+        if (item.use_count() > 1)
+          item = std::make_shared<T>(*item);
+        return *item;
+        }
+
+    private:
+      std::shared_ptr<items_type> _items;
+    };
+
+  }
@@ -30,6 +30,12 @@ namespace jamlib
       case pipe_error:
         str << "Pipe error";
         break;
+      case write_error:
+        str << "Cannot write file";
+        break;
+      case source_changed_error:
+        str << "The file changed on disk before all of its text was read, reread it before writing it";
+        break;
       case invalid_address:
         str << "Invalid address";
         break;
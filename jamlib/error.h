@@ -15,6 +15,8 @@ namespace jamlib
     invalid_address,
     invalid_regex,
     pipe_error,
+    write_error,
+    source_changed_error,
     not_implemented
     };
 
@@ -3,6 +3,7 @@
 #include <utils/jam_pipe.h>
 #include <utils/jam_process.h>
 #include "error.h"
+#include "undo.h"
 #include <fstream>
 #include <iostream>
 #include <optional>
@@ -11,9 +12,35 @@
 #include <sstream>
 #include <regex>
 #include <thread>
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 #include <utils/jam_utf8.h>
 #include <utils/jam_filename.h>
+#include <utils/jam_mapped_file.h>
+#include <utils/jam_thread_pool.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace jamlib
   {
@@ -52,57 +79,6 @@ namespace jamlib
       return true;
       }
 
-    buffer read_buffer_from_file(const std::string& filename, encoding& enc)
-      {
-      buffer b;
-      if (file_exists(filename))
-        {
-      #ifdef _WIN32
-        std::wstring wfilename = convert_string_to_wstring(filename, ENC_UTF8); // filenames are in utf8 encoding
-      #else
-        std::string wfilename(filename);
-      #endif
-        auto cont = b.transient();
-        if (enc == ENC_UTF8 && JAM::valid_utf8_file(wfilename))
-          {
-          auto f = std::ifstream{ wfilename };
-          std::string file_in_chars;
-          {
-          std::stringstream ss;
-          ss << f.rdbuf();
-          file_in_chars = ss.str();
-          }
-          auto it = file_in_chars.begin();
-          auto it_end = file_in_chars.end();
-          utf8::utf8to16(it, it_end, std::back_inserter(cont));
-          f.close();
-          }
-        else
-          {
-          if (enc == ENC_UTF8)
-            enc = ENC_ASCII;
-          auto f = std::ifstream{ wfilename };
-          std::string line;
-          while (std::getline(f, line))
-            {
-            for (const auto& ch : line)
-              {
-              switch (enc)
-                {
-                case ENC_ASCII: cont.push_back(ch); break;
-                default: cont.push_back(ch); break;
-                }
-              }
-            if (!f.eof())
-              cont.push_back('\n');
-            }
-          f.close();
-          }
-        b = cont.persistent();
-        }
-      return b;
-      }
-
     file read_file(const std::string& filename, uint64_t file_id)
       {
       file out = make_empty_file(file_id);
@@ -219,22 +195,44 @@ namespace jamlib
       return JAM::get_filename(path);
       }    
 
+    const uint32_t history_check_interval = 32; // the memory held by the history is measured after every so many snapshots
+
     struct command_handler
       {
       app_state state;
       bool save_undo;
 
-      command_handler(app_state i_state) : state(i_state), save_undo(true) {}
+      command_handler(app_state i_state) : state(std::move(i_state)), save_undo(true) {}
 
       void push_undo(snapshot ss)
         {
         if (save_undo)
           {
-          state.files[state.active_file].history = state.files[state.active_file].history.push_back(ss);
-          state.files[state.active_file].undo_redo_index = state.files[state.active_file].history.size();
+          file& f = state.files[state.active_file];
+          append_snapshot(f, ss);
+          f.undo_redo_index = f.history.size();
+          const uint64_t max_bytes = get_undo_settings().max_history_bytes;
+          if (max_bytes && f.history.size() % history_check_interval == 0)
+            compact_history(f, max_bytes);
           }
         }
 
+      // Consecutive characters typed on the same line share the snapshot taken before the first one, so that they are undone at once.
+      void push_typing_undo(snapshot ss, const std::wstring& typed)
+        {
+        if (!save_undo)
+          return;
+        const file& f = state.files[state.active_file];
+        const bool typing = get_undo_settings().group_typing && typed.size() == 1 && typed[0] != L'\n';
+        const bool grouped = typing && ss.dot.r.p1 == ss.dot.r.p2 && f.typing_end == ss.dot.r.p1
+          && f.typing_history_size == f.history.size() && f.undo_redo_index == f.history.size();
+        if (!grouped)
+          push_undo(ss);
+        file& g = state.files[state.active_file];
+        g.typing_end = typing ? ss.dot.r.p1 + 1 : -1;
+        g.typing_history_size = g.history.size();
+        }
+
       char** alloc_arguments(const std::string& path, const std::vector<std::string>& parameters)
         {
         char** argv = new char*[parameters.size() + 2];
@@ -460,7 +458,7 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Cmd_a& cmd)
         {
-        file f = state.files[state.active_file];
+        file& f = state.files[state.active_file];
 
         snapshot ss;
         ss.content = f.content;
@@ -604,7 +602,7 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Cmd_c& cmd)
         {
-        file f = state.files[state.active_file];
+        file& f = state.files[state.active_file];
 
         snapshot ss;
         ss.content = f.content;
@@ -633,7 +631,7 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Cmd_d&)
         {
-        file f = state.files[state.active_file];
+        file& f = state.files[state.active_file];
 
         snapshot ss;
         ss.content = f.content;
@@ -693,7 +691,7 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Cmd_i& cmd)
         {
-        file f = state.files[state.active_file];
+        file& f = state.files[state.active_file];
 
         snapshot ss;
         ss.content = f.content;
@@ -713,7 +711,7 @@ namespace jamlib
         state.files[state.active_file].content = f.content.insert((uint32_t)f.dot.r.p1, txt);
         state.files[state.active_file].dot.r.p2 = state.files[state.active_file].dot.r.p1 + wtext.length();
         state.files[state.active_file].modification_mask |= 1;
-        push_undo(ss);
+        push_typing_undo(ss, wtext);
 
         return state;
         }
@@ -797,12 +795,11 @@ namespace jamlib
           if (state.files[state.active_file].undo_redo_index + 1 < state.files[state.active_file].history.size())
             {
             ++state.files[state.active_file].undo_redo_index;
-            snapshot ss = state.files[state.active_file].history[(uint32_t)state.files[state.active_file].undo_redo_index];
+            snapshot ss = get_snapshot(state.files[state.active_file], (uint32_t)state.files[state.active_file].undo_redo_index);
             state.files[state.active_file].content = ss.content;
             state.files[state.active_file].dot = ss.dot;
             state.files[state.active_file].modification_mask = ss.modification_mask;
             state.files[state.active_file].enc = ss.enc;
-            state.files[state.active_file].history = state.files[state.active_file].history.push_back(ss);
             }
           }
         return state;
@@ -904,12 +901,11 @@ namespace jamlib
           if (state.files[state.active_file].undo_redo_index)
             {
             --state.files[state.active_file].undo_redo_index;
-            snapshot ss = state.files[state.active_file].history[(uint32_t)state.files[state.active_file].undo_redo_index];
+            snapshot ss = get_snapshot(state.files[state.active_file], (uint32_t)state.files[state.active_file].undo_redo_index);
             state.files[state.active_file].content = ss.content;
             state.files[state.active_file].dot = ss.dot;
             state.files[state.active_file].modification_mask = ss.modification_mask;
             state.files[state.active_file].enc = ss.enc;
-            state.files[state.active_file].history = state.files[state.active_file].history.push_back(ss);
             }
           }
         return state;
@@ -1091,42 +1087,12 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Cmd_w& cmd)
         {
-        #ifdef _WIN32
-        std::wstring wfilename = convert_string_to_wstring(cmd.filename, ENC_UTF8); // filenames are in utf8 encoding
-        #else
-        std::string wfilename(cmd.filename);
-        #endif
-        auto f = std::ofstream{ wfilename };
-        if (f.is_open())
-          {
-          file& current_file = state.files[state.active_file];
-          std::string str;
-          auto it = current_file.content.begin();
-          auto it_end = current_file.content.end();
-          str.reserve(std::distance(it, it_end));
-          switch (current_file.enc)
-            {
-            case ENC_ASCII:
-              for (; it != it_end; ++it)
-                str.push_back((char)*it);
-            case ENC_UTF8:
-            {
-            utf8::utf16to8(it, it_end, std::back_inserter(str));
-            break;
-            }
-            }
-          f << str;
-          f.close();
-          current_file.modification_mask = 0;
-          auto thistory = current_file.history.transient();
-          for (uint32_t idx = 0; idx < thistory.size(); ++idx)
-            {
-            auto h = thistory[idx];
-            h.modification_mask = 1;
-            thistory.set(idx, h);
-            }
-          current_file.history = thistory.persistent();
-          }
+        file& current_file = state.files[state.active_file];
+        if (lazy_text_changed(current_file.content))
+          throw_error(source_changed_error, current_file.filename);
+        if (!write_buffer_to_file(cmd.filename, current_file.content, current_file.enc))
+          throw_error(write_error, cmd.filename);
+        mark_as_saved(current_file);
         return state;
         }
 
@@ -1348,7 +1314,7 @@ namespace jamlib
       {
       app_state state;
 
-      expression_handler(app_state i_state) : state(i_state) {}
+      expression_handler(app_state i_state) : state(std::move(i_state)) {}
 
       std::optional<app_state> operator() (const AddressRange& addr)
         {
@@ -1358,7 +1324,7 @@ namespace jamlib
 
       std::optional<app_state> operator() (const Command& cmd)
         {
-        command_handler ch(state);
+        command_handler ch(std::move(state));
         return std::visit(ch, cmd);
         }
       };
@@ -1371,9 +1337,9 @@ namespace jamlib
     auto cmds = parse(tokens);
     for (const auto& cmd : cmds)
       {
-      expression_handler eh(state);
+      expression_handler eh(std::move(state));
       if (std::optional<app_state> new_state = std::visit(eh, cmd))
-        state = *new_state;
+        state = std::move(*new_state);
       else
         return std::nullopt;
       }
@@ -1381,6 +1347,694 @@ namespace jamlib
     return state;
     }
 
+  namespace
+    {
+    const size_t read_chunk_size = 1 << 22; // bytes of a file that are decoded by one thread
+
+    // bytes that were read into memory, with the interface of JAM::mapped_file to copy them out
+    struct bytes_in_memory
+      {
+      const char* data;
+      uint64_t length;
+
+      uint64_t size() const
+        {
+        return length;
+        }
+
+      bool read(uint64_t offset, size_t n, char* out) const
+        {
+        if (offset > length || n > length - offset)
+          return false;
+        if (n > 0)
+          memcpy(out, data + offset, n);
+        return true;
+        }
+      };
+
+    std::string read_file_in_memory(const std::string& filename)
+      {
+#ifdef _WIN32
+      std::wstring wfilename = convert_string_to_wstring(filename, ENC_UTF8); // filenames are in utf8 encoding
+#else
+      std::string wfilename(filename);
+#endif
+      auto f = std::ifstream{ wfilename, std::ios::binary };
+      std::stringstream ss;
+      ss << f.rdbuf();
+      return ss.str();
+      }
+
+    /*
+    Splits the bytes of source in chunks of about read_chunk_size bytes that do not start in the middle of a utf8 sequence,
+    and on Windows not between the '\r' and '\n' of a line ending. Returns false if source cannot be read.
+    */
+    template <class Source>
+    bool split_in_chunks(std::vector<uint64_t>& bounds, const Source& source)
+      {
+      bounds.assign(1, 0);
+      while (source.size() - bounds.back() > read_chunk_size)
+        {
+        uint64_t b = bounds.back() + read_chunk_size;
+        char before[5]; // the bytes [b - 4, b]
+        if (!source.read(b - 4, sizeof(before), before))
+          return false;
+        int i = 4;
+        for (; i > 1 && (((uint8_t)before[i]) & 0xc0) == 0x80; --i)
+          --b;
+    #ifdef _WIN32
+        if (before[i - 1] == '\r') // keep "\r\n" in one chunk
+          --b;
+    #endif
+        bounds.push_back(b);
+        }
+      bounds.push_back(source.size());
+      return true;
+      }
+
+    // copies the bytes [first, last) of source into bytes, followed by 3 zero bytes that a utf8 sequence that is cut off can run into
+    template <class Source>
+    bool read_bytes(std::string& bytes, const Source& source, uint64_t first, uint64_t last)
+      {
+      bytes.assign((size_t)(last - first) + 3, '\0');
+      const bool ok = source.read(first, (size_t)(last - first), &bytes[0]);
+      bytes.resize((size_t)(last - first));
+      return ok;
+      }
+
+    // calls f for the consecutive ranges of [first, last) that hold the text as it would be read in text mode
+    template <class F>
+    void for_each_text_range(const char* first, const char* last, F f)
+      {
+    #ifdef _WIN32
+      while (const char* cr = (const char*)memchr(first, '\r', last - first))
+        {
+        if (cr + 1 != last && cr[1] == '\n')
+          {
+          f(first, cr);
+          first = cr + 1;
+          }
+        else
+          {
+          f(first, cr + 1);
+          first = cr + 1;
+          }
+        }
+    #endif
+      f(first, last);
+      }
+
+    template <class OutputIterator>
+    void decode_text(const char* first, const char* last, encoding enc, OutputIterator out)
+      {
+      for_each_text_range(first, last, [&](const char* a, const char* b)
+        {
+        if (enc == ENC_UTF8)
+          out = utf8::unchecked::utf8to16(a, b, out);
+        else
+          out = std::copy(a, b, out);
+        });
+      }
+
+    buffer decode_chunk(const char* first, const char* last, encoding enc)
+      {
+      auto cont = buffer().transient();
+      decode_text(first, last, enc, std::back_inserter(cont));
+      return cont.persistent();
+      }
+
+    // the number of characters (wchar_t) that decode_text makes of the bytes [first, last)
+    uint64_t count_characters(const char* first, const char* last, encoding enc)
+      {
+      uint64_t n = (uint64_t)(last - first);
+      if (enc == ENC_UTF8)
+        {
+        n = 0;
+        for (const char* p = first; p != last; ++p)
+          {
+          const uint8_t ch = (uint8_t)*p;
+          n += ((ch & 0xc0) != 0x80) + ((ch & 0xf8) == 0xf0); // a 4 byte sequence becomes a surrogate pair
+          }
+        }
+    #ifdef _WIN32
+      for (const char* cr = first; (cr = (const char*)memchr(cr, '\r', last - cr)) != nullptr; ++cr)
+        if (cr + 1 != last && cr[1] == '\n')
+          --n;
+    #endif
+      return n;
+      }
+
+    /*
+    Calls f(i) for i in [0, n) on the threads of pool and on the calling thread, which can be a thread of pool itself:
+    the calling thread takes indices until there are none left, and then only waits for the calls that other threads
+    started, never for tasks that are still queued behind other work.
+    */
+    template <class F>
+    void parallel_for(JAM::thread_pool* pool, size_t n, F f)
+      {
+      struct shared_state
+        {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> busy{ 0 };
+        std::mutex mt;
+        std::condition_variable cv;
+        std::exception_ptr error;
+        };
+      auto state = std::make_shared<shared_state>();
+      F* p_f = &f;
+      auto work = [state, p_f, n]()
+        {
+        ++state->busy; // before taking an index, so that the calling thread waits for the call
+        for (size_t i = state->next++; i < n; i = state->next++)
+          {
+          try
+            {
+            (*p_f)(i);
+            }
+          catch (...)
+            {
+            std::scoped_lock<std::mutex> lock(state->mt);
+            if (!state->error)
+              state->error = std::current_exception();
+            }
+          }
+        if (--state->busy == 0)
+          {
+          std::scoped_lock<std::mutex> lock(state->mt);
+          state->cv.notify_all();
+          }
+        };
+      const size_t nr_of_helpers = pool ? std::min<size_t>(n, pool->size()) - (n > 0) : 0;
+      for (size_t t = 0; t < nr_of_helpers; ++t)
+        pool->push(work);
+      work();
+      std::unique_lock<std::mutex> lock(state->mt);
+      state->cv.wait(lock, [&]() { return state->busy == 0; });
+      if (state->error)
+        std::rethrow_exception(state->error);
+      }
+
+    /*
+    Decodes the bytes of a file into b. Large files are cut in chunks that are validated and decoded in parallel,
+    each into its own buffer, and the buffers are concatenated, which costs a logarithmic number of node copies
+    per chunk only. Returns false if source cannot be read, e.g. because the file was truncated meanwhile.
+    */
+    template <class Source>
+    bool decode_file(buffer& b, const Source& source, encoding& enc, JAM::thread_pool* pool)
+      {
+      std::vector<uint64_t> bounds;
+      if (!split_in_chunks(bounds, source))
+        return false;
+      const size_t nr_of_chunks = bounds.size() - 1;
+      std::vector<buffer> chunks(nr_of_chunks);
+      std::atomic<bool> readable(true);
+      std::atomic<bool> valid(true);
+      auto decode = [&](size_t i, encoding chunk_enc)
+        {
+        std::string bytes;
+        if (!readable || !valid)
+          return;
+        if (!read_bytes(bytes, source, bounds[i], bounds[i + 1]))
+          readable = false;
+        else if (chunk_enc == ENC_UTF8 && !utf8::is_valid(bytes.begin(), bytes.end()))
+          valid = false;
+        else
+          chunks[i] = decode_chunk(bytes.data(), bytes.data() + bytes.size(), chunk_enc);
+        };
+      if (enc == ENC_UTF8)
+        {
+        parallel_for(pool, nr_of_chunks, [&](size_t i) { decode(i, ENC_UTF8); });
+        if (!valid)
+          {
+          enc = ENC_ASCII;
+          valid = true;
+          }
+        }
+      if (enc != ENC_UTF8)
+        parallel_for(pool, nr_of_chunks, [&](size_t i) { decode(i, enc); });
+      if (!readable)
+        return false;
+      b = buffer();
+      for (const auto& chunk : chunks)
+        b = b + chunk;
+      return true;
+      }
+
+    /*
+    The text of a mapped file for a lazy buffer, see immutable::vector::lazy: a page is decoded when the buffer first
+    uses it. The file is scanned once when it is opened, to find the byte offset of the character at which each page
+    starts. page_skip is 1 for a page that starts with the second half of a surrogate pair, whose character starts on
+    the page before. mt lets load replace the mapping by a copy in memory while other threads read pages.
+    */
+    struct lazy_file : public immutable::lazy_source<wchar_t>
+      {
+      static constexpr uint64_t page_size = buffer::lazy_page_size;
+
+      JAM::mapped_file file;
+      encoding enc;
+      uint64_t length; // in characters
+      std::vector<uint64_t> page_offset;
+      std::vector<uint8_t> page_skip;
+      mutable std::shared_mutex mt;
+
+      bool changed() const
+        {
+        std::shared_lock<std::shared_mutex> lock(mt);
+        return file.changed();
+        }
+
+      // copies the file into memory and lets go of it, see JAM::mapped_file::load
+      bool load()
+        {
+        std::unique_lock<std::shared_mutex> lock(mt);
+        return file.load();
+        }
+
+      virtual void read_page(uint64_t page, std::vector<wchar_t>& out) const override
+        {
+        std::shared_lock<std::shared_mutex> lock(mt);
+        const uint64_t first = page_offset[page];
+        uint64_t last = file.size();
+        if (page + 1 < page_offset.size())
+          last = page_offset[page + 1] + (page_skip[page + 1] ? 4 : 0);
+        std::string bytes;
+        if (!read_bytes(bytes, file, first, last)) // the file was truncated after it was scanned, the text that is gone reads as zeros
+          std::fill(bytes.begin(), bytes.end(), '\0');
+        out.clear();
+        decode_text(bytes.data(), bytes.data() + bytes.size(), enc, std::back_inserter(out));
+        if (page_skip[page] && !out.empty())
+          out.erase(out.begin());
+        out.resize((size_t)std::min<uint64_t>(page_size, length - page * page_size), L'\0');
+        }
+
+      // fills in page_offset and page_skip for the pages that start in the bytes [first, last), the bytes at offset of the file,
+      // whose first character is character number position of the file
+      void find_pages(const char* first, const char* last, uint64_t offset, uint64_t position)
+        {
+        uint64_t page = (position + page_size - 1) / page_size;
+        for (const char* p = first; p != last && page < page_offset.size();)
+          {
+          const uint8_t ch = (uint8_t)*p;
+          size_t bytes = 1;
+          uint64_t characters = 1;
+          if (enc == ENC_UTF8 && ch >= 0x80)
+            {
+            bytes = (ch & 0xe0) == 0xc0 ? 2 : (ch & 0xf0) == 0xe0 ? 3 : 4;
+            characters = bytes == 4 ? 2 : 1;
+            }
+    #ifdef _WIN32
+          if (ch == '\r' && p + 1 != last && p[1] == '\n')
+            bytes = 2;
+    #endif
+          if (page * page_size < position + characters)
+            {
+            page_offset[page] = offset + (uint64_t)(p - first);
+            page_skip[page] = (uint8_t)(page * page_size - position);
+            ++page;
+            }
+          position += characters;
+          p += bytes;
+          }
+        }
+      };
+
+    /*
+    Scans the mapped file of lf in parallel chunks: the first pass validates the encoding and counts the characters
+    of each chunk, the second pass finds the pages. Returns false if the file cannot be read, or holds more
+    characters than a buffer can.
+    */
+    bool scan_lazy_file(lazy_file& lf, JAM::thread_pool* pool)
+      {
+      std::vector<uint64_t> bounds;
+      if (!split_in_chunks(bounds, lf.file))
+        return false;
+      const size_t nr_of_chunks = bounds.size() - 1;
+      std::vector<uint64_t> position(nr_of_chunks + 1, 0);
+      std::atomic<bool> readable(true);
+      std::atomic<bool> valid(true);
+      auto count = [&](size_t i)
+        {
+        std::string bytes;
+        if (!readable || !valid)
+          return;
+        if (!read_bytes(bytes, lf.file, bounds[i], bounds[i + 1]))
+          readable = false;
+        else if (lf.enc == ENC_UTF8 && !utf8::is_valid(bytes.begin(), bytes.end()))
+          valid = false;
+        else
+          position[i + 1] = count_characters(bytes.data(), bytes.data() + bytes.size(), lf.enc);
+        };
+      parallel_for(pool, nr_of_chunks, count);
+      if (!valid)
+        {
+        lf.enc = ENC_ASCII;
+        valid = true;
+        parallel_for(pool, nr_of_chunks, count);
+        }
+      if (!readable)
+        return false;
+      for (size_t i = 0; i < nr_of_chunks; ++i)
+        position[i + 1] += position[i];
+      lf.length = position.back();
+      if (lf.length > std::numeric_limits<uint32_t>::max())
+        return false;
+      const size_t nr_of_pages = (size_t)((lf.length + lazy_file::page_size - 1) / lazy_file::page_size);
+      lf.page_offset.assign(nr_of_pages, 0);
+      lf.page_skip.assign(nr_of_pages, 0);
+      parallel_for(pool, nr_of_chunks, [&](size_t i)
+        {
+        std::string bytes;
+        if (!read_bytes(bytes, lf.file, bounds[i], bounds[i + 1]))
+          readable = false;
+        else
+          lf.find_pages(bytes.data(), bytes.data() + bytes.size(), bounds[i], position[i]);
+        });
+      return readable;
+      }
+
+    std::mutex lazy_files_mt;
+    std::vector<std::pair<std::string, std::weak_ptr<lazy_file>>> lazy_files; // by filename, the mapped files of the lazy buffers, guarded by lazy_files_mt
+
+    void add_lazy_file(const std::string& filename, const std::shared_ptr<lazy_file>& lf)
+      {
+      std::scoped_lock<std::mutex> lock(lazy_files_mt);
+      lazy_files.erase(std::remove_if(lazy_files.begin(), lazy_files.end(), [](const auto& f) { return f.second.expired(); }), lazy_files.end());
+      lazy_files.emplace_back(filename, lf);
+      }
+
+#ifdef _WIN32
+    // loads the lazy buffers of filename into memory, as Windows cannot replace a file that is mapped
+    bool load_lazy_files(const std::string& filename)
+      {
+      std::vector<std::shared_ptr<lazy_file>> mapped;
+      {
+      std::scoped_lock<std::mutex> lock(lazy_files_mt);
+      for (const auto& f : lazy_files)
+        {
+        auto lf = f.second.lock();
+        if (lf && f.first == filename)
+          mapped.push_back(lf);
+        }
+      }
+      bool ok = true;
+      for (const auto& lf : mapped)
+        ok = lf->load() && ok;
+      return ok;
+      }
+#endif
+
+    // the number of bytes at the end of [first, last) that start a utf8 sequence that is not complete
+    size_t incomplete_utf8_tail(const char* first, const char* last)
+      {
+      for (size_t back = 1; back <= 3 && back <= (size_t)(last - first); ++back)
+        {
+        const uint8_t ch = (uint8_t)*(last - back);
+        if ((ch & 0xc0) == 0x80)
+          continue;
+        const size_t length = (ch & 0xe0) == 0xc0 ? 2 : (ch & 0xf0) == 0xe0 ? 3 : (ch & 0xf8) == 0xf0 ? 4 : 1;
+        return length > back ? back : 0;
+        }
+      return 0;
+      }
+    }
+
+  buffer read_buffer_from_file(const std::string& filename, encoding& enc, JAM::thread_pool* pool)
+    {
+    buffer b;
+    if (file_exists(filename))
+      {
+      JAM::mapped_file mf;
+      encoding mapped_enc = enc;
+      if (mf.open(filename) && decode_file(b, mf, mapped_enc, pool))
+        enc = mapped_enc;
+      else // e.g. not a regular file, or a file that was truncated while it was read
+        {
+        const std::string file_in_chars = read_file_in_memory(filename);
+        decode_file(b, bytes_in_memory{ file_in_chars.data(), file_in_chars.size() }, enc, pool);
+        }
+      }
+    return b;
+    }
+
+  buffer read_buffer_from_file_lazily(const std::string& filename, encoding& enc, JAM::thread_pool* pool)
+    {
+    auto lf = std::make_shared<lazy_file>();
+    lf->enc = enc;
+    if (!file_exists(filename) || !lf->file.open(filename) || !scan_lazy_file(*lf, pool))
+      return read_buffer_from_file(filename, enc, pool);
+    enc = lf->enc;
+    add_lazy_file(filename, lf);
+    return buffer::lazy(lf, (uint32_t)lf->length);
+    }
+
+  bool lazy_text_changed(const buffer& content)
+    {
+    bool changed = false;
+    const immutable::lazy_source<wchar_t>* checked = nullptr;
+    content.for_each_unread_page([&](const immutable::lazy_source<wchar_t>& source, uint64_t)
+      {
+      if (changed || &source == checked)
+        return;
+      checked = &source;
+      const lazy_file* lf = dynamic_cast<const lazy_file*>(&source);
+      changed = lf && lf->changed();
+      });
+    return changed;
+    }
+
+  bool read_appended_text(buffer& text, const std::string& filename, int64_t& offset, encoding enc)
+    {
+    text = buffer();
+#ifdef _WIN32
+    std::wstring wfilename = convert_string_to_wstring(filename, ENC_UTF8); // filenames are in utf8 encoding
+#else
+    std::string wfilename(filename);
+#endif
+    auto f = std::ifstream{ wfilename, std::ios::binary };
+    if (!f.is_open())
+      return false;
+    f.seekg(0, std::ios::end);
+    const int64_t size = (int64_t)f.tellg();
+    if (size < offset)
+      return false;
+    std::string bytes((size_t)(size - offset), '\0');
+    f.seekg(offset);
+    f.read(&bytes[0], (std::streamsize)bytes.size());
+    bytes.resize((size_t)f.gcount());
+    const char* first = bytes.data();
+    const char* last = first + bytes.size();
+    if (enc == ENC_UTF8)
+      last -= incomplete_utf8_tail(first, last);
+#ifdef _WIN32
+    if (last != first && *(last - 1) == '\r') // its '\n' may not be written yet
+      --last;
+#endif
+    encoding text_enc = enc; // text that is not valid utf8 is read byte by byte, but the encoding of the file stays as it is
+    decode_file(text, bytes_in_memory{ first, (uint64_t)(last - first) }, text_enc, nullptr);
+    offset += (int64_t)(last - first);
+    return true;
+    }
+
+  namespace
+    {
+    const size_t write_chunk_size = 1 << 20;
+
+    bool is_lead_surrogate(wchar_t ch)
+      {
+      return ch >= 0xd800 && ch <= 0xdbff;
+      }
+
+    void encode_characters(std::string& out, const wchar_t* first, const wchar_t* last, encoding enc)
+      {
+      switch (enc)
+        {
+        case ENC_ASCII:
+          for (; first != last; ++first)
+            out.push_back((char)*first);
+          break;
+        case ENC_UTF8:
+          utf8::utf16to8(first, last, std::back_inserter(out));
+          break;
+        }
+      }
+
+    // writes content chunk by chunk into f, encoding the runs of content into the same string each time. Pages of a lazy buffer
+    // that were not used yet are decoded for the run only, see immutable::vector::for_each_run
+    bool write_encoded_buffer(FILE* f, const buffer& content, encoding enc)
+      {
+      std::string chunk;
+      chunk.reserve(write_chunk_size + 64);
+      wchar_t lead = 0; // a lead surrogate at the end of a run, encoded together with its trail surrogate at the start of the next run
+      bool ok = true;
+      content.for_each_run(0, content.size(), [&](const wchar_t* first, const wchar_t* last)
+        {
+        if (!ok)
+          return;
+        if (lead)
+          {
+          const wchar_t pair[2] = { lead, *first++ };
+          encode_characters(chunk, pair, pair + 2, enc);
+          lead = 0;
+          }
+        if (enc == ENC_UTF8 && first != last && is_lead_surrogate(*(last - 1)))
+          lead = *--last;
+        encode_characters(chunk, first, last, enc);
+        if (chunk.size() >= write_chunk_size)
+          {
+          ok = fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+          chunk.clear();
+          }
+        });
+      if (lead)
+        encode_characters(chunk, &lead, &lead + 1, enc);
+      return ok && fwrite(chunk.data(), 1, chunk.size(), f) == chunk.size();
+      }
+    }
+
+  namespace
+    {
+    /*
+    Creates a new temporary file next to target for writing, with a name that no other save uses, so that saves of the same
+    file by Put and Putall or by two instances of jam do not write into each other's file. The file is created exclusively:
+    if its name exists already, even as a symbolic link, another name is tried.
+    */
+    FILE* create_temp_file(const std::string& target, std::string& temp_filename)
+      {
+      static std::atomic<uint64_t> counter{ 0 };
+#ifdef _WIN32
+      const uint64_t process_id = (uint64_t)GetCurrentProcessId();
+#else
+      const uint64_t process_id = (uint64_t)getpid();
+#endif
+      for (int attempt = 0; attempt < 100; ++attempt)
+        {
+        std::stringstream str;
+        str << target << ".jam." << std::hex << process_id << "." << counter.fetch_add(1) << ".tmp";
+        temp_filename = str.str();
+#ifdef _WIN32
+        HANDLE h = CreateFileW(convert_string_to_wstring(temp_filename, ENC_UTF8).c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr); // filenames are in utf8 encoding
+        if (h == INVALID_HANDLE_VALUE)
+          {
+          if (GetLastError() == ERROR_FILE_EXISTS)
+            continue;
+          return nullptr;
+          }
+        const int fd = _open_osfhandle((intptr_t)h, _O_TEXT);
+        if (fd == -1)
+          {
+          CloseHandle(h);
+          ::remove(temp_filename.c_str());
+          return nullptr;
+          }
+        FILE* f = _fdopen(fd, "w");
+        if (!f)
+          {
+          _close(fd);
+          ::remove(temp_filename.c_str());
+          }
+        return f;
+#else
+        const int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd == -1)
+          {
+          if (errno == EEXIST)
+            continue;
+          return nullptr;
+          }
+        FILE* f = fdopen(fd, "w");
+        if (!f)
+          {
+          close(fd);
+          ::remove(temp_filename.c_str());
+          }
+        return f;
+#endif
+        }
+      return nullptr;
+      }
+
+#ifndef _WIN32
+    // flushes the directory entry of a file that was renamed into folder to disk
+    bool sync_folder(const std::string& folder)
+      {
+      const int fd = open(folder.empty() ? "." : folder.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd == -1)
+        return false;
+      const bool ok = fsync(fd) == 0 || errno == EINVAL; // some file systems cannot sync a folder
+      close(fd);
+      return ok;
+      }
+#endif
+    }
+
+  bool write_buffer_to_file(const std::string& filename, const buffer& content, encoding enc)
+    {
+    std::string target(filename);
+#ifndef _WIN32
+    struct stat original;
+    const bool exists = stat(filename.c_str(), &original) == 0;
+    if (exists)
+      {
+      char* resolved = realpath(filename.c_str(), nullptr); // replace the file that a symbolic link points to, and not the link
+      if (resolved)
+        {
+        target = resolved;
+        free(resolved);
+        }
+      }
+#endif
+    std::string temp_filename;
+    FILE* f = create_temp_file(target, temp_filename);
+    if (!f)
+      return false;
+    bool ok = false;
+    try
+      {
+      ok = write_encoded_buffer(f, content, enc);
+      }
+    catch (...)
+      {
+      fclose(f);
+      ::remove(temp_filename.c_str());
+      throw;
+      }
+    ok = (fflush(f) == 0) && ok;
+#ifdef _WIN32
+    ok = (_commit(_fileno(f)) == 0) && ok;
+#else
+    if (exists)
+      fchmod(fileno(f), original.st_mode & 07777);
+    ok = (fsync(fileno(f)) == 0) && ok;
+#endif
+    ok = (fclose(f) == 0) && ok;
+    if (ok)
+      {
+#ifdef _WIN32
+      ok = load_lazy_files(target) && MoveFileExW(convert_string_to_wstring(temp_filename, ENC_UTF8).c_str(), convert_string_to_wstring(target, ENC_UTF8).c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+      ok = rename(temp_filename.c_str(), target.c_str()) == 0;
+      if (ok) // the rename itself is only durable once the folder is synced
+        return sync_folder(get_folder(target));
+#endif
+      }
+    if (!ok)
+      ::remove(temp_filename.c_str());
+    return ok;
+    }
+
+  void mark_as_saved(file& f)
+    {
+    f.modification_mask = 0;
+    auto thistory = f.history.transient();
+    for (uint32_t idx = 0; idx < thistory.size(); ++idx)
+      {
+      auto h = thistory[idx];
+      h.modification_mask = 1;
+      thistory.set(idx, h);
+      }
+    f.history = thistory.persistent();
+    }
+
   app_state init_state(int argc, const char** argv)
     {
     app_state state;
@@ -9,8 +9,14 @@
 #include <optional>
 #include <ostream>
 
+#include "cow_vector.h"
 #include "encoding.h"
 
+namespace jam
+  {
+  class thread_pool;
+  }
+
 namespace jamlib
   {
 
@@ -29,9 +35,23 @@ namespace jamlib
     uint64_t file_id;
     };
 
+  // the edit that replaces removed at position pos by inserted
+  struct delta
+    {
+    int64_t pos = 0;
+    buffer removed;
+    buffer inserted;
+    };
+
+  /*
+  A history only keeps the content of its checkpoints, which include the newest snapshot. Any other snapshot keeps
+  the delta from its own content to the content of the next snapshot in the history, see get_snapshot in undo.h.
+  */
   struct snapshot
     {
     buffer content;
+    delta change;
+    bool checkpoint = true;
     address dot;
     uint64_t modification_mask;
     encoding enc;
@@ -47,17 +67,48 @@ namespace jamlib
     immutable::vector<snapshot, false> history;
     uint64_t undo_redo_index;
     encoding enc;
+    int64_t typing_end = -1; // position after the last typed character that the next typed character can be grouped with
+    uint64_t typing_history_size = 0; // size of history when that character was typed
     };
 
   struct app_state
     {
-    std::vector<file> files;
+    cow_vector<file> files; // copying an app_state shares the files, see cow_vector.h
     uint64_t active_file;
     };
 
   //use const cast to convert your main's char** argv to const char** argv
   JAMLIB_API app_state init_state(int argc, const char** argv);
   JAMLIB_API std::optional<app_state> handle_command(app_state state, std::string command);
+  //reads the content of a file, enc is the preferred encoding on input and the encoding that was used on output
+  //large files are decoded in chunks on the threads of pool if it is given, the calling thread can be one of them
+  //the file is read through a mapping with guarded reads, and read again with an ifstream if a guarded read fails, so a file
+  //that is truncated while it is read gives its shorter content instead of a SIGBUS
+  //does not use any state, so it can be called from any thread
+  JAMLIB_API buffer read_buffer_from_file(const std::string& filename, encoding& enc, jam::thread_pool* pool = nullptr);
+  //like read_buffer_from_file, but the file is only scanned for its encoding and length: the buffer decodes its pages from
+  //a mapping of the file the first time they are used, see immutable::vector::lazy. Text that is cut off from the file
+  //before it was used reads as zeros, and text that is written over in place reads as the new text, see lazy_text_changed.
+  //Replacing the file by another one, as write_buffer_to_file does, leaves the buffer intact.
+  //Falls back to read_buffer_from_file for files that cannot be mapped
+  JAMLIB_API buffer read_buffer_from_file_lazily(const std::string& filename, encoding& enc, jam::thread_pool* pool = nullptr);
+  //true if content has text that was not used yet from a file read by read_buffer_from_file_lazily, and that file was
+  //written, truncated or extended in place since. That text is not the text that was read anymore, so the w command refuses
+  //to write such content. Can be called from any thread
+  JAMLIB_API bool lazy_text_changed(const buffer& content);
+  //reads the text of filename that follows its first offset bytes into text, and moves offset past the bytes that were read,
+  //so that a file that grows can be followed at a cost that depends on the appended bytes only. A utf8 sequence that is not
+  //complete yet at the end of the file is left for the next call. Returns false if the file cannot be read or is shorter than
+  //offset, i.e. if it was truncated or replaced. Does not use any state, so it can be called from any thread
+  JAMLIB_API bool read_appended_text(buffer& text, const std::string& filename, int64_t& offset, encoding enc);
+  //writes content to a new temporary file with a unique name next to filename, flushes it to disk and then renames it to
+  //filename, and on posix also flushes the folder, so that a failing save or a crash never leaves filename half written. The content is encoded chunk by chunk, so memory use does not grow
+  //with the size of the file. Returns false if the file could not be written, in which case filename is untouched.
+  //On Windows, which cannot replace a mapped file, the lazy buffers of filename are first copied into memory.
+  //does not use any state, so it can be called from any thread, as long as content is not destroyed meanwhile
+  JAMLIB_API bool write_buffer_to_file(const std::string& filename, const buffer& content, encoding enc);
+  //marks f as not modified after its content was written to disk, and all the steps in its history as modified
+  JAMLIB_API void mark_as_saved(file& f);
   JAMLIB_API void parse_command(std::string& executable_name, std::string& folder, std::vector<std::string>& parameters, std::string command);
 
   //nullptr for wcout, which is the default
@@ -157,6 +157,7 @@ namespace jamlib
   std::vector<token> tokenize(const std::string& str)
     {
     std::vector<token> tokens;
+    tokens.reserve(str.length() + 1); // a token takes at least one character, plus the token that ends the command: one allocation for the tokens of a keystroke
     std::string buff;
     const char* s = str.c_str();
     const char* s_end = str.c_str() + str.length();
@@ -0,0 +1,143 @@
+#include "undo.h"
+
+#include <immutable/memory.h>
+
+#include <vector>
+
+namespace jamlib
+  {
+
+  namespace
+    {
+    undo_settings g_undo_settings = { 0, true };
+
+    typedef immutable::memory_counter<wchar_t, false, 5> buffer_memory_counter;
+
+    const uint32_t checkpoint_interval = 32; // rebuilding a snapshot reverts at most this many deltas
+    }
+
+  void set_undo_settings(const undo_settings& s)
+    {
+    g_undo_settings = s;
+    }
+
+  undo_settings get_undo_settings()
+    {
+    return g_undo_settings;
+    }
+
+  delta make_delta(const buffer& before, const buffer& after)
+    {
+    const uint32_t prefix = immutable::first_difference(before, after);
+    uint32_t suffix = immutable::common_suffix_length(before, after);
+    const uint32_t smallest = before.size() < after.size() ? before.size() : after.size();
+    if (suffix > smallest - prefix)
+      suffix = smallest - prefix;
+    delta d;
+    d.pos = prefix;
+    d.removed = before.slice(prefix, before.size() - suffix);
+    d.inserted = after.slice(prefix, after.size() - suffix);
+    return d;
+    }
+
+  buffer apply_delta(const buffer& before, const delta& d)
+    {
+    buffer after = before.erase((uint32_t)d.pos, (uint32_t)d.pos + d.removed.size());
+    return after.insert((uint32_t)d.pos, d.inserted);
+    }
+
+  buffer revert_delta(const buffer& after, const delta& d)
+    {
+    buffer before = after.erase((uint32_t)d.pos, (uint32_t)d.pos + d.inserted.size());
+    return before.insert((uint32_t)d.pos, d.removed);
+    }
+
+  void append_snapshot(file& f, snapshot ss)
+    {
+    /*
+    The newest snapshot is always a checkpoint. When a snapshot is appended, the previous newest snapshot
+    only keeps the delta to the new one, unless the checkpoint before it is too far away.
+    Undo and redo only move undo_redo_index through the history. An edit after an undo first drops the
+    snapshots from undo_redo_index on, which redo would have gone to, so that ss takes the place of the
+    snapshot that undo went back to. The snapshot before them is made a checkpoint again, as its delta
+    led to a dropped snapshot.
+    */
+    if (f.undo_redo_index < f.history.size())
+      {
+      const uint32_t keep = (uint32_t)f.undo_redo_index;
+      if (keep > 0 && !f.history[keep - 1].checkpoint)
+        f.history = f.history.set(keep - 1, get_snapshot(f, keep - 1));
+      f.history = f.history.take(keep);
+      }
+    ss.checkpoint = true;
+    ss.change = delta();
+    if (!f.history.empty())
+      {
+      const uint32_t last = f.history.size() - 1;
+      uint32_t deltas = 0;
+      while (deltas < last && !f.history[last - 1 - deltas].checkpoint)
+        ++deltas;
+      if (deltas + 1 < checkpoint_interval)
+        {
+        snapshot previous = f.history[last];
+        previous.change = make_delta(previous.content, ss.content);
+        previous.content = buffer();
+        previous.checkpoint = false;
+        f.history = f.history.set(last, previous);
+        }
+      }
+    f.history = f.history.push_back(ss);
+    }
+
+  snapshot get_snapshot(const file& f, uint32_t index)
+    {
+    uint32_t checkpoint = index;
+    while (!f.history[checkpoint].checkpoint)
+      ++checkpoint;
+    buffer content = f.history[checkpoint].content;
+    for (uint32_t i = checkpoint; i > index; --i)
+      content = revert_delta(content, f.history[i - 1].change);
+    snapshot ss = f.history[index];
+    ss.content = content;
+    ss.change = delta();
+    ss.checkpoint = true;
+    return ss;
+    }
+
+  uint64_t history_bytes(const file& f)
+    {
+    buffer_memory_counter counter;
+    counter.add(f.content);
+    uint64_t bytes = (uint64_t)f.history.size() * sizeof(snapshot);
+    for (const auto& ss : f.history)
+      bytes += counter.add(ss.content) + counter.add(ss.change.removed) + counter.add(ss.change.inserted);
+    return bytes;
+    }
+
+  void compact_history(file& f, uint64_t max_bytes)
+    {
+    /*
+    Count from the newest snapshot to the oldest one: the bytes counted for a snapshot are then exactly the bytes
+    that are freed when it is dropped together with all the snapshots that are older.
+    */
+    buffer_memory_counter counter;
+    counter.add(f.content);
+    uint64_t bytes = 0;
+    uint32_t keep = 0;
+    for (uint32_t i = f.history.size(); i > 0; --i)
+      {
+      const snapshot& ss = f.history[i - 1];
+      bytes += sizeof(snapshot) + counter.add(ss.content) + counter.add(ss.change.removed) + counter.add(ss.change.inserted);
+      if (bytes > max_bytes)
+        break;
+      ++keep;
+      }
+    const uint32_t drop = f.history.size() - keep;
+    if (drop == 0)
+      return;
+    f.history = f.history.drop(drop);
+    f.undo_redo_index = f.undo_redo_index > drop ? f.undo_redo_index - drop : 0;
+    f.typing_history_size = f.typing_history_size > drop ? f.typing_history_size - drop : 0;
+    }
+
+  }
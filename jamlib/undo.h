@@ -0,0 +1,40 @@
+#pragma once
+
+#include "jam_api.h"
+#include "jam.h"
+
+#include <stdint.h>
+
+namespace jamlib
+  {
+
+  struct undo_settings
+    {
+    uint64_t max_history_bytes; // the oldest snapshots of a file are dropped when its history holds more bytes, 0 means no limit
+    bool group_typing; // consecutive characters typed on the same line are undone in one step
+    };
+
+  JAMLIB_API void set_undo_settings(const undo_settings& s);
+
+  JAMLIB_API undo_settings get_undo_settings();
+
+  // the delta that turns before into after, found in time proportional to the part that was changed
+  JAMLIB_API delta make_delta(const buffer& before, const buffer& after);
+
+  JAMLIB_API buffer apply_delta(const buffer& before, const delta& d);
+
+  // the inverse of apply_delta: apply_delta(revert_delta(after, d), d) == after
+  JAMLIB_API buffer revert_delta(const buffer& after, const delta& d);
+
+  // appends ss to the history of f, keeping only the delta from the previous snapshot unless ss becomes a checkpoint, after dropping the snapshots that redo would go to
+  JAMLIB_API void append_snapshot(file& f, snapshot ss);
+
+  // the snapshot at index in the history of f, with its content rebuilt from the nearest checkpoint after it
+  JAMLIB_API snapshot get_snapshot(const file& f, uint32_t index);
+
+  // bytes of the buffer nodes that are only held by the history of f, i.e. that are not shared with its content
+  JAMLIB_API uint64_t history_bytes(const file& f);
+
+  // drops the oldest snapshots of the history of f until the remaining snapshots hold at most max_bytes
+  JAMLIB_API void compact_history(file& f, uint64_t max_bytes);
+  }
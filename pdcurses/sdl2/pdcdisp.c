@@ -23,6 +23,52 @@ static int rectcount = 0;              /* index into uprect */
 static short foregr = -2, backgr = -2; /* current foreground, background */
 static bool blinked_off = FALSE;
 
+/* upload the given rects of pdc_screen to the streaming texture, and
+   present the texture; all dirty rects of a frame are batched into a
+   single present */
+
+static void _render_rects(const SDL_Rect *rects, int count)
+{
+    int i;
+
+    if (!pdc_texture)
+        return;
+
+    for (i = 0; i < count; i++)
+    {
+        const Uint8 *pixels = (const Uint8 *)pdc_screen->pixels +
+            rects[i].y * pdc_screen->pitch +
+            rects[i].x * pdc_screen->format->BytesPerPixel;
+
+        SDL_UpdateTexture(pdc_texture, rects + i, pixels, pdc_screen->pitch);
+    }
+
+    SDL_RenderCopy(pdc_renderer, pdc_texture, NULL, NULL);
+    SDL_RenderPresent(pdc_renderer);
+}
+
+/* show the complete screen */
+
+void PDC_present(void)
+{
+    if (pdc_renderer)
+    {
+        SDL_Rect all;
+
+        all.x = 0;
+        all.y = 0;
+        all.w = pdc_screen->w;
+        all.h = pdc_screen->h;
+
+        _render_rects(&all, 1);
+    }
+    else
+        SDL_UpdateWindowSurface(pdc_window);
+
+    pdc_lastupdate = SDL_GetTicks();
+    rectcount = 0;
+}
+
 /* do the real updates on a delay */
 
 void PDC_update_rects(void)
@@ -35,7 +81,7 @@ void PDC_update_rects(void)
            probably better off doing a full screen update */
 
         if (rectcount == MAXRECT)
-            SDL_UpdateWindowSurface(pdc_window);
+            PDC_present();
         else
         {
             int w = pdc_screen->w;
@@ -65,7 +111,13 @@ void PDC_update_rects(void)
             }
 
             if (rectcount > 0)
-                SDL_UpdateWindowSurfaceRects(pdc_window, uprect, rectcount);
+            {
+                if (pdc_renderer)
+                    _render_rects(uprect, rectcount);
+                else
+                    SDL_UpdateWindowSurfaceRects(pdc_window, uprect,
+                                                 rectcount);
+            }
         }
 
         pdc_lastupdate = SDL_GetTicks();
@@ -142,6 +194,90 @@ static void _set_attr(chtype ch)
 
 #ifdef PDC_WIDE
 
+/* glyph cache: each combination of character, font style and foreground
+   color is rasterized once by TTF_RenderUNICODE_Blended and blitted from
+   the cached surface afterwards; the cache belongs to the current font
+   and font size, and is flushed when either changes */
+
+#define GLYPH_CACHE_SIZE 4096   /* must be a power of two */
+
+typedef struct
+{
+    Uint32 key;                 /* character | font style << 16 */
+    Uint32 color;               /* foreground color as 0xRRGGBB */
+    SDL_Surface *surface;
+} glyph_entry;
+
+static glyph_entry glyph_cache[GLYPH_CACHE_SIZE];
+static int glyph_count = 0;
+static TTF_Font *glyph_font = NULL;
+static int glyph_font_size = 0;
+
+void PDC_clear_glyph_cache(void)
+{
+    int i;
+
+    for (i = 0; i < GLYPH_CACHE_SIZE; i++)
+    {
+        if (glyph_cache[i].surface)
+        {
+            SDL_FreeSurface(glyph_cache[i].surface);
+            glyph_cache[i].surface = NULL;
+        }
+    }
+
+    glyph_count = 0;
+    glyph_font = NULL;
+    glyph_font_size = 0;
+}
+
+static Uint32 _glyph_hash(Uint32 key, Uint32 color)
+{
+    return ((key * 2654435761u) ^ (color * 40503u)) & (GLYPH_CACHE_SIZE - 1);
+}
+
+static SDL_Surface *_get_glyph(chtype ch)
+{
+    Uint16 chstr[2] = {0, 0};
+    SDL_Color c = pdc_color[foregr];
+    Uint32 key = (Uint32)(ch & 0xffff) |
+                 ((Uint32)TTF_GetFontStyle(pdc_ttffont) << 16);
+    Uint32 color = ((Uint32)c.r << 16) | ((Uint32)c.g << 8) | c.b;
+    Uint32 h;
+    SDL_Surface *surface;
+
+    if (glyph_font != pdc_ttffont || glyph_font_size != pdc_font_size ||
+        glyph_count >= GLYPH_CACHE_SIZE * 3 / 4)
+    {
+        PDC_clear_glyph_cache();
+        glyph_font = pdc_ttffont;
+        glyph_font_size = pdc_font_size;
+    }
+
+    h = _glyph_hash(key, color);
+
+    while (glyph_cache[h].surface)
+    {
+        if (glyph_cache[h].key == key && glyph_cache[h].color == color)
+            return glyph_cache[h].surface;
+
+        h = (h + 1) & (GLYPH_CACHE_SIZE - 1);
+    }
+
+    chstr[0] = ch & 0xffff;
+
+    surface = TTF_RenderUNICODE_Blended(pdc_ttffont, chstr, c);
+    if (!surface)
+        return NULL;
+
+    glyph_cache[h].key = key;
+    glyph_cache[h].color = color;
+    glyph_cache[h].surface = surface;
+    ++glyph_count;
+
+    return surface;
+}
+
 /* Draw some of the ACS_* "graphics" */
 
 bool _grprint(chtype ch, SDL_Rect dest)
@@ -258,7 +394,7 @@ void PDC_gotoyx(int row, int col)
     chtype ch;
     int oldrow, oldcol;
 #ifdef PDC_WIDE
-    Uint16 chstr[2] = {0, 0};
+    SDL_Surface *glyph;
 #endif
 
     PDC_LOG(("PDC_gotoyx() - called: row %d col %d from row %d col %d\n",
@@ -299,21 +435,16 @@ void PDC_gotoyx(int row, int col)
         if (ch & A_ALTCHARSET && !(ch & 0xff80))
             ch = acs_map[ch & 0x7f];
 
-        chstr[0] = ch & A_CHARTEXT;
-
-        pdc_font = TTF_RenderUNICODE_Blended(pdc_ttffont, chstr,
-                                             pdc_color[foregr]);
-        if (pdc_font)
+        glyph = _get_glyph(ch & A_CHARTEXT);
+        if (glyph)
         {
-            int center = pdc_fwidth > pdc_font->w ?
-                        (pdc_fwidth - pdc_font->w) >> 1 : 0;
+            int center = pdc_fwidth > glyph->w ?
+                        (pdc_fwidth - glyph->w) >> 1 : 0;
             src.x = 0;
             src.y = pdc_fheight - src.h;
             dest.x += center;
-            SDL_BlitSurface(pdc_font, &src, pdc_screen, &dest);
+            SDL_BlitSurface(glyph, &src, pdc_screen, &dest);
             dest.x -= center;
-            SDL_FreeSurface(pdc_font);
-            pdc_font = NULL;
         }
     }
 #else
@@ -340,7 +471,7 @@ void _new_packet(attr_t attr, int lineno, int x, int len, const chtype *srcp)
     SDL_Rect src, dest, lastrect;
     int j;
 #ifdef PDC_WIDE
-    Uint16 chstr[2] = {0, 0};
+    SDL_Surface *glyph;
 #endif
     attr_t sysattrs = SP->termattrs;
     short hcol = SP->line_color;
@@ -417,23 +548,14 @@ void _new_packet(attr_t attr, int lineno, int x, int len, const chtype *srcp)
 
         if (ch != ' ')
         {
-            if (chstr[0] != ch)
-            {
-                chstr[0] = ch;
+            glyph = _get_glyph(ch);
 
-                if (pdc_font)
-                    SDL_FreeSurface(pdc_font);
-
-                pdc_font = TTF_RenderUNICODE_Blended(pdc_ttffont, chstr,
-                                                     pdc_color[foregr]);
-            }
-
-            if (pdc_font)
+            if (glyph)
             {
-                int center = pdc_fwidth > pdc_font->w ?
-                    (pdc_fwidth - pdc_font->w) >> 1 : 0;
+                int center = pdc_fwidth > glyph->w ?
+                    (pdc_fwidth - glyph->w) >> 1 : 0;
                 dest.x += center;
-                SDL_BlitSurface(pdc_font, &src, pdc_screen, &dest);
+                SDL_BlitSurface(glyph, &src, pdc_screen, &dest);
                 dest.x -= center;
             }
         }
@@ -462,14 +584,6 @@ void _new_packet(attr_t attr, int lineno, int x, int len, const chtype *srcp)
         dest.x += pdc_fwidth;
     }
 
-#ifdef PDC_WIDE
-    if (pdc_font)
-    {
-        SDL_FreeSurface(pdc_font);
-        pdc_font = NULL;
-    }
-#endif
-
     if (!blink && (attr & A_UNDERLINE))
     {
         dest.y += pdc_fheight - pdc_fthick;
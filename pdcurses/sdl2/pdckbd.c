@@ -447,7 +447,7 @@ int PDC_get_key(void)
         switch (event.window.event)
         {
         case SDL_WINDOWEVENT_SIZE_CHANGED:
-            pdc_screen = SDL_GetWindowSurface(pdc_window);
+            PDC_get_screen_surface();
             pdc_sheight = pdc_screen->h - pdc_xoffset;
             pdc_swidth = pdc_screen->w - pdc_yoffset;
             touchwin(curscr);
@@ -462,7 +462,11 @@ int PDC_get_key(void)
             break;
         case SDL_WINDOWEVENT_RESTORED:
         case SDL_WINDOWEVENT_EXPOSED:
-            SDL_UpdateWindowSurface(pdc_window);
+            if (pdc_renderer)       /* the window surface may not be used
+                                       together with a renderer */
+                PDC_present();
+            else
+                SDL_UpdateWindowSurface(pdc_window);
         }
         break;
     case SDL_MOUSEMOTION:
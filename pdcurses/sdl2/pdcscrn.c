@@ -3,6 +3,7 @@
 #include "pdcsdl.h"
 
 #include <stdlib.h>
+#include <string.h>
 #ifndef PDC_WIDE
 # include "../common/font437.h"
 #endif
@@ -31,6 +32,8 @@ SDL_Window *pdc_window = NULL;
 SDL_Surface *pdc_screen = NULL, *pdc_font = NULL, *pdc_icon = NULL,
             *pdc_back = NULL, *pdc_tileback = NULL;
 int pdc_sheight = 0, pdc_swidth = 0, pdc_yoffset = 0, pdc_xoffset = 0;
+SDL_Renderer *pdc_renderer = NULL;
+SDL_Texture *pdc_texture = NULL;
 
 SDL_Color pdc_color[PDC_MAXCOL];
 Uint32 pdc_mapped[PDC_MAXCOL];
@@ -46,6 +49,7 @@ static void _clean(void)
 #ifdef PDC_WIDE
     if (pdc_ttffont)
     {
+        PDC_clear_glyph_cache();
         TTF_CloseFont(pdc_ttffont);
         TTF_Quit();
     }
@@ -54,6 +58,12 @@ static void _clean(void)
     SDL_FreeSurface(pdc_back);
     SDL_FreeSurface(pdc_icon);
     SDL_FreeSurface(pdc_font);
+    if (pdc_renderer)
+    {
+        SDL_DestroyTexture(pdc_texture);
+        SDL_FreeSurface(pdc_screen);
+        SDL_DestroyRenderer(pdc_renderer);
+    }
     SDL_DestroyWindow(pdc_window);
     SDL_Quit();
 }
@@ -90,6 +100,64 @@ void PDC_retile(void)
     }
 }
 
+/* optional SDL_Renderer backend: if the environment variable PDC_RENDERER
+   is set, pdc_screen is an offscreen surface, its dirty rects are uploaded
+   to a streaming texture that is presented by the renderer;
+   PDC_RENDERER=software selects the software renderer (e.g. for headless
+   testing), any other value an accelerated renderer with the software
+   renderer as fallback; without a renderer the window surface is used */
+
+static void _create_renderer(void)
+{
+    const char *mode = getenv("PDC_RENDERER");
+
+    if (!mode || !*mode)
+        return;
+
+    if (strcmp(mode, "software"))
+        pdc_renderer = SDL_CreateRenderer(pdc_window, -1,
+                                          SDL_RENDERER_ACCELERATED);
+
+    if (!pdc_renderer)
+        pdc_renderer = SDL_CreateRenderer(pdc_window, -1,
+                                          SDL_RENDERER_SOFTWARE);
+
+    if (!pdc_renderer)
+        fprintf(stderr, "Could not create SDL renderer, using the window "
+                "surface: %s\n", SDL_GetError());
+}
+
+/* (re)create pdc_screen for the current size of pdc_window */
+
+void PDC_get_screen_surface(void)
+{
+    int w, h;
+
+    if (!pdc_renderer)
+    {
+        pdc_screen = SDL_GetWindowSurface(pdc_window);
+        return;
+    }
+
+    SDL_GetWindowSize(pdc_window, &w, &h);
+
+    if (pdc_screen && pdc_texture && pdc_screen->w == w && pdc_screen->h == h)
+        return;
+
+    if (pdc_texture)
+        SDL_DestroyTexture(pdc_texture);
+    if (pdc_screen)
+        SDL_FreeSurface(pdc_screen);
+
+    pdc_screen = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32,
+                                                SDL_PIXELFORMAT_ARGB8888);
+    pdc_texture = SDL_CreateTexture(pdc_renderer, SDL_PIXELFORMAT_ARGB8888,
+                                    SDL_TEXTUREACCESS_STREAMING, w, h);
+
+    if (!pdc_texture)
+        fprintf(stderr, "Could not create SDL texture: %s\n", SDL_GetError());
+}
+
 void PDC_scr_close(void)
 {
     PDC_LOG(("PDC_scr_close() - called\n"));
@@ -270,7 +338,8 @@ int PDC_scr_open(int argc, char **argv)
            initial modifiers (e.g. numlock) will be ignored and out-of-sync. */
         SDL_PumpEvents();
 
-        pdc_screen = SDL_GetWindowSurface(pdc_window);
+        _create_renderer();
+        PDC_get_screen_surface();
         if (pdc_screen == NULL)
         {
             fprintf(stderr, "Could not open SDL window surface: %s\n",
@@ -284,7 +353,10 @@ int PDC_scr_open(int argc, char **argv)
     else
     {
         if (!pdc_screen)
-            pdc_screen = SDL_GetWindowSurface(pdc_window);
+        {
+            _create_renderer();
+            PDC_get_screen_surface();
+        }
 
         if (!pdc_sheight)
             pdc_sheight = pdc_screen->h - pdc_yoffset;
@@ -354,7 +426,7 @@ int PDC_resize_screen(int nlines, int ncols)
         pdc_swidth = ncols * pdc_fwidth;
 
         //SDL_SetWindowSize(pdc_window, pdc_swidth, pdc_sheight); [JanM]
-        pdc_screen = SDL_GetWindowSurface(pdc_window);
+        PDC_get_screen_surface();
     }
 
     if (pdc_tileback)
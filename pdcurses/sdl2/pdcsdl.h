@@ -14,6 +14,9 @@ PDCEX  int pdc_font_size;
 PDCEX  SDL_Window *pdc_window;
 PDCEX  SDL_Surface *pdc_screen, *pdc_font, *pdc_icon, *pdc_back;
 PDCEX  int pdc_sheight, pdc_swidth, pdc_yoffset, pdc_xoffset;
+PDCEX  SDL_Renderer *pdc_renderer;  /* only set when the SDL_Renderer
+                                       backend is active, see PDC_RENDERER */
+PDCEX  SDL_Texture *pdc_texture;
 
 extern SDL_Surface *pdc_tileback;    /* used to regenerate the background
                                         of "transparent" cells */
@@ -31,6 +34,11 @@ extern bool pdc_own_window;          /* if pdc_window was not set
 extern Uint32 pdc_lastupdate;        /* time of last update, in ticks */
 
 PDCEX  void PDC_update_rects(void);
+PDCEX  void PDC_present(void);
 PDCEX  void PDC_retile(void);
+#ifdef PDC_WIDE
+PDCEX  void PDC_clear_glyph_cache(void);
+#endif
 
 extern void PDC_blink_text(void);
+extern void PDC_get_screen_surface(void);
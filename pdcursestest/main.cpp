@@ -1,17 +1,86 @@
 #include <SDL.h>
 #include <curses.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 extern "C"
   {
 #include <sdl2/pdcsdl.h>
   }
 
-int main(int, char**)
+namespace
+  {
+  /*
+  Fills the screen with text in a number of color pairs and measures the time of a full screen redraw.
+  Each redraw is done once with an empty glyph cache (every glyph is rasterized again) and once with a warm glyph cache.
+  */
+  double full_redraw_ms(int frames, bool flush_glyph_cache)
+    {
+    Uint64 total = 0;
+    for (int f = 0; f < frames; ++f)
+      {
+      if (flush_glyph_cache)
+        PDC_clear_glyph_cache();
+      Uint64 start = SDL_GetPerformanceCounter();
+      clearok(curscr, TRUE);
+      touchwin(stdscr);
+      refresh();
+      PDC_update_rects();
+      total += SDL_GetPerformanceCounter() - start;
+      }
+    return (double)total * 1000.0 / (double)SDL_GetPerformanceFrequency() / (double)frames;
+    }
+
+  int run_benchmark()
+    {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+      return 1;
+
+    atexit(SDL_Quit);
+
+    // Both backends draw into a window of the same size. With PDC_RENDERER set, pdc_screen is left empty, so that
+    // PDCurses creates the renderer and its offscreen surface for this window itself.
+    pdc_window = SDL_CreateWindow("PDCurses benchmark", SDL_WINDOWPOS_UNDEFINED,
+      SDL_WINDOWPOS_UNDEFINED, 1920, 1080, 0);
+    if (!getenv("PDC_RENDERER"))
+      pdc_screen = SDL_GetWindowSurface(pdc_window);
+
+    initscr();
+    start_color();
+    for (short p = 1; p < 8; ++p)
+      init_pair(p, p, COLOR_BLACK);
+
+    const char* text = "for (int i = 0; i < n; ++i) { sum += values[i] * weights[i]; } // jam benchmark ";
+    size_t text_len = strlen(text);
+    for (int r = 0; r < LINES; ++r)
+      {
+      attrset(COLOR_PAIR(1 + r % 7));
+      for (int c = 0; c < COLS; ++c)
+        mvaddch(r, c, text[(r + c) % text_len]);
+      }
+    refresh();
+
+    const int frames = 100;
+    double uncached = full_redraw_ms(frames, true);
+    double cached = full_redraw_ms(frames, false);
+    endwin();
+
+    printf("full screen redraw of %dx%d cells, %d frames\n", COLS, LINES, frames);
+    printf("  without glyph cache: %.3f ms/frame\n", uncached);
+    printf("  with glyph cache:    %.3f ms/frame\n", cached);
+    return 0;
+    }
+  }
+
+int main(int argc, char** argv)
   {
   char inp[60];
   int i, j, seed;
 
+  if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+    return run_benchmark();
+
   seed = (int)time((time_t *)0);
   srand(seed);
 
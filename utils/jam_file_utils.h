@@ -14,6 +14,7 @@
 #endif
 #endif
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -67,7 +68,87 @@ inline bool file_exists(const std::string& filename)
   struct stat buffer;
   return (stat(filename.c_str(), &buffer) == 0);
 #endif
-  }  
+  }
+
+// seconds since the epoch of the last modification of the file, or -1 if the file cannot be found
+inline int64_t file_modification_time(const std::string& filename)
+  {
+#ifdef _WIN32
+  std::wstring wfilename = convert_string_to_wstring(filename);
+  struct _stat64 buffer;
+  if (_wstat64(wfilename.c_str(), &buffer) != 0)
+    return -1;
+  return (int64_t)buffer.st_mtime;
+#else
+  struct stat buffer;
+  if (stat(filename.c_str(), &buffer) != 0)
+    return -1;
+  return (int64_t)buffer.st_mtime;
+#endif
+  }
+
+// size in bytes of the file, or -1 if the file cannot be found
+inline int64_t file_size(const std::string& filename)
+  {
+#ifdef _WIN32
+  std::wstring wfilename = convert_string_to_wstring(filename);
+  struct _stat64 buffer;
+  if (_wstat64(wfilename.c_str(), &buffer) != 0)
+    return -1;
+  return (int64_t)buffer.st_size;
+#else
+  struct stat buffer;
+  if (stat(filename.c_str(), &buffer) != 0)
+    return -1;
+  return (int64_t)buffer.st_size;
+#endif
+  }
+
+/*
+Identifies a version of a file on disk. Writing the file changes its modification time or its size, and replacing it, as
+when a log is rotated, also changes its inode. The time is in nanoseconds where the file system records them.
+*/
+struct file_version
+  {
+  int64_t time = -1; // -1 if the file cannot be found
+  int64_t size = -1;
+  uint64_t device = 0, inode = 0; // 0 on Windows
+  };
+
+inline bool operator == (const file_version& lhs, const file_version& rhs)
+  {
+  return lhs.time == rhs.time && lhs.size == rhs.size && lhs.device == rhs.device && lhs.inode == rhs.inode;
+  }
+
+inline bool operator != (const file_version& lhs, const file_version& rhs)
+  {
+  return !(lhs == rhs);
+  }
+
+inline file_version get_file_version(const std::string& filename)
+  {
+  file_version v;
+#ifdef _WIN32
+  std::wstring wfilename = convert_string_to_wstring(filename);
+  struct _stat64 buffer;
+  if (_wstat64(wfilename.c_str(), &buffer) != 0)
+    return v;
+  v.time = (int64_t)buffer.st_mtime * 1000000000;
+#else
+  struct stat buffer;
+  if (stat(filename.c_str(), &buffer) != 0)
+    return v;
+#if defined(__APPLE__)
+  v.time = (int64_t)buffer.st_mtimespec.tv_sec * 1000000000 + buffer.st_mtimespec.tv_nsec;
+#else
+  v.time = (int64_t)buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+#endif
+  v.device = (uint64_t)buffer.st_dev;
+  v.inode = (uint64_t)buffer.st_ino;
+#endif
+  v.size = (int64_t)buffer.st_size;
+  return v;
+  }
 
 inline std::vector<std::string> get_files_from_directory(const std::string& d, bool include_subfolders)
   {
@@ -245,4 +326,60 @@ inline std::vector<std::string> get_list_from_directory(const std::string& d, bo
   return files;
   }
 
+/*
+Reads the directory once, and appends the paths of its files to files and the paths of its subdirectories to subdirectories.
+Subdirectories whose name starts with a '.' are skipped, as in the functions above. Unlike them, entries whose type the
+file system does not report are looked up, so that they are not skipped either.
+*/
+inline void get_files_and_subdirectories_from_directory(const std::string& d, std::vector<std::string>& files, std::vector<std::string>& subdirectories)
+  {
+  std::string directory(d);
+  if (!directory.empty() && !(directory.back() == '/' || directory.back() == '\\'))
+    directory.push_back('/');
+#ifdef _WIN32
+  std::wstring wdirectory = convert_string_to_wstring(directory);
+  _WDIR* dir = wopendir(wdirectory.c_str());
+  _wdirent* ent = nullptr;
+  if (dir)
+    ent = wreaddir(dir);
+#else
+  DIR* dir = opendir(directory.c_str());
+  dirent* ent = nullptr;
+  if (dir)
+    ent = readdir(dir);
+#endif
+  if (!dir)
+    return;
+  while (ent)
+    {
+#ifdef _WIN32
+    std::string n = convert_wstring_to_string(std::wstring(ent->d_name));
+    int type = ent->d_type;
+#else
+    std::string n(ent->d_name);
+    int type = ent->d_type;
+    if (type == DT_UNKNOWN)
+      {
+      struct stat buffer;
+      if (lstat((directory + n).c_str(), &buffer) == 0)
+        type = S_ISREG(buffer.st_mode) ? DT_REG : (S_ISDIR(buffer.st_mode) ? DT_DIR : DT_UNKNOWN);
+      }
+#endif
+    if (type == DT_REG) // a file
+      files.push_back(directory + n);
+    else if (type == DT_DIR && n.front() != '.') // a directory
+      subdirectories.push_back(directory + n);
+#ifdef _WIN32
+    ent = wreaddir(dir);
+#else
+    ent = readdir(dir);
+#endif
+    }
+#ifdef _WIN32
+  wclosedir(dir);
+#else
+  closedir(dir);
+#endif
+  }
+
 JAM_END
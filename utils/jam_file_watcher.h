@@ -0,0 +1,315 @@
+#pragma once
+
+#include "jam_namespace.h"
+#include "jam_encoding.h"
+#include "jam_file_utils.h"
+#include "jam_filename.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+JAM_BEGIN
+
+/*
+Watches files and folders, and calls on_change with the watched path when it changed. on_change is called on the
+thread of the watcher, so it should only hand the path over to another thread.
+
+A folder changes when an entry is added to it, removed from it or renamed, or when a file in it is written. A file changes
+when it is written, replaced (as by a save that renames a new file over it) or removed.
+
+On Linux the changes come from inotify. A file is watched through a watch on its folder, so that the watch survives the
+file being replaced. If inotify drops events because its queue overflowed, every watched path is reported as changed.
+Elsewhere, if inotify is not available, or for the paths whose folder could not be watched (as when the limit on inotify
+watches is reached), the thread compares the modification time and the size of the path every poll_interval_ms
+milliseconds instead.
+*/
+class file_watcher
+  {
+  public:
+    file_watcher(std::function<void(const std::string&)> on_change, int poll_interval_ms = 1000) : _on_change(on_change), _poll_interval_ms(poll_interval_ms), _stop(false), _fd(-1)
+      {
+#if defined(__linux__)
+      _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+      _thread = std::thread([this]() { _fd >= 0 ? read_events() : poll_paths(); });
+      }
+
+    file_watcher(const file_watcher&) = delete;
+    file_watcher& operator = (const file_watcher&) = delete;
+
+    ~file_watcher()
+      {
+      _stop = true;
+      _thread.join();
+#if defined(__linux__)
+      if (_fd >= 0)
+        ::close(_fd);
+#endif
+      }
+
+    /*
+    Watching a path that is watched already only counts the watches, it is watched until it is unwatched as often.
+    Returns false if the changes of path are only found by polling, as when inotify could not watch its folder.
+    Can be called from any thread.
+    */
+    bool watch(const std::string& path)
+      {
+      std::scoped_lock<std::mutex> lock(_mt);
+      auto it = _paths.find(path);
+      if (it != _paths.end())
+        {
+        ++it->second.count;
+        return !it->second.polled;
+        }
+      watched_path& wp = _paths[path];
+      wp.is_folder = is_directory(path);
+      signature(path, wp.time, wp.size);
+#if defined(__linux__)
+      if (_fd >= 0)
+        {
+        wp.folder = wp.is_folder ? path : get_folder(path);
+        if (wp.folder.empty())
+          wp.folder = "./";
+        if (wp.folder.back() != '/') // so that a folder and the folder of a file in it share their inotify watch
+          wp.folder.push_back('/');
+        if (!wp.is_folder)
+          wp.name = get_filename(path);
+        auto fit = _folders.find(wp.folder);
+        if (fit != _folders.end())
+          ++fit->second.count;
+        else
+          {
+          const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF;
+          const int wd = inotify_add_watch(_fd, wp.folder.c_str(), mask);
+          fit = _folders.emplace(wp.folder, watched_folder{ wd, 1 }).first;
+          if (wd >= 0)
+            _folders_by_wd[wd] = wp.folder;
+          }
+        if (wp.is_folder)
+          fit->second.folder_paths.insert(path);
+        else
+          fit->second.file_paths[wp.name].insert(path);
+        wp.polled = fit->second.wd < 0;
+        }
+#endif
+      return !wp.polled;
+      }
+
+    void unwatch(const std::string& path)
+      {
+      std::scoped_lock<std::mutex> lock(_mt);
+      auto it = _paths.find(path);
+      if (it == _paths.end() || --it->second.count > 0)
+        return;
+#if defined(__linux__)
+      auto fit = _folders.find(it->second.folder);
+      if (fit != _folders.end())
+        {
+        if (it->second.is_folder)
+          fit->second.folder_paths.erase(path);
+        else
+          {
+          auto nit = fit->second.file_paths.find(it->second.name);
+          if (nit != fit->second.file_paths.end() && nit->second.erase(path) && nit->second.empty())
+            fit->second.file_paths.erase(nit);
+          }
+        }
+      if (fit != _folders.end() && --fit->second.count == 0)
+        {
+        if (fit->second.wd >= 0)
+          {
+          inotify_rm_watch(_fd, fit->second.wd);
+          _folders_by_wd.erase(fit->second.wd);
+          }
+        _folders.erase(fit);
+        }
+#endif
+      _paths.erase(it);
+      }
+
+    // true if changes are reported as soon as they happen, false if they are found by polling
+    bool immediate() const
+      {
+      return _fd >= 0;
+      }
+
+  private:
+    struct watched_path
+      {
+      int count = 1;
+      bool is_folder = false;
+      bool polled = true; // false if inotify watches its folder
+      int64_t time = -1, size = -1; // for polling
+      std::string folder, name; // for inotify: the watched folder, and the name of the file in it if the path is a file
+      };
+
+    struct watched_folder
+      {
+      int wd;
+      int count;
+      std::set<std::string> folder_paths; // the watched paths of the folder itself
+      std::map<std::string, std::set<std::string>> file_paths; // the watched paths of the files in the folder, by name
+      };
+
+    // modification time in nanoseconds and size of path, -1 if it does not exist
+    static void signature(const std::string& path, int64_t& time, int64_t& size)
+      {
+#ifdef _WIN32
+      struct _stat64 buffer;
+      if (_wstat64(convert_string_to_wstring(path).c_str(), &buffer) != 0)
+        {
+        time = size = -1;
+        return;
+        }
+      time = (int64_t)buffer.st_mtime * 1000000000;
+#else
+      struct stat buffer;
+      if (stat(path.c_str(), &buffer) != 0)
+        {
+        time = size = -1;
+        return;
+        }
+#if defined(__APPLE__)
+      time = (int64_t)buffer.st_mtimespec.tv_sec * 1000000000 + buffer.st_mtimespec.tv_nsec;
+#else
+      time = (int64_t)buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+#endif
+#endif
+      size = (int64_t)buffer.st_size;
+      }
+
+    void report(const std::set<std::string>& changed)
+      {
+      for (const auto& path : changed)
+        _on_change(path);
+      }
+
+    // the polled paths whose modification time or size changed since they were polled last
+    std::set<std::string> poll_changes()
+      {
+      std::vector<std::string> paths;
+      {
+      std::scoped_lock<std::mutex> lock(_mt);
+      for (const auto& p : _paths)
+        {
+        if (p.second.polled)
+          paths.push_back(p.first);
+        }
+      }
+      std::set<std::string> changed;
+      for (const auto& path : paths) // stat is called without the lock, so that watch and unwatch never wait for the disk
+        {
+        int64_t time, size;
+        signature(path, time, size);
+        std::scoped_lock<std::mutex> lock(_mt);
+        auto it = _paths.find(path);
+        if (it != _paths.end() && (it->second.time != time || it->second.size != size))
+          {
+          it->second.time = time;
+          it->second.size = size;
+          changed.insert(path);
+          }
+        }
+      return changed;
+      }
+
+    void poll_paths()
+      {
+      const auto step = std::chrono::milliseconds(50);
+      auto next_poll = std::chrono::steady_clock::now();
+      while (!_stop)
+        {
+        std::this_thread::sleep_for(step);
+        if (std::chrono::steady_clock::now() < next_poll)
+          continue;
+        next_poll = std::chrono::steady_clock::now() + std::chrono::milliseconds(_poll_interval_ms);
+        report(poll_changes());
+        }
+      }
+
+#if defined(__linux__)
+    void read_events()
+      {
+      alignas(inotify_event) char buffer[16 * 1024];
+      auto next_poll = std::chrono::steady_clock::now() + std::chrono::milliseconds(_poll_interval_ms);
+      while (!_stop)
+        {
+        if (std::chrono::steady_clock::now() >= next_poll) // the paths whose folder has no inotify watch
+          {
+          next_poll = std::chrono::steady_clock::now() + std::chrono::milliseconds(_poll_interval_ms);
+          report(poll_changes());
+          }
+        pollfd pfd = { _fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0)
+          continue;
+        std::set<std::string> changed;
+        for (;;)
+          {
+          const ssize_t len = ::read(_fd, buffer, sizeof(buffer));
+          if (len <= 0)
+            break;
+          std::scoped_lock<std::mutex> lock(_mt);
+          for (const char* p = buffer; p < buffer + len;)
+            {
+            const inotify_event* ev = (const inotify_event*)p;
+            p += sizeof(inotify_event) + ev->len;
+            if (ev->mask & IN_Q_OVERFLOW) // events were lost, so any path may have changed, which covers the other events
+              {
+              for (const auto& wp : _paths)
+                changed.insert(wp.first);
+              break;
+              }
+            auto wit = _folders_by_wd.find(ev->wd);
+            if (wit == _folders_by_wd.end())
+              continue;
+            const watched_folder& folder = _folders[wit->second];
+            changed.insert(folder.folder_paths.begin(), folder.folder_paths.end());
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+              {
+              for (const auto& file : folder.file_paths)
+                changed.insert(file.second.begin(), file.second.end());
+              }
+            else if (ev->len > 0)
+              {
+              auto nit = folder.file_paths.find(std::string(ev->name));
+              if (nit != folder.file_paths.end())
+                changed.insert(nit->second.begin(), nit->second.end());
+              }
+            }
+          }
+        report(changed);
+        }
+      }
+#else
+    void read_events()
+      {
+      }
+#endif
+
+  private:
+    std::function<void(const std::string&)> _on_change;
+    int _poll_interval_ms;
+    std::atomic<bool> _stop;
+    int _fd; // inotify instance, -1 if the paths are polled
+    std::mutex _mt;
+    std::map<std::string, watched_path> _paths;
+    std::map<std::string, watched_folder> _folders; // inotify watches by folder, with the watched paths that their events concern
+    std::map<int, std::string> _folders_by_wd;
+    std::thread _thread;
+  };
+
+JAM_END
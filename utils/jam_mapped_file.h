@@ -0,0 +1,303 @@
+#pragma once
+
+#include "jam_namespace.h"
+#include "jam_encoding.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <mutex>
+#include <string>
+
+JAM_BEGIN
+
+#ifndef _WIN32
+namespace mapped_file_details
+  {
+  inline thread_local sigjmp_buf* p_read_guard = nullptr; // set while mapped_file::read copies bytes on this thread
+  inline struct sigaction previous_sigbus_action;
+
+  inline void on_sigbus(int signal, siginfo_t* info, void* context)
+    {
+    if (p_read_guard)
+      siglongjmp(*p_read_guard, 1);
+    if (previous_sigbus_action.sa_flags & SA_SIGINFO)
+      previous_sigbus_action.sa_sigaction(signal, info, context);
+    else if (previous_sigbus_action.sa_handler != SIG_DFL && previous_sigbus_action.sa_handler != SIG_IGN)
+      previous_sigbus_action.sa_handler(signal);
+    else // the faulting access is repeated on return, and now ends the process as it would have without this handler
+      sigaction(SIGBUS, &previous_sigbus_action, nullptr);
+    }
+
+  inline void install_sigbus_handler()
+    {
+    static std::once_flag installed;
+    std::call_once(installed, []()
+      {
+      struct sigaction action;
+      memset(&action, 0, sizeof(action));
+      action.sa_sigaction = &on_sigbus;
+      action.sa_flags = SA_SIGINFO;
+      sigemptyset(&action.sa_mask);
+      sigaction(SIGBUS, &action, &previous_sigbus_action);
+      });
+    }
+  }
+#endif
+
+/*
+Read-only memory mapping of a complete file.
+The pages of the file are only read from disk when they are touched, so mapping a large file is cheap,
+and the pages can be dropped again by the operating system without writing them to swap.
+Another process can still truncate the file while it is mapped, after which touching the pages past its new end
+raises SIGBUS (an in-page error on Windows). Use read to copy bytes out of the mapping, which reports that as a
+failure, and touch data directly only where the file cannot change. Such a change in place is reported by changed.
+Replacing the file by renaming another file over it does not affect the mapping, except that Windows refuses the rename
+while the file is mapped: load copies the file into memory and lets go of it first.
+*/
+class mapped_file
+  {
+  public:
+    mapped_file() : _data(nullptr), _size(0), _time(-1)
+#ifdef _WIN32
+      , _file(INVALID_HANDLE_VALUE), _mapping(nullptr)
+#else
+      , _fd(-1)
+#endif
+      {
+      }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator = (const mapped_file&) = delete;
+
+    ~mapped_file()
+      {
+      close();
+      }
+
+    // maps the file with the given name (utf8), returns false if the file cannot be opened or mapped
+    bool open(const std::string& filename)
+      {
+      close();
+#ifdef _WIN32
+      std::wstring wfilename = convert_string_to_wstring(filename);
+      _file = CreateFileW(wfilename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+      if (_file == INVALID_HANDLE_VALUE)
+        return false;
+      LARGE_INTEGER size;
+      if (!GetFileSizeEx(_file, &size))
+        {
+        close();
+        return false;
+        }
+      _size = (uint64_t)size.QuadPart;
+      _time = modification_time();
+      if (_size == 0)
+        return true;
+      _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if (!_mapping)
+        {
+        close();
+        return false;
+        }
+      _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+      if (!_data)
+        {
+        close();
+        return false;
+        }
+#else
+      int fd = ::open(filename.c_str(), O_RDONLY);
+      if (fd < 0)
+        return false;
+      struct stat buffer;
+      if (fstat(fd, &buffer) != 0 || !S_ISREG(buffer.st_mode))
+        {
+        ::close(fd);
+        return false;
+        }
+      _size = (uint64_t)buffer.st_size;
+      if (_size > 0)
+        {
+        void* p = mmap(nullptr, (size_t)_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+          {
+          ::close(fd);
+          _size = 0;
+          return false;
+          }
+        madvise(p, (size_t)_size, MADV_SEQUENTIAL);
+        _data = (const char*)p;
+        }
+      _fd = fd; // kept open for changed, the mapping itself keeps its own reference to the file
+      _time = modification_time();
+#endif
+      return true;
+      }
+
+    // true if the mapped file itself was written, truncated or extended since it was mapped
+    bool changed() const
+      {
+      if (_time < 0)
+        return false; // nothing is mapped, or the file was loaded into memory
+#ifdef _WIN32
+      LARGE_INTEGER size;
+      if (!GetFileSizeEx(_file, &size))
+        return true;
+      return (uint64_t)size.QuadPart != _size || modification_time() != _time;
+#else
+      struct stat buffer;
+      if (fstat(_fd, &buffer) != 0)
+        return true;
+      return (uint64_t)buffer.st_size != _size || modification_time() != _time;
+#endif
+      }
+
+    /*
+    Copies the complete file into memory and closes the mapping and the file, after which data and read use the copy.
+    Returns false, and keeps the mapping, if the file cannot be read completely anymore. Not thread safe: no other
+    thread may read from this mapped_file meanwhile.
+    */
+    bool load()
+      {
+      if (_time < 0)
+        return true;
+      std::string bytes(_size, '\0');
+      if (!read(0, (size_t)_size, &bytes[0]))
+        return false;
+      const uint64_t size = _size;
+      close();
+      _memory.swap(bytes);
+      _data = _memory.data();
+      _size = size;
+      return true;
+      }
+
+    void close()
+      {
+#ifdef _WIN32
+      if (_data && _memory.empty())
+        UnmapViewOfFile(_data);
+      if (_mapping)
+        CloseHandle(_mapping);
+      if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle(_file);
+      _mapping = nullptr;
+      _file = INVALID_HANDLE_VALUE;
+#else
+      if (_data && _memory.empty())
+        munmap((void*)_data, (size_t)_size);
+      if (_fd >= 0)
+        ::close(_fd);
+      _fd = -1;
+#endif
+      _memory.clear();
+      _data = nullptr;
+      _size = 0;
+      _time = -1;
+      }
+
+    const char* data() const
+      {
+      return _data;
+      }
+
+    uint64_t size() const
+      {
+      return _size;
+      }
+
+    // copies the bytes [offset, offset + length) of the file into out, returns false if they are outside the mapping
+    // or if the file no longer holds them because it was truncated after it was mapped
+    bool read(uint64_t offset, size_t length, char* out) const
+      {
+      if (offset > _size || length > _size - offset)
+        return false;
+      if (length == 0)
+        return true;
+      if (!_memory.empty())
+        {
+        memcpy(out, _data + offset, length);
+        return true;
+        }
+#ifdef _WIN32
+      return guarded_copy(out, _data + offset, length);
+#else
+      mapped_file_details::install_sigbus_handler();
+      sigjmp_buf guard;
+      if (sigsetjmp(guard, 1) != 0)
+        {
+        mapped_file_details::p_read_guard = nullptr;
+        return false;
+        }
+      mapped_file_details::p_read_guard = &guard;
+      memcpy(out, _data + offset, length);
+      mapped_file_details::p_read_guard = nullptr;
+      return true;
+#endif
+      }
+
+  private:
+    // of the open file, in nanoseconds where the file system records them
+    int64_t modification_time() const
+      {
+#ifdef _WIN32
+      FILETIME t;
+      if (!GetFileTime(_file, nullptr, nullptr, &t))
+        return -1;
+      return (int64_t)((((uint64_t)t.dwHighDateTime) << 32) | t.dwLowDateTime) * 100;
+#else
+      struct stat buffer;
+      if (fstat(_fd, &buffer) != 0)
+        return -1;
+#if defined(__APPLE__)
+      return (int64_t)buffer.st_mtimespec.tv_sec * 1000000000 + buffer.st_mtimespec.tv_nsec;
+#else
+      return (int64_t)buffer.st_mtim.tv_sec * 1000000000 + buffer.st_mtim.tv_nsec;
+#endif
+#endif
+      }
+
+#ifdef _WIN32
+    static bool guarded_copy(char* out, const char* in, size_t length)
+      {
+#ifdef _MSC_VER
+      __try
+        {
+        memcpy(out, in, length);
+        }
+      __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+        {
+        return false;
+        }
+#else
+      memcpy(out, in, length);
+#endif
+      return true;
+      }
+#endif
+
+  private:
+    const char* _data;
+    uint64_t _size;
+    int64_t _time; // modification time of the file when it was mapped, -1 if nothing is mapped
+    std::string _memory; // the file after load
+#ifdef _WIN32
+    HANDLE _file;
+    HANDLE _mapping;
+#else
+    int _fd;
+#endif
+  };
+
+JAM_END
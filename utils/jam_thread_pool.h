@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "jam_namespace.h"
+
+JAM_BEGIN
+
+/*
+Fixed size pool of worker threads.
+Tasks are started in the order in which they were pushed.
+The destructor drops the tasks that were not started yet and waits for the running tasks.
+*/
+class thread_pool
+  {
+  public:
+    thread_pool(size_t nr_of_threads = std::thread::hardware_concurrency()) : stop(false)
+      {
+      if (nr_of_threads == 0)
+        nr_of_threads = 1;
+      for (size_t i = 0; i < nr_of_threads; ++i)
+        workers.emplace_back([this] { work(); });
+      }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator = (const thread_pool&) = delete;
+
+    ~thread_pool()
+      {
+      {
+      std::scoped_lock<std::mutex> lock(mt);
+      stop = true;
+      tasks.clear();
+      }
+      cv.notify_all();
+      for (auto& w : workers)
+        w.join();
+      }
+
+    template <class F>
+    auto push(F&& f) -> std::future<decltype(f())>
+      {
+      auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::forward<F>(f));
+      auto result = task->get_future();
+      {
+      std::scoped_lock<std::mutex> lock(mt);
+      tasks.emplace_back([task] { (*task)(); });
+      }
+      cv.notify_one();
+      return result;
+      }
+
+    size_t size() const
+      {
+      return workers.size();
+      }
+
+    // true once the pool is being destroyed, running tasks can poll this to give up early
+    bool stopped() const
+      {
+      return stop;
+      }
+
+  private:
+    void work()
+      {
+      for (;;)
+        {
+        std::function<void()> task;
+        {
+        std::unique_lock<std::mutex> lock(mt);
+        cv.wait(lock, [this] { return stop || !tasks.empty(); });
+        if (stop)
+          return;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+        }
+        task();
+        }
+      }
+
+  private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mt;
+    std::condition_variable cv;
+    std::atomic<bool> stop;
+  };
+
+JAM_END